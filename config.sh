@@ -337,8 +337,8 @@ find_sources() {
 	# Need to backslash-escape slashes so the upcoming seds work.
 	sd=`echo "$SRCDIR" | sed 's|/|\\\\/|g'`
 
-	# Remove test code.
-	CXXSOURCES=`echo "$CXXSOURCES" | sed '/'"$sd"'\/tests/d'`
+	# Remove test code, and tools, which have their own entry points.
+	CXXSOURCES=`echo "$CXXSOURCES" | sed -e '/'"$sd"'\/tests/d' -e '/'"$sd"'\/tools/d'`
 
 	# Compared to above, the C sources are easy--they're always there,
 	# regardless of features.
@@ -9,16 +9,22 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cstdint>
+#include <limits>
 #include <string>
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "../metrics.hpp"
+#include "../probes.hpp"
 #include "../response.hpp"
+#include "../trace.hpp"
 #include "audio.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
+#include "sample_convert.hpp"
 #include "sample_formats.hpp"
 
 //
@@ -31,6 +37,21 @@ std::unique_ptr<Response> Audio::Emit(const std::string &, bool)
 	return std::unique_ptr<Response>();
 }
 
+bool Audio::EmitTime(Response &)
+{
+	return false;
+}
+
+bool Audio::TakeFileChange()
+{
+	return false;
+}
+
+bool Audio::TakeCuesReady()
+{
+	return false;
+}
+
 //
 // NoAudio
 //
@@ -61,6 +82,62 @@ void NoAudio::Seek(std::uint64_t)
 	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
 }
 
+void NoAudio::SetHotCue(std::size_t, std::uint64_t)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::ClearHotCue(std::size_t)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::SetLooping(bool)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::SetLoopIn(std::uint64_t)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::SetLoopOut(std::uint64_t)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::ClearLoopOut()
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::SetNext(std::unique_ptr<AudioSource>, HotCue::SourceFactory)
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::ClearNext()
+{
+	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
+}
+
+void NoAudio::SetCrossfade(const CrossfadeSettings &)
+{
+	// There's nothing to crossfade from, but the settings will be passed
+	// on to whatever gets loaded next anyway.
+}
+
+void NoAudio::SetDsp(const DspSettings &)
+{
+	// As with SetCrossfade, the Player keeps hold of the settings.
+}
+
+void NoAudio::SetRate(double)
+{
+	// As with SetCrossfade, the Player keeps hold of the rate.
+}
+
 std::uint64_t NoAudio::Position() const
 {
 	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
@@ -70,10 +147,37 @@ std::uint64_t NoAudio::Position() const
 // PipeAudio
 //
 
+const std::uint32_t PipeAudio::REWIND_SECONDS = 10;
+const std::uint32_t PipeAudio::PREROLL_SECONDS = 2;
+
 PipeAudio::PipeAudio(std::unique_ptr<AudioSource> &&src,
                      std::unique_ptr<AudioSink> &&sink)
-    : src(std::move(src)), sink(std::move(sink)), announced_time(false)
+    : src(std::move(src)),
+      sink(std::move(sink)),
+      rewind(REWIND_SECONDS * this->src->SampleRate(),
+             this->src->BytesPerSample()),
+      announced_time(false),
+      decode_position(0),
+      trim(false),
+      trimmed_in(false),
+      cues_pending(false),
+      catch_up(false),
+      source_ended(false),
+      transfer_position(0),
+      looping(false),
+      loop_in(0),
+      loop_out(0),
+      has_loop_out(false),
+      crossfade_settings{0, CrossfadeCurve::EQUAL_POWER, false, 0},
+      crossfade_cost(0),
+      crossfaded(false),
+      file_changed(false),
+      dsp(this->src->SampleRate(), this->src->ChannelCount()),
+      frame_unprocessed(false),
+      stretch(this->src->SampleRate(), this->src->ChannelCount()),
+      stretching(false)
 {
+	this->dsp.AddBuiltins();
 	this->ClearFrame();
 }
 
@@ -101,11 +205,63 @@ std::unique_ptr<Response> PipeAudio::Emit(const std::string &path,
 		bool can = (!broadcast) || this->CanAnnounceTime(micros);
 		if (!can) return ret;
 		value = std::to_string(micros);
+	} else if (path == "/player/cue/in" || path == "/player/cue/out") {
+		// The cue points don't exist until analysis has finished.
+		if (!this->cues || !this->cues->Ready()) return ret;
+
+		auto &points = this->cues->Points();
+		bool in = path == "/player/cue/in";
+		auto samples = in ? points.in : points.out;
+		value = std::to_string(this->src->MicrosFromSamples(samples));
+	} else if (path.compare(0, 15, "/player/hotcue/") == 0) {
+		std::size_t index = 0;
+		try {
+			index = std::stoul(path.substr(15));
+		} catch (...) {
+			return ret;
+		}
+		if (HOT_CUE_COUNT <= index || !this->hot_cues[index]) {
+			return ret;
+		}
+
+		auto samples = this->hot_cues[index]->Position();
+		value = std::to_string(this->src->MicrosFromSamples(samples));
+	} else if (path == "/player/loop/mode") {
+		value = this->looping ? "On" : "Off";
+	} else if (path == "/player/loop/in") {
+		value = std::to_string(this->src->MicrosFromSamples(this->loop_in));
+	} else if (path == "/player/loop/out") {
+		// Without an out point, we loop at the end of the file, which
+		// we don't know the position of.
+		if (!this->has_loop_out) return ret;
+		auto micros = this->src->MicrosFromSamples(this->loop_out);
+		value = std::to_string(micros);
+	} else if (path == "/player/crossfade/file") {
+		if (!this->crossfade) return ret;
+		value = this->crossfade->NextPath();
+	} else if (path == "/player/crossfade/cost") {
+		if (!this->crossfaded) return ret;
+		value = std::to_string(this->crossfade_cost);
+	} else if (path.compare(0, 17, "/player/dsp/cost/") == 0) {
+		std::chrono::nanoseconds cost;
+		if (!this->dsp.Cost(path.substr(17), cost)) return ret;
+		auto micros = std::chrono::duration_cast<
+		        std::chrono::microseconds>(cost);
+		value = std::to_string(micros.count());
 	} else return ret;
 
 	return Response::Res("Entry", path, value);
 }
 
+bool PipeAudio::EmitTime(Response &response)
+{
+	auto micros = this->Position();
+	if (!this->CanAnnounceTime(micros)) return false;
+
+	response.AddArg("/player/time/elapsed").AddArg("Entry").AddArg(micros);
+	return true;
+}
+
 void PipeAudio::SetPlaying(bool playing)
 {
 	assert(this->sink != nullptr);
@@ -122,7 +278,8 @@ std::uint64_t PipeAudio::Position() const
 	assert(this->sink != nullptr);
 	assert(this->src != nullptr);
 
-	return this->src->MicrosFromSamples(this->sink->Position());
+	auto samples = this->positions.ToFile(this->sink->Position());
+	return this->src->MicrosFromSamples(samples);
 }
 
 void PipeAudio::Seek(std::uint64_t position)
@@ -131,8 +288,41 @@ void PipeAudio::Seek(std::uint64_t position)
 	assert(this->src != nullptr);
 
 	auto in_samples = this->src->SamplesFromMicros(position);
+
+	// When trimming, anything before the in point is dead air, so we
+	// don't let anyone seek into it.
+	if (this->Trimming()) {
+		in_samples = std::max(in_samples, this->cues->Points().in);
+	}
+
+	// If the sink already has the audio we're seeking to, it can just
+	// skip ahead to it; nothing else needs to change.  The sink only
+	// knows stream positions, though, so this only works if they're the
+	// same as file positions.
+	if (this->positions.Empty() && this->sink->SkipTo(in_samples)) {
+		this->announced_time = false;
+		return;
+	}
+
+	// If we've only just played the audio we're seeking to, we can
+	// replay it from memory instead of asking the decoder to seek.
+	// Stretched audio isn't kept, as it doesn't line up with the file.
+	if (!this->stretching && this->rewind.Contains(in_samples)) {
+		this->SeekFromMemory(in_samples);
+		return;
+	}
+
+	if (this->SeekFromHotCue(in_samples)) return;
+
 	auto out_samples = this->src->Seek(in_samples);
-	this->sink->SetPosition(out_samples);
+	this->SetSinkPosition(out_samples);
+	this->decode_position = out_samples;
+	this->rewind.Reset(out_samples);
+	this->catch_up = false;
+	this->source_ended = false;
+
+	// Any crossfade we were in the middle of has to start again.
+	if (this->crossfade) this->crossfade->Restart();
 
 	// Make sure we always announce the new position to all response sinks.
 	this->announced_time = false;
@@ -142,33 +332,422 @@ void PipeAudio::Seek(std::uint64_t position)
 	this->ClearFrame();
 }
 
+void PipeAudio::SeekFromMemory(std::uint64_t samples)
+{
+	// The new frame is the replayed history, followed by whatever was
+	// left of the current frame; the decoder then carries on from where
+	// it already is.
+	AudioSource::DecodeVector replay;
+	this->rewind.Rewind(samples, replay);
+	replay.insert(replay.end(), this->frame_iterator, this->frame.end());
+
+	this->frame.swap(replay);
+	this->frame_iterator = this->frame.begin();
+
+	// All of this has been through the DSP chain already.
+	this->frame_unprocessed = false;
+
+	this->SetSinkPosition(samples);
+	this->announced_time = false;
+}
+
+bool PipeAudio::SeekFromHotCue(std::uint64_t samples)
+{
+	auto ready_at = [samples](const std::unique_ptr<HotCue> &cue) {
+		return cue && cue->Ready() && cue->Position() == samples;
+	};
+	auto hit = std::find_if(this->hot_cues.begin(), this->hot_cues.end(),
+	                        ready_at);
+	if (hit == this->hot_cues.end()) return false;
+	auto &cue = **hit;
+
+	// The preroll is kept for later jumps, so we play a copy of it.
+	auto &preroll = cue.Preroll();
+	this->frame.assign(preroll.begin(), preroll.end());
+	this->frame_iterator = this->frame.begin();
+	this->frame_unprocessed = true;
+
+	auto start = cue.Start();
+	this->SetSinkPosition(start);
+	this->rewind.Reset(start);
+	this->announced_time = false;
+
+	// The decoder catches up to the end of the preroll in a later
+	// Update, by which point the preroll is already in the sink.  If the
+	// file ended inside the preroll, there's nothing to catch up to.
+	auto bytes_per_sample = this->src->BytesPerSample();
+	this->decode_position = start + preroll.size() / bytes_per_sample;
+	this->catch_up = !cue.AtEnd();
+	this->source_ended = cue.AtEnd();
+	if (this->crossfade) this->crossfade->Restart();
+
+	this->CutAtOutPoint();
+	return true;
+}
+
+void PipeAudio::SetHotCue(std::size_t index, std::uint64_t position)
+{
+	assert(index < HOT_CUE_COUNT);
+
+	// Replace the old cue first, so that it isn't still prerolling while
+	// the new one starts.
+	auto &cue = this->hot_cues[index];
+	cue = nullptr;
+
+	auto samples = this->src->SamplesFromMicros(position);
+	auto length = PREROLL_SECONDS * this->src->SampleRate();
+	cue = std::unique_ptr<HotCue>(
+	        new HotCue(this->preroll_source, samples, length));
+}
+
+void PipeAudio::ClearHotCue(std::size_t index)
+{
+	assert(index < HOT_CUE_COUNT);
+	this->hot_cues[index] = nullptr;
+}
+
+void PipeAudio::SetPrerollSource(HotCue::SourceFactory factory)
+{
+	this->preroll_source = factory;
+}
+
+void PipeAudio::SetDsp(const DspSettings &settings)
+{
+	this->dsp.Configure(settings);
+}
+
+void PipeAudio::SetRate(double rate)
+{
+	if (rate == this->stretch.Rate()) return;
+
+	// The new rate applies from the next sample the stretcher produces,
+	// which follows on from whatever has already been through it.
+	auto stream = this->transfer_position;
+	if (!this->frame_unprocessed) {
+		auto left = std::distance(this->frame_iterator, this->frame.end());
+		stream += left / this->src->BytesPerSample();
+	}
+	auto file = this->positions.ToFile(stream);
+
+	this->stretch.SetRate(rate);
+	this->positions.Add(stream, file, rate);
+
+	if (this->stretching) return;
+	this->stretching = true;
+	this->stretch.Reset();
+	this->rewind.Reset(file);
+}
+
+void PipeAudio::Insert(std::unique_ptr<Processor> processor)
+{
+	// The built-in limiter stays at the end of the chain, so nothing we
+	// insert can push the output back over its ceiling.
+	assert(0 < this->dsp.Size());
+	this->dsp.Insert(std::move(processor), this->dsp.Size() - 1);
+}
+
+void PipeAudio::SetLooping(bool looping)
+{
+	this->looping = looping;
+}
+
+void PipeAudio::SetLoopIn(std::uint64_t position)
+{
+	this->loop_in = this->src->SamplesFromMicros(position);
+}
+
+void PipeAudio::SetLoopOut(std::uint64_t position)
+{
+	this->loop_out = this->src->SamplesFromMicros(position);
+	this->has_loop_out = true;
+}
+
+void PipeAudio::ClearLoopOut()
+{
+	this->has_loop_out = false;
+}
+
+bool PipeAudio::Looping() const
+{
+	// A loop with nothing in it would spin without producing any audio.
+	return this->looping && this->loop_in < this->OutPoint();
+}
+
+void PipeAudio::LoopBack()
+{
+	// We only decode when the last frame has been transferred, so the
+	// sink has everything up to the loop-out point, and the loop-in
+	// point follows straight on from it.
+	auto in = this->src->Seek(this->loop_in);
+	this->AddJump(in);
+
+	this->decode_position = in;
+	this->rewind.Reset(in);
+	this->catch_up = false;
+	this->source_ended = false;
+}
+
+void PipeAudio::AddJump(std::uint64_t file)
+{
+	// Anything the stretcher is holding back reaches the sink first.
+	auto stream = this->transfer_position;
+	auto rate = 1.0;
+	if (this->stretching) {
+		stream += this->stretch.Pending();
+		rate = this->stretch.Rate();
+	}
+
+	this->positions.Add(stream, file, rate);
+}
+
+void PipeAudio::SetNext(std::unique_ptr<AudioSource> next,
+                        HotCue::SourceFactory factory)
+{
+	assert(next != nullptr);
+
+	// The next file's audio goes into the same sink, so it has to be in
+	// the same format as ours.
+	bool same = next->OutputSampleFormat() ==
+	                    this->src->OutputSampleFormat() &&
+	            next->ChannelCount() == this->src->ChannelCount() &&
+	            next->SampleRate() == this->src->SampleRate();
+	if (!same) throw FileError(MSG_LOAD_NEXT_MISMATCH);
+
+	// The next file starts decoding now, so the fade doesn't have to
+	// decode both files in turn when it comes.
+	auto preroll = next->SamplesFromMicros(this->crossfade_settings.length);
+	this->crossfade = std::unique_ptr<Crossfade>(
+	        new Crossfade(std::move(next), factory, preroll));
+}
+
+void PipeAudio::ClearNext()
+{
+	this->crossfade = nullptr;
+}
+
+void PipeAudio::SetCrossfade(const CrossfadeSettings &settings)
+{
+	this->crossfade_settings = settings;
+}
+
+bool PipeAudio::TakeFileChange()
+{
+	bool changed = this->file_changed;
+	this->file_changed = false;
+	return changed;
+}
+
+bool PipeAudio::TakeCuesReady()
+{
+	if (!this->cues_pending || !this->cues->Ready()) return false;
+
+	this->cues_pending = false;
+	return true;
+}
+
+std::uint64_t PipeAudio::FadeStart() const
+{
+	auto &settings = this->crossfade_settings;
+	if (settings.has_start) {
+		return this->src->SamplesFromMicros(settings.start);
+	}
+
+	auto out = this->OutPoint();
+	if (out == std::numeric_limits<std::uint64_t>::max()) return out;
+
+	auto length = this->src->SamplesFromMicros(settings.length);
+	return length < out ? out - length : 0;
+}
+
+bool PipeAudio::MixNext(bool ended)
+{
+	if (!this->crossfade || this->Looping()) return false;
+
+	auto begin = std::chrono::steady_clock::now();
+
+	auto bytes_per_sample = this->src->BytesPerSample();
+	auto frame_start =
+	        this->decode_position - this->frame.size() / bytes_per_sample;
+	auto &settings = this->crossfade_settings;
+	auto length = this->src->SamplesFromMicros(settings.length);
+	this->crossfade->Mix(this->frame, frame_start, this->FadeStart(),
+	                     length, settings.curve, ended);
+
+	// The frame may have been cut short at the end of the fade.
+	this->frame_iterator = this->frame.begin();
+	this->decode_position =
+	        frame_start + this->frame.size() / bytes_per_sample;
+
+	if (this->crossfade->Started()) {
+		auto end = std::chrono::steady_clock::now();
+		this->crossfade->AddCost(end - begin);
+	}
+
+	return this->crossfade->Done();
+}
+
+void PipeAudio::SwitchToNext()
+{
+	assert(this->crossfade && this->crossfade->Done());
+
+	auto cost = std::chrono::duration_cast<std::chrono::microseconds>(
+	        this->crossfade->Cost());
+	this->crossfade_cost = cost.count();
+	this->crossfaded = true;
+
+	auto in = this->crossfade->Position();
+	this->frame = this->crossfade->TakeLeftover();
+	this->frame_iterator = this->frame.begin();
+	this->frame_unprocessed = true;
+	this->preroll_source = this->crossfade->NextFactory();
+	this->src = this->crossfade->TakeNext();
+	this->crossfade = nullptr;
+
+	// Everything we knew about the old file is now irrelevant.
+	this->cues = nullptr;
+	this->cues_pending = false;
+	this->trim = false;
+	for (auto &cue : this->hot_cues) cue = nullptr;
+	this->looping = false;
+	this->loop_in = 0;
+	this->has_loop_out = false;
+	this->catch_up = false;
+	this->source_ended = false;
+
+	// As with looping, the sink has everything up to the end of the
+	// fade, and the next file follows straight on from it.
+	this->AddJump(in);
+	this->rewind.Reset(in);
+
+	auto bytes_per_sample = this->src->BytesPerSample();
+	this->decode_position = in + this->frame.size() / bytes_per_sample;
+
+	this->announced_time = false;
+	this->file_changed = true;
+}
+
+void PipeAudio::SetSinkPosition(std::uint64_t samples)
+{
+	this->sink->SetPosition(samples);
+	this->transfer_position = samples;
+	this->positions.Clear();
+
+	// Whatever the stretcher held back came from the old position.  If
+	// we're back at normal speed, this is our chance to stop stretching.
+	if (!this->stretching) return;
+	this->stretch.Reset();
+	auto rate = this->stretch.Rate();
+	this->stretching = rate != 1.0;
+	if (this->stretching) this->positions.Add(samples, samples, rate);
+}
+
 void PipeAudio::ClearFrame()
 {
 	this->frame.clear();
 	this->frame_iterator = this->frame.end();
+	this->frame_unprocessed = false;
 }
 
 Audio::State PipeAudio::Update()
 {
+	TraceSpan span("PipeAudio::Update");
 	assert(this->sink != nullptr);
 	assert(this->src != nullptr);
 
+	this->TrimIn();
+
+	// Jumps that have already been played no longer matter.
+	this->positions.Prune(this->sink->Position());
+
 	bool more_available = this->DecodeIfFrameEmpty();
+	if (!more_available) more_available = this->DrainStretch();
 	if (!more_available) this->sink->SourceOut();
 
-	if (!this->FrameFinished()) this->TransferFrame();
+	if (!this->FrameFinished()) {
+		this->ProcessFrame();
+
+		// The stretcher may have held back the whole frame.
+		if (this->FrameFinished()) {
+			this->ClearFrame();
+		} else {
+			this->TransferFrame();
+		}
+	}
 
 	return this->sink->State();
 }
 
+void PipeAudio::ProcessFrame()
+{
+	// Frames replayed from the rewind buffer have already been processed,
+	// and frames are processed whole, so we only do this once per frame.
+	if (!this->frame_unprocessed) return;
+	this->frame_unprocessed = false;
+
+	this->dsp.Process(this->frame, this->src->OutputSampleFormat());
+	if (this->stretching) this->StretchFrame();
+}
+
+void PipeAudio::StretchFrame()
+{
+	auto fmt = this->src->OutputSampleFormat();
+	auto bps = SAMPLE_FORMAT_BPS[static_cast<int>(fmt)];
+	auto count = this->frame.size() / bps;
+	this->stretch_in.resize(count);
+	SamplesToFloat(this->frame.data(), fmt, count, this->stretch_in.data());
+
+	this->stretch_out.clear();
+	auto frames = count / this->src->ChannelCount();
+	this->stretch.Process(this->stretch_in.data(), frames,
+	                      this->stretch_out);
+	this->TakeStretched();
+}
+
+void PipeAudio::TakeStretched()
+{
+	auto fmt = this->src->OutputSampleFormat();
+	auto count = this->stretch_out.size();
+	this->frame.resize(count * SAMPLE_FORMAT_BPS[static_cast<int>(fmt)]);
+	SamplesFromFloat(this->stretch_out.data(), count, fmt,
+	                 this->frame.data());
+	this->frame_iterator = this->frame.begin();
+}
+
+bool PipeAudio::DrainStretch()
+{
+	if (!this->stretching || this->stretch.Pending() == 0) return false;
+
+	// If there's still a frame, it has yet to go into the stretcher, so
+	// the draining has to wait for it.
+	if (!this->FrameFinished()) return true;
+
+	this->stretch_out.clear();
+	this->stretch.Drain(this->stretch_out);
+	this->TakeStretched();
+	this->frame_unprocessed = false;
+	return true;
+}
+
 void PipeAudio::TransferFrame()
 {
 	assert(!this->frame.empty());
 	assert(this->sink != nullptr);
 	assert(this->src != nullptr);
 
+	auto begin = this->frame_iterator;
 	this->sink->Transfer(this->frame_iterator, this->frame.end());
 
+	// Remember what we just transferred, in case we need to rewind.
+	auto data = this->frame.data();
+	if (!this->stretching) {
+		this->rewind.Append(
+		        data + (begin - this->frame.begin()),
+		        data + (this->frame_iterator - this->frame.begin()));
+	}
+
+	auto bytes = static_cast<std::size_t>(this->frame_iterator - begin);
+	this->transfer_position += bytes / this->src->BytesPerSample();
+
 	// We empty the frame once we're done with it.  This
 	// maintains FrameFinished(), as an empty frame is a finished one.
 	if (this->FrameFinished()) {
@@ -193,13 +772,66 @@ bool PipeAudio::DecodeIfFrameEmpty()
 	// If we still have a frame, don't bother decoding yet.
 	if (!this->FrameFinished()) return true;
 
+	// Once the end of a crossfade has been transferred, the next file
+	// takes over, starting with whatever it decoded past the fade.
+	if (this->crossfade && this->crossfade->Done()) {
+		this->SwitchToNext();
+		if (!this->FrameFinished()) return true;
+	}
+
+	// When looping, reaching the out point (or the end of the file)
+	// sends the decoder back to the loop-in point.  This happens as soon
+	// as the decoder gets there, well before the sink runs dry.
+	if (this->Looping() && (this->source_ended ||
+	                        this->OutPoint() <= this->decode_position)) {
+		this->LoopBack();
+	}
+
+	// Otherwise, the out point is as good as the end of file.
+	if (this->OutPoint() <= this->decode_position) return false;
+
+	// Likewise if we've played a preroll that ran to the end of file.
+	if (this->source_ended) return false;
+
 	assert(this->src != nullptr);
-	AudioSource::DecodeResult result = this->src->Decode();
 
-	this->frame = result.second;
+	// If we've just played a hot cue preroll, the decoder is still back
+	// where it was before, and needs to catch up with it.
+	if (this->catch_up) {
+		this->decode_position = this->src->Seek(this->decode_position);
+		this->catch_up = false;
+	}
+
+	// The frame is empty by now, but keeps its storage; decoding into it
+	// means steady playback doesn't allocate.
+	AudioSource::DecodeState state;
+	{
+		TraceSpan span("AudioSource::Decode");
+		LatencyTimer timer(Metrics::Get().decode);
+		PD_PROBE(decode_start);
+		state = this->src->DecodeInto(this->frame);
+		PD_PROBE1(decode_end, this->frame.size());
+	}
+
 	this->frame_iterator = this->frame.begin();
+	this->frame_unprocessed = true;
+	auto bytes_per_sample = this->src->BytesPerSample();
+	this->decode_position += this->frame.size() / bytes_per_sample;
+
+	this->CutAtOutPoint();
 
-	return result.first != AudioSource::DecodeState::END_OF_FILE;
+	// When crossfading, the end of this file isn't the end of the audio.
+	bool eof = state == AudioSource::DecodeState::END_OF_FILE;
+	bool ended = eof || this->OutPoint() <= this->decode_position;
+	if (this->MixNext(ended)) return true;
+
+	if (!eof) return true;
+
+	// When looping, the end of file isn't the end of the audio; we
+	// loop back once this frame has been transferred.
+	if (!this->Looping()) return false;
+	this->source_ended = true;
+	return true;
 }
 
 bool PipeAudio::FrameFinished() const
@@ -207,6 +839,61 @@ bool PipeAudio::FrameFinished() const
 	return this->frame.end() <= this->frame_iterator;
 }
 
+void PipeAudio::SetCueAnalysis(std::unique_ptr<CueAnalysis> cues, bool trim)
+{
+	this->cues = std::move(cues);
+	this->trim = trim;
+	this->trimmed_in = false;
+
+	// Cue points that are already known, such as cached ones, go out with
+	// the rest of the file's state; only a running analysis needs to
+	// announce them when it finishes.
+	this->cues_pending = this->cues && !this->cues->Ready();
+}
+
+bool PipeAudio::Trimming() const
+{
+	return this->trim && this->cues && this->cues->Ready();
+}
+
+void PipeAudio::TrimIn()
+{
+	if (this->trimmed_in || !this->Trimming()) return;
+	this->trimmed_in = true;
+
+	// The analysis may finish after playback has started.  Jumping
+	// forwards mid-play would be worse than the dead air, so only skip
+	// the lead-in if nothing has been played yet.
+	if (this->sink->State() == Audio::State::PLAYING) return;
+	if (this->sink->Position() != 0) return;
+
+	// Seek() clamps this to the in point for us.
+	this->Seek(0);
+}
+
+std::uint64_t PipeAudio::OutPoint() const
+{
+	auto out = std::numeric_limits<std::uint64_t>::max();
+	if (this->looping && this->has_loop_out) out = this->loop_out;
+	if (this->Trimming()) out = std::min(out, this->cues->Points().out);
+	return out;
+}
+
+void PipeAudio::CutAtOutPoint()
+{
+	auto out = this->OutPoint();
+	if (this->decode_position <= out) return;
+
+	// Drop everything in the frame that lies after the out point.  This
+	// may be the whole frame.
+	auto bytes_per_sample = this->src->BytesPerSample();
+	auto excess = (this->decode_position - out) * bytes_per_sample;
+	auto size = this->frame.size();
+	this->frame.resize(excess < size ? size - excess : 0);
+	this->frame_iterator = this->frame.begin();
+	this->decode_position = out;
+}
+
 bool PipeAudio::CanAnnounceTime(std::uint64_t micros)
 {
 	std::uint64_t secs = micros / 1000 / 1000;
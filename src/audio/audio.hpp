@@ -10,6 +10,7 @@
 #ifndef PLAYD_AUDIO_HPP
 #define PLAYD_AUDIO_HPP
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -18,6 +19,13 @@
 
 #include "../response.hpp"
 #include "audio_source.hpp"
+#include "crossfade.hpp"
+#include "cue_points.hpp"
+#include "dsp.hpp"
+#include "hot_cue.hpp"
+#include "position_map.hpp"
+#include "rewind_buffer.hpp"
+#include "time_stretch.hpp"
 
 class AudioSink;
 
@@ -46,6 +54,9 @@ public:
 		AT_END,  ///< The Audio has ended and can't play without a seek.
 	};
 
+	/// The number of hot cues that can be registered on one Audio.
+	static const std::size_t HOT_CUE_COUNT = 8;
+
 	/// Virtual, empty destructor for Audio.
 	virtual ~Audio() = default;
 
@@ -66,6 +77,102 @@ public:
 	 */
 	virtual void Seek(std::uint64_t position) = 0;
 
+	/**
+	 * Registers a hot cue, replacing any already in its slot.
+	 * Seeking to a hot cue may be faster than seeking elsewhere.
+	 * @param index The slot of the hot cue; must be below HOT_CUE_COUNT.
+	 * @param position The position of the cue, in microseconds.
+	 * @see ClearHotCue
+	 */
+	virtual void SetHotCue(std::size_t index, std::uint64_t position) = 0;
+
+	/**
+	 * Unregisters a hot cue, if one is registered.
+	 * @param index The slot of the hot cue; must be below HOT_CUE_COUNT.
+	 * @see SetHotCue
+	 */
+	virtual void ClearHotCue(std::size_t index) = 0;
+
+	/**
+	 * Sets whether this Audio should loop.
+	 * When looping, the Audio jumps back to the loop-in point on reaching
+	 * the loop-out point (or, if there is none, the end of the file),
+	 * without stopping or ending.
+	 * @param looping True to loop; false to play through.
+	 * @see SetLoopIn
+	 * @see SetLoopOut
+	 */
+	virtual void SetLooping(bool looping) = 0;
+
+	/**
+	 * Sets the point to which this Audio jumps back when looping.
+	 * This defaults to the start of the file.
+	 * @param position The loop-in point, in microseconds.
+	 */
+	virtual void SetLoopIn(std::uint64_t position) = 0;
+
+	/**
+	 * Sets the point at which this Audio jumps back when looping.
+	 * @param position The loop-out point, in microseconds.
+	 * @see ClearLoopOut
+	 */
+	virtual void SetLoopOut(std::uint64_t position) = 0;
+
+	/// Makes this Audio loop at the end of the file again.
+	virtual void ClearLoopOut() = 0;
+
+	/**
+	 * Queues the file to be crossfaded into once this one finishes.
+	 * Any file already queued is replaced.
+	 * @param next The AudioSource of the next file.
+	 * @param factory A function opening the next file again, for use in
+	 *   background work once it has taken over.
+	 * @exception FileError Thrown if the next file can't be mixed with
+	 *   this one.
+	 * @see SetCrossfade
+	 */
+	virtual void SetNext(std::unique_ptr<AudioSource> next,
+	                     HotCue::SourceFactory factory) = 0;
+
+	/// Unqueues the next file, if any.
+	virtual void ClearNext() = 0;
+
+	/**
+	 * Sets how the crossfade into the next file is carried out.
+	 * Changes don't affect a crossfade that has already started.
+	 * @param settings The crossfade settings.
+	 */
+	virtual void SetCrossfade(const CrossfadeSettings &settings) = 0;
+
+	/**
+	 * Sets up the built-in processors of the DSP insert chain.
+	 * @param settings The DSP settings.
+	 */
+	virtual void SetDsp(const DspSettings &settings) = 0;
+
+	/**
+	 * Sets the speed of playback, without changing its pitch.
+	 * Positions are still reported in the file's own time.
+	 * @param rate The rate, between TimeStretch::MIN_RATE and
+	 *   TimeStretch::MAX_RATE: 1 is normal speed, 2 twice as fast.
+	 */
+	virtual void SetRate(double rate) = 0;
+
+	/**
+	 * Checks whether this Audio has moved on to a different file.
+	 * This happens at the end of a crossfade.  Checking resets the flag.
+	 * @return True if the file has changed since the last check.
+	 */
+	virtual bool TakeFileChange();
+
+	/**
+	 * Checks whether a background cue point analysis has just finished.
+	 * Checking resets the flag, so each analysis is reported once.
+	 * @return True if the cue points have become known since the last
+	 *   check.
+	 */
+	virtual bool TakeCuesReady();
+
 	/**
 	 * Performs an update cycle on this Audio.
 	 *
@@ -95,6 +202,15 @@ public:
 	 */
 	virtual std::unique_ptr<Response> Emit(const std::string &path, bool broadcast);
 
+	/**
+	 * Adds the position to a response, if it is due to be broadcast.
+	 * This is the regular broadcast part of Emit("/player/time/elapsed"),
+	 * but fills in a Response the caller owns, and so doesn't allocate.
+	 * @param response A RES Response with no arguments yet.
+	 * @return Whether the Response was filled in and should be broadcast.
+	 */
+	virtual bool EmitTime(Response &response);
+
 	/**
 	 * This Audio's current position.
 	 *
@@ -126,6 +242,18 @@ public:
 
 	void SetPlaying(bool playing) override;
 	void Seek(std::uint64_t position) override;
+	void SetHotCue(std::size_t index, std::uint64_t position) override;
+	void ClearHotCue(std::size_t index) override;
+	void SetLooping(bool looping) override;
+	void SetLoopIn(std::uint64_t position) override;
+	void SetLoopOut(std::uint64_t position) override;
+	void ClearLoopOut() override;
+	void SetNext(std::unique_ptr<AudioSource> next,
+	             HotCue::SourceFactory factory) override;
+	void ClearNext() override;
+	void SetCrossfade(const CrossfadeSettings &settings) override;
+	void SetDsp(const DspSettings &settings) override;
+	void SetRate(double rate) override;
 	std::uint64_t Position() const override;
 };
 
@@ -154,12 +282,63 @@ public:
 
 	void SetPlaying(bool playing) override;
 	void Seek(std::uint64_t position) override;
+	void SetHotCue(std::size_t index, std::uint64_t position) override;
+	void ClearHotCue(std::size_t index) override;
+	void SetLooping(bool looping) override;
+	void SetLoopIn(std::uint64_t position) override;
+	void SetLoopOut(std::uint64_t position) override;
+	void ClearLoopOut() override;
+	void SetNext(std::unique_ptr<AudioSource> next,
+	             HotCue::SourceFactory factory) override;
+	void ClearNext() override;
+	void SetCrossfade(const CrossfadeSettings &settings) override;
+	void SetDsp(const DspSettings &settings) override;
+	void SetRate(double rate) override;
+	bool TakeFileChange() override;
+	bool TakeCuesReady() override;
 	Audio::State Update() override;
 
 	std::unique_ptr<Response> Emit(const std::string &path, bool broadcast) override;
+	bool EmitTime(Response &response) override;
 	std::uint64_t Position() const override;
 
+	/**
+	 * Attaches a cue point analysis to this PipeAudio.
+	 *
+	 * Once the analysis is ready, its cue points are emitted as
+	 * `/player/cue/in` and `/player/cue/out`.  If @a trim is set, the
+	 * PipeAudio also starts at the in point (if it hasn't yet started
+	 * playing) and ends at the out point.
+	 *
+	 * @param cues The cue point analysis, which may still be running.
+	 * @param trim Whether to trim playback to the cue points.
+	 */
+	void SetCueAnalysis(std::unique_ptr<CueAnalysis> cues, bool trim);
+
+	/**
+	 * Sets the function used to open the file when prerolling hot cues.
+	 * Without one, hot cues can be registered but are never prerolled.
+	 * @param factory The function used to open the file.
+	 * @see HotCue
+	 */
+	void SetPrerollSource(HotCue::SourceFactory factory);
+
+	/**
+	 * Inserts a Processor into the DSP insert chain.
+	 * The Processor runs after the built-in gain and EQ, but before the
+	 * limiter, which is always last.
+	 * @param processor The Processor, which must have been constructed
+	 *   with this PipeAudio's sample rate and channel count.
+	 */
+	void Insert(std::unique_ptr<Processor> processor);
+
 private:
+	/// The number of seconds of audio kept for rewinding from memory.
+	static const std::uint32_t REWIND_SECONDS;
+
+	/// The number of seconds of audio prerolled at each hot cue.
+	static const std::uint32_t PREROLL_SECONDS;
+
 	/// The source of audio data.
 	std::unique_ptr<AudioSource> src;
 
@@ -172,15 +351,182 @@ private:
 	/// The current position in the current decoded frame.
 	AudioSource::DecodeVector::iterator frame_iterator;
 
+	/// The history of recently transferred audio, for fast rewinding.
+	RewindBuffer rewind;
+
 	/// Whether last_time contains a valid last time.
 	bool announced_time;
 
 	/// The last time into this Audio when the time was broadcast.
 	std::uint64_t last_time;
 
+	/// The position, in samples, of the end of the current frame.
+	std::uint64_t decode_position;
+
+	/// The cue point analysis for this Audio, if any.
+	std::unique_ptr<CueAnalysis> cues;
+
+	/// Whether playback should be trimmed to the cue points.
+	bool trim;
+
+	/// Whether we have already considered trimming to the in point.
+	bool trimmed_in;
+
+	/// Whether the cue points have yet to be reported by TakeCuesReady.
+	bool cues_pending;
+
+	/// The function used to open the file for hot cue prerolls.
+	HotCue::SourceFactory preroll_source;
+
+	/// The registered hot cues, by slot.
+	std::array<std::unique_ptr<HotCue>, HOT_CUE_COUNT> hot_cues;
+
+	/// Whether the source must seek to decode_position before decoding.
+	/// This is set after playing from a hot cue preroll.
+	bool catch_up;
+
+	/// Whether the source has nothing to decode after the current frame.
+	/// This is set after playing a preroll that reached the end of file,
+	/// or after decoding the end of file while looping.
+	bool source_ended;
+
+	/// The stream position, in samples, just after the last sample
+	/// transferred to the sink.
+	std::uint64_t transfer_position;
+
+	/// The jumps in the stream sent to the sink, such as loop wraps.
+	PositionMap positions;
+
+	/// Whether this Audio is looping.
+	bool looping;
+
+	/// The loop-in point, in samples.
+	std::uint64_t loop_in;
+
+	/// The loop-out point, in samples, if has_loop_out is set.
+	std::uint64_t loop_out;
+
+	/// Whether there is a loop-out point, rather than the end of file.
+	bool has_loop_out;
+
+	/// The crossfade into the next file, if one is queued.
+	std::unique_ptr<Crossfade> crossfade;
+
+	/// How the crossfade into the next file should be carried out.
+	CrossfadeSettings crossfade_settings;
+
+	/// The time spent on the last finished crossfade, in microseconds.
+	std::uint64_t crossfade_cost;
+
+	/// Whether any crossfade has finished, so crossfade_cost is valid.
+	bool crossfaded;
+
+	/// Whether the file has changed since TakeFileChange was last called.
+	bool file_changed;
+
+	/// The DSP insert chain, run over each frame before it is transferred.
+	ProcessorChain dsp;
+
+	/// Whether the current frame has yet to go through the DSP chain.
+	bool frame_unprocessed;
+
+	/// The time-stretcher, run over each frame after the DSP chain.
+	TimeStretch stretch;
+
+	/// Whether frames are going through the time-stretcher.
+	/// Once on, this stays on until the next seek, even at normal speed,
+	/// so that the stretcher can give up the audio it is holding back.
+	bool stretching;
+
+	/// Scratch space for the floating point input to the stretcher.
+	std::vector<float> stretch_in;
+
+	/// Scratch space for the floating point output of the stretcher.
+	std::vector<float> stretch_out;
+
+	/**
+	 * Checks whether playback is being trimmed to known cue points.
+	 * @return True if trimming is on and the cue points are ready.
+	 */
+	bool Trimming() const;
+
+	/// Moves to the in point, if we should and haven't already.
+	void TrimIn();
+
+	/**
+	 * Finds the point at which decoding should stop (or loop back).
+	 * This is the loop-out point if looping, or the trimmed out point if
+	 * trimming, whichever is earlier.
+	 * @return The out point, in samples, which may be the maximum
+	 *   possible position if there is none.
+	 */
+	std::uint64_t OutPoint() const;
+
+	/// Cuts the current frame short if it runs past the out point.
+	void CutAtOutPoint();
+
+	/**
+	 * Checks whether the decoder should loop back at the out point.
+	 * @return True if looping is on and the loop isn't empty.
+	 */
+	bool Looping() const;
+
+	/// Sends the decoder back to the loop-in point.
+	void LoopBack();
+
+	/**
+	 * Records a jump in the stream, at the point the next decoded sample
+	 * will reach the sink.
+	 * @param file The file position to which the stream jumps.
+	 */
+	void AddJump(std::uint64_t file);
+
+	/**
+	 * Finds the point in this file at which the crossfade should start.
+	 * This is the start set in the crossfade settings, or failing that,
+	 * one crossfade length before the out point.
+	 * @return The fade start, in samples, which may be the maximum
+	 *   possible position if it isn't yet known.
+	 */
+	std::uint64_t FadeStart() const;
+
+	/**
+	 * Passes the current frame through the crossfade, if any.
+	 * @param ended Whether this file ends with the current frame.
+	 * @return True if the current frame finishes the crossfade.
+	 */
+	bool MixNext(bool ended);
+
+	/// Hands over to the next file, once its crossfade has finished.
+	void SwitchToNext();
+
+	/**
+	 * Sets the sink's position, flushing anything already sent to it.
+	 * @param samples The new position, in samples.
+	 */
+	void SetSinkPosition(std::uint64_t samples);
+
 	/// Clears the current frame and its iterator.
 	void ClearFrame();
 
+	/**
+	 * Seeks by replaying audio from the rewind buffer.
+	 * The decoder is left where it is, and picks up after the replayed
+	 * audio.
+	 * @param samples The new position, in samples.  Must be contained in
+	 *   the rewind buffer.
+	 */
+	void SeekFromMemory(std::uint64_t samples);
+
+	/**
+	 * Seeks by playing a hot cue's preroll, if one is ready at a position.
+	 * The decoder is left to seek to the end of the preroll later, once
+	 * the preroll has been transferred.
+	 * @param samples The new position, in samples.
+	 * @return True if a preroll was used; false otherwise.
+	 */
+	bool SeekFromHotCue(std::uint64_t samples);
+
 	/**
 	 * Decodes a new frame, if the current frame is empty.
 	 * @return True if more frames are available to decode; false
@@ -196,6 +542,22 @@ private:
 	 */
 	bool FrameFinished() const;
 
+	/// Runs the current frame through the DSP chain, if it hasn't been.
+	void ProcessFrame();
+
+	/// Runs the current frame through the time-stretcher.
+	void StretchFrame();
+
+	/// Makes the current frame from the stretcher's output.
+	void TakeStretched();
+
+	/**
+	 * Fills the current frame with whatever the time-stretcher is holding
+	 * back, once there's nothing left to decode.
+	 * @return True if the stretcher was holding anything back.
+	 */
+	bool DrainStretch();
+
 	/// Transfers as much of the current frame as possible to the sink.
 	void TransferFrame();
 
@@ -9,8 +9,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
+#include <cstdint>
 #include <cstring>
+#include <iterator>
 #include <memory>
 #include <string>
 
@@ -18,9 +21,15 @@
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "../metrics.hpp"
+#include "../probes.hpp"
+#include "../realtime.hpp"
+#include "../trace.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
+#include "downmix.hpp"
 #include "ringbuffer.hpp"
+#include "sample_convert.hpp"
 #include "sample_formats.hpp"
 
 //
@@ -32,11 +41,65 @@ Audio::State AudioSink::State()
 	return Audio::State::NONE;
 }
 
+bool AudioSink::SkipTo(std::uint64_t)
+{
+	return false;
+}
+
+/**
+ * Checks whether one channel of one sample is silent.
+ * @param sample The first byte of the channel's sample.
+ * @param format The format of the sample.
+ * @return Whether the sample is at its format's silence.
+ */
+static bool IsSilent(const char *sample, SampleFormat format)
+{
+	switch (format) {
+	case SampleFormat::PACKED_UNSIGNED_INT_8:
+		return static_cast<unsigned char>(*sample) == 0x80;
+	case SampleFormat::PACKED_FLOAT_32: {
+		// This is true of -0.0f as well as 0.0f.
+		float value;
+		std::memcpy(&value, sample, sizeof(value));
+		return value == 0.0f;
+	}
+	default: {
+		auto end = sample + SAMPLE_FORMAT_BPS[static_cast<int>(format)];
+		return std::all_of(sample, end, [](char b) { return b == 0; });
+	}
+	}
+}
+
+/* static */ std::size_t AudioSink::LeadingSilence(
+        const char *bytes, std::size_t samples, std::size_t bytes_per_sample,
+        SampleFormat format)
+{
+	auto width = SAMPLE_FORMAT_BPS[static_cast<int>(format)];
+	auto count = samples * bytes_per_sample / width;
+
+	std::size_t i = 0;
+	while (i < count && IsSilent(bytes + i * width, format)) i++;
+	return i * width / bytes_per_sample;
+}
+
+/* static */ std::size_t AudioSink::TrailingSilence(
+        const char *bytes, std::size_t samples, std::size_t bytes_per_sample,
+        SampleFormat format)
+{
+	auto width = SAMPLE_FORMAT_BPS[static_cast<int>(format)];
+	auto count = samples * bytes_per_sample / width;
+
+	auto i = count;
+	while (0 < i && IsSilent(bytes + (i - 1) * width, format)) i--;
+	return (count - i) * width / bytes_per_sample;
+}
+
 //
 // SdlAudioSink
 //
 
 const size_t SdlAudioSink::RINGBUF_POWER = 16;
+const size_t SdlAudioSink::CONVERT_SAMPLES = 4096;
 
 /**
  * The callback used by SDL_Audio.
@@ -56,9 +119,27 @@ static void SDLCallback(void *vsink, std::uint8_t *data, int len)
 }
 
 SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id)
-    : bytes_per_sample(source.BytesPerSample()),
-      ring_buf(RINGBUF_POWER, source.BytesPerSample()),
+    : SdlAudioSink(source, device_id, source.OutputSampleFormat())
+{
+}
+
+SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id,
+                           SampleFormat device_format)
+    : SdlAudioSink(source, device_id, device_format, DownmixGains::Itu())
+{
+}
+
+SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id,
+                           SampleFormat device_format,
+                           const DownmixGains &gains)
+    : device_format(device_format),
+      silence(SilenceByte(device_format)),
+      in_bytes_per_sample(source.BytesPerSample()),
+      in_channels(source.ChannelCount()),
+      to_float(nullptr),
+      from_float(nullptr),
       position_sample_count(0),
+      written_sample_count(0),
       source_out(false),
       state(Audio::State::STOPPED)
 {
@@ -71,19 +152,60 @@ SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id)
 	SDL_AudioSpec want;
 	SDL_zero(want);
 	want.freq = source.SampleRate();
-	want.format = SDLFormat(source.OutputSampleFormat());
-	want.channels = source.ChannelCount();
+	want.format = SDLFormat(device_format);
+	want.channels = this->in_channels;
 	want.callback = &SDLCallback;
 	want.userdata = (void *)this;
 
+	// Mono and stereo go out as they are.  Anything wider is up to the
+	// device: we downmix to what it has, rather than leave it to SDL.
+	int allowed = 0;
+	if (2 < this->in_channels && this->in_channels <= Downmix::MAX_CHANNELS) {
+		allowed = SDL_AUDIO_ALLOW_CHANNELS_CHANGE;
+	}
+
 	SDL_AudioSpec have;
 	SDL_zero(have);
 
-	this->device = SDL_OpenAudioDevice(name, 0, &want, &have, 0);
+	this->device = SDL_OpenAudioDevice(name, 0, &want, &have, allowed);
 	if (this->device == 0) {
 		throw ConfigError(std::string("couldn't open device: ") +
 		                  SDL_GetError());
 	}
+
+	this->out_channels = have.channels;
+	if (this->out_channels != this->in_channels) {
+		if (!Downmix::CanMap(this->in_channels, this->out_channels)) {
+			SDL_CloseAudioDevice(this->device);
+			throw ConfigError(std::string("can't map channels to device: ") +
+			                  std::to_string(this->out_channels));
+		}
+		this->downmix = std::unique_ptr<Downmix>(new Downmix(
+		        this->in_channels, this->out_channels, gains));
+	}
+
+	this->bytes_per_sample =
+	        SAMPLE_FORMAT_BPS[static_cast<int>(device_format)] *
+	        this->out_channels;
+	this->ring_buf = std::unique_ptr<RingBuffer>(
+	        new RingBuffer(RINGBUF_POWER, this->bytes_per_sample));
+	Metrics::Get().ring_size = this->ring_buf->WriteCapacity();
+
+	// Converting and downmixing here means it happens once, on the way in,
+	// rather than in SDL's callback thread, which then only ever copies.
+	auto in_format = source.OutputSampleFormat();
+	this->converting = this->downmix || device_format != in_format;
+	if (!this->converting) return;
+
+	if (in_format != SampleFormat::PACKED_FLOAT_32) {
+		this->to_float = ToFloatKernel(in_format);
+		this->unpacked.resize(CONVERT_SAMPLES * this->in_channels);
+	}
+	if (this->downmix) {
+		this->mixed.resize(CONVERT_SAMPLES * this->out_channels);
+	}
+	this->from_float = FromFloatKernel(device_format);
+	this->converted.resize(CONVERT_SAMPLES * this->bytes_per_sample);
 }
 
 SdlAudioSink::~SdlAudioSink()
@@ -145,6 +267,7 @@ std::uint64_t SdlAudioSink::Position()
 void SdlAudioSink::SetPosition(std::uint64_t samples)
 {
 	this->position_sample_count = samples;
+	this->written_sample_count = samples;
 
 	// We might have been at the end of the file previously.
 	// If so, we might not be now, so clear the out flags.
@@ -156,12 +279,37 @@ void SdlAudioSink::SetPosition(std::uint64_t samples)
 
 	// The ringbuf will have been full of samples from the old
 	// position, so we need to get rid of them.
-	this->ring_buf.Flush();
+	this->ring_buf->Flush();
+}
+
+bool SdlAudioSink::SkipTo(std::uint64_t samples)
+{
+	// Only forward seeks into what we've already been given can be
+	// served from the ringbuf.
+	if (samples > this->written_sample_count) return false;
+
+	// The callback moves the read end of the ringbuf, so it mustn't run
+	// while we move it too.
+	SDL_LockAudioDevice(this->device);
+
+	bool skipped = false;
+	if (this->position_sample_count <= samples) {
+		auto count = samples - this->position_sample_count;
+		assert(count <= this->ring_buf->ReadCapacity());
+
+		this->ring_buf->Skip(static_cast<unsigned long>(count));
+		this->position_sample_count = samples;
+		skipped = true;
+	}
+
+	SDL_UnlockAudioDevice(this->device);
+	return skipped;
 }
 
 void SdlAudioSink::Transfer(AudioSink::TransferIterator &start,
                             const AudioSink::TransferIterator &end)
 {
+	TraceSpan span("SdlAudioSink::Transfer");
 	assert(start <= end);
 
 	// No point transferring 0 bytes.
@@ -169,37 +317,69 @@ void SdlAudioSink::Transfer(AudioSink::TransferIterator &start,
 
 	unsigned long bytes = std::distance(start, end);
 	// There should be a whole number of samples being transferred.
-	assert(bytes % bytes_per_sample == 0);
+	assert(bytes % this->in_bytes_per_sample == 0);
 	assert(0 < bytes);
 
-	auto samples = bytes / this->bytes_per_sample;
+	auto samples = bytes / this->in_bytes_per_sample;
 
 	// Only transfer as many samples as the ring buffer can take.
 	// Don't bother trying to write 0 samples!
-	auto count = std::min(samples, this->ring_buf.WriteCapacity());
+	auto count = std::min(samples, this->ring_buf->WriteCapacity());
+	if (this->converting) count = std::min(count, CONVERT_SAMPLES);
 	if (count == 0) return;
+	PD_PROBE1(transfer, count);
 
 	auto start_ptr = reinterpret_cast<char *>(&*start);
-	unsigned long written_count = this->ring_buf.Write(start_ptr, count);
+	if (this->converting) start_ptr = this->Convert(start_ptr, count);
+
+	unsigned long written_count = this->ring_buf->Write(start_ptr, count);
 	// Since we never write more than the ring buffer can take, the written
 	// count should equal the requested written count.
 	assert(written_count == count);
 
-	start += (written_count * this->bytes_per_sample);
+	start += (written_count * this->in_bytes_per_sample);
 	assert(start <= end);
+
+	this->written_sample_count += written_count;
+}
+
+char *SdlAudioSink::Convert(const char *samples, size_t count)
+{
+	assert(count <= CONVERT_SAMPLES);
+
+	auto floats = reinterpret_cast<const float *>(samples);
+	if (this->to_float != nullptr) {
+		this->to_float(reinterpret_cast<const std::uint8_t *>(samples),
+		               count * this->in_channels, this->unpacked.data());
+		floats = this->unpacked.data();
+	}
+
+	if (this->downmix) {
+		this->downmix->Run(floats, count, this->mixed.data());
+		floats = this->mixed.data();
+	}
+
+	this->from_float(floats, count * this->out_channels,
+	                 this->converted.data());
+	return reinterpret_cast<char *>(this->converted.data());
 }
 
 void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 {
 	assert(out != nullptr);
+	CountFaults(AudioPath::DEVICE);
+	this->trace.Adopt();
+	NameTraceThread("device");
+	TraceSpan span("SdlAudioSink::Callback");
 
 	assert(0 <= nbytes);
 	unsigned long lnbytes = static_cast<unsigned long>(nbytes);
 
 	// Make sure anything not filled up with sound later is set to silence.
 	// This is slightly inefficient (two writes to sound-filled regions
-	// instead of one), but more elegant in failure cases.
-	memset(out, 0, lnbytes);
+	// instead of one), but more elegant in failure cases.  Zero isn't
+	// silence for unsigned samples, so we use the device format's.
+	memset(out, this->silence, lnbytes);
 
 	// If we're not supposed to be playing, don't play anything.
 	if (this->state != Audio::State::PLAYING) return;
@@ -213,7 +393,18 @@ void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 	// actual read capacity can only be greater than or equal to
 	// `avail_samples`, as this is the only place where we can *decrease*
 	// it.
-	auto avail_samples = this->ring_buf.ReadCapacity();
+	auto avail_samples = this->ring_buf->ReadCapacity();
+
+	// How many samples do we want to pull out of the ring buffer?
+	auto req_samples = lnbytes / this->bytes_per_sample;
+	PD_PROBE2(callback, avail_samples, req_samples);
+
+	// Running short before the source has run out is an underrun.
+	auto &metrics = Metrics::Get();
+	metrics.ring_fill.store(avail_samples, std::memory_order_relaxed);
+	if (avail_samples < req_samples && !this->source_out) {
+		metrics.underruns.fetch_add(1, std::memory_order_relaxed);
+	}
 
 	// Have we run out of things to feed?
 	if (avail_samples == 0) {
@@ -225,14 +416,29 @@ void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 		return;
 	}
 
-	// How many samples do we want to pull out of the ring buffer?
-	auto req_samples = lnbytes / this->bytes_per_sample;
-
 	// How many can we pull out?  Send this amount to SDL.
 	auto samples = std::min(req_samples, avail_samples);
 	auto read_samples =
-	        this->ring_buf.Read(reinterpret_cast<char *>(out), samples);
+	        this->ring_buf->Read(reinterpret_cast<char *>(out), samples);
 	this->position_sample_count += read_samples;
+
+	// Only look for sound when a command is waiting to be heard.
+	auto &audible = metrics.audible;
+	if (audible.Armed() &&
+	    LeadingSilence(reinterpret_cast<char *>(out), read_samples,
+	                   this->bytes_per_sample,
+	                   this->device_format) < read_samples) {
+		audible.Heard(std::chrono::steady_clock::now());
+	}
+}
+
+/* static */ std::uint8_t SdlAudioSink::SilenceByte(SampleFormat fmt)
+{
+	// Every byte of a silent sample is the same, so the first will do.
+	std::uint8_t sample[sizeof(std::int32_t)];
+	float zero = 0.0f;
+	SamplesFromFloat(&zero, 1, fmt, sample);
+	return sample[0];
 }
 
 /// Mappings from SampleFormats to their equivalent SDL_AudioFormats.
@@ -20,8 +20,11 @@
 
 #include "audio.hpp"
 #include "audio_source.hpp"
+#include "downmix.hpp"
 #include "ringbuffer.hpp"
+#include "sample_convert.hpp"
 #include "sample_formats.hpp"
+#include "../trace.hpp"
 
 /// Abstract class for audio output sinks.
 class AudioSink
@@ -71,6 +74,21 @@ public:
 	 */
 	virtual void SetPosition(std::uint64_t samples) = 0;
 
+	/**
+	 * Tries to move the played position forwards without flushing.
+	 *
+	 * If the sink already holds the audio at @a samples (because it has
+	 * been transferred but not yet played), it may simply skip over the
+	 * audio in between.  Sinks that can't do this should return false, in
+	 * which case the caller should seek the usual way.
+	 *
+	 * @param samples The new position, as a count of elapsed samples.
+	 * @return True if the sink is now at @a samples; false if nothing
+	 *   changed.
+	 * @see SetPosition
+	 */
+	virtual bool SkipTo(std::uint64_t samples);
+
 	/**
 	 * Tells this AudioSink that the source has run out.
 	 *
@@ -95,6 +113,37 @@ public:
 	 */
 	virtual void Transfer(TransferIterator &start,
 	                      const TransferIterator &end) = 0;
+
+protected:
+	/**
+	 * Counts the silent samples at the start of a block of samples.
+	 * A sample is silent if each of its channels is at its format's
+	 * silence, like those a sink plays when it runs dry: zero, except
+	 * for unsigned samples, whose silence is their midpoint, and floats,
+	 * where either zero is silence.
+	 * @param bytes The first byte of the samples.
+	 * @param samples The number of samples.
+	 * @param bytes_per_sample The number of bytes in each sample.
+	 * @param format The format of each channel of each sample.
+	 * @return The number of leading silent samples; @a samples if all are.
+	 */
+	static std::size_t LeadingSilence(const char *bytes, std::size_t samples,
+	                                  std::size_t bytes_per_sample,
+	                                  SampleFormat format);
+
+	/**
+	 * Counts the silent samples at the end of a block of samples.
+	 * @param bytes The first byte of the samples.
+	 * @param samples The number of samples.
+	 * @param bytes_per_sample The number of bytes in each sample.
+	 * @param format The format of each channel of each sample.
+	 * @return The number of trailing silent samples; @a samples if all are.
+	 * @see LeadingSilence
+	 */
+	static std::size_t TrailingSilence(const char *bytes,
+	                                   std::size_t samples,
+	                                   std::size_t bytes_per_sample,
+	                                   SampleFormat format);
 };
 
 /**
@@ -123,6 +172,32 @@ public:
 	 */
 	SdlAudioSink(const AudioSource &source, int device_id);
 
+	/**
+	 * Constructs an SdlAudioSink with its own output sample format.
+	 * @param source The source from which this sink will receive audio.
+	 * @param device_id The device ID to which this sink will output.
+	 * @param device_format The sample format in which to open the device.
+	 *   Samples are converted to this format as they are transferred.
+	 */
+	SdlAudioSink(const AudioSource &source, int device_id,
+	             SampleFormat device_format);
+
+	/**
+	 * Constructs an SdlAudioSink with its own output sample format and
+	 * downmix.
+	 *
+	 * Sources with more than two channels let SDL pick the device's
+	 * channel count.  If it picks fewer channels than the source has, the
+	 * sink downmixes as samples are transferred, so SDL never has to.
+	 *
+	 * @param source The source from which this sink will receive audio.
+	 * @param device_id The device ID to which this sink will output.
+	 * @param device_format The sample format in which to open the device.
+	 * @param gains The gains to use when downmixing.
+	 */
+	SdlAudioSink(const AudioSource &source, int device_id,
+	             SampleFormat device_format, const DownmixGains &gains);
+
 	/// Destructs an SdlAudioSink.
 	~SdlAudioSink() override;
 
@@ -131,6 +206,7 @@ public:
 	Audio::State State() override;
 	std::uint64_t Position() override;
 	void SetPosition(std::uint64_t samples) override;
+	bool SkipTo(std::uint64_t samples) override;
 	void SourceOut() override;
 	void Transfer(TransferIterator &start,
 	              const TransferIterator &end) override;
@@ -151,6 +227,16 @@ public:
 	 */
 	static SDL_AudioFormat SDLFormat(SampleFormat fmt);
 
+	/**
+	 * Finds the byte with which the callback fills silence.
+	 * This is zero, except for unsigned 8-bit samples, whose silence is
+	 * their midpoint; it agrees with the silence SDL reports for each
+	 * format.
+	 * @param fmt The sample format of the device.
+	 * @return The byte which, repeated, is silence in @a fmt.
+	 */
+	static std::uint8_t SilenceByte(SampleFormat fmt);
+
 	/**
 	 * Gets the number and name of each output device entry in the
 	 * AudioSystem.
@@ -175,24 +261,82 @@ private:
 	/// The SDL device to which we are outputting sound.
 	SDL_AudioDeviceID device;
 
+	/// The device thread's trace ring, taken before the device opens, so
+	/// that the callback never waits for one.
+	TraceReservation trace;
+
 	/// n, where 2^n is the capacity of the Audio ring buffer.
 	/// @see RINGBUF_SIZE
 	static const size_t RINGBUF_POWER;
 
-	/// Number of bytes in one sample.
+	/// The number of samples converted at a time by Transfer().
+	static const size_t CONVERT_SAMPLES;
+
+	/// The format of each channel of each sample, as stored in ring_buf.
+	SampleFormat device_format;
+
+	/// The byte with which the callback fills silence.
+	std::uint8_t silence;
+
+	/// Number of bytes in one sample, as stored in ring_buf.
 	size_t bytes_per_sample;
 
+	/// Number of bytes in one sample, as given to Transfer().
+	size_t in_bytes_per_sample;
+
+	/// Number of channels in one sample, as given to Transfer().
+	std::uint8_t in_channels;
+
+	/// Number of channels in one sample, as stored in ring_buf.
+	std::uint8_t out_channels;
+
+	/// Whether samples need converting or downmixing before they are
+	/// stored in ring_buf.
+	bool converting;
+
+	/// Unpacks samples into floating point, or nullptr if they already
+	/// are.
+	ToFloatFn to_float;
+
+	/// Mixes samples down to the device's channels, if needed.
+	std::unique_ptr<Downmix> downmix;
+
+	/// Packs floating point samples for the device.
+	FromFloatFn from_float;
+
+	/// Scratch space for samples unpacked into floating point.
+	std::vector<float> unpacked;
+
+	/// Scratch space for downmixed samples.
+	std::vector<float> mixed;
+
+	/// Scratch space for converted samples.
+	std::vector<std::uint8_t> converted;
+
 	/// The ring buffer used to transfer samples to the playing callback.
-	RingBuffer ring_buf;
+	/// This is made once the device is open, and its channel count known.
+	std::unique_ptr<RingBuffer> ring_buf;
 
 	/// The current position, in samples.
+	/// This is the position of the sample at the read end of ring_buf.
 	std::uint64_t position_sample_count;
 
+	/// The position, in samples, just after the write end of ring_buf.
+	std::uint64_t written_sample_count;
+
 	/// Whether the source has run out of things to feed the sink.
 	bool source_out;
 
 	/// The decoder's current state.
 	Audio::State state;
+
+	/**
+	 * Converts and downmixes samples into the scratch space.
+	 * @param samples The samples, as given to Transfer().
+	 * @param count The number of samples; at most CONVERT_SAMPLES.
+	 * @return The converted samples, ready for ring_buf.
+	 */
+	char *Convert(const char *samples, size_t count);
 };
 
 #endif // PLAYD_AUDIO_SINK_HPP
@@ -9,6 +9,7 @@
 
 #include <cstdint>
 #include <string>
+#include <utility>
 
 #include "audio_source.hpp"
 #include "sample_formats.hpp"
@@ -17,6 +18,13 @@ AudioSource::AudioSource(const std::string &path) : path(path)
 {
 }
 
+AudioSource::DecodeResult AudioSource::Decode()
+{
+	DecodeVector frame;
+	auto state = this->DecodeInto(frame);
+	return std::make_pair(state, std::move(frame));
+}
+
 size_t AudioSource::BytesPerSample() const
 {
 	auto sf = static_cast<uint8_t>(this->OutputSampleFormat());
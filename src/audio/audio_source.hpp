@@ -61,17 +61,30 @@ public:
 	/// Virtual, empty destructor for AudioSource.
 	virtual ~AudioSource() = default;
 
+	/**
+	 * Performs a round of decoding into a new vector.
+	 * This allocates on each call; anything decoding repeatedly should
+	 * use DecodeInto instead.
+	 * @return A pair of the decoder's state upon finishing the decoding
+	 *   round and the vector of bytes decoded.  The vector may be empty,
+	 *   if the decoding round did not finish off a frame.
+	 */
+	DecodeResult Decode();
+
 	//
 	// Methods that must be overridden
 	//
 
 	/**
-	 * Performs a round of decoding.
-	 * @return A pair of the decoder's state upon finishing the decoding
-	 *   round and the vector of bytes decoded.  The vector may be empty,
-	 *   if the decoding round did not finish off a frame.
+	 * Performs a round of decoding into an existing vector.
+	 * The vector's contents are replaced, but its storage is reused, so
+	 * decoding into the same vector each time doesn't allocate once it
+	 * has grown to fit a frame.
+	 * @param frame The vector to fill with the bytes decoded.  It may be
+	 *   left empty, if the decoding round did not finish off a frame.
+	 * @return The decoder's state upon finishing the decoding round.
 	 */
-	virtual DecodeResult Decode() = 0;
+	virtual DecodeState DecodeInto(DecodeVector &frame) = 0;
 
 	/**
 	 * Returns the channel count.
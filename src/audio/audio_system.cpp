@@ -21,6 +21,7 @@
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
 #include "audio_system.hpp"
+#include "float_source.hpp"
 #include "sample_formats.hpp"
 
 #include "sources/mp3.hpp"
@@ -30,7 +31,12 @@ AudioSystem::AudioSystem(int device_id)
     : sink([](const AudioSource &, int) -> std::unique_ptr<AudioSink> {
 	      throw InternalError("No audio sink!");
       }),
-      device_id(device_id)
+      device_id(device_id),
+      cue_scan(false),
+      cue_trim(false),
+      cue_threshold(0),
+      cue_cache(std::make_shared<CueCache>()),
+      float_pipeline(false)
 {
 }
 
@@ -45,11 +51,28 @@ std::unique_ptr<Audio> AudioSystem::Load(const std::string &path) const
 	assert(source != nullptr);
 
 	auto sink = this->sink(*source, this->device_id);
-	return std::unique_ptr<Audio>(
+	std::unique_ptr<PipeAudio> pipe(
 	        new PipeAudio(std::move(source), std::move(sink)));
+
+	pipe->SetPrerollSource(this->SourceFactoryFor(path));
+	if (this->cue_scan) {
+		pipe->SetCueAnalysis(this->AnalyseCues(path), this->cue_trim);
+	}
+
+	return std::unique_ptr<Audio>(std::move(pipe));
 }
 
 std::unique_ptr<AudioSource> AudioSystem::LoadSource(const std::string &path) const
+{
+	auto source = this->SourceBuilderFor(path)(path);
+	if (!this->float_pipeline) return source;
+
+	return std::unique_ptr<AudioSource>(
+	        new FloatAudioSource(std::move(source)));
+}
+
+const AudioSystem::SourceBuilder &AudioSystem::SourceBuilderFor(
+        const std::string &path) const
 {
 	size_t extpoint = path.find_last_of('.');
 	std::string ext = path.substr(extpoint + 1);
@@ -59,7 +82,36 @@ std::unique_ptr<AudioSource> AudioSystem::LoadSource(const std::string &path) co
 		throw FileError("Unknown file format: " + ext);
 	}
 
-	return (ibuilder->second)(path);
+	return ibuilder->second;
+}
+
+std::unique_ptr<CueAnalysis> AudioSystem::AnalyseCues(
+        const std::string &path) const
+{
+	CuePoints points;
+	if (this->cue_cache->Find(path, points)) {
+		return std::unique_ptr<CueAnalysis>(new CueAnalysis(points));
+	}
+
+	return std::unique_ptr<CueAnalysis>(
+	        new CueAnalysis(this->SourceFactoryFor(path),
+	                        this->cue_threshold, this->cue_cache, path));
+}
+
+std::function<std::unique_ptr<AudioSource>()> AudioSystem::SourceFactoryFor(
+        const std::string &path) const
+{
+	// The factory is called from other threads, so it gets its own copy
+	// of the builder rather than a reference into our source map.
+	SourceBuilder builder = this->SourceBuilderFor(path);
+	if (!this->float_pipeline) {
+		return [builder, path]() { return builder(path); };
+	}
+
+	return [builder, path]() {
+		return std::unique_ptr<AudioSource>(
+		        new FloatAudioSource(builder(path)));
+	};
 }
 
 void AudioSystem::SetSink(AudioSystem::SinkBuilder sink)
@@ -72,3 +124,15 @@ void AudioSystem::AddSource(const std::string &ext,
 {
 	this->sources.emplace(ext, source);
 }
+
+void AudioSystem::SetCueAnalysis(double threshold, bool trim)
+{
+	this->cue_scan = true;
+	this->cue_trim = trim;
+	this->cue_threshold = threshold;
+}
+
+void AudioSystem::SetFloatPipeline()
+{
+	this->float_pipeline = true;
+}
@@ -11,12 +11,14 @@
 #define PLAYD_AUDIO_SYSTEM_HPP
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include "audio.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
+#include "cue_points.hpp"
 
 /**
  * An AudioSystem represents the entire audio stack used by playd.
@@ -76,6 +78,43 @@ public:
 	 */
 	void AddSource(const std::string &ext, SourceBuilder source);
 
+	/**
+	 * Enables background cue point analysis of loaded files.
+	 * @param threshold The silence threshold, as a fraction of full
+	 *   scale.
+	 * @param trim Whether playback should be trimmed to the cue points.
+	 * @see CueAnalysis
+	 */
+	void SetCueAnalysis(double threshold, bool trim);
+
+	/**
+	 * Switches on the float pipeline.
+	 * All sources then emit 32-bit floating point samples, whatever the
+	 * file's format, and sinks convert them to the device's format.
+	 * @see FloatAudioSource
+	 */
+	void SetFloatPipeline();
+
+	/**
+	 * Loads a file, creating an AudioSource.
+	 * @param path The path to the file to load.
+	 * @return An AudioSource pointer (may be nullptr, if no available
+	 *   and suitable AudioSource was found).
+	 * @see Load
+	 */
+	std::unique_ptr<AudioSource> LoadSource(const std::string &path) const;
+
+	/**
+	 * Makes a function that opens fresh AudioSources for a file.
+	 * These are used by background work, such as cue point analysis and
+	 * hot cue prerolling, that mustn't touch the AudioSource being played.
+	 * @param path The path to the file.
+	 * @return A function returning a new AudioSource for @a path.
+	 * @exception FileError Thrown if no builder handles the file.
+	 */
+	std::function<std::unique_ptr<AudioSource>()> SourceFactoryFor(
+	        const std::string &path) const;
+
 private:
 	/// The current sink builder.
 	SinkBuilder sink;
@@ -86,14 +125,35 @@ private:
 	/// The device ID for the sink.
 	int device_id;
 
+	/// Whether loaded files should have their cue points analysed.
+	bool cue_scan;
+
+	/// Whether loaded files should be trimmed to their cue points.
+	bool cue_trim;
+
+	/// The silence threshold used in cue point analysis.
+	double cue_threshold;
+
+	/// The cache of cue points for previously analysed files.
+	std::shared_ptr<CueCache> cue_cache;
+
+	/// Whether sources should be converted to floating point.
+	bool float_pipeline;
+
 	/**
-	 * Loads a file, creating an AudioSource.
-	 * @param path The path to the file to load.
-	 * @return An AudioSource pointer (may be nullptr, if no available
-	 *   and suitable AudioSource was found).
-	 * @see Load
+	 * Finds the source builder for a file, by its extension.
+	 * @param path The path to the file.
+	 * @return The builder for the file's AudioSource.
+	 * @exception FileError Thrown if no builder handles the file.
 	 */
-	std::unique_ptr<AudioSource> LoadSource(const std::string &path) const;
+	const SourceBuilder &SourceBuilderFor(const std::string &path) const;
+
+	/**
+	 * Starts (or retrieves from the cache) a cue point analysis.
+	 * @param path The path to the file to analyse.
+	 * @return The CueAnalysis for the file.
+	 */
+	std::unique_ptr<CueAnalysis> AnalyseCues(const std::string &path) const;
 };
 
 #endif // PLAYD_AUDIO_SYSTEM_HPP
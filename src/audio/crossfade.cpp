@@ -0,0 +1,363 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Crossfade class.
+ * @see audio/crossfade.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "../errors.hpp"
+#include "../simd.hpp"
+#include "audio_source.hpp"
+#include "crossfade.hpp"
+#include "sample_convert.hpp"
+#include "sample_formats.hpp"
+
+const std::size_t Crossfade::RAMP_BLOCK = 64;
+
+/// Pi, which C++11 doesn't reliably provide.
+static const double PI = 3.14159265358979323846;
+
+/**
+ * Finds the gains of the outgoing and incoming audio part-way into a fade.
+ * @param curve The shape of the fade.
+ * @param t How far into the fade we are, from 0 to 1.
+ * @param out Set to the gain of the outgoing audio.
+ * @param in Set to the gain of the incoming audio.
+ */
+static void FadeGains(CrossfadeCurve curve, double t, float &out, float &in)
+{
+	t = std::min(1.0, std::max(0.0, t));
+
+	switch (curve) {
+		case CrossfadeCurve::LINEAR:
+			out = static_cast<float>(1.0 - t);
+			in = static_cast<float>(t);
+			break;
+		case CrossfadeCurve::EQUAL_POWER:
+			out = static_cast<float>(std::cos(t * PI / 2));
+			in = static_cast<float>(std::sin(t * PI / 2));
+			break;
+	}
+}
+
+/**
+ * Fills a run of per-sample gains with a linear ramp.
+ * @param gains The gains to fill, one per mono sample.
+ * @param frames The number of (multi-channel) samples in the run.
+ * @param channels The number of channels per sample.
+ * @param from The gain at the start of the run.
+ * @param to The gain just after the end of the run.
+ */
+static void Ramp(float *gains, std::size_t frames, std::uint8_t channels,
+                 float from, float to)
+{
+	float step = (to - from) / static_cast<float>(frames);
+	for (std::size_t i = 0; i < frames; i++) {
+		float g = from + step * static_cast<float>(i);
+		for (std::uint8_t c = 0; c < channels; c++) {
+			gains[i * channels + c] = g;
+		}
+	}
+}
+
+Crossfade::Crossfade(std::unique_ptr<AudioSource> next,
+                     HotCue::SourceFactory factory, std::uint64_t preroll)
+    : next(std::move(next)),
+      factory(factory),
+      format(this->next->OutputSampleFormat()),
+      channels(this->next->ChannelCount()),
+      bytes_per_sample(this->next->BytesPerSample()),
+      cancel(false),
+      preroll_at_end(false),
+      position(0),
+      next_at(0),
+      next_ended(false),
+      started(false),
+      done(false),
+      cost(0)
+{
+	assert(this->next != nullptr);
+
+	// The scratch space is allocated once, up front, so mixing never
+	// allocates.
+	auto n = RAMP_BLOCK * this->channels;
+	this->out_buf.resize(n);
+	this->in_buf.resize(n);
+	this->out_gains.resize(n);
+	this->in_gains.resize(n);
+
+	if (preroll == 0) return;
+
+	this->thread = std::thread([this, preroll]() {
+		try {
+			this->Preroll(preroll);
+		} catch (Error &e) {
+			// Failing to preroll isn't fatal here; the fade just
+			// decodes what's missing, and fails there if it must.
+			Debug() << "crossfade preroll failed:" << e.Message()
+			        << std::endl;
+		}
+	});
+}
+
+Crossfade::~Crossfade()
+{
+	this->cancel = true;
+	this->WaitForPreroll();
+}
+
+void Crossfade::Preroll(std::uint64_t samples)
+{
+	auto bytes = samples * this->bytes_per_sample;
+	this->preroll.reserve(bytes);
+
+	// Unlike a hot cue, we keep any overshoot from the last frame: it is
+	// the start of what plays after the fade.
+	auto &frame = this->decoded;
+	while (this->preroll.size() < bytes && !this->cancel) {
+		auto state = this->next->DecodeInto(frame);
+		this->preroll.insert(this->preroll.end(), frame.begin(),
+		                     frame.end());
+		this->next_at = this->preroll.size() / this->bytes_per_sample;
+
+		if (state == AudioSource::DecodeState::END_OF_FILE) {
+			this->preroll_at_end = true;
+			this->next_ended = true;
+			break;
+		}
+	}
+}
+
+void Crossfade::WaitForPreroll()
+{
+	if (this->thread.joinable()) this->thread.join();
+}
+
+void Crossfade::Mix(AudioSource::DecodeVector &frame, std::uint64_t position,
+                    std::uint64_t fade_start, std::uint64_t length,
+                    CrossfadeCurve curve, bool ended)
+{
+	assert(!this->done);
+
+	auto bps = this->bytes_per_sample;
+	auto frame_end = position + frame.size() / bps;
+
+	// If we don't know where the fade starts, it starts at the very end.
+	auto max = std::numeric_limits<std::uint64_t>::max();
+	auto fade_end = fade_start < max - length ? fade_start + length : max;
+
+	// Anything after the fade is the incoming file's job.
+	if (fade_end < frame_end) {
+		auto keep = fade_end < position ? 0 : fade_end - position;
+		frame.resize(keep * bps);
+		frame_end = position + keep;
+	}
+
+	auto mix_from = std::max(position, fade_start);
+	if (mix_from < frame_end) {
+		this->started = true;
+
+		auto run = static_cast<std::size_t>(frame_end - mix_from);
+		auto offset = static_cast<std::size_t>(mix_from - position);
+		this->Fill(run * bps);
+
+		double step = 1.0 / static_cast<double>(std::max<std::uint64_t>(length, 1));
+		double from = static_cast<double>(mix_from - fade_start) * step;
+		this->MixRun(frame.data() + offset * bps, run, from, step, curve);
+
+		this->pending.erase(this->pending.begin(),
+		                    this->pending.begin() + run * bps);
+		this->position += run;
+	}
+
+	if (ended || fade_end <= frame_end) this->done = true;
+}
+
+void Crossfade::MixRun(std::uint8_t *out, std::size_t frames, double from,
+                       double step, CrossfadeCurve curve)
+{
+	auto fmt = this->format;
+	auto channels = this->channels;
+	auto bps = this->bytes_per_sample;
+	auto in = this->pending.data();
+
+	// Gains are worked out exactly at the edges of each block, and ramped
+	// linearly in between, so the per-sample work is a multiply-add.
+	for (std::size_t i = 0; i < frames; i += RAMP_BLOCK) {
+		auto block = std::min(RAMP_BLOCK, frames - i);
+		auto n = block * channels;
+
+		float out_from, in_from, out_to, in_to;
+		FadeGains(curve, from + step * i, out_from, in_from);
+		FadeGains(curve, from + step * (i + block), out_to, in_to);
+		Ramp(this->out_gains.data(), block, channels, out_from, out_to);
+		Ramp(this->in_gains.data(), block, channels, in_from, in_to);
+
+		SamplesToFloat(out + i * bps, fmt, n, this->out_buf.data());
+		SamplesToFloat(in + i * bps, fmt, n, this->in_buf.data());
+
+		auto o = this->out_buf.data();
+		auto x = this->in_buf.data();
+		auto go = this->out_gains.data();
+		auto gi = this->in_gains.data();
+		std::size_t j = 0;
+#ifdef PLAYD_HAVE_SSE2
+		for (; j + 4 <= n; j += 4) {
+			auto fo = _mm_mul_ps(_mm_loadu_ps(o + j),
+			                     _mm_loadu_ps(go + j));
+			auto fi = _mm_mul_ps(_mm_loadu_ps(x + j),
+			                     _mm_loadu_ps(gi + j));
+			_mm_storeu_ps(o + j, _mm_add_ps(fo, fi));
+		}
+#endif // PLAYD_HAVE_SSE2
+		for (; j < n; j++) {
+			o[j] = o[j] * go[j] + x[j] * gi[j];
+		}
+
+		SamplesFromFloat(o, n, fmt, out + i * bps);
+	}
+}
+
+void Crossfade::SeekNext(std::uint64_t samples)
+{
+	if (samples == this->next_at) return;
+
+	// Past the end of the file, there is nothing to seek to.
+	if (this->next_ended && this->next_at < samples) return;
+
+	this->next_at = this->next->Seek(samples);
+	this->next_ended = false;
+}
+
+void Crossfade::Fill(std::size_t bytes)
+{
+	if (bytes <= this->pending.size()) return;
+	this->WaitForPreroll();
+
+	auto bps = this->bytes_per_sample;
+
+	// Most of the time, the preroll holds everything we need.
+	auto from = this->position * bps + this->pending.size();
+	auto to = this->position * bps + bytes;
+	if (from < this->preroll.size()) {
+		auto end = std::min<std::uint64_t>(to, this->preroll.size());
+		this->pending.insert(this->pending.end(),
+		                     this->preroll.begin() + from,
+		                     this->preroll.begin() + end);
+		from = end;
+	}
+
+	// If the fade has grown since we prerolled, we decode the rest as we
+	// go.  After a restart, the decoder may be past where we need it.
+	if (this->pending.size() < bytes) this->SeekNext(from / bps);
+	while (this->pending.size() < bytes && !this->next_ended) {
+		auto &frame = this->decoded;
+		auto state = this->next->DecodeInto(frame);
+		this->pending.insert(this->pending.end(), frame.begin(),
+		                     frame.end());
+		this->next_at += frame.size() / bps;
+
+		this->next_ended = state == AudioSource::DecodeState::END_OF_FILE;
+	}
+
+	// If the incoming file is shorter than the fade, pad it out with
+	// silence.  Zero isn't silence for unsigned samples, so we ask the
+	// converter for it.
+	if (this->pending.size() < bytes) {
+		auto old = this->pending.size();
+		this->pending.resize(bytes);
+
+		float zero = 0.0f;
+		for (auto i = old; i < bytes; i += bps) {
+			SamplesFromFloat(&zero, 1, this->format,
+			                 this->pending.data() + i);
+		}
+	}
+}
+
+void Crossfade::Restart()
+{
+	// The preroll is still the start of the file, so there's nothing to
+	// seek yet; Fill() seeks if it ever needs the decoder again.
+	this->position = 0;
+	this->pending.clear();
+	this->started = false;
+	this->done = false;
+	this->cost = std::chrono::nanoseconds(0);
+}
+
+bool Crossfade::Started() const
+{
+	return this->started;
+}
+
+bool Crossfade::Done() const
+{
+	return this->done;
+}
+
+const std::string &Crossfade::NextPath() const
+{
+	return this->next->Path();
+}
+
+std::unique_ptr<AudioSource> Crossfade::TakeNext()
+{
+	assert(this->done);
+	this->WaitForPreroll();
+	return std::move(this->next);
+}
+
+const HotCue::SourceFactory &Crossfade::NextFactory() const
+{
+	return this->factory;
+}
+
+AudioSource::DecodeVector Crossfade::TakeLeftover()
+{
+	assert(this->done);
+	this->WaitForPreroll();
+
+	AudioSource::DecodeVector leftover;
+	leftover.swap(this->pending);
+
+	// Whatever of the preroll the fade didn't use plays next, and the
+	// decoder carries on from the end of it.
+	auto bps = this->bytes_per_sample;
+	auto from = this->position * bps + leftover.size();
+	if (from < this->preroll.size()) {
+		leftover.insert(leftover.end(), this->preroll.begin() + from,
+		                this->preroll.end());
+	}
+	this->SeekNext(this->position + leftover.size() / bps);
+
+	return leftover;
+}
+
+std::uint64_t Crossfade::Position() const
+{
+	return this->position;
+}
+
+void Crossfade::AddCost(std::chrono::nanoseconds time)
+{
+	this->cost += time;
+}
+
+std::chrono::nanoseconds Crossfade::Cost() const
+{
+	return this->cost;
+}
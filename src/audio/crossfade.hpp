@@ -0,0 +1,242 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Crossfade class.
+ * @see audio/crossfade.cpp
+ */
+
+#ifndef PLAYD_CROSSFADE_HPP
+#define PLAYD_CROSSFADE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_source.hpp"
+#include "hot_cue.hpp"
+
+/**
+ * The shape of the gain curves used when crossfading.
+ */
+enum class CrossfadeCurve : std::uint8_t {
+	LINEAR,     ///< Gains change linearly; quieter in the middle.
+	EQUAL_POWER ///< Gains follow a quarter-sine; constant power throughout.
+};
+
+/**
+ * How a crossfade into the next file should be carried out.
+ * Positions are measured in microseconds.
+ */
+struct CrossfadeSettings {
+	std::uint64_t length; ///< The length of the overlap.
+	CrossfadeCurve curve; ///< The shape of the fade.
+	bool has_start;       ///< Whether start is set.
+	std::uint64_t start;  ///< Where in the outgoing file the fade starts.
+};
+
+/**
+ * A pending crossfade from the file being played into the next one.
+ *
+ * The Crossfade owns the incoming AudioSource.  On construction, it starts
+ * decoding the opening of the incoming file, as long as the fade, in its
+ * own thread, as a HotCue prerolls; by the time the fade starts, that is
+ * usually done, so the two files decode at once rather than in turn.  As the
+ * outgoing file is decoded, each frame is passed through Mix(), which fades
+ * the outgoing audio out and mixes the incoming preroll in.  Once the fade
+ * is Done(), the incoming source can be taken over, along with any of the
+ * preroll left past the end of the fade.
+ *
+ * If the fade starts before the preroll is done, Mix() waits for it.  If the
+ * fade has grown longer than the preroll since, Mix() decodes the rest of
+ * it as it goes.
+ *
+ * Both sources must have the same sample format, rate and channel count.
+ */
+class Crossfade
+{
+public:
+	/**
+	 * Constructs a Crossfade, and starts prerolling in the background.
+	 * @param next The incoming AudioSource, which should be at its start.
+	 * @param factory The function used to open the incoming file again,
+	 *   for hot cue prerolls once it has taken over.
+	 * @param preroll The number of samples to decode ahead; normally the
+	 *   length of the fade.
+	 */
+	Crossfade(std::unique_ptr<AudioSource> next,
+	          HotCue::SourceFactory factory, std::uint64_t preroll);
+
+	/**
+	 * Destructs a Crossfade.
+	 * If the preroll is still being decoded, it is cancelled and joined.
+	 */
+	~Crossfade();
+
+	/// Deleted copy constructor.
+	Crossfade(const Crossfade &) = delete;
+
+	/// Deleted copy-assignment.
+	Crossfade &operator=(const Crossfade &) = delete;
+
+	/**
+	 * Mixes the incoming file into a frame of the outgoing file.
+	 *
+	 * Parts of the frame before the fade are left alone.  If the frame runs
+	 * past the end of the fade, it is cut short there, and the fade is
+	 * Done().
+	 *
+	 * @param frame The frame of outgoing audio, which is mixed in place.
+	 * @param position The position of the start of @a frame in the
+	 *   outgoing file, in samples.
+	 * @param fade_start The position in the outgoing file at which the
+	 *   fade starts, in samples.
+	 * @param length The length of the fade, in samples.
+	 * @param curve The shape of the fade.
+	 * @param ended Whether the outgoing file ends with this frame.  If so,
+	 *   the fade is Done() however far through it is.
+	 */
+	void Mix(AudioSource::DecodeVector &frame, std::uint64_t position,
+	         std::uint64_t fade_start, std::uint64_t length,
+	         CrossfadeCurve curve, bool ended);
+
+	/**
+	 * Sends the incoming file back to its start, undoing any mixing.
+	 * This is used when the outgoing file seeks.  The preroll still holds
+	 * the start of the incoming file, so nothing is decoded again; if the
+	 * incoming decoder went past the preroll, it only seeks back once the
+	 * fade gets there.
+	 */
+	void Restart();
+
+	/**
+	 * Whether any mixing has happened yet.
+	 * @return True if the fade has started; false otherwise.
+	 */
+	bool Started() const;
+
+	/**
+	 * Whether the fade has finished.
+	 * @return True if the incoming file is ready to take over.
+	 */
+	bool Done() const;
+
+	/**
+	 * The path of the incoming file.
+	 * This is safe to call while prerolling, unlike most of the incoming
+	 * source's methods.
+	 * @return The incoming file's path.
+	 */
+	const std::string &NextPath() const;
+
+	/**
+	 * Takes over the incoming source, once the fade is Done().
+	 * @return The incoming AudioSource.
+	 */
+	std::unique_ptr<AudioSource> TakeNext();
+
+	/**
+	 * The function used to open the incoming file again.
+	 * @return The incoming file's source factory.
+	 */
+	const HotCue::SourceFactory &NextFactory() const;
+
+	/**
+	 * Takes any incoming audio decoded past the end of the fade.
+	 * @return The leftover packed samples, which follow on from
+	 *   Position().
+	 */
+	AudioSource::DecodeVector TakeLeftover();
+
+	/**
+	 * The position in the incoming file just after the mixed-in audio.
+	 * @return The position, in samples.
+	 */
+	std::uint64_t Position() const;
+
+	/**
+	 * Records time spent on the crossfade.
+	 * @param time The time to add.
+	 */
+	void AddCost(std::chrono::nanoseconds time);
+
+	/**
+	 * The total time spent on the crossfade so far.
+	 * @return The time spent decoding and mixing during the fade.
+	 */
+	std::chrono::nanoseconds Cost() const;
+
+private:
+	/// The number of samples over which gains are linearly interpolated.
+	static const std::size_t RAMP_BLOCK;
+
+	std::unique_ptr<AudioSource> next; ///< The incoming source.
+	HotCue::SourceFactory factory;     ///< Opens the incoming file.
+
+	/// The incoming format, read before prerolling starts, as the source
+	/// can't be asked while it decodes.
+	SampleFormat format;
+	std::uint8_t channels;         ///< The incoming channel count.
+	std::size_t bytes_per_sample;  ///< The incoming sample size.
+
+	std::atomic<bool> cancel;          ///< Set to stop prerolling early.
+	std::thread thread;                ///< The preroll thread, if any.
+	AudioSource::DecodeVector preroll; ///< The opening of next.
+	bool preroll_at_end;               ///< Whether next ended in it.
+
+	AudioSource::DecodeVector pending; ///< Unmixed audio, after position.
+	AudioSource::DecodeVector decoded; ///< Scratch for next's frames.
+	std::uint64_t position;            ///< Incoming position of pending.
+	std::uint64_t next_at;             ///< Where next's decoder is.
+	bool next_ended;                   ///< Whether next has run out.
+	bool started;                      ///< Whether mixing has started.
+	bool done;                         ///< Whether the fade is over.
+	std::chrono::nanoseconds cost;     ///< Time spent on the fade.
+
+	std::vector<float> out_buf;   ///< Scratch for outgoing samples.
+	std::vector<float> in_buf;    ///< Scratch for incoming samples.
+	std::vector<float> out_gains; ///< Scratch for outgoing gains.
+	std::vector<float> in_gains;  ///< Scratch for incoming gains.
+
+	/**
+	 * Decodes the preroll.  Runs in the preroll thread.
+	 * @param samples The length of the preroll, in samples.
+	 */
+	void Preroll(std::uint64_t samples);
+
+	/// Waits for the preroll thread, if it is still running.
+	void WaitForPreroll();
+
+	/**
+	 * Seeks the incoming decoder, unless it is there already, or has run
+	 * out.
+	 * @param samples The position to seek to, in samples.
+	 */
+	void SeekNext(std::uint64_t samples);
+
+	/**
+	 * Takes audio from the preroll, then the incoming decoder, until
+	 * enough is pending.
+	 * If the incoming file runs out, the rest is silence.
+	 * @param bytes The number of bytes that must be pending.
+	 */
+	void Fill(std::size_t bytes);
+
+	/**
+	 * Mixes a run of samples, all of which lie within the fade.
+	 * @param out The packed outgoing samples, which are mixed in place.
+	 * @param frames The number of samples in the run.
+	 * @param from How far through the fade the run starts, from 0 to 1.
+	 * @param step How far through the fade each sample moves, from 0 to 1.
+	 * @param curve The shape of the fade.
+	 */
+	void MixRun(std::uint8_t *out, std::size_t frames, double from,
+	            double step, CrossfadeCurve curve);
+};
+
+#endif // PLAYD_CROSSFADE_HPP
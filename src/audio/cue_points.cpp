@@ -0,0 +1,376 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of silence analysis and the CueAnalysis class.
+ * @see audio/cue_points.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../errors.hpp"
+#include "../simd.hpp"
+#include "audio_source.hpp"
+#include "cue_points.hpp"
+#include "sample_formats.hpp"
+
+//
+// Threshold scanning
+//
+
+/// The number of mono samples examined in each pass of AnyLoud.
+static const std::size_t SCAN_CHUNK = 64;
+
+/**
+ * Does as much of AnyLoud as can be done with SIMD instructions.
+ * This version is for formats without a SIMD kernel, and does nothing.
+ * @see AnyLoud
+ * @param loud Set to true if any scanned mono sample is loud.
+ * @return The number of mono samples scanned.
+ */
+template <typename T, typename W, int BIAS>
+static std::size_t AnyLoudWide(const T *, std::size_t, W, bool &)
+{
+	return 0;
+}
+
+#ifdef PLAYD_HAVE_SSE2
+/// AnyLoudWide for 16-bit samples, eight at a time.
+template <>
+std::size_t AnyLoudWide<std::int16_t, int, 0>(const std::int16_t *s,
+                                              std::size_t n, int t,
+                                              bool &loud)
+{
+	if (INT16_MAX < t) return 0;
+
+	auto hi = _mm_set1_epi16(static_cast<std::int16_t>(t));
+	auto lo = _mm_set1_epi16(static_cast<std::int16_t>(-t));
+	auto hits = _mm_setzero_si128();
+
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		auto x = _mm_loadu_si128(
+		        reinterpret_cast<const __m128i *>(s + i));
+		hits = _mm_or_si128(hits, _mm_cmpgt_epi16(x, hi));
+		hits = _mm_or_si128(hits, _mm_cmpgt_epi16(lo, x));
+	}
+
+	loud |= _mm_movemask_epi8(hits) != 0;
+	return i;
+}
+
+/// AnyLoudWide for 32-bit samples, four at a time.
+template <>
+std::size_t AnyLoudWide<std::int32_t, std::int64_t, 0>(
+        const std::int32_t *s, std::size_t n, std::int64_t t, bool &loud)
+{
+	// A threshold above full scale can't be compared in 32 bits, but
+	// nothing is louder than it anyway.
+	if (INT32_MAX < t) return 0;
+
+	auto hi = _mm_set1_epi32(static_cast<std::int32_t>(t));
+	auto lo = _mm_set1_epi32(static_cast<std::int32_t>(-t));
+	auto hits = _mm_setzero_si128();
+
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		auto x = _mm_loadu_si128(
+		        reinterpret_cast<const __m128i *>(s + i));
+		hits = _mm_or_si128(hits, _mm_cmpgt_epi32(x, hi));
+		hits = _mm_or_si128(hits, _mm_cmpgt_epi32(lo, x));
+	}
+
+	loud |= _mm_movemask_epi8(hits) != 0;
+	return i;
+}
+
+/// AnyLoudWide for floating-point samples, four at a time.
+template <>
+std::size_t AnyLoudWide<float, float, 0>(const float *s, std::size_t n,
+                                         float t, bool &loud)
+{
+	auto hi = _mm_set1_ps(t);
+	auto lo = _mm_set1_ps(-t);
+	auto hits = _mm_setzero_ps();
+
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		auto x = _mm_loadu_ps(s + i);
+		hits = _mm_or_ps(hits, _mm_cmpgt_ps(x, hi));
+		hits = _mm_or_ps(hits, _mm_cmplt_ps(x, lo));
+	}
+
+	loud |= _mm_movemask_ps(hits) != 0;
+	return i;
+}
+#endif // PLAYD_HAVE_SSE2
+
+/**
+ * Checks whether any mono sample in a run is louder than a threshold.
+ *
+ * The common 16-bit, 32-bit and floating-point formats are scanned with
+ * SSE2 where available, without early exits; callers narrow down the exact
+ * position with IsLoud afterwards.
+ *
+ * @tparam T The type of one mono sample.
+ * @tparam W A signed type wide enough to hold any biased T.
+ * @tparam BIAS The value of T representing silence.
+ * @param s Pointer to the start of the run.
+ * @param n The number of mono samples in the run.
+ * @param t The threshold, in units of W.
+ * @return Whether any mono sample exceeds the threshold.
+ */
+template <typename T, typename W, int BIAS>
+static bool AnyLoud(const T *s, std::size_t n, W t)
+{
+	bool loud = false;
+	auto i = AnyLoudWide<T, W, BIAS>(s, n, t, loud);
+	for (; i < n; i++) {
+		W x = static_cast<W>(s[i]) - BIAS;
+		loud |= (x > t) | (x < -t);
+	}
+	return loud;
+}
+
+/**
+ * Checks whether one mono sample is louder than a threshold.
+ * @see AnyLoud
+ */
+template <typename T, typename W, int BIAS>
+static bool IsLoud(T s, W t)
+{
+	W x = static_cast<W>(s) - BIAS;
+	return (x > t) || (x < -t);
+}
+
+/**
+ * Finds the first and last loud mono samples in a run.
+ * @see FindAudible
+ */
+template <typename T, typename W, int BIAS>
+static bool FindLoud(const T *s, std::size_t n, W t, std::size_t &first,
+                     std::size_t &last)
+{
+	// Find the first chunk containing anything loud, then the first
+	// loud mono sample in that chunk.
+	std::size_t i = 0;
+	for (; i < n; i += SCAN_CHUNK) {
+		auto len = std::min(SCAN_CHUNK, n - i);
+		if (AnyLoud<T, W, BIAS>(s + i, len, t)) break;
+	}
+	if (n <= i) return false;
+	while (!IsLoud<T, W, BIAS>(s[i], t)) i++;
+	first = i;
+
+	// Now do the same thing backwards.  We know there's at least one loud
+	// mono sample, so this must terminate at or after first.
+	std::size_t j = n;
+	while (first < j) {
+		auto len = std::min(SCAN_CHUNK, j - first);
+		if (AnyLoud<T, W, BIAS>(s + j - len, len, t)) break;
+		j -= len;
+	}
+	do j--;
+	while (!IsLoud<T, W, BIAS>(s[j], t));
+	last = j;
+
+	return true;
+}
+
+/**
+ * FindLoud for packed 24-bit samples, which have no native C++ type.
+ * Nothing in playd currently decodes to 24-bit, so this is unoptimised.
+ * @see FindAudible
+ */
+static bool FindLoud24(const std::uint8_t *s, std::size_t n, std::int32_t t,
+                       std::size_t &first, std::size_t &last)
+{
+	bool found = false;
+	for (std::size_t i = 0; i < n; i++) {
+		// Shift into the top of an int32 to sign-extend.
+		auto u = static_cast<std::uint32_t>(s[3 * i]) << 8 |
+		         static_cast<std::uint32_t>(s[3 * i + 1]) << 16 |
+		         static_cast<std::uint32_t>(s[3 * i + 2]) << 24;
+		std::int32_t x = static_cast<std::int32_t>(u) / 256;
+		if (!IsLoud<std::int32_t, std::int32_t, 0>(x, t)) continue;
+
+		if (!found) first = i;
+		last = i;
+		found = true;
+	}
+	return found;
+}
+
+bool FindAudible(const std::uint8_t *begin, const std::uint8_t *end,
+                 SampleFormat fmt, std::uint8_t channels, double threshold,
+                 std::size_t &first, std::size_t &last)
+{
+	assert(begin <= end);
+	assert(0 < channels);
+
+	auto bps = SAMPLE_FORMAT_BPS[static_cast<int>(fmt)];
+	std::size_t n = (end - begin) / bps;
+
+	bool found = false;
+	switch (fmt) {
+		case SampleFormat::PACKED_UNSIGNED_INT_8:
+			found = FindLoud<std::uint8_t, int, 128>(
+			        begin, n, static_cast<int>(threshold * 127),
+			        first, last);
+			break;
+		case SampleFormat::PACKED_SIGNED_INT_8:
+			found = FindLoud<std::int8_t, int, 0>(
+			        reinterpret_cast<const std::int8_t *>(begin),
+			        n, static_cast<int>(threshold * 127), first,
+			        last);
+			break;
+		case SampleFormat::PACKED_SIGNED_INT_16:
+			found = FindLoud<std::int16_t, int, 0>(
+			        reinterpret_cast<const std::int16_t *>(begin),
+			        n, static_cast<int>(threshold * 32767), first,
+			        last);
+			break;
+		case SampleFormat::PACKED_SIGNED_INT_24:
+			found = FindLoud24(
+			        begin, n,
+			        static_cast<std::int32_t>(threshold * 8388607),
+			        first, last);
+			break;
+		case SampleFormat::PACKED_SIGNED_INT_32:
+			found = FindLoud<std::int32_t, std::int64_t, 0>(
+			        reinterpret_cast<const std::int32_t *>(begin),
+			        n, static_cast<std::int64_t>(threshold *
+			                                     2147483647.0),
+			        first, last);
+			break;
+		case SampleFormat::PACKED_FLOAT_32:
+			found = FindLoud<float, float, 0>(
+			        reinterpret_cast<const float *>(begin), n,
+			        static_cast<float>(threshold), first, last);
+			break;
+	}
+
+	// The scan works in mono samples; our callers want whole samples.
+	if (found) {
+		first /= channels;
+		last /= channels;
+	}
+	return found;
+}
+
+//
+// CueCache
+//
+
+bool CueCache::Find(const std::string &path, CuePoints &points) const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	auto i = this->points.find(path);
+	if (i == this->points.end()) return false;
+
+	points = i->second;
+	return true;
+}
+
+void CueCache::Add(const std::string &path, const CuePoints &points)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->points[path] = points;
+}
+
+//
+// CueAnalysis
+//
+
+CueAnalysis::CueAnalysis(const CuePoints &points)
+    : cancel(false), done(true), points(points)
+{
+}
+
+CueAnalysis::CueAnalysis(SourceFactory factory, double threshold,
+                         std::shared_ptr<CueCache> cache,
+                         const std::string &path)
+    : cancel(false), done(false), points{0, 0}
+{
+	assert(cache != nullptr);
+
+	this->thread = std::thread([this, factory, threshold, cache, path]() {
+		try {
+			auto source = factory();
+			auto points = CueAnalysis::Scan(*source, threshold,
+			                                this->cancel);
+			if (this->cancel) return;
+
+			cache->Add(path, points);
+			this->points = points;
+			this->done = true;
+		} catch (Error &e) {
+			// Failing to analyse a file isn't fatal; the cue
+			// points just never become available.
+			Debug() << "cue analysis failed:" << e.Message()
+			        << std::endl;
+		}
+	});
+}
+
+CueAnalysis::~CueAnalysis()
+{
+	this->cancel = true;
+	if (this->thread.joinable()) this->thread.join();
+}
+
+bool CueAnalysis::Ready() const
+{
+	return this->done;
+}
+
+const CuePoints &CueAnalysis::Points() const
+{
+	assert(this->Ready());
+	return this->points;
+}
+
+/* static */ CuePoints CueAnalysis::Scan(AudioSource &source,
+                                         double threshold,
+                                         const std::atomic<bool> &cancel)
+{
+	auto fmt = source.OutputSampleFormat();
+	auto channels = source.ChannelCount();
+	auto bytes_per_sample = source.BytesPerSample();
+
+	CuePoints points{0, 0};
+	bool heard = false;
+	std::uint64_t position = 0;
+
+	AudioSource::DecodeVector frame;
+	while (!cancel) {
+		auto state = source.DecodeInto(frame);
+		if (state == AudioSource::DecodeState::END_OF_FILE) break;
+
+		auto begin = frame.data();
+
+		std::size_t first = 0;
+		std::size_t last = 0;
+		if (FindAudible(begin, begin + frame.size(), fmt, channels,
+		                threshold, first, last)) {
+			if (!heard) points.in = position + first;
+			points.out = position + last + 1;
+			heard = true;
+		}
+
+		position += frame.size() / bytes_per_sample;
+	}
+
+	// A file that is silent throughout shouldn't be trimmed to nothing.
+	if (!heard) points = CuePoints{0, position};
+	return points;
+}
@@ -0,0 +1,160 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the CuePoints structure and the CueAnalysis class.
+ * @see audio/cue_points.cpp
+ */
+
+#ifndef PLAYD_CUE_POINTS_HPP
+#define PLAYD_CUE_POINTS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "audio_source.hpp"
+#include "sample_formats.hpp"
+
+/**
+ * The audible region of an audio file.
+ *
+ * Both points are measured in samples from the start of the file.
+ */
+struct CuePoints {
+	std::uint64_t in;  ///< The position of the first audible sample.
+	std::uint64_t out; ///< The position just after the last audible sample.
+};
+
+/**
+ * Finds the first and last audible samples in a block of packed samples.
+ *
+ * A sample is audible if any of its channels has a magnitude above
+ * @a threshold.  The block is scanned in fixed-size chunks, each checked
+ * as a whole (with SSE2, where available) before being searched sample by
+ * sample, so the common case of silent chunks stays cheap.
+ *
+ * @param begin Pointer to the start of the block.
+ * @param end Pointer to the end of the block.
+ * @param fmt The sample format of the block.
+ * @param channels The number of channels in each sample.
+ * @param threshold The silence threshold, as a fraction of full scale.
+ * @param first Set to the index of the first audible sample, if any.
+ * @param last Set to the index of the last audible sample, if any.
+ * @return True if the block contains any audible samples; false otherwise.
+ */
+bool FindAudible(const std::uint8_t *begin, const std::uint8_t *end,
+                 SampleFormat fmt, std::uint8_t channels, double threshold,
+                 std::size_t &first, std::size_t &last);
+
+/**
+ * A thread-safe cache of previously computed CuePoints, keyed by file path.
+ *
+ * This is shared between the AudioSystem and any running CueAnalysis, so
+ * that reloading a file does not trigger a second scan.
+ */
+class CueCache
+{
+public:
+	/**
+	 * Looks up the cue points for a file.
+	 * @param path The path of the file.
+	 * @param points Set to the cached cue points, if they exist.
+	 * @return True if the file's cue points were cached; false otherwise.
+	 */
+	bool Find(const std::string &path, CuePoints &points) const;
+
+	/**
+	 * Caches the cue points for a file.
+	 * @param path The path of the file.
+	 * @param points The file's cue points.
+	 */
+	void Add(const std::string &path, const CuePoints &points);
+
+private:
+	mutable std::mutex lock;                ///< Guards points.
+	std::map<std::string, CuePoints> points; ///< The cache proper.
+};
+
+/**
+ * A background analysis pass that finds the CuePoints of an audio file.
+ *
+ * CueAnalysis decodes the file on its own AudioSource, in its own thread, so
+ * that the audio being played is never touched.  The result may be polled
+ * with Ready() without blocking.
+ */
+class CueAnalysis
+{
+public:
+	/// Type of functions that open a fresh AudioSource for analysis.
+	using SourceFactory = std::function<std::unique_ptr<AudioSource>()>;
+
+	/**
+	 * Constructs a CueAnalysis that has already finished.
+	 * This is used when the cue points have been cached.
+	 * @param points The known cue points.
+	 */
+	explicit CueAnalysis(const CuePoints &points);
+
+	/**
+	 * Constructs a CueAnalysis and starts analysing in the background.
+	 * @param factory The function used to open the file for analysis.
+	 * @param threshold The silence threshold, as a fraction of full
+	 *   scale.
+	 * @param cache The cache into which the results will be placed.
+	 * @param path The path under which the results will be cached.
+	 */
+	CueAnalysis(SourceFactory factory, double threshold,
+	            std::shared_ptr<CueCache> cache, const std::string &path);
+
+	/**
+	 * Destructs a CueAnalysis.
+	 * If the analysis is still running, it is cancelled and joined.
+	 */
+	~CueAnalysis();
+
+	/// Deleted copy constructor.
+	CueAnalysis(const CueAnalysis &) = delete;
+
+	/// Deleted copy-assignment.
+	CueAnalysis &operator=(const CueAnalysis &) = delete;
+
+	/**
+	 * Checks whether the analysis has finished successfully.
+	 * This never blocks.
+	 * @return True if Points() may be called; false otherwise.
+	 */
+	bool Ready() const;
+
+	/**
+	 * Gets the analysed cue points.
+	 * @return The cue points.  Only valid if Ready() is true.
+	 */
+	const CuePoints &Points() const;
+
+	/**
+	 * Scans an entire AudioSource for its cue points.
+	 * If no sample is audible, the whole file is treated as audible.
+	 * @param source The source to scan, which should be at its start.
+	 * @param threshold The silence threshold, as a fraction of full
+	 *   scale.
+	 * @param cancel If this becomes true, the scan stops early.
+	 * @return The cue points of the source.
+	 */
+	static CuePoints Scan(AudioSource &source, double threshold,
+	                      const std::atomic<bool> &cancel);
+
+private:
+	std::atomic<bool> cancel; ///< Set to stop the analysis early.
+	std::atomic<bool> done;   ///< Set once points is valid.
+	CuePoints points;         ///< The analysed cue points.
+	std::thread thread;       ///< The analysis thread, if any.
+};
+
+#endif // PLAYD_CUE_POINTS_HPP
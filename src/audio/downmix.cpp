@@ -0,0 +1,315 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Downmix class.
+ * @see audio/downmix.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../simd.hpp"
+#include "downmix.hpp"
+
+/// The speakers that can appear in a channel layout.
+enum class Speaker : std::uint8_t {
+	FL,  ///< Front left.
+	FR,  ///< Front right.
+	FC,  ///< Front centre.
+	LFE, ///< Low-frequency effects.
+	BL,  ///< Back left.
+	BR,  ///< Back right.
+	BC,  ///< Back centre.
+	SL,  ///< Side left.
+	SR,  ///< Side right.
+	NONE ///< No speaker; pads out the layout table.
+};
+
+/// The speakers of each channel count, in channel order.
+static const Speaker LAYOUTS[Downmix::MAX_CHANNELS][Downmix::MAX_CHANNELS] = {
+	// Mono
+	{Speaker::FC, Speaker::NONE, Speaker::NONE, Speaker::NONE,
+	 Speaker::NONE, Speaker::NONE, Speaker::NONE, Speaker::NONE},
+	// Stereo
+	{Speaker::FL, Speaker::FR, Speaker::NONE, Speaker::NONE, Speaker::NONE,
+	 Speaker::NONE, Speaker::NONE, Speaker::NONE},
+	// 3.0
+	{Speaker::FL, Speaker::FR, Speaker::FC, Speaker::NONE, Speaker::NONE,
+	 Speaker::NONE, Speaker::NONE, Speaker::NONE},
+	// Quad
+	{Speaker::FL, Speaker::FR, Speaker::BL, Speaker::BR, Speaker::NONE,
+	 Speaker::NONE, Speaker::NONE, Speaker::NONE},
+	// 5.0
+	{Speaker::FL, Speaker::FR, Speaker::FC, Speaker::BL, Speaker::BR,
+	 Speaker::NONE, Speaker::NONE, Speaker::NONE},
+	// 5.1
+	{Speaker::FL, Speaker::FR, Speaker::FC, Speaker::LFE, Speaker::BL,
+	 Speaker::BR, Speaker::NONE, Speaker::NONE},
+	// 6.1
+	{Speaker::FL, Speaker::FR, Speaker::FC, Speaker::LFE, Speaker::BC,
+	 Speaker::SL, Speaker::SR, Speaker::NONE},
+	// 7.1
+	{Speaker::FL, Speaker::FR, Speaker::FC, Speaker::LFE, Speaker::BL,
+	 Speaker::BR, Speaker::SL, Speaker::SR}};
+
+/// -3dB, as a linear amplitude.
+static const double MINUS_3DB = 0.7071067811865476;
+
+/**
+ * Finds the channel of a speaker in a layout.
+ * @param channels The channel count of the layout.
+ * @param speaker The speaker to find.
+ * @return The channel, or -1 if the layout lacks the speaker.
+ */
+static int ChannelOf(std::uint8_t channels, Speaker speaker)
+{
+	auto &layout = LAYOUTS[channels - 1];
+	for (int c = 0; c < channels; c++) {
+		if (layout[c] == speaker) return c;
+	}
+	return -1;
+}
+
+/**
+ * Adds one input speaker's contribution to a column of the mixing matrix.
+ *
+ * Speakers the output has are passed straight through.  The rest are folded
+ * into their neighbours: we try each option in turn, and if the output has
+ * none of them, fold again from the last (which is always towards the
+ * front).
+ *
+ * @param speaker The speaker to place.
+ * @param gain The gain accumulated so far.
+ * @param gains The folding gains.
+ * @param out The output channel count.
+ * @param column Set to the gain of @a speaker in each output channel.
+ */
+static void Place(Speaker speaker, double gain, const DownmixGains &gains,
+                  std::uint8_t out, std::vector<double> &column)
+{
+	int c = ChannelOf(out, speaker);
+	if (0 <= c) {
+		column[c] += gain;
+		return;
+	}
+
+	/// A pair of speakers to fold into, with a gain for each.
+	struct Fold {
+		Speaker a;   ///< The first speaker.
+		Speaker b;   ///< The second speaker, or NONE.
+		double gain; ///< The gain into each speaker.
+	};
+	std::vector<Fold> folds;
+
+	double h = MINUS_3DB;
+	double s = gains.surround;
+	switch (speaker) {
+		case Speaker::FL:
+		case Speaker::FR:
+			folds = {{Speaker::FC, Speaker::NONE, h}};
+			break;
+		case Speaker::FC:
+			folds = {{Speaker::FL, Speaker::FR, gains.centre}};
+			break;
+		case Speaker::LFE:
+			folds = {{Speaker::FL, Speaker::FR, gains.lfe}};
+			break;
+		case Speaker::BL:
+			folds = {{Speaker::SL, Speaker::NONE, 1},
+			         {Speaker::FL, Speaker::NONE, s}};
+			break;
+		case Speaker::BR:
+			folds = {{Speaker::SR, Speaker::NONE, 1},
+			         {Speaker::FR, Speaker::NONE, s}};
+			break;
+		case Speaker::SL:
+			folds = {{Speaker::BL, Speaker::NONE, 1},
+			         {Speaker::FL, Speaker::NONE, s}};
+			break;
+		case Speaker::SR:
+			folds = {{Speaker::BR, Speaker::NONE, 1},
+			         {Speaker::FR, Speaker::NONE, s}};
+			break;
+		case Speaker::BC:
+			folds = {{Speaker::BL, Speaker::BR, h},
+			         {Speaker::SL, Speaker::SR, h},
+			         {Speaker::FL, Speaker::FR, s * h}};
+			break;
+		case Speaker::NONE:
+			return;
+	}
+
+	auto has = [out](Speaker sp) {
+		return sp == Speaker::NONE || 0 <= ChannelOf(out, sp);
+	};
+	auto fold = folds.end() - 1;
+	for (auto f = folds.begin(); f != folds.end(); f++) {
+		if (!has(f->a) || !has(f->b)) continue;
+		fold = f;
+		break;
+	}
+
+	Place(fold->a, gain * fold->gain, gains, out, column);
+	Place(fold->b, gain * fold->gain, gains, out, column);
+}
+
+/**
+ * Mixes packed samples, for any pair of channel counts.
+ * @see Downmix::Kernel
+ */
+static void MixAny(const float *matrix, std::uint8_t in, std::uint8_t out,
+                   const float *samples, std::size_t frames, float *mixed)
+{
+	for (std::size_t f = 0; f < frames; f++) {
+		const float *x = samples + f * in;
+		float *y = mixed + f * out;
+		for (std::uint8_t o = 0; o < out; o++) {
+			float sum = 0.0f;
+			for (std::uint8_t i = 0; i < in; i++) {
+				sum += matrix[o * in + i] * x[i];
+			}
+			y[o] = sum;
+		}
+	}
+}
+
+#ifdef PLAYD_HAVE_SSE2
+/**
+ * Does as much of MixFixed as can be done with SIMD instructions.
+ *
+ * Each vector holds four output samples: two stereo frames, or four mono
+ * ones.  For each input channel, that channel of the frames is spread
+ * across the lanes and multiplied by its gain into each output, so the
+ * sums come out in the same order as in the plain loop.
+ *
+ * @return The number of frames mixed.
+ * @see MixFixed
+ */
+template <std::uint8_t IN, std::uint8_t OUT>
+static std::size_t MixFixedWide(const float *m, const float *samples,
+                                std::size_t frames, float *mixed)
+{
+	static_assert(OUT == 1 || OUT == 2, "only mono and stereo are fixed");
+	const std::size_t step = 4 / OUT;
+
+	__m128 gains[IN];
+	for (std::uint8_t i = 0; i < IN; i++) {
+		float lanes[4];
+		for (int l = 0; l < 4; l++) lanes[l] = m[(l % OUT) * IN + i];
+		gains[i] = _mm_loadu_ps(lanes);
+	}
+
+	std::size_t f = 0;
+	for (; f + step <= frames; f += step) {
+		const float *x = samples + f * IN;
+		auto sum = _mm_setzero_ps();
+		for (std::uint8_t i = 0; i < IN; i++) {
+			__m128 v;
+			if (OUT == 2) {
+				v = _mm_shuffle_ps(_mm_set1_ps(x[i]),
+				                   _mm_set1_ps(x[IN + i]), 0);
+			} else {
+				v = _mm_set_ps(x[3 * IN + i], x[2 * IN + i],
+				               x[IN + i], x[i]);
+			}
+			sum = _mm_add_ps(sum, _mm_mul_ps(v, gains[i]));
+		}
+		_mm_storeu_ps(mixed + f * OUT, sum);
+	}
+	return f;
+}
+#else
+/**
+ * Does as much of MixFixed as can be done with SIMD instructions.
+ * Without SSE2, this does nothing.
+ * @return The number of frames mixed.
+ * @see MixFixed
+ */
+template <std::uint8_t IN, std::uint8_t OUT>
+static std::size_t MixFixedWide(const float *, const float *, std::size_t,
+                                float *)
+{
+	return 0;
+}
+#endif // PLAYD_HAVE_SSE2
+
+/**
+ * Mixes packed samples, for channel counts known at compile time.
+ * With SSE2, this mixes several frames at once; otherwise, and for any
+ * frames left over, it runs the same sums as MixAny with the channel
+ * counts fixed.
+ * @tparam IN The number of input channels.
+ * @tparam OUT The number of output channels.
+ * @see Downmix::Kernel
+ */
+template <std::uint8_t IN, std::uint8_t OUT>
+static void MixFixed(const float *matrix, std::uint8_t, std::uint8_t,
+                     const float *samples, std::size_t frames, float *mixed)
+{
+	float m[OUT * IN];
+	std::copy(matrix, matrix + OUT * IN, m);
+
+	auto f = MixFixedWide<IN, OUT>(m, samples, frames, mixed);
+
+	for (; f < frames; f++) {
+		for (std::uint8_t o = 0; o < OUT; o++) {
+			float sum = 0.0f;
+			for (std::uint8_t i = 0; i < IN; i++) {
+				sum += m[o * IN + i] * samples[f * IN + i];
+			}
+			mixed[f * OUT + o] = sum;
+		}
+	}
+}
+
+/// The specialised kernels for mono and stereo output, by input count.
+static const Downmix::Kernel FIXED_KERNELS[2][Downmix::MAX_CHANNELS] = {
+	{&MixFixed<1, 1>, &MixFixed<2, 1>, &MixFixed<3, 1>, &MixFixed<4, 1>,
+	 &MixFixed<5, 1>, &MixFixed<6, 1>, &MixFixed<7, 1>, &MixFixed<8, 1>},
+	{&MixFixed<1, 2>, &MixFixed<2, 2>, &MixFixed<3, 2>, &MixFixed<4, 2>,
+	 &MixFixed<5, 2>, &MixFixed<6, 2>, &MixFixed<7, 2>, &MixFixed<8, 2>}};
+
+/* static */ DownmixGains DownmixGains::Itu()
+{
+	return DownmixGains{MINUS_3DB, MINUS_3DB, 0.0};
+}
+
+/* static */ bool Downmix::CanMap(std::uint8_t in, std::uint8_t out)
+{
+	return 0 < in && in <= MAX_CHANNELS && 0 < out && out <= MAX_CHANNELS;
+}
+
+Downmix::Downmix(std::uint8_t in, std::uint8_t out,
+                 const DownmixGains &gains)
+    : in(in), out(out), matrix(in * out, 0.0f), kernel(&MixAny)
+{
+	assert(CanMap(in, out));
+
+	std::vector<double> column(out);
+	for (std::uint8_t i = 0; i < in; i++) {
+		std::fill(column.begin(), column.end(), 0.0);
+		Place(LAYOUTS[in - 1][i], 1.0, gains, out, column);
+
+		for (std::uint8_t o = 0; o < out; o++) {
+			this->matrix[o * in + i] = static_cast<float>(column[o]);
+		}
+	}
+
+	if (out <= 2) this->kernel = FIXED_KERNELS[out - 1][in - 1];
+}
+
+void Downmix::Run(const float *in, std::size_t frames, float *out) const
+{
+	this->kernel(this->matrix.data(), this->in, this->out, in, frames, out);
+}
+
+float Downmix::Coefficient(std::uint8_t out, std::uint8_t in) const
+{
+	assert(out < this->out && in < this->in);
+	return this->matrix[out * this->in + in];
+}
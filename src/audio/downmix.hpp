@@ -0,0 +1,97 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Downmix class.
+ * @see audio/downmix.cpp
+ */
+
+#ifndef PLAYD_DOWNMIX_HPP
+#define PLAYD_DOWNMIX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The gains used when folding speakers a device lacks into those it has.
+ * All gains are linear amplitudes.
+ */
+struct DownmixGains {
+	double centre;   ///< Gain of the centre, into left and right.
+	double surround; ///< Gain of the surrounds, into the front.
+	double lfe;      ///< Gain of the LFE, into the front.
+
+	/**
+	 * The ITU-R BS.775 downmix: centre and surrounds at -3dB, and the LFE
+	 * dropped.
+	 * @return The ITU gains.
+	 */
+	static DownmixGains Itu();
+};
+
+/**
+ * A mapping from one channel layout to another.
+ *
+ * Layouts are those of WAVE, FLAC and SDL: for example, 5.1 is front left,
+ * front right, centre, LFE, back left, back right.  Each speaker in the
+ * input either goes straight to the same speaker in the output, or is
+ * folded into its nearest neighbours using the DownmixGains.
+ *
+ * Mixing works on packed floating point samples.  The kernel is chosen
+ * when the Downmix is made; for mono and stereo output, it is specialised
+ * at compile time for the channel counts, and uses SSE2 where available.
+ */
+class Downmix
+{
+public:
+	/// The largest channel count with a known layout.
+	static const std::uint8_t MAX_CHANNELS = 8;
+
+	/**
+	 * Checks whether a Downmix can map between two channel counts.
+	 * @param in The number of input channels.
+	 * @param out The number of output channels.
+	 * @return True if both counts have known layouts.
+	 */
+	static bool CanMap(std::uint8_t in, std::uint8_t out);
+
+	/**
+	 * Constructs a Downmix.
+	 * @param in The number of input channels.
+	 * @param out The number of output channels.
+	 * @param gains The gains used when folding speakers.
+	 * @pre CanMap(in, out).
+	 */
+	Downmix(std::uint8_t in, std::uint8_t out, const DownmixGains &gains);
+
+	/**
+	 * Mixes a run of packed samples.
+	 * @param in The input samples, with the input channel count.
+	 * @param frames The number of (multi-channel) samples.
+	 * @param out The output samples, with the output channel count.
+	 */
+	void Run(const float *in, std::size_t frames, float *out) const;
+
+	/**
+	 * Finds how much of one input channel goes into one output channel.
+	 * @param out The output channel.
+	 * @param in The input channel.
+	 * @return The gain, as a linear amplitude.
+	 */
+	float Coefficient(std::uint8_t out, std::uint8_t in) const;
+
+	/// Type of mixing kernels.
+	using Kernel = void (*)(const float *matrix, std::uint8_t in,
+	                        std::uint8_t out, const float *samples,
+	                        std::size_t frames, float *mixed);
+
+private:
+	std::uint8_t in;           ///< The number of input channels.
+	std::uint8_t out;          ///< The number of output channels.
+	std::vector<float> matrix; ///< Gains, out-major: matrix[o * in + i].
+	Kernel kernel;             ///< The mixing kernel.
+};
+
+#endif // PLAYD_DOWNMIX_HPP
@@ -0,0 +1,478 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the DSP insert chain and its built-in processors.
+ * @see audio/dsp.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../simd.hpp"
+#include "audio_source.hpp"
+#include "dsp.hpp"
+#include "sample_convert.hpp"
+#include "sample_formats.hpp"
+
+/// Pi, which C++11 doesn't reliably provide.
+static const double PI = 3.14159265358979323846;
+
+/**
+ * Converts a level in decibels to a linear amplitude.
+ * @param db The level, in dB.
+ * @return The amplitude.
+ */
+static double FromDecibels(double db)
+{
+	return std::pow(10.0, db / 20.0);
+}
+
+/**
+ * Multiplies a run of samples by a gain that ramps linearly.
+ * With SSE2, this works on four samples at a time; every sample gets the
+ * same gain either way.
+ * @param samples The samples to scale, in place.
+ * @param frames The number of samples.
+ * @param from The gain at the first sample.
+ * @param to The gain just after the last sample.
+ */
+static void ApplyRamp(float *samples, std::size_t frames, float from,
+                      float to)
+{
+	float step = (to - from) / static_cast<float>(frames);
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	auto start = _mm_set1_ps(from);
+	auto steps = _mm_set1_ps(step);
+	auto lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	for (; i + 4 <= frames; i += 4) {
+		auto at = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lanes);
+		auto gain = _mm_add_ps(start, _mm_mul_ps(steps, at));
+		auto x = _mm_loadu_ps(samples + i);
+		_mm_storeu_ps(samples + i, _mm_mul_ps(x, gain));
+	}
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i < frames; i++) {
+		samples[i] *= from + step * static_cast<float>(i);
+	}
+}
+
+/**
+ * Finds the largest magnitude in a run of samples.
+ * With SSE2, this works on four samples at a time; NaNs are skipped
+ * either way.
+ * @param samples The samples to search.
+ * @param frames The number of samples.
+ * @param peak The largest magnitude found so far.
+ * @return The largest magnitude in the run, or @a peak if that is larger.
+ */
+static float FindPeak(const float *samples, std::size_t frames, float peak)
+{
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	// Clearing the sign bit takes the magnitude.  The accumulator goes
+	// second, so that _mm_max_ps keeps it when the sample is NaN.
+	auto magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	auto peaks = _mm_set1_ps(peak);
+	for (; i + 4 <= frames; i += 4) {
+		auto x = _mm_and_ps(_mm_loadu_ps(samples + i), magnitude);
+		peaks = _mm_max_ps(x, peaks);
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, peaks);
+	for (float lane : lanes) peak = std::max(peak, lane);
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i < frames; i++) {
+		peak = std::max(peak, std::fabs(samples[i]));
+	}
+	return peak;
+}
+
+/**
+ * Clamps a run of samples to within a ceiling of zero.
+ * With SSE2, this works on four samples at a time.
+ * @param samples The samples to clamp, in place.
+ * @param frames The number of samples.
+ * @param ceiling The largest magnitude allowed.
+ */
+static void ClampToCeiling(float *samples, std::size_t frames, float ceiling)
+{
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	// As with std::max below, a NaN sample clamps to the floor.
+	auto lo = _mm_set1_ps(-ceiling);
+	auto hi = _mm_set1_ps(ceiling);
+	for (; i + 4 <= frames; i += 4) {
+		auto x = _mm_max_ps(_mm_loadu_ps(samples + i), lo);
+		_mm_storeu_ps(samples + i, _mm_min_ps(x, hi));
+	}
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i < frames; i++) {
+		samples[i] = std::min(ceiling, std::max(-ceiling, samples[i]));
+	}
+}
+
+//
+// Processor
+//
+
+Processor::Processor(std::uint32_t rate, std::uint8_t channels)
+    : rate(rate), channels(channels)
+{
+	assert(0 < rate);
+	assert(0 < channels);
+}
+
+void Processor::Configure(const DspSettings &)
+{
+}
+
+//
+// GainProcessor
+//
+
+GainProcessor::GainProcessor(std::uint32_t rate, std::uint8_t channels)
+    : Processor(rate, channels), enabled(false), current(1.0f), target(1.0f)
+{
+}
+
+std::string GainProcessor::Name() const
+{
+	return "gain";
+}
+
+void GainProcessor::Configure(const DspSettings &settings)
+{
+	this->enabled = settings.has_gain;
+
+	// Disabling the gain is the same as ramping it back to unity.
+	auto target = static_cast<float>(FromDecibels(settings.gain));
+	this->target = this->enabled ? target : 1.0f;
+}
+
+bool GainProcessor::Enabled() const
+{
+	// Keep running while ramping back to unity, so disabling the gain
+	// doesn't click.
+	return this->enabled || this->current != this->target;
+}
+
+void GainProcessor::Process(float *const *planes, std::size_t frames)
+{
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		ApplyRamp(planes[c], frames, this->current, this->target);
+	}
+	this->current = this->target;
+}
+
+//
+// BiquadProcessor
+//
+
+BiquadProcessor::BiquadProcessor(std::uint32_t rate, std::uint8_t channels,
+                                 std::size_t band)
+    : Processor(rate, channels),
+      band(band),
+      enabled(false),
+      settings{false, 0, 0, 0},
+      b0(1),
+      b1(0),
+      b2(0),
+      a1(0),
+      a2(0),
+      state(2 * channels, 0.0)
+{
+	assert(band < DspSettings::EQ_BANDS);
+}
+
+std::string BiquadProcessor::Name() const
+{
+	return "eq" + std::to_string(this->band);
+}
+
+void BiquadProcessor::Configure(const DspSettings &settings)
+{
+	auto &eq = settings.eq[this->band];
+
+	// Turning a band on shouldn't ring with whatever was left in the
+	// filter when it was last turned off.
+	if (eq.enabled && !this->enabled) {
+		std::fill(this->state.begin(), this->state.end(), 0.0);
+	}
+	this->enabled = eq.enabled;
+	this->settings = eq;
+	if (!eq.enabled) return;
+
+	// Keep the filter stable: below Nyquist, and not infinitely narrow.
+	double nyquist = this->rate / 2.0;
+	double freq = std::min(std::max(eq.frequency, 1.0), 0.98 * nyquist);
+	double q = std::max(eq.q, 0.01);
+
+	double a = std::pow(10.0, eq.gain / 40.0);
+	double w0 = 2 * PI * freq / this->rate;
+	double alpha = std::sin(w0) / (2 * q);
+	double cos_w0 = std::cos(w0);
+
+	double a0 = 1 + alpha / a;
+	this->b0 = (1 + alpha * a) / a0;
+	this->b1 = (-2 * cos_w0) / a0;
+	this->b2 = (1 - alpha * a) / a0;
+	this->a1 = (-2 * cos_w0) / a0;
+	this->a2 = (1 - alpha / a) / a0;
+}
+
+bool BiquadProcessor::Enabled() const
+{
+	return this->enabled;
+}
+
+void BiquadProcessor::Process(float *const *planes, std::size_t frames)
+{
+	// Transposed direct form II, which behaves well in floating point.
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		float *x = planes[c];
+		double z1 = this->state[2 * c];
+		double z2 = this->state[2 * c + 1];
+
+		for (std::size_t i = 0; i < frames; i++) {
+			double in = x[i];
+			double out = this->b0 * in + z1;
+			z1 = this->b1 * in - this->a1 * out + z2;
+			z2 = this->b2 * in - this->a2 * out;
+			x[i] = static_cast<float>(out);
+		}
+
+		this->state[2 * c] = z1;
+		this->state[2 * c + 1] = z2;
+	}
+}
+
+//
+// LimiterProcessor
+//
+
+const double LimiterProcessor::ATTACK_SECONDS = 0.001;
+const double LimiterProcessor::RELEASE_SECONDS = 0.1;
+
+LimiterProcessor::LimiterProcessor(std::uint32_t rate, std::uint8_t channels)
+    : Processor(rate, channels), enabled(false), ceiling(1.0f), gain(1.0f)
+{
+}
+
+std::string LimiterProcessor::Name() const
+{
+	return "limiter";
+}
+
+void LimiterProcessor::Configure(const DspSettings &settings)
+{
+	if (settings.has_limiter && !this->enabled) this->gain = 1.0f;
+	this->enabled = settings.has_limiter;
+
+	// A ceiling above full scale would do nothing.
+	auto ceiling = FromDecibels(std::min(settings.ceiling, 0.0));
+	this->ceiling = static_cast<float>(ceiling);
+}
+
+bool LimiterProcessor::Enabled() const
+{
+	return this->enabled;
+}
+
+void LimiterProcessor::Process(float *const *planes, std::size_t frames)
+{
+	float peak = 0.0f;
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		peak = FindPeak(planes[c], frames, peak);
+	}
+	float allowed = this->ceiling < peak ? this->ceiling / peak : 1.0f;
+
+	// Recover exponentially towards unity, but never past what this
+	// block allows.
+	double blocks_per_release = RELEASE_SECONDS * this->rate / frames;
+	auto recovery =
+	        static_cast<float>(1.0 - std::exp(-1.0 / blocks_per_release));
+	float next = this->gain + (1.0f - this->gain) * recovery;
+	next = std::min(next, allowed);
+
+	// Attacking, the gain ramps down from where the last block left it,
+	// so that it doesn't jump at the block edge, reaching what the peak
+	// allows by the peak itself.  A peak too near the start of the block
+	// gets a short ramp anyway, and the clamp below takes its top off.
+	auto ramp = frames;
+	if (next < this->gain) {
+		ramp = this->PeakIndex(planes, frames, peak);
+		auto attack = static_cast<std::size_t>(ATTACK_SECONDS *
+		                                       this->rate);
+		ramp = std::min(frames, std::max(ramp, attack));
+	}
+
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		float *x = planes[c];
+
+		// Releasing, every gain in the ramp is at most next, which the
+		// block's peak allows.
+		ApplyRamp(x, ramp, this->gain, next);
+		ApplyRamp(x + ramp, frames - ramp, next, next);
+
+		// Rounding, or a short attack, can leave us over; clamp that
+		// away.
+		ClampToCeiling(x, frames, this->ceiling);
+	}
+	this->gain = next;
+}
+
+std::size_t LimiterProcessor::PeakIndex(const float *const *planes,
+                                        std::size_t frames, float peak) const
+{
+	for (std::size_t i = 0; i < frames; i++) {
+		for (std::uint8_t c = 0; c < this->channels; c++) {
+			if (std::fabs(planes[c][i]) == peak) return i;
+		}
+	}
+	return frames;
+}
+
+//
+// ProcessorChain
+//
+
+const std::size_t ProcessorChain::BLOCK = 256;
+
+ProcessorChain::ProcessorChain(std::uint32_t rate, std::uint8_t channels)
+    : rate(rate),
+      channels(channels),
+      packed(BLOCK * channels),
+      planes(channels, std::vector<float>(BLOCK)),
+      plane_ptrs(channels)
+{
+	for (std::uint8_t c = 0; c < channels; c++) {
+		this->plane_ptrs[c] = this->planes[c].data();
+	}
+}
+
+void ProcessorChain::AddBuiltins()
+{
+	auto rate = this->rate;
+	auto channels = this->channels;
+
+	this->Insert(std::unique_ptr<Processor>(
+	                     new GainProcessor(rate, channels)),
+	             this->Size());
+	for (std::size_t i = 0; i < DspSettings::EQ_BANDS; i++) {
+		this->Insert(std::unique_ptr<Processor>(
+		                     new BiquadProcessor(rate, channels, i)),
+		             this->Size());
+	}
+	this->Insert(std::unique_ptr<Processor>(
+	                     new LimiterProcessor(rate, channels)),
+	             this->Size());
+}
+
+void ProcessorChain::Insert(std::unique_ptr<Processor> processor,
+                            std::size_t index)
+{
+	assert(processor != nullptr);
+	assert(index <= this->Size());
+
+	this->processors.insert(this->processors.begin() + index,
+	                        std::move(processor));
+	this->costs.insert(this->costs.begin() + index,
+	                   std::chrono::nanoseconds(0));
+}
+
+std::size_t ProcessorChain::Size() const
+{
+	return this->processors.size();
+}
+
+void ProcessorChain::Configure(const DspSettings &settings)
+{
+	for (auto &processor : this->processors) {
+		processor->Configure(settings);
+	}
+}
+
+bool ProcessorChain::Enabled() const
+{
+	for (auto &processor : this->processors) {
+		if (processor->Enabled()) return true;
+	}
+	return false;
+}
+
+void ProcessorChain::Process(AudioSource::DecodeVector &frame,
+                             SampleFormat fmt)
+{
+	if (!this->Enabled()) return;
+
+	auto channels = this->channels;
+	auto bytes_per_sample =
+	        SAMPLE_FORMAT_BPS[static_cast<int>(fmt)] * channels;
+	auto frames = frame.size() / bytes_per_sample;
+
+	for (std::size_t done = 0; done < frames; done += BLOCK) {
+		auto block = std::min(BLOCK, frames - done);
+		auto data = frame.data() + done * bytes_per_sample;
+
+		// Unpack, then split the channels out into their planes.
+		auto packed = this->packed.data();
+		SamplesToFloat(data, fmt, block * channels, packed);
+		for (std::uint8_t c = 0; c < channels; c++) {
+			auto plane = this->plane_ptrs[c];
+			for (std::size_t i = 0; i < block; i++) {
+				plane[i] = packed[i * channels + c];
+			}
+		}
+
+		this->ProcessBlock(block);
+
+		for (std::uint8_t c = 0; c < channels; c++) {
+			auto plane = this->plane_ptrs[c];
+			for (std::size_t i = 0; i < block; i++) {
+				packed[i * channels + c] = plane[i];
+			}
+		}
+		SamplesFromFloat(packed, block * channels, fmt, data);
+	}
+}
+
+void ProcessorChain::ProcessBlock(std::size_t frames)
+{
+	auto planes = this->plane_ptrs.data();
+	for (std::size_t i = 0; i < this->processors.size(); i++) {
+		auto &processor = this->processors[i];
+		if (!processor->Enabled()) continue;
+
+		auto begin = std::chrono::steady_clock::now();
+		processor->Process(planes, frames);
+		auto end = std::chrono::steady_clock::now();
+		this->costs[i] += end - begin;
+	}
+}
+
+bool ProcessorChain::Cost(const std::string &name,
+                          std::chrono::nanoseconds &cost) const
+{
+	for (std::size_t i = 0; i < this->processors.size(); i++) {
+		if (this->processors[i]->Name() != name) continue;
+		cost = this->costs[i];
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,294 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the DSP insert chain and its built-in processors.
+ * @see audio/dsp.cpp
+ */
+
+#ifndef PLAYD_DSP_HPP
+#define PLAYD_DSP_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_source.hpp"
+#include "sample_formats.hpp"
+
+/**
+ * The settings of one band of the built-in parametric EQ.
+ */
+struct EqBand {
+	bool enabled;     ///< Whether the band is in use.
+	double frequency; ///< The centre frequency, in Hz.
+	double gain;      ///< The boost (or cut, if negative), in dB.
+	double q;         ///< The width of the band; higher is narrower.
+};
+
+/**
+ * The settings of the built-in processors in a ProcessorChain.
+ * Value-initialising a DspSettings turns every processor off.
+ */
+struct DspSettings {
+	/// The number of bands in the built-in EQ.
+	static const std::size_t EQ_BANDS = 4;
+
+	bool has_gain;       ///< Whether the gain stage is in use.
+	double gain;         ///< The gain, in dB.
+	EqBand eq[EQ_BANDS]; ///< The bands of the EQ.
+	bool has_limiter;    ///< Whether the limiter is in use.
+	double ceiling;      ///< The limiter's ceiling, in dBFS.
+};
+
+/**
+ * A stage of audio processing in a ProcessorChain.
+ *
+ * Processors work on blocks of floating point samples, one array per
+ * channel.  They are told the sample rate and channel count up front, and
+ * should allocate any state they need then: Process is called on the audio
+ * path, and shouldn't allocate.
+ */
+class Processor
+{
+public:
+	/**
+	 * Constructs a Processor.
+	 * @param rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels in the audio.
+	 */
+	Processor(std::uint32_t rate, std::uint8_t channels);
+
+	/// Virtual, empty destructor for Processor.
+	virtual ~Processor() = default;
+
+	/**
+	 * The name of this Processor, used in its cost resource.
+	 * @return The name, which should be unique within its chain.
+	 */
+	virtual std::string Name() const = 0;
+
+	/**
+	 * Picks out this Processor's settings.
+	 * Processors with no built-in settings ignore this.
+	 * @param settings The settings of the chain.
+	 */
+	virtual void Configure(const DspSettings &settings);
+
+	/**
+	 * Whether this Processor currently does anything.
+	 * Disabled processors are skipped, and cost nothing.
+	 * @return True if enabled; false otherwise.
+	 */
+	virtual bool Enabled() const = 0;
+
+	/**
+	 * Processes a block of audio in place.
+	 * @param planes One array of samples per channel.
+	 * @param frames The number of samples in each array.  This is never
+	 *   more than ProcessorChain::BLOCK.
+	 */
+	virtual void Process(float *const *planes, std::size_t frames) = 0;
+
+protected:
+	std::uint32_t rate;    ///< The sample rate, in Hz.
+	std::uint8_t channels; ///< The number of channels.
+};
+
+/**
+ * A Processor applying a fixed gain.
+ * Changes in gain are ramped over one block, to avoid zipper noise.
+ */
+class GainProcessor : public Processor
+{
+public:
+	/// @copydoc Processor::Processor
+	GainProcessor(std::uint32_t rate, std::uint8_t channels);
+
+	std::string Name() const override;
+	void Configure(const DspSettings &settings) override;
+	bool Enabled() const override;
+	void Process(float *const *planes, std::size_t frames) override;
+
+private:
+	bool enabled;  ///< Whether the gain is in use.
+	float current; ///< The linear gain at the end of the last block.
+	float target;  ///< The linear gain being ramped towards.
+};
+
+/**
+ * A Processor implementing one peaking band of a parametric EQ.
+ * This is a biquad filter, using the coefficients from Robert
+ * Bristow-Johnson's 'Audio EQ Cookbook'.
+ */
+class BiquadProcessor : public Processor
+{
+public:
+	/**
+	 * Constructs a BiquadProcessor.
+	 * @param rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels in the audio.
+	 * @param band The index of the band in DspSettings::eq.
+	 */
+	BiquadProcessor(std::uint32_t rate, std::uint8_t channels,
+	                std::size_t band);
+
+	std::string Name() const override;
+	void Configure(const DspSettings &settings) override;
+	bool Enabled() const override;
+	void Process(float *const *planes, std::size_t frames) override;
+
+private:
+	std::size_t band; ///< The index of the band in DspSettings::eq.
+	bool enabled;     ///< Whether the band is in use.
+	EqBand settings;  ///< The settings the coefficients were made from.
+
+	double b0; ///< Feed-forward coefficient for x[n].
+	double b1; ///< Feed-forward coefficient for x[n-1].
+	double b2; ///< Feed-forward coefficient for x[n-2].
+	double a1; ///< Feedback coefficient for y[n-1].
+	double a2; ///< Feedback coefficient for y[n-2].
+
+	/// The filter state, two values per channel.
+	std::vector<double> state;
+};
+
+/**
+ * A Processor keeping peaks under a ceiling.
+ *
+ * The limiter finds the peak of each block across all channels.  If the
+ * block would exceed the ceiling, the gain ramps down within the block, so
+ * that it has come down far enough by the peak; the gain never jumps at a
+ * block edge.  The gain then recovers smoothly over the release time.  Any
+ * sample still over the ceiling, because its peak came too early in the
+ * block for a smooth ramp, is clamped, so nothing gets through above it.
+ */
+class LimiterProcessor : public Processor
+{
+public:
+	/// @copydoc Processor::Processor
+	LimiterProcessor(std::uint32_t rate, std::uint8_t channels);
+
+	std::string Name() const override;
+	void Configure(const DspSettings &settings) override;
+	bool Enabled() const override;
+	void Process(float *const *planes, std::size_t frames) override;
+
+private:
+	/// The shortest time over which the gain comes down, in seconds.
+	static const double ATTACK_SECONDS;
+
+	/// The time the gain takes to mostly recover, in seconds.
+	static const double RELEASE_SECONDS;
+
+	bool enabled;  ///< Whether the limiter is in use.
+	float ceiling; ///< The ceiling, as a linear amplitude.
+	float gain;    ///< The gain applied at the end of the last block.
+
+	/**
+	 * Finds where a block first reaches its peak, on any channel.
+	 * @param planes The samples of each channel.
+	 * @param frames The number of samples in each channel.
+	 * @param peak The largest magnitude in the block.
+	 * @return The index of the first sample at the peak.
+	 */
+	std::size_t PeakIndex(const float *const *planes, std::size_t frames,
+	                      float peak) const;
+};
+
+/**
+ * An ordered chain of Processors, run over packed audio.
+ *
+ * The chain converts each frame into planar floating point in blocks of
+ * BLOCK samples, runs every enabled Processor over each block, and converts
+ * the block back.  The time each Processor spends is accounted separately.
+ *
+ * All scratch space is allocated on construction.
+ */
+class ProcessorChain
+{
+public:
+	/// The largest number of samples passed to Processor::Process.
+	static const std::size_t BLOCK;
+
+	/**
+	 * Constructs an empty ProcessorChain.
+	 * @param rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels in the audio.
+	 */
+	ProcessorChain(std::uint32_t rate, std::uint8_t channels);
+
+	/**
+	 * Adds the built-in gain, EQ and limiter Processors, in that order.
+	 * They start off disabled.
+	 */
+	void AddBuiltins();
+
+	/**
+	 * Inserts a Processor into the chain.
+	 * @param processor The Processor to insert.  It must have been
+	 *   constructed with the chain's rate and channel count.
+	 * @param index The position at which to insert it.  Processors at or
+	 *   after this position move down one.
+	 */
+	void Insert(std::unique_ptr<Processor> processor, std::size_t index);
+
+	/**
+	 * The number of Processors in the chain.
+	 * @return The number of Processors, enabled or not.
+	 */
+	std::size_t Size() const;
+
+	/**
+	 * Passes settings on to every Processor in the chain.
+	 * @param settings The new settings.
+	 */
+	void Configure(const DspSettings &settings);
+
+	/**
+	 * Whether any Processor in the chain is enabled.
+	 * @return True if Process would change anything.
+	 */
+	bool Enabled() const;
+
+	/**
+	 * Runs the chain over a frame of packed audio, in place.
+	 * @param frame The frame to process.
+	 * @param fmt The sample format of @a frame.
+	 */
+	void Process(AudioSource::DecodeVector &frame, SampleFormat fmt);
+
+	/**
+	 * Finds the time a Processor has spent processing.
+	 * @param name The name of the Processor.
+	 * @param cost Set to the total time the Processor has spent.
+	 * @return True if a Processor called @a name is in the chain.
+	 */
+	bool Cost(const std::string &name,
+	          std::chrono::nanoseconds &cost) const;
+
+private:
+	std::uint32_t rate;    ///< The sample rate, in Hz.
+	std::uint8_t channels; ///< The number of channels.
+
+	/// The Processors, in the order they run.
+	std::vector<std::unique_ptr<Processor>> processors;
+
+	/// The time each Processor has spent, indexed as processors.
+	std::vector<std::chrono::nanoseconds> costs;
+
+	std::vector<float> packed;              ///< Scratch packed samples.
+	std::vector<std::vector<float>> planes; ///< Scratch planar samples.
+	std::vector<float *> plane_ptrs;        ///< Pointers into planes.
+
+	/**
+	 * Runs the enabled Processors over one block.
+	 * @param frames The number of samples in the block.
+	 */
+	void ProcessBlock(std::size_t frames);
+};
+
+#endif // PLAYD_DSP_HPP
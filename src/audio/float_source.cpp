@@ -0,0 +1,65 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the FloatAudioSource class.
+ * @see audio/float_source.hpp
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "audio_source.hpp"
+#include "float_source.hpp"
+#include "sample_convert.hpp"
+#include "sample_formats.hpp"
+
+FloatAudioSource::FloatAudioSource(std::unique_ptr<AudioSource> inner)
+    : AudioSource(inner->Path()),
+      inner(std::move(inner)),
+      inner_format(this->inner->OutputSampleFormat()),
+      convert(ToFloatKernel(this->inner_format))
+{
+	assert(this->convert != nullptr);
+}
+
+AudioSource::DecodeState FloatAudioSource::DecodeInto(DecodeVector &frame)
+{
+	// Some decoders give us floats already.
+	if (this->inner_format == SampleFormat::PACKED_FLOAT_32) {
+		return this->inner->DecodeInto(frame);
+	}
+
+	auto &in = this->decoded;
+	auto state = this->inner->DecodeInto(in);
+	auto count = in.size() / SAMPLE_FORMAT_BPS[static_cast<int>(
+	                                 this->inner_format)];
+
+	frame.resize(count * sizeof(float));
+	this->convert(in.data(), count,
+	              reinterpret_cast<float *>(frame.data()));
+	return state;
+}
+
+std::uint8_t FloatAudioSource::ChannelCount() const
+{
+	return this->inner->ChannelCount();
+}
+
+std::uint32_t FloatAudioSource::SampleRate() const
+{
+	return this->inner->SampleRate();
+}
+
+SampleFormat FloatAudioSource::OutputSampleFormat() const
+{
+	return SampleFormat::PACKED_FLOAT_32;
+}
+
+std::uint64_t FloatAudioSource::Seek(std::uint64_t position)
+{
+	return this->inner->Seek(position);
+}
@@ -0,0 +1,52 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the FloatAudioSource class.
+ * @see audio/float_source.cpp
+ */
+
+#ifndef PLAYD_FLOAT_SOURCE_HPP
+#define PLAYD_FLOAT_SOURCE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "audio_source.hpp"
+#include "sample_convert.hpp"
+#include "sample_formats.hpp"
+
+/**
+ * An AudioSource converting another AudioSource's output to floating point.
+ *
+ * In the float pipeline, every decoder is wrapped in one of these, so the
+ * rest of playd only ever sees 32-bit floating point samples, whatever the
+ * file.  The conversion kernel is chosen once, when the file is opened.
+ *
+ * @see AudioSystem::SetFloatPipeline
+ */
+class FloatAudioSource : public AudioSource
+{
+public:
+	/**
+	 * Constructs a FloatAudioSource.
+	 * @param inner The AudioSource to convert.
+	 */
+	FloatAudioSource(std::unique_ptr<AudioSource> inner);
+
+	DecodeState DecodeInto(DecodeVector &frame) override;
+	std::uint8_t ChannelCount() const override;
+	std::uint32_t SampleRate() const override;
+	SampleFormat OutputSampleFormat() const override;
+	std::uint64_t Seek(std::uint64_t position) override;
+
+private:
+	std::unique_ptr<AudioSource> inner; ///< The converted AudioSource.
+	SampleFormat inner_format;          ///< The format of inner.
+	ToFloatFn convert;                  ///< Converts from inner_format.
+	DecodeVector decoded;               ///< Scratch for inner's frames.
+};
+
+#endif // PLAYD_FLOAT_SOURCE_HPP
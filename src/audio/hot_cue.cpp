@@ -0,0 +1,106 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the HotCue class.
+ * @see audio/hot_cue.hpp
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "../errors.hpp"
+#include "audio_source.hpp"
+#include "hot_cue.hpp"
+
+HotCue::HotCue(SourceFactory factory, std::uint64_t position,
+               std::uint64_t length)
+    : position(position),
+      cancel(false),
+      done(false),
+      start(position),
+      at_end(false)
+{
+	if (!factory) return;
+
+	this->thread = std::thread([this, factory, length]() {
+		try {
+			auto source = factory();
+			this->Decode(*source, length);
+		} catch (Error &e) {
+			// Failing to preroll isn't fatal; seeks to the cue
+			// just go through the decoder as usual.
+			Debug() << "hot cue preroll failed:" << e.Message()
+			        << std::endl;
+		}
+	});
+}
+
+HotCue::~HotCue()
+{
+	this->cancel = true;
+	if (this->thread.joinable()) this->thread.join();
+}
+
+std::uint64_t HotCue::Position() const
+{
+	return this->position;
+}
+
+bool HotCue::Ready() const
+{
+	return this->done;
+}
+
+std::uint64_t HotCue::Start() const
+{
+	assert(this->Ready());
+	return this->start;
+}
+
+const AudioSource::DecodeVector &HotCue::Preroll() const
+{
+	assert(this->Ready());
+	return this->preroll;
+}
+
+bool HotCue::AtEnd() const
+{
+	assert(this->Ready());
+	return this->at_end;
+}
+
+void HotCue::Decode(AudioSource &source, std::uint64_t length)
+{
+	this->start = source.Seek(this->position);
+
+	auto bytes = length * source.BytesPerSample();
+	this->preroll.reserve(bytes);
+
+	AudioSource::DecodeVector frame;
+	while (this->preroll.size() < bytes) {
+		if (this->cancel) return;
+
+		auto state = source.DecodeInto(frame);
+		this->preroll.insert(this->preroll.end(), frame.begin(),
+		                     frame.end());
+
+		if (state == AudioSource::DecodeState::END_OF_FILE) {
+			this->at_end = true;
+			break;
+		}
+	}
+
+	// The last frame probably overshot the preroll length, in which case
+	// there is more audio after the preroll even if that frame was the
+	// file's last.
+	if (bytes < this->preroll.size()) {
+		this->preroll.resize(bytes);
+		this->at_end = false;
+	}
+	this->done = true;
+}
@@ -0,0 +1,108 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the HotCue class.
+ * @see audio/hot_cue.cpp
+ */
+
+#ifndef PLAYD_HOT_CUE_HPP
+#define PLAYD_HOT_CUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "audio_source.hpp"
+
+/**
+ * A registered jump point in an audio file, with a preroll of decoded audio.
+ *
+ * On construction, a HotCue opens its own AudioSource and decodes a short
+ * stretch of audio starting at the cue, in its own thread.  Once Ready(), a
+ * seek to the cue can start playing from the preroll straight away, leaving
+ * the main decoder to seek to the end of the preroll in the background.
+ */
+class HotCue
+{
+public:
+	/// Type of functions that open a fresh AudioSource for prerolling.
+	using SourceFactory = std::function<std::unique_ptr<AudioSource>()>;
+
+	/**
+	 * Constructs a HotCue and starts prerolling in the background.
+	 * @param factory The function used to open the file for prerolling.
+	 *   If empty, the HotCue is registered but never becomes Ready().
+	 * @param position The position of the cue, in samples.
+	 * @param length The length of the preroll, in samples.
+	 */
+	HotCue(SourceFactory factory, std::uint64_t position,
+	       std::uint64_t length);
+
+	/**
+	 * Destructs a HotCue.
+	 * If the preroll is still being decoded, it is cancelled and joined.
+	 */
+	~HotCue();
+
+	/// Deleted copy constructor.
+	HotCue(const HotCue &) = delete;
+
+	/// Deleted copy-assignment.
+	HotCue &operator=(const HotCue &) = delete;
+
+	/**
+	 * The position at which the cue was registered.
+	 * @return The cue position, in samples.
+	 */
+	std::uint64_t Position() const;
+
+	/**
+	 * Checks whether the preroll has been decoded.
+	 * This never blocks.
+	 * @return True if Start(), Preroll() and AtEnd() may be called; false
+	 *   otherwise.
+	 */
+	bool Ready() const;
+
+	/**
+	 * The position at which the preroll actually starts.
+	 * Decoders can't always seek sample-accurately, so this may differ
+	 * slightly from Position().
+	 * @return The preroll's start position, in samples.
+	 */
+	std::uint64_t Start() const;
+
+	/**
+	 * The decoded preroll.
+	 * @return The preroll's packed samples.
+	 */
+	const AudioSource::DecodeVector &Preroll() const;
+
+	/**
+	 * Whether the file ended during the preroll.
+	 * @return True if there is no audio after the preroll; false otherwise.
+	 */
+	bool AtEnd() const;
+
+private:
+	std::uint64_t position;           ///< The cue position.
+	std::atomic<bool> cancel;         ///< Set to stop prerolling early.
+	std::atomic<bool> done;           ///< Set once the preroll is valid.
+	std::uint64_t start;              ///< The preroll's start position.
+	AudioSource::DecodeVector preroll; ///< The decoded preroll.
+	bool at_end;                      ///< Whether the file ended early.
+	std::thread thread;               ///< The preroll thread, if any.
+
+	/**
+	 * Decodes the preroll.  Runs in the preroll thread.
+	 * @param source The source to decode from.
+	 * @param length The length of the preroll, in samples.
+	 */
+	void Decode(AudioSource &source, std::uint64_t length);
+};
+
+#endif // PLAYD_HOT_CUE_HPP
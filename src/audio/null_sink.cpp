@@ -0,0 +1,259 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the NullAudioSink and FileAudioSink classes.
+ * @see audio/null_sink.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "../errors.hpp"
+#include "../metrics.hpp"
+#include "../trace.hpp"
+#include "audio.hpp"
+#include "audio_sink.hpp"
+#include "audio_source.hpp"
+#include "null_sink.hpp"
+
+//
+// NullAudioSink
+//
+
+// This matches the ring buffer of an SdlAudioSink.
+const std::uint64_t NullAudioSink::CAPACITY = 1 << 16;
+
+/* static */ std::unique_ptr<AudioSink> NullAudioSink::Build(
+        const AudioSource &source, int)
+{
+	return std::unique_ptr<AudioSink>(new NullAudioSink(source));
+}
+
+NullAudioSink::NullAudioSink(const AudioSource &source)
+    : sample_rate(source.SampleRate()),
+      bytes_per_sample(source.BytesPerSample()),
+      format(source.OutputSampleFormat()),
+      position_sample_count(0),
+      written_sample_count(0),
+      played_at(Clock::now()),
+      source_out(false),
+      starved(false),
+      state(Audio::State::STOPPED),
+      audible_count(0)
+{
+	assert(0 < this->sample_rate);
+	assert(0 < this->bytes_per_sample);
+	Metrics::Get().ring_size = CAPACITY;
+}
+
+void NullAudioSink::Start()
+{
+	if (this->state != Audio::State::STOPPED) return;
+
+	this->played_at = Clock::now();
+	this->state = Audio::State::PLAYING;
+}
+
+void NullAudioSink::Stop()
+{
+	if (this->state == Audio::State::STOPPED) return;
+
+	this->CatchUp();
+	this->state = Audio::State::STOPPED;
+}
+
+Audio::State NullAudioSink::State()
+{
+	this->CatchUp();
+	return this->state;
+}
+
+std::uint64_t NullAudioSink::Position()
+{
+	this->CatchUp();
+	return this->position_sample_count;
+}
+
+void NullAudioSink::SetPosition(std::uint64_t samples)
+{
+	this->position_sample_count = samples;
+	this->written_sample_count = samples;
+	this->played_at = Clock::now();
+	this->audible_count = 0;
+
+	this->source_out = false;
+	if (this->state == Audio::State::AT_END) {
+		this->state = Audio::State::STOPPED;
+	}
+}
+
+bool NullAudioSink::SkipTo(std::uint64_t samples)
+{
+	if (samples > this->written_sample_count) return false;
+
+	this->CatchUp();
+	if (samples < this->position_sample_count) return false;
+
+	this->position_sample_count = samples;
+	this->ForgetAudible(samples);
+	return true;
+}
+
+void NullAudioSink::SourceOut()
+{
+	this->source_out = true;
+}
+
+void NullAudioSink::Transfer(AudioSink::TransferIterator &start,
+                             const AudioSink::TransferIterator &end)
+{
+	TraceSpan span("NullAudioSink::Transfer");
+	assert(start <= end);
+
+	if (start == end) return;
+
+	auto bytes = static_cast<std::size_t>(std::distance(start, end));
+	assert(bytes % this->bytes_per_sample == 0);
+
+	this->CatchUp();
+	auto held = this->written_sample_count - this->position_sample_count;
+	auto count = std::min<std::uint64_t>(bytes / this->bytes_per_sample,
+	                                     CAPACITY - held);
+	if (count == 0) return;
+
+	auto count_bytes = static_cast<std::size_t>(count) *
+	                   this->bytes_per_sample;
+	auto bytes_start = reinterpret_cast<const char *>(&*start);
+	this->NoteAudible(bytes_start, this->written_sample_count,
+	                  static_cast<std::size_t>(count));
+	this->Consume(bytes_start, count_bytes);
+
+	start += count_bytes;
+	assert(start <= end);
+
+	this->written_sample_count += count;
+	this->starved = false;
+}
+
+void NullAudioSink::Consume(const char *, std::size_t)
+{
+}
+
+void NullAudioSink::CatchUp()
+{
+	if (this->state != Audio::State::PLAYING) return;
+
+	auto now = Clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                       now - this->played_at)
+	                       .count();
+	auto due = static_cast<std::uint64_t>(elapsed) * this->sample_rate /
+	           1000000000;
+
+	auto &metrics = Metrics::Get();
+	auto from = this->position_sample_count;
+	auto from_at = this->played_at;
+	auto held = this->written_sample_count - this->position_sample_count;
+	if (due <= held) {
+		// Only count the time those samples took, so that the rest
+		// goes towards the next sample.
+		this->position_sample_count += due;
+		this->played_at += std::chrono::nanoseconds(
+		        due * 1000000000 / this->sample_rate);
+	} else {
+		// A device would play silence until there's more, so the
+		// next sample plays from now, not from when it was due.
+		this->position_sample_count = this->written_sample_count;
+		this->played_at = now;
+
+		if (!this->source_out && !this->starved) {
+			metrics.underruns.fetch_add(1,
+			                            std::memory_order_relaxed);
+			this->starved = true;
+		}
+	}
+
+	this->Hear(from, this->position_sample_count, from_at);
+
+	held = this->written_sample_count - this->position_sample_count;
+	metrics.ring_fill.store(held, std::memory_order_relaxed);
+	if (held == 0 && this->source_out) this->state = Audio::State::AT_END;
+}
+
+void NullAudioSink::NoteAudible(const char *bytes, std::uint64_t first,
+                                std::size_t samples)
+{
+	auto lead = LeadingSilence(bytes, samples, this->bytes_per_sample,
+	                           this->format);
+	if (lead == samples) return;
+
+	auto trail = TrailingSilence(bytes, samples, this->bytes_per_sample,
+	                             this->format);
+	Audible sound{first + lead, first + samples - trail};
+
+	// Sound carrying on from the last stretch extends it; so does any
+	// sound once there's no room to remember it apart, which at worst
+	// takes some silence for sound.
+	auto &count = this->audible_count;
+	if (0 < count && (this->audible[count - 1].to == sound.from ||
+	                  count == AUDIBLE_STRETCHES)) {
+		this->audible[count - 1].to = sound.to;
+		return;
+	}
+	this->audible[count++] = sound;
+}
+
+void NullAudioSink::Hear(std::uint64_t from, std::uint64_t to,
+                         Clock::time_point from_at)
+{
+	auto &audible = Metrics::Get().audible;
+	if (audible.Armed() && 0 < this->audible_count) {
+		// The first stretch is the only one that can reach back
+		// before the samples just played.
+		auto first = std::max(this->audible[0].from, from);
+		if (first < to) {
+			auto ns = (first - from) * 1000000000;
+			std::chrono::nanoseconds after(ns / this->sample_rate);
+			audible.Heard(from_at + after);
+		}
+	}
+
+	this->ForgetAudible(to);
+}
+
+void NullAudioSink::ForgetAudible(std::uint64_t position)
+{
+	auto begin = this->audible.begin();
+	auto end = begin + this->audible_count;
+	auto kept = std::find_if(begin, end, [position](const Audible &a) {
+		return position < a.to;
+	});
+
+	std::copy(kept, end, begin);
+	this->audible_count -= static_cast<std::size_t>(kept - begin);
+}
+
+//
+// FileAudioSink
+//
+
+FileAudioSink::FileAudioSink(const AudioSource &source,
+                             const std::string &path)
+    : NullAudioSink(source),
+      out(path, std::ios::out | std::ios::app | std::ios::binary)
+{
+	if (!this->out) throw FileError("can't open sink file " + path);
+}
+
+void FileAudioSink::Consume(const char *bytes, std::size_t count)
+{
+	this->out.write(bytes, static_cast<std::streamsize>(count));
+}
@@ -0,0 +1,182 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the NullAudioSink and FileAudioSink classes.
+ * @see audio/null_sink.cpp
+ */
+
+#ifndef PLAYD_NULL_SINK_HPP
+#define PLAYD_NULL_SINK_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "audio.hpp"
+#include "audio_sink.hpp"
+#include "audio_source.hpp"
+
+/**
+ * An AudioSink that plays nothing, but keeps time as if it did.
+ *
+ * A NullAudioSink stands in for a device when there is none, such as when
+ * benchmarking.  It accepts samples until it holds as many unplayed ones as
+ * an SdlAudioSink's ring buffer would, and 'plays' them at the source's
+ * sample rate, going by the wall clock rather than a device callback.  So
+ * the player decodes, and sees positions move, just as it would on a real
+ * device.
+ *
+ * It keeps time on whichever thread calls it, which must be the player's.
+ * Like the device callback, it counts an underrun when it runs dry before
+ * the source runs out; it counts each dry spell once.  It also tells
+ * Metrics::audible when it plays an audible sample, so it remembers where
+ * the stretches of sound are among the samples it holds.
+ */
+class NullAudioSink : public AudioSink
+{
+public:
+	/**
+	 * Helper function for creating uniquely pointed-to NullAudioSinks.
+	 * @param source The source from which this sink will receive audio.
+	 * @param device_id Ignored.
+	 * @return A unique pointer to an AudioSink.
+	 */
+	static std::unique_ptr<AudioSink> Build(const AudioSource &source,
+	                                        int device_id);
+
+	/**
+	 * Constructs a NullAudioSink.
+	 * @param source The source from which this sink will receive audio.
+	 */
+	explicit NullAudioSink(const AudioSource &source);
+
+	void Start() override;
+	void Stop() override;
+	Audio::State State() override;
+	std::uint64_t Position() override;
+	void SetPosition(std::uint64_t samples) override;
+	bool SkipTo(std::uint64_t samples) override;
+	void SourceOut() override;
+	void Transfer(TransferIterator &start,
+	              const TransferIterator &end) override;
+
+protected:
+	/**
+	 * Does something with samples as this sink accepts them.
+	 * The NullAudioSink does nothing.
+	 * @param bytes The first byte of the samples.
+	 * @param count The number of bytes.
+	 */
+	virtual void Consume(const char *bytes, std::size_t count);
+
+private:
+	/// The clock by which samples are played.
+	using Clock = std::chrono::steady_clock;
+
+	/// The most unplayed samples held at once.
+	static const std::uint64_t CAPACITY;
+
+	/// The number of samples played each second.
+	std::uint32_t sample_rate;
+
+	/// Number of bytes in one sample, as given to Transfer().
+	std::size_t bytes_per_sample;
+
+	/// The format of each channel of each sample, as given to Transfer().
+	SampleFormat format;
+
+	/// The current position, in samples.
+	std::uint64_t position_sample_count;
+
+	/// The position, in samples, just after the last one transferred.
+	std::uint64_t written_sample_count;
+
+	/// When playback last caught up with the clock.
+	Clock::time_point played_at;
+
+	/// Whether the source has run out of things to feed the sink.
+	bool source_out;
+
+	/// Whether the sink has run dry, and already counted the underrun.
+	bool starved;
+
+	/// The sink's current state.
+	Audio::State state;
+
+	/**
+	 * A stretch of held samples, from the first audible one to just after
+	 * the last.
+	 */
+	struct Audible {
+		std::uint64_t from; ///< The first audible sample.
+		std::uint64_t to;   ///< The sample after the last audible one.
+	};
+
+	/// The most stretches of sound remembered at once.
+	static const std::size_t AUDIBLE_STRETCHES = 8;
+
+	/// The stretches of sound not yet played, oldest first.
+	std::array<Audible, AUDIBLE_STRETCHES> audible;
+
+	/// The number of stretches of sound in audible.
+	std::size_t audible_count;
+
+	/// Plays whatever samples are due by now.
+	void CatchUp();
+
+	/**
+	 * Remembers where the sound is in samples being transferred.
+	 * @param bytes The first byte of the samples.
+	 * @param first The position of the first sample.
+	 * @param samples The number of samples.
+	 */
+	void NoteAudible(const char *bytes, std::uint64_t first,
+	                 std::size_t samples);
+
+	/**
+	 * Tells Metrics::audible if samples just played held any sound.
+	 * @param from The position of the first sample played.
+	 * @param to The position after the last sample played.
+	 * @param from_at When the first sample played.
+	 */
+	void Hear(std::uint64_t from, std::uint64_t to,
+	          Clock::time_point from_at);
+
+	/**
+	 * Forgets the stretches of sound that end before a position.
+	 * @param position The position.
+	 */
+	void ForgetAudible(std::uint64_t position);
+};
+
+/**
+ * A NullAudioSink that also appends the samples it accepts to a file.
+ *
+ * The file holds raw samples, in the source's sample format, channel
+ * count and rate, one file's worth after the other.
+ */
+class FileAudioSink : public NullAudioSink
+{
+public:
+	/**
+	 * Constructs a FileAudioSink.
+	 * @param source The source from which this sink will receive audio.
+	 * @param path The path of the file to which samples are appended.
+	 * @exception FileError Thrown if the file can't be opened.
+	 */
+	FileAudioSink(const AudioSource &source, const std::string &path);
+
+protected:
+	void Consume(const char *bytes, std::size_t count) override;
+
+private:
+	/// The file to which samples are appended.
+	std::ofstream out;
+};
+
+#endif // PLAYD_NULL_SINK_HPP
@@ -0,0 +1,71 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the PositionMap class.
+ * @see audio/position_map.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "position_map.hpp"
+
+PositionMap::PositionMap() : count(0)
+{
+}
+
+void PositionMap::Clear()
+{
+	this->count = 0;
+}
+
+bool PositionMap::Empty() const
+{
+	return this->count == 0;
+}
+
+void PositionMap::Add(std::uint64_t stream, std::uint64_t file, double rate)
+{
+	assert(this->count == 0 ||
+	       this->jumps[this->count - 1].stream <= stream);
+
+	// If we're full, the oldest jump has to go.
+	if (this->count == CAPACITY) {
+		std::copy(this->jumps.begin() + 1, this->jumps.end(),
+		          this->jumps.begin());
+		this->count--;
+	}
+
+	this->jumps[this->count++] = Jump{stream, file, rate};
+}
+
+void PositionMap::Prune(std::uint64_t stream)
+{
+	// Every jump before the last one that has been played is redundant.
+	std::size_t played = 0;
+	while (played < this->count && this->jumps[played].stream <= stream) {
+		played++;
+	}
+	if (played <= 1) return;
+
+	auto first = this->jumps.begin() + (played - 1);
+	std::copy(first, this->jumps.begin() + this->count,
+	          this->jumps.begin());
+	this->count -= played - 1;
+}
+
+std::uint64_t PositionMap::ToFile(std::uint64_t stream) const
+{
+	// Find the latest jump at or before this point in the stream.
+	auto i = this->count;
+	while (0 < i && stream < this->jumps[i - 1].stream) i--;
+	if (i == 0) return stream;
+
+	auto &jump = this->jumps[i - 1];
+	auto offset = stream - jump.stream;
+	if (jump.rate == 1.0) return jump.file + offset;
+	return jump.file + static_cast<std::uint64_t>(offset * jump.rate + 0.5);
+}
@@ -0,0 +1,90 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the PositionMap class.
+ * @see audio/position_map.cpp
+ */
+
+#ifndef PLAYD_POSITION_MAP_HPP
+#define PLAYD_POSITION_MAP_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A mapping from positions in the stream sent to a sink to positions in the
+ * file being played.
+ *
+ * Normally, the two are the same: sinks count samples from the position
+ * they were last set to, and each sample sent follows on from the last.
+ * When the audio sent to a sink jumps (for example, when a loop wraps
+ * around), the PositionMap records the jump, so that the sink's count of
+ * played samples can still be turned into a file position.  Jumps can also
+ * change the rate at which file positions go by, for time-stretched audio.
+ *
+ * The map holds a fixed number of jumps, and never allocates.  If more jumps
+ * are pending than it can hold, the oldest are forgotten, and positions
+ * before them become inaccurate.
+ */
+class PositionMap
+{
+public:
+	/// The maximum number of jumps a PositionMap remembers.
+	static const std::size_t CAPACITY = 32;
+
+	/// Constructs an empty PositionMap.
+	PositionMap();
+
+	/**
+	 * Forgets all jumps, so that stream and file positions are the same.
+	 * This should be done whenever the sink's position is set.
+	 */
+	void Clear();
+
+	/**
+	 * Checks whether the map holds any jumps.
+	 * @return True if stream and file positions are the same; false
+	 *   otherwise.
+	 */
+	bool Empty() const;
+
+	/**
+	 * Records a jump.
+	 * @param stream The stream position at which the jump happens.  This
+	 *   must be no earlier than that of any jump already recorded.
+	 * @param file The file position to which the stream jumps.
+	 * @param rate The number of file samples each stream sample covers,
+	 *   from the jump onwards.
+	 */
+	void Add(std::uint64_t stream, std::uint64_t file, double rate = 1.0);
+
+	/**
+	 * Forgets jumps that no longer matter, because a later jump has
+	 * already been played.
+	 * @param stream The stream position that has now been played.
+	 */
+	void Prune(std::uint64_t stream);
+
+	/**
+	 * Converts a stream position into a file position.
+	 * @param stream The stream position, in samples.
+	 * @return The file position, in samples.
+	 */
+	std::uint64_t ToFile(std::uint64_t stream) const;
+
+private:
+	/// A jump from one position to another.
+	struct Jump {
+		std::uint64_t stream; ///< The stream position of the jump.
+		std::uint64_t file;   ///< The file position jumped to.
+		double rate;          ///< File samples per stream sample.
+	};
+
+	std::array<Jump, CAPACITY> jumps; ///< The jumps, oldest first.
+	std::size_t count;                ///< The number of jumps held.
+};
+
+#endif // PLAYD_POSITION_MAP_HPP
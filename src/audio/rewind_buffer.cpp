@@ -0,0 +1,115 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the RewindBuffer class.
+ * @see audio/rewind_buffer.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "audio_source.hpp"
+#include "rewind_buffer.hpp"
+
+RewindBuffer::RewindBuffer(std::size_t capacity, std::size_t bytes_per_sample)
+    : buffer(capacity * bytes_per_sample),
+      bytes_per_sample(bytes_per_sample),
+      capacity(capacity),
+      head(0),
+      count(0),
+      end(0)
+{
+	assert(0 < bytes_per_sample);
+}
+
+void RewindBuffer::Reset(std::uint64_t position)
+{
+	this->head = 0;
+	this->count = 0;
+	this->end = position;
+}
+
+void RewindBuffer::Append(const std::uint8_t *begin, const std::uint8_t *end)
+{
+	assert(begin <= end);
+	assert((end - begin) % this->bytes_per_sample == 0);
+
+	std::size_t samples = (end - begin) / this->bytes_per_sample;
+	this->end += samples;
+	if (this->capacity == 0) return;
+
+	// Anything that wouldn't survive the append needn't be copied.
+	if (this->capacity < samples) {
+		begin += (samples - this->capacity) * this->bytes_per_sample;
+		samples = this->capacity;
+	}
+
+	// Write at the tail, which may mean wrapping around to the start.
+	auto tail = (this->head + this->count) % this->capacity;
+	auto first = std::min(samples, this->capacity - tail);
+	auto bps = this->bytes_per_sample;
+	std::memcpy(&this->buffer[tail * bps], begin, first * bps);
+	std::memcpy(&this->buffer[0], begin + first * bps,
+	            (samples - first) * bps);
+
+	// If we overflowed, the oldest samples have just been overwritten.
+	auto total = this->count + samples;
+	if (this->capacity < total) {
+		auto lost = total - this->capacity;
+		this->head = (this->head + lost) % this->capacity;
+		total = this->capacity;
+	}
+	this->count = total;
+}
+
+bool RewindBuffer::Contains(std::uint64_t position) const
+{
+	return this->Start() <= position && position <= this->End();
+}
+
+void RewindBuffer::Rewind(std::uint64_t position,
+                          AudioSource::DecodeVector &out)
+{
+	assert(this->Contains(position));
+
+	auto keep = static_cast<std::size_t>(position - this->Start());
+	this->CopyOut(this->head + keep, this->count - keep, out);
+
+	this->count = keep;
+	this->end = position;
+}
+
+std::uint64_t RewindBuffer::Start() const
+{
+	return this->end - this->count;
+}
+
+std::uint64_t RewindBuffer::End() const
+{
+	return this->end;
+}
+
+std::size_t RewindBuffer::Capacity() const
+{
+	return this->capacity;
+}
+
+void RewindBuffer::CopyOut(std::size_t index, std::size_t samples,
+                           AudioSource::DecodeVector &out) const
+{
+	if (samples == 0) return;
+
+	auto bps = this->bytes_per_sample;
+	index %= this->capacity;
+
+	auto first = std::min(samples, this->capacity - index);
+	auto begin = this->buffer.begin();
+	out.insert(out.end(), begin + index * bps,
+	           begin + (index + first) * bps);
+	out.insert(out.end(), begin, begin + (samples - first) * bps);
+}
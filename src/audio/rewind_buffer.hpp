@@ -0,0 +1,110 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the RewindBuffer class.
+ * @see audio/rewind_buffer.cpp
+ */
+
+#ifndef PLAYD_REWIND_BUFFER_HPP
+#define PLAYD_REWIND_BUFFER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "audio_source.hpp"
+
+/**
+ * A bounded history of the most recently transferred audio.
+ *
+ * The RewindBuffer holds the last Capacity() samples sent to a sink, along
+ * with their positions in the file.  Seeks that land inside this history
+ * can be served from memory, without asking the AudioSource to seek (which
+ * is slow, and not always sample-accurate).
+ *
+ * Storage is allocated once, up front; appending never allocates.
+ */
+class RewindBuffer
+{
+public:
+	/**
+	 * Constructs a RewindBuffer.
+	 * @param capacity The maximum number of samples to remember.
+	 * @param bytes_per_sample The size of one sample, in bytes.
+	 */
+	RewindBuffer(std::size_t capacity, std::size_t bytes_per_sample);
+
+	/**
+	 * Empties the RewindBuffer.
+	 * @param position The position, in samples, of the next sample to be
+	 *   appended.
+	 */
+	void Reset(std::uint64_t position);
+
+	/**
+	 * Appends a run of packed samples to the end of the history.
+	 * If the history overflows, the oldest samples are forgotten.
+	 * @param begin Pointer to the start of the run.
+	 * @param end Pointer to the end of the run.  The run must contain a
+	 *   whole number of samples.
+	 */
+	void Append(const std::uint8_t *begin, const std::uint8_t *end);
+
+	/**
+	 * Checks whether a position can be sought to from memory.
+	 * @param position The position, in samples.
+	 * @return True if @a position lies within the history (including at
+	 *   its very end); false otherwise.
+	 */
+	bool Contains(std::uint64_t position) const;
+
+	/**
+	 * Rewinds the history to a given position.
+	 *
+	 * The samples from @a position to the end of the history are appended
+	 * to @a out, and forgotten by the RewindBuffer (as they will be
+	 * appended again once they are re-transferred).
+	 *
+	 * @param position The position, in samples.  Must satisfy Contains.
+	 * @param out The vector to which the rewound samples are appended.
+	 */
+	void Rewind(std::uint64_t position, AudioSource::DecodeVector &out);
+
+	/**
+	 * The position of the oldest sample in the history.
+	 * @return The start position, in samples.
+	 */
+	std::uint64_t Start() const;
+
+	/**
+	 * The position just after the newest sample in the history.
+	 * @return The end position, in samples.
+	 */
+	std::uint64_t End() const;
+
+	/**
+	 * The maximum size of the history.
+	 * @return The capacity, in samples.
+	 */
+	std::size_t Capacity() const;
+
+private:
+	std::vector<std::uint8_t> buffer; ///< The circular sample store.
+	std::size_t bytes_per_sample;     ///< The size of one sample.
+	std::size_t capacity;             ///< The store's size, in samples.
+	std::size_t head;                 ///< Index of the oldest sample.
+	std::size_t count;                ///< Number of samples stored.
+	std::uint64_t end;                ///< Position after the newest sample.
+
+	/**
+	 * Copies samples out of the circular store.
+	 * @param index The index of the first sample, which may wrap.
+	 * @param samples The number of samples to copy.
+	 * @param out The vector to which the samples are appended.
+	 */
+	void CopyOut(std::size_t index, std::size_t samples,
+	             AudioSource::DecodeVector &out) const;
+};
+
+#endif // PLAYD_REWIND_BUFFER_HPP
@@ -14,6 +14,7 @@ extern "C" {
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "../realtime.hpp"
 #include "ringbuffer.hpp"
 
 RingBuffer::RingBuffer(int power, int size)
@@ -24,6 +25,9 @@ RingBuffer::RingBuffer(int power, int size)
 	this->rb = new PaUtilRingBuffer;
 	this->buffer = new char[(1 << power) * size];
 
+	// The callback thread reads this, so it mustn't page-fault on it.
+	Prefault(this->buffer, (1 << power) * size);
+
 	if (PaUtil_InitializeRingBuffer(
 	            this->rb, size, static_cast<ring_buffer_size_t>(1 << power),
 	            this->buffer) != 0) {
@@ -71,6 +75,14 @@ unsigned long RingBuffer::Read(char *start, unsigned long count)
 	        this->rb, start, static_cast<ring_buffer_size_t>(count)));
 }
 
+void RingBuffer::Skip(unsigned long count)
+{
+	assert(count <= ReadCapacity());
+
+	PaUtil_AdvanceRingBufferReadIndex(
+	        this->rb, static_cast<ring_buffer_size_t>(count));
+}
+
 void RingBuffer::Flush()
 {
 	PaUtil_FlushRingBuffer(this->rb);
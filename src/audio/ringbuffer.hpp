@@ -104,6 +104,20 @@ public:
 	 */
 	unsigned long Read(char *start, unsigned long count);
 
+	/**
+	 * Discards samples from the front of the ring buffer, without reading
+	 * them.
+	 *
+	 * * Precondition: count <= ReadCapacity().
+	 * * Postcondition: The first count samples of the ring buffer have
+	 *     been discarded.
+	 *
+	 * @param count The number of samples to discard.  This must not
+	 *   exceed ReadCapacity().
+	 * @see ReadCapacity
+	 */
+	void Skip(unsigned long count);
+
 	/// Empties the ring buffer.
 	void Flush();
 
@@ -0,0 +1,331 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of conversions between sample formats and floating point.
+ * @see audio/sample_convert.hpp
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "../simd.hpp"
+#include "sample_convert.hpp"
+#include "sample_formats.hpp"
+
+/**
+ * Compile-time description of a packed integer sample format.
+ * Only the integer formats with a native C++ type are described; 24-bit
+ * and floating point samples have their own kernels.
+ * @tparam F The sample format.
+ */
+template <SampleFormat F>
+struct IntFormat;
+
+/// Description of unsigned 8-bit samples.
+template <>
+struct IntFormat<SampleFormat::PACKED_UNSIGNED_INT_8> {
+	using Type = std::uint8_t;             ///< One mono sample.
+	using Real = float;                    ///< Used in conversion.
+	static const int BIAS = 128;           ///< The value of silence.
+	static const std::int64_t SCALE = 128; ///< Full scale.
+};
+
+/// Description of signed 8-bit samples.
+template <>
+struct IntFormat<SampleFormat::PACKED_SIGNED_INT_8> {
+	using Type = std::int8_t;              ///< One mono sample.
+	using Real = float;                    ///< Used in conversion.
+	static const int BIAS = 0;             ///< The value of silence.
+	static const std::int64_t SCALE = 128; ///< Full scale.
+};
+
+/// Description of signed 16-bit samples.
+template <>
+struct IntFormat<SampleFormat::PACKED_SIGNED_INT_16> {
+	using Type = std::int16_t;               ///< One mono sample.
+	using Real = float;                      ///< Used in conversion.
+	static const int BIAS = 0;               ///< The value of silence.
+	static const std::int64_t SCALE = 32768; ///< Full scale.
+};
+
+/// Description of signed 32-bit samples.
+template <>
+struct IntFormat<SampleFormat::PACKED_SIGNED_INT_32> {
+	using Type = std::int32_t;                     ///< One mono sample.
+	using Real = double;                           ///< Used in conversion.
+	static const int BIAS = 0;                     ///< The value of silence.
+	static const std::int64_t SCALE = 2147483648LL; ///< Full scale.
+};
+
+/**
+ * Converts as many integer samples into floating point as can be done with
+ * SIMD instructions.
+ * This version is for formats without a SIMD kernel, and does nothing.
+ * @tparam F The sample format of @a in.
+ * @return The number of mono samples converted.
+ */
+template <SampleFormat F>
+static std::size_t IntToFloatWide(const std::uint8_t *, std::size_t, float *)
+{
+	return 0;
+}
+
+/**
+ * Converts as many floating point samples into integers as can be done
+ * with SIMD instructions.
+ * This version is for formats without a SIMD kernel, and does nothing.
+ * @tparam F The sample format of @a out.
+ * @return The number of mono samples converted.
+ */
+template <SampleFormat F>
+static std::size_t FloatToIntWide(const float *, std::size_t, std::uint8_t *)
+{
+	return 0;
+}
+
+#ifdef PLAYD_HAVE_SSE2
+/// IntToFloatWide for 16-bit samples, eight at a time.
+template <>
+std::size_t IntToFloatWide<SampleFormat::PACKED_SIGNED_INT_16>(
+        const std::uint8_t *in, std::size_t count, float *out)
+{
+	auto scale = _mm_set1_ps(1.0f / 32768);
+
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		auto x = _mm_loadu_si128(
+		        reinterpret_cast<const __m128i *>(in + i * 2));
+
+		// Each sample goes into the top half of a 32-bit lane, and is
+		// shifted back down to sign-extend it.
+		auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + i + 4,
+		              _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	return i;
+}
+
+/// IntToFloatWide for 32-bit samples, four at a time.
+template <>
+std::size_t IntToFloatWide<SampleFormat::PACKED_SIGNED_INT_32>(
+        const std::uint8_t *in, std::size_t count, float *out)
+{
+	auto scale = _mm_set1_ps(1.0f / 2147483648LL);
+
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		auto x = _mm_loadu_si128(
+		        reinterpret_cast<const __m128i *>(in + i * 4));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+	return i;
+}
+
+/// FloatToIntWide for 16-bit samples, eight at a time.
+template <>
+std::size_t FloatToIntWide<SampleFormat::PACKED_SIGNED_INT_16>(
+        const float *in, std::size_t count, std::uint8_t *out)
+{
+	auto lo = _mm_set1_ps(-1.0f);
+	auto hi = _mm_set1_ps(1.0f);
+	auto scale = _mm_set1_ps(32767.0f);
+
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		// The clamped argument goes first, so NaN clamps to -1 as
+		// std::max does in the plain loop.
+		auto a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi);
+		auto b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo),
+		                    hi);
+		auto sa = _mm_cvttps_epi32(_mm_mul_ps(a, scale));
+		auto sb = _mm_cvttps_epi32(_mm_mul_ps(b, scale));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2),
+		                 _mm_packs_epi32(sa, sb));
+	}
+	return i;
+}
+
+/// FloatToIntWide for 32-bit samples, four at a time.
+template <>
+std::size_t FloatToIntWide<SampleFormat::PACKED_SIGNED_INT_32>(
+        const float *in, std::size_t count, std::uint8_t *out)
+{
+	auto lo = _mm_set1_ps(-1.0f);
+	auto hi = _mm_set1_ps(1.0f);
+	auto scale = _mm_set1_pd(2147483647.0);
+
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		auto x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi);
+
+		// Full scale doesn't fit in a float's mantissa, so, as in the
+		// plain loop, we scale in double precision, two at a time.
+		auto a = _mm_mul_pd(_mm_cvtps_pd(x), scale);
+		auto b = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), scale);
+		auto s = _mm_unpacklo_epi64(_mm_cvttpd_epi32(a),
+		                            _mm_cvttpd_epi32(b));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 4), s);
+	}
+	return i;
+}
+#endif // PLAYD_HAVE_SSE2
+
+/**
+ * Converts integer samples into floating point.
+ * The 16- and 32-bit formats use SSE2 where available.
+ * @tparam F The sample format of @a in.
+ */
+template <SampleFormat F>
+static void IntToFloat(const std::uint8_t *in, std::size_t count, float *out)
+{
+	using Format = IntFormat<F>;
+	using T = typename Format::Type;
+	const float scale = 1.0f / Format::SCALE;
+
+	// memcpy-ing each sample keeps us clear of alignment problems.
+	auto i = IntToFloatWide<F>(in, count, out);
+	for (; i < count; i++) {
+		T s;
+		std::memcpy(&s, in + i * sizeof(T), sizeof(T));
+		out[i] = (static_cast<float>(s) - Format::BIAS) * scale;
+	}
+}
+
+/**
+ * Converts floating point samples into integers.
+ * The 16- and 32-bit formats use SSE2 where available.  Full scale is one
+ * less than on the way in, so that 1.0 doesn't overflow.
+ * @tparam F The sample format of @a out.
+ */
+template <SampleFormat F>
+static void FloatToInt(const float *in, std::size_t count, std::uint8_t *out)
+{
+	using Format = IntFormat<F>;
+	using T = typename Format::Type;
+	using Real = typename Format::Real;
+	const Real scale = static_cast<Real>(Format::SCALE - 1);
+
+	auto i = FloatToIntWide<F>(in, count, out);
+	for (; i < count; i++) {
+		float x = std::min(1.0f, std::max(-1.0f, in[i]));
+		auto s = static_cast<T>(static_cast<Real>(x) * scale +
+		                        Format::BIAS);
+		std::memcpy(out + i * sizeof(T), &s, sizeof(T));
+	}
+}
+
+/// Converts packed 24-bit samples into floating point.
+static void Int24ToFloat(const std::uint8_t *in, std::size_t count,
+                         float *out)
+{
+	for (std::size_t i = 0; i < count; i++) {
+		// Shift into the top of an int32 to sign-extend.
+		auto u = static_cast<std::uint32_t>(in[3 * i]) << 8 |
+		         static_cast<std::uint32_t>(in[3 * i + 1]) << 16 |
+		         static_cast<std::uint32_t>(in[3 * i + 2]) << 24;
+		auto s = static_cast<std::int32_t>(u);
+		out[i] = static_cast<float>(s) * (1.0f / 2147483648.0f);
+	}
+}
+
+/// Converts floating point samples into packed 24-bit samples.
+static void FloatToInt24(const float *in, std::size_t count,
+                         std::uint8_t *out)
+{
+	for (std::size_t i = 0; i < count; i++) {
+		float x = std::min(1.0f, std::max(-1.0f, in[i]));
+		auto s = static_cast<std::int32_t>(x * 8388607.0f);
+		out[3 * i] = static_cast<std::uint8_t>(s);
+		out[3 * i + 1] = static_cast<std::uint8_t>(s >> 8);
+		out[3 * i + 2] = static_cast<std::uint8_t>(s >> 16);
+	}
+}
+
+/// Copies floating point samples, which need no conversion.
+static void FloatToFloat(const std::uint8_t *in, std::size_t count,
+                         float *out)
+{
+	std::memcpy(out, in, count * sizeof(float));
+}
+
+/// Copies and clips floating point samples.
+static void FloatFromFloat(const float *in, std::size_t count,
+                           std::uint8_t *out)
+{
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	auto lo = _mm_set1_ps(-1.0f);
+	auto hi = _mm_set1_ps(1.0f);
+	for (; i + 4 <= count; i += 4) {
+		auto x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi);
+		_mm_storeu_ps(reinterpret_cast<float *>(out + i * sizeof(float)),
+		              x);
+	}
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i < count; i++) {
+		float x = std::min(1.0f, std::max(-1.0f, in[i]));
+		std::memcpy(out + i * sizeof(float), &x, sizeof(float));
+	}
+}
+
+ToFloatFn ToFloatKernel(SampleFormat fmt)
+{
+	switch (fmt) {
+		case SampleFormat::PACKED_UNSIGNED_INT_8:
+			return &IntToFloat<SampleFormat::PACKED_UNSIGNED_INT_8>;
+		case SampleFormat::PACKED_SIGNED_INT_8:
+			return &IntToFloat<SampleFormat::PACKED_SIGNED_INT_8>;
+		case SampleFormat::PACKED_SIGNED_INT_16:
+			return &IntToFloat<SampleFormat::PACKED_SIGNED_INT_16>;
+		case SampleFormat::PACKED_SIGNED_INT_24:
+			return &Int24ToFloat;
+		case SampleFormat::PACKED_SIGNED_INT_32:
+			return &IntToFloat<SampleFormat::PACKED_SIGNED_INT_32>;
+		case SampleFormat::PACKED_FLOAT_32:
+			return &FloatToFloat;
+	}
+
+	// All formats are handled above.
+	return nullptr;
+}
+
+FromFloatFn FromFloatKernel(SampleFormat fmt)
+{
+	switch (fmt) {
+		case SampleFormat::PACKED_UNSIGNED_INT_8:
+			return &FloatToInt<SampleFormat::PACKED_UNSIGNED_INT_8>;
+		case SampleFormat::PACKED_SIGNED_INT_8:
+			return &FloatToInt<SampleFormat::PACKED_SIGNED_INT_8>;
+		case SampleFormat::PACKED_SIGNED_INT_16:
+			return &FloatToInt<SampleFormat::PACKED_SIGNED_INT_16>;
+		case SampleFormat::PACKED_SIGNED_INT_24:
+			return &FloatToInt24;
+		case SampleFormat::PACKED_SIGNED_INT_32:
+			return &FloatToInt<SampleFormat::PACKED_SIGNED_INT_32>;
+		case SampleFormat::PACKED_FLOAT_32:
+			return &FloatFromFloat;
+	}
+
+	// All formats are handled above.
+	return nullptr;
+}
+
+void SamplesToFloat(const std::uint8_t *in, SampleFormat fmt,
+                    std::size_t count, float *out)
+{
+	ToFloatKernel(fmt)(in, count, out);
+}
+
+void SamplesFromFloat(const float *in, std::size_t count, SampleFormat fmt,
+                      std::uint8_t *out)
+{
+	FromFloatKernel(fmt)(in, count, out);
+}
@@ -0,0 +1,77 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of conversions between sample formats and floating point.
+ * @see audio/sample_convert.cpp
+ */
+
+#ifndef PLAYD_SAMPLE_CONVERT_HPP
+#define PLAYD_SAMPLE_CONVERT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "sample_formats.hpp"
+
+/**
+ * Type of functions converting packed samples of one format into floating
+ * point.
+ * @see ToFloatKernel
+ */
+using ToFloatFn = void (*)(const std::uint8_t *in, std::size_t count,
+                           float *out);
+
+/**
+ * Type of functions converting floating point samples into packed samples
+ * of one format.
+ * @see FromFloatKernel
+ */
+using FromFloatFn = void (*)(const float *in, std::size_t count,
+                             std::uint8_t *out);
+
+/**
+ * Finds the conversion kernel from a sample format into floating point.
+ *
+ * Each kernel is specialised for its format at compile time, so callers
+ * converting many runs of the same format should look the kernel up once,
+ * rather than switching on the format for each run.
+ *
+ * @param fmt The sample format to convert from.
+ * @return The kernel, which converts @a count mono samples into the range
+ *   [-1, 1].
+ */
+ToFloatFn ToFloatKernel(SampleFormat fmt);
+
+/**
+ * Finds the conversion kernel from floating point into a sample format.
+ * Samples outside [-1, 1] are clipped.
+ * @param fmt The sample format to convert to.
+ * @return The kernel, which converts @a count mono samples.
+ * @see ToFloatKernel
+ */
+FromFloatFn FromFloatKernel(SampleFormat fmt);
+
+/**
+ * Converts packed samples into floating point, in the range [-1, 1].
+ * @param in Pointer to the samples to convert.
+ * @param fmt The sample format of @a in.
+ * @param count The number of mono samples to convert.
+ * @param out Pointer to an array of at least @a count floats.
+ */
+void SamplesToFloat(const std::uint8_t *in, SampleFormat fmt,
+                    std::size_t count, float *out);
+
+/**
+ * Converts floating point samples into a packed sample format.
+ * Samples outside [-1, 1] are clipped.
+ * @param in Pointer to the samples to convert.
+ * @param count The number of mono samples to convert.
+ * @param fmt The sample format of @a out.
+ * @param out Pointer to enough bytes for @a count samples in @a fmt.
+ */
+void SamplesFromFloat(const float *in, std::size_t count, SampleFormat fmt,
+                      std::uint8_t *out);
+
+#endif // PLAYD_SAMPLE_CONVERT_HPP
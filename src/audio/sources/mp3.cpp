@@ -127,7 +127,7 @@ std::uint64_t Mp3AudioSource::Seek(std::uint64_t in_samples)
 	return mpg123_tell(this->context);
 }
 
-Mp3AudioSource::DecodeResult Mp3AudioSource::Decode()
+Mp3AudioSource::DecodeState Mp3AudioSource::DecodeInto(DecodeVector &frame)
 {
 	assert(this->context != nullptr);
 
@@ -135,7 +135,7 @@ Mp3AudioSource::DecodeResult Mp3AudioSource::Decode()
 	size_t rbytes = 0;
 	int err = mpg123_read(this->context, buf, this->buffer.size(), &rbytes);
 
-	DecodeVector decoded;
+	frame.clear();
 	DecodeState decode_state;
 
 	if (err == MPG123_DONE) {
@@ -149,10 +149,10 @@ Mp3AudioSource::DecodeResult Mp3AudioSource::Decode()
 
 		// Copy only the bit of the buffer occupied by decoded data
 		auto front = this->buffer.begin();
-		decoded = DecodeVector(front, front + rbytes);
+		frame.assign(front, front + rbytes);
 	}
 
-	return std::make_pair(decode_state, decoded);
+	return decode_state;
 }
 
 SampleFormat Mp3AudioSource::OutputSampleFormat() const
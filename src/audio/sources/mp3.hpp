@@ -49,7 +49,7 @@ public:
 	/// Destructs an Mp3AudioSource.
 	~Mp3AudioSource();
 
-	DecodeResult Decode() override;
+	DecodeState DecodeInto(DecodeVector &frame) override;
 	std::uint64_t Seek(std::uint64_t position) override;
 
 	std::uint8_t ChannelCount() const override;
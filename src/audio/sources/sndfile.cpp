@@ -89,14 +89,16 @@ std::uint64_t SndfileAudioSource::Seek(std::uint64_t in_samples)
 	return out_samples;
 }
 
-SndfileAudioSource::DecodeResult SndfileAudioSource::Decode()
+SndfileAudioSource::DecodeState SndfileAudioSource::DecodeInto(
+        DecodeVector &frame)
 {
 	auto read = sf_read_int(this->file, &*this->buffer.begin(),
 	                        this->buffer.size());
 
 	// Have we hit the end of the file?
 	if (read == 0) {
-		return std::make_pair(DecodeState::END_OF_FILE, DecodeVector());
+		frame.clear();
+		return DecodeState::END_OF_FILE;
 	}
 
 	// Else, we're good to go (hopefully).
@@ -114,7 +116,8 @@ SndfileAudioSource::DecodeResult SndfileAudioSource::Decode()
 	// The end is 'read' 32-bit items--read*4 bytes--after.
 	uint8_t *end = begin + (read * 4);
 
-	return std::make_pair(DecodeState::DECODING, DecodeVector(begin, end));
+	frame.assign(begin, end);
+	return DecodeState::DECODING;
 }
 
 SampleFormat SndfileAudioSource::OutputSampleFormat() const
@@ -0,0 +1,262 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the TimeStretch class.
+ * @see audio/time_stretch.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "../simd.hpp"
+#include "time_stretch.hpp"
+
+const double TimeStretch::MIN_RATE = 0.5;
+const double TimeStretch::MAX_RATE = 2.0;
+
+/// The gap between segments in the output, in seconds.
+static const double HOP_SECONDS = 0.01;
+
+/// Ratio of pi to 1.
+static const double PI = 3.14159265358979323846;
+
+/**
+ * Finds the dot product of two runs of samples.
+ * This is the inner loop of the search for the best overlap.  It keeps
+ * four separate sums, which SSE2 works on at once where available; the
+ * plain loop keeps the same sums, so the result is the same either way.
+ * @param a The first run.
+ * @param b The second run.
+ * @param n The length of each run.
+ * @return The dot product.
+ */
+static float Dot(const float *a, const float *b, std::size_t n)
+{
+	float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	auto sums = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		auto x = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		sums = _mm_add_ps(sums, x);
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, sums);
+	s0 = lanes[0];
+	s1 = lanes[1];
+	s2 = lanes[2];
+	s3 = lanes[3];
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i + 4 <= n; i += 4) {
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	for (; i < n; i++) s0 += a[i] * b[i];
+
+	return (s0 + s1) + (s2 + s3);
+}
+
+TimeStretch::TimeStretch(std::uint32_t rate, std::uint8_t channels)
+    : channels(channels),
+      window(0),
+      hop(std::max<std::size_t>(
+              16, static_cast<std::size_t>(rate * HOP_SECONDS))),
+      tolerance(this->hop / 2),
+      speed(1.0),
+      analysis(0.0),
+      previous(0),
+      started(false),
+      overlap(this->hop * channels, 0.0f)
+{
+	assert(0 < channels);
+
+	// A periodic Hann window, half of which overlaps at each hop, sums to
+	// exactly one; at normal speed, the input passes through untouched.
+	this->window = 2 * this->hop;
+	this->hann.resize(this->window);
+	for (std::size_t n = 0; n < this->window; n++) {
+		double phase = 2.0 * PI * n / this->window;
+		this->hann[n] = static_cast<float>(0.5 - 0.5 * std::cos(phase));
+	}
+}
+
+double TimeStretch::Rate() const
+{
+	return this->speed;
+}
+
+void TimeStretch::SetRate(double rate)
+{
+	assert(MIN_RATE <= rate && rate <= MAX_RATE);
+	this->speed = rate;
+}
+
+void TimeStretch::Reset()
+{
+	this->input.clear();
+	this->mono.clear();
+	this->analysis = 0.0;
+	this->previous = 0;
+	this->started = false;
+	std::fill(this->overlap.begin(), this->overlap.end(), 0.0f);
+}
+
+void TimeStretch::Process(const float *in, std::size_t frames,
+                          std::vector<float> &out)
+{
+	this->input.insert(this->input.end(), in, in + frames * this->channels);
+
+	for (std::size_t f = 0; f < frames; f++) {
+		float sum = 0.0f;
+		for (std::uint8_t c = 0; c < this->channels; c++) {
+			sum += in[f * this->channels + c];
+		}
+		this->mono.push_back(sum / this->channels);
+	}
+
+	while (this->Step(out)) {
+	}
+}
+
+void TimeStretch::Drain(std::vector<float> &out)
+{
+	auto pending = this->Pending();
+	auto base = out.size();
+
+	// Pad with enough silence that every held-back sample gets laid down,
+	// then drop whatever came from the silence.
+	auto pad = this->window + this->tolerance + this->hop;
+	this->input.resize(this->input.size() + pad * this->channels, 0.0f);
+	this->mono.resize(this->mono.size() + pad, 0.0f);
+	while (this->Step(out)) {
+	}
+
+	auto end = base + pending * this->channels;
+	if (end < out.size()) out.resize(end);
+
+	this->Reset();
+}
+
+std::uint64_t TimeStretch::Pending() const
+{
+	auto frames = static_cast<double>(this->InputFrames());
+	if (frames <= this->analysis) return 0;
+	return static_cast<std::uint64_t>((frames - this->analysis) /
+	                                  this->speed);
+}
+
+bool TimeStretch::Step(std::vector<float> &out)
+{
+	auto centre = static_cast<std::size_t>(this->analysis + 0.5);
+
+	// We need the whole search range for the segment, and the audio the
+	// segment has to match.
+	auto need = centre + this->tolerance + this->window;
+	need = std::max(need, this->previous + this->hop + this->window);
+	if (this->InputFrames() < need) return false;
+
+	auto pos = this->started ? this->BestMatch(centre) : centre;
+
+	auto ch = this->channels;
+	auto base = out.size();
+	out.resize(base + this->hop * ch);
+	float *y = out.data() + base;
+	const float *x = this->input.data() + pos * ch;
+
+	if (this->started) {
+		for (std::size_t n = 0; n < this->hop; n++) {
+			for (std::uint8_t c = 0; c < ch; c++) {
+				auto i = n * ch + c;
+				y[i] = this->overlap[i] + this->hann[n] * x[i];
+			}
+		}
+	} else {
+		// Nothing to overlap with, so there's nothing to fade in from.
+		std::copy(x, x + this->hop * ch, y);
+	}
+
+	const float *tail = x + this->hop * ch;
+	for (std::size_t n = 0; n < this->hop; n++) {
+		for (std::uint8_t c = 0; c < ch; c++) {
+			auto i = n * ch + c;
+			this->overlap[i] = this->hann[this->hop + n] * tail[i];
+		}
+	}
+
+	this->previous = pos;
+	this->started = true;
+	this->analysis += this->hop * this->speed;
+
+	// Everything before both the next search range and the audio the next
+	// segment has to match is done with.
+	auto next = static_cast<std::size_t>(this->analysis);
+	auto low = next < this->tolerance ? 0 : next - this->tolerance;
+	auto drop = std::min(low, this->previous + this->hop);
+	this->input.erase(this->input.begin(),
+	                  this->input.begin() + drop * ch);
+	this->mono.erase(this->mono.begin(), this->mono.begin() + drop);
+	this->analysis -= drop;
+	this->previous -= drop;
+
+	return true;
+}
+
+std::size_t TimeStretch::BestMatch(std::size_t centre) const
+{
+	// The next segment's first half overlaps the last segment's second
+	// half, so it should look like whatever followed that in the input.
+	auto length = this->hop;
+	const float *target = this->mono.data() + this->previous + this->hop;
+
+	auto low = centre < this->tolerance ? 0 : centre - this->tolerance;
+	auto high = centre + this->tolerance;
+
+	double energy = 0.0;
+	for (std::size_t n = low; n < low + length; n++) {
+		energy += this->mono[n] * this->mono[n];
+	}
+
+	auto best = centre;
+	auto best_score = -std::numeric_limits<double>::infinity();
+	auto distance = [centre](std::size_t pos) {
+		return pos < centre ? centre - pos : pos - centre;
+	};
+
+	for (auto pos = low; pos <= high; pos++) {
+		const float *candidate = this->mono.data() + pos;
+		double corr = Dot(target, candidate, length);
+		double score = corr / std::sqrt(energy + 1e-9);
+
+		// On ties, nudging less is better.
+		bool better = best_score < score ||
+		              (score == best_score &&
+		               distance(pos) < distance(best));
+		if (better) {
+			best = pos;
+			best_score = score;
+		}
+
+		double out = candidate[0];
+		double in = candidate[length];
+		energy = std::max(0.0, energy - out * out + in * in);
+	}
+
+	return best;
+}
+
+std::size_t TimeStretch::InputFrames() const
+{
+	return this->mono.size();
+}
@@ -0,0 +1,136 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the TimeStretch class.
+ * @see audio/time_stretch.cpp
+ */
+
+#ifndef PLAYD_TIME_STRETCH_HPP
+#define PLAYD_TIME_STRETCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A time-stretcher, changing the speed of audio without changing its pitch.
+ *
+ * This uses WSOLA (waveform similarity overlap-add).  The input is cut into
+ * overlapping, Hann-windowed segments, which are laid back down half a
+ * segment apart.  To speed up, the segments are taken from further apart
+ * than that; to slow down, closer together.  Each segment is nudged, within
+ * a small tolerance, to wherever the input best matches the audio it is
+ * overlapping, so that the joins don't beat or click.
+ *
+ * Output sample n corresponds to input sample n * Rate(), give or take the
+ * tolerance, so the input position of any output can be worked out from the
+ * rate alone.  The stretcher holds back about a segment and a tolerance of
+ * input, which it only gives up on Drain.
+ *
+ * Audio is packed 32-bit floating point.
+ */
+class TimeStretch
+{
+public:
+	/// The slowest supported rate.
+	static const double MIN_RATE;
+
+	/// The fastest supported rate.
+	static const double MAX_RATE;
+
+	/**
+	 * Constructs a TimeStretch, running at normal speed.
+	 * @param rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels in the audio.
+	 */
+	TimeStretch(std::uint32_t rate, std::uint8_t channels);
+
+	/**
+	 * The current rate.
+	 * @return The rate: 1 is normal speed, 2 twice as fast.
+	 */
+	double Rate() const;
+
+	/**
+	 * Changes the rate.
+	 * This takes effect from the next output sample to be produced.
+	 * @param rate The new rate, between MIN_RATE and MAX_RATE.
+	 */
+	void SetRate(double rate);
+
+	/// Forgets all held-back input, for example after a seek.
+	void Reset();
+
+	/**
+	 * Stretches some input.
+	 * @param in The input samples.
+	 * @param frames The number of (multi-channel) samples in @a in.
+	 * @param out The vector to which any output samples are appended.
+	 */
+	void Process(const float *in, std::size_t frames,
+	             std::vector<float> &out);
+
+	/**
+	 * Stretches all held-back input, as if the input had ended.
+	 * The TimeStretch is then reset.
+	 * @param out The vector to which the output samples are appended.
+	 */
+	void Drain(std::vector<float> &out);
+
+	/**
+	 * The output still to come from the held-back input.
+	 * @return The number of (multi-channel) output samples.
+	 */
+	std::uint64_t Pending() const;
+
+private:
+	std::uint8_t channels;   ///< The number of channels.
+	std::size_t window;      ///< The length of a segment, in samples.
+	std::size_t hop;         ///< The output distance between segments.
+	std::size_t tolerance;   ///< How far a segment may be nudged.
+	double speed;            ///< The current rate.
+	std::vector<float> hann; ///< The window, one value per sample.
+
+	/// The held-back input.
+	std::vector<float> input;
+
+	/// The held-back input mixed to mono, for the similarity search.
+	std::vector<float> mono;
+
+	/// Where, in input, the next segment would be taken from without
+	/// any nudging.
+	double analysis;
+
+	/// Where, in input, the last segment was taken from.
+	std::size_t previous;
+
+	/// Whether any segment has yet been laid down.
+	bool started;
+
+	/// The second half of the last segment, waiting to be overlapped.
+	std::vector<float> overlap;
+
+	/**
+	 * Lays down one segment, if there is enough input for it.
+	 * @param out The vector to which the finished output is appended.
+	 * @return True if a segment was laid down; false otherwise.
+	 */
+	bool Step(std::vector<float> &out);
+
+	/**
+	 * Finds where the next segment best continues the last.
+	 * @param centre The un-nudged position of the next segment.
+	 * @return The position of the next segment.
+	 */
+	std::size_t BestMatch(std::size_t centre) const;
+
+	/**
+	 * The number of samples of held-back input.
+	 * @return The number of (multi-channel) samples in input.
+	 */
+	std::size_t InputFrames() const;
+};
+
+#endif // PLAYD_TIME_STRETCH_HPP
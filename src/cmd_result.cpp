@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "metrics.hpp"
 #include "response.hpp"
 #include "cmd_result.hpp"
 
@@ -52,5 +53,6 @@ void CommandResult::Emit(const ResponseSink &sink,
 	r.AddArg(this->msg);
 	for (auto &cwd : cmd) r.AddArg(cwd);
 
+	Metrics::Get().CountCommand(cmd.empty() ? "" : cmd[0], this->type);
 	sink.Respond(r, id);
 }
@@ -0,0 +1,56 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the CommandLog class.
+ * @see command_log.hpp
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "command_log.hpp"
+#include "response.hpp"
+
+CommandLog::CommandLog(std::ostream &out)
+    : out(out), start(std::chrono::steady_clock::now())
+{
+}
+
+CommandLog::~CommandLog()
+{
+	this->out.flush();
+}
+
+void CommandLog::Open(std::size_t id)
+{
+	this->Begin(id, "open");
+	this->out << std::endl;
+}
+
+void CommandLog::Run(std::size_t id, const std::vector<std::string> &cmd)
+{
+	this->Begin(id, "run");
+	for (const auto &word : cmd) {
+		this->out << ' ' << Response::Escape(word);
+	}
+	this->out << '\n';
+}
+
+void CommandLog::Close(std::size_t id)
+{
+	this->Begin(id, "close");
+	this->out << std::endl;
+}
+
+void CommandLog::Begin(std::size_t id, const char *event)
+{
+	auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+	                      std::chrono::steady_clock::now() - this->start)
+	                      .count();
+	this->out << micros << ' ' << id << ' ' << event;
+}
@@ -0,0 +1,90 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the CommandLog class.
+ * @see command_log.cpp
+ */
+
+#ifndef PLAYD_COMMAND_LOG_HPP
+#define PLAYD_COMMAND_LOG_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * A log of every connection and command a playd is sent, for replaying.
+ *
+ * Each event is one line, which the Tokeniser can read back:
+ *
+ *     MICROS ID open
+ *     MICROS ID run WORD...
+ *     MICROS ID close
+ *
+ * MICROS is when the event happened, in microseconds since the log began;
+ * ID is the connection's ID, which may be re-used once it is closed.
+ * Command words are quoted as in responses.  A command is logged when it
+ * arrives, not when it runs, so the log shows what clients asked for and
+ * when.
+ *
+ * The log is written through a buffer, which is only flushed when a
+ * connection opens or closes, and when the log is destroyed.
+ */
+class CommandLog
+{
+public:
+	/**
+	 * Constructs a CommandLog.
+	 * @param out The stream to which the log is written.  It must
+	 *   outlive the CommandLog.
+	 */
+	explicit CommandLog(std::ostream &out);
+
+	/// Flushes the log.
+	~CommandLog();
+
+	/// Deleted copy constructor.
+	CommandLog(const CommandLog &) = delete;
+
+	/// Deleted copy-assignment.
+	CommandLog &operator=(const CommandLog &) = delete;
+
+	/**
+	 * Logs a new connection.
+	 * @param id The connection's ID.
+	 */
+	void Open(std::size_t id);
+
+	/**
+	 * Logs a command from a connection.
+	 * @param id The connection's ID.
+	 * @param cmd The command words.
+	 */
+	void Run(std::size_t id, const std::vector<std::string> &cmd);
+
+	/**
+	 * Logs the end of a connection.
+	 * @param id The connection's ID.
+	 */
+	void Close(std::size_t id);
+
+private:
+	/// The stream to which the log is written.
+	std::ostream &out;
+
+	/// When the log began.
+	std::chrono::steady_clock::time_point start;
+
+	/**
+	 * Starts a line of the log.
+	 * @param id The connection's ID.
+	 * @param event The name of the event.
+	 */
+	void Begin(std::size_t id, const char *event);
+};
+
+#endif // PLAYD_COMMAND_LOG_HPP
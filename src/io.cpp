@@ -16,24 +16,34 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csignal>
 #include <cstring>
 #include <sstream>
 #include <string>
+#include <utility>
 
 // If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
 // We don't want this.
 #undef UNICODE
 #include <uv.h>
 
+#include "cmd_result.hpp"
 #include "errors.hpp"
 #include "messages.h"
+#include "metrics.hpp"
 #include "player.hpp"
+#include "player_thread.hpp"
+#include "probes.hpp"
 #include "response.hpp"
+#include "trace.hpp"
 
 #include "io.hpp"
 
 const std::uint16_t IoCore::PLAYER_UPDATE_PERIOD = 5; // ms
+const std::uint64_t IoCore::METRICS_TIMEOUT = 5000;    // ms
+const std::size_t IoCore::METRICS_CLIENTS = 8;
+const std::size_t Connection::COMMAND_BUDGET = 32;
 
 //
 // libuv callbacks
@@ -61,6 +71,22 @@ struct WriteReq
 	bool fatal;       ///< Whether the Connection should now close.
 };
 
+/**
+ * A connection from a metrics scraper.
+ *
+ * Like the WriteReq, the MetricsClient can appear to libuv code as a
+ * `uv_tcp_t`, which it includes at the start of its memory footprint.  Both
+ * of its handles point back to it through their data, and it is freed once
+ * both have closed.
+ */
+struct MetricsClient
+{
+	uv_tcp_t tcp;        ///< The scraper's connection.
+	uv_timer_t deadline; ///< Closes the connection if the scraper stalls.
+	IoCore *io;          ///< The IoCore that accepted the connection.
+	int open_handles;    ///< The number of handles yet to close.
+};
+
 /// The function used to allocate and initialise buffers for client reading.
 void UvAlloc(uv_handle_t *, size_t suggested_size, uv_buf_t *buf)
 {
@@ -97,6 +123,113 @@ void UvListenCallback(uv_stream_t *server, int status)
 	pool->Accept(server);
 }
 
+/// The callback fired when one of a metrics connection's handles closes.
+void UvMetricsCloseCallback(uv_handle_t *handle)
+{
+	assert(handle != nullptr);
+
+	auto client = static_cast<MetricsClient *>(handle->data);
+	assert(client != nullptr);
+
+	if (0 < --client->open_handles) return;
+	client->io->MetricsClosed();
+	delete client;
+}
+
+/**
+ * Closes a metrics connection, if it isn't already closing.
+ * @param client The metrics connection.
+ */
+void CloseMetricsClient(MetricsClient *client)
+{
+	assert(client != nullptr);
+
+	auto tcp = reinterpret_cast<uv_handle_t *>(&client->tcp);
+	if (uv_is_closing(tcp)) return;
+
+	uv_close(tcp, UvMetricsCloseCallback);
+	uv_close(reinterpret_cast<uv_handle_t *>(&client->deadline),
+	         UvMetricsCloseCallback);
+}
+
+/// The callback fired when a scraper has taken too long.
+void UvMetricsDeadlineCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+
+	CloseMetricsClient(static_cast<MetricsClient *>(handle->data));
+}
+
+/// The callback fired when a scraper connects to the metrics listener.
+void UvMetricsListenCallback(uv_stream_t *server, int status)
+{
+	if (status < 0) return;
+	assert(server != nullptr);
+
+	IoCore *io = static_cast<IoCore *>(server->data);
+	assert(io != nullptr);
+
+	io->AcceptMetrics(server);
+}
+
+/// The callback fired when the metrics have been sent to a scraper.
+void UvMetricsWrittenCallback(uv_write_t *req, int)
+{
+	auto *wr = reinterpret_cast<WriteReq *>(req);
+	assert(wr != nullptr);
+
+	// If the deadline passed mid-write, the connection is already closing.
+	CloseMetricsClient(static_cast<MetricsClient *>(wr->req.data));
+	delete[] wr -> buf.base;
+	delete wr;
+}
+
+/// The callback fired when a scraper sends its request.
+void UvMetricsReadCallback(uv_stream_t *stream, ssize_t nread,
+                           const uv_buf_t *buf)
+{
+	assert(stream != nullptr);
+	assert(buf != nullptr);
+
+	delete[] buf->base;
+	if (nread == 0) return;
+
+	auto client = static_cast<MetricsClient *>(stream->data);
+	assert(client != nullptr);
+
+	// Whatever the scraper asked for, it gets the metrics: it is only
+	// ever going to ask for them, and we only need to answer once.
+	uv_read_stop(stream);
+	if (nread < 0) {
+		CloseMetricsClient(client);
+		return;
+	}
+
+	std::ostringstream body;
+	Metrics::Get().Write(body);
+	auto text = body.str();
+
+	std::ostringstream http;
+	http << "HTTP/1.0 200 OK\r\n"
+	     << "Content-Type: text/plain; version=0.0.4\r\n"
+	     << "Content-Length: " << text.size() << "\r\n"
+	     << "Connection: close\r\n\r\n"
+	     << text;
+	auto response = http.str();
+
+	// The write request carries the client, so we can close it after.
+	// The deadline keeps running, in case the scraper never reads this.
+	auto req = new WriteReq;
+	req->req.data = static_cast<void *>(client);
+	req->conn = nullptr;
+	req->fatal = false;
+	req->buf = uv_buf_init(new char[response.size()], response.size());
+	memcpy(req->buf.base, response.data(), response.size());
+
+	uv_write((uv_write_t *)req, stream, &req->buf, 1,
+	         UvMetricsWrittenCallback);
+}
+
 /// The callback fired when a response has been sent to a client.
 void UvRespondCallback(uv_write_t *req, int status)
 {
@@ -126,18 +259,78 @@ void UvUpdateTimerCallback(uv_timer_t *handle)
 	io->UpdatePlayer();
 }
 
+/// The callback fired on each loop iteration while commands are backlogged.
+void UvDrainCallback(uv_idle_t *handle)
+{
+	assert(handle != nullptr);
+
+	IoCore *io = static_cast<IoCore *>(handle->data);
+	assert(io != nullptr);
+	io->DrainBacklogs();
+}
+
+/// The callback fired when the player thread has replies waiting.
+void UvWakeupCallback(uv_async_t *handle)
+{
+	assert(handle != nullptr);
+
+	IoCore *io = static_cast<IoCore *>(handle->data);
+	assert(io != nullptr);
+	io->TakeReplies();
+}
+
 //
 // IoCore
 //
 
-IoCore::IoCore(Player &player) : player(player)
+IoCore::IoCore(Player &player)
+    : player(player),
+      player_thread(nullptr),
+      command_log(nullptr),
+      clients(0),
+      metrics_clients(0)
+{
+}
+
+void IoCore::ServeMetrics(const std::string &host, const std::string &port)
+{
+	this->metrics_host = host;
+	this->metrics_port = port;
+}
+
+void IoCore::UseCommandLog(CommandLog &log)
+{
+	this->command_log = &log;
+}
+
+void IoCore::UsePlayerThread(PlayerThread &thread)
 {
+	this->player_thread = &thread;
 }
 
 void IoCore::Run(const std::string &host, const std::string &port)
 {
-	this->InitAcceptor(host, port);
-	this->DoUpdateTimer();
+	this->InitAcceptor(this->server, host, port, UvListenCallback);
+	if (!this->metrics_port.empty()) {
+		this->InitAcceptor(this->metrics_server, this->metrics_host,
+		                   this->metrics_port, UvMetricsListenCallback);
+	}
+
+	uv_idle_init(uv_default_loop(), &this->drainer);
+	this->drainer.data = static_cast<void *>(this);
+
+	if (this->player_thread == nullptr) {
+		this->DoUpdateTimer();
+	} else {
+		uv_async_init(uv_default_loop(), &this->wakeup,
+		              UvWakeupCallback);
+		this->wakeup.data = static_cast<void *>(this);
+
+		// uv_async_send is the one libuv call safe from other threads.
+		this->player_thread->Start(
+		        [this]() { uv_async_send(&this->wakeup); });
+	}
+
 	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
 }
 
@@ -154,18 +347,68 @@ void IoCore::Accept(uv_stream_t *server)
 		return;
 	}
 
+	auto &metrics = Metrics::Get();
+	metrics.connections.fetch_add(1, std::memory_order_relaxed);
+	metrics.connections_total.fetch_add(1, std::memory_order_relaxed);
+
 	auto id = this->NextConnectionID();
-	auto conn = std::make_shared<Connection>(*this, client, this->player, id);
+	auto conn = std::make_shared<Connection>(*this, client, id);
 	client->data = static_cast<void *>(conn.get());
 	this->pool[id - 1] = std::move(conn);
+	this->clients++;
+	if (this->player_thread != nullptr) {
+		this->player_thread->SetListening(true);
+	}
+	if (this->command_log != nullptr) this->command_log->Open(id);
 
 	// The player will already have been told to send responses to the
-	// IoCore, so all it needs to know is the slot.
-	this->player.WelcomeClient(id);
+	// IoCore (or the player thread), so all it needs to know is the slot.
+	if (this->player_thread == nullptr) {
+		this->player.WelcomeClient(id);
+	} else {
+		PlayerThread::Command welcome{
+		        PlayerThread::Command::Kind::WELCOME, {}, id, {}};
+		this->Submit(welcome);
+	}
 
 	uv_read_start((uv_stream_t *)client, UvAlloc, UvReadCallback);
 }
 
+void IoCore::AcceptMetrics(uv_stream_t *server)
+{
+	assert(server != nullptr);
+
+	auto client = new MetricsClient();
+	client->io = this;
+	client->open_handles = 2;
+	uv_tcp_init(uv_default_loop(), &client->tcp);
+	uv_timer_init(uv_default_loop(), &client->deadline);
+	client->tcp.data = static_cast<void *>(client);
+	client->deadline.data = static_cast<void *>(client);
+	this->metrics_clients++;
+
+	// Scrapers are few, so past a handful at once, something is wrong;
+	// we accept the excess only to close it.
+	auto stream = reinterpret_cast<uv_stream_t *>(&client->tcp);
+	if (uv_accept(server, stream) ||
+	    METRICS_CLIENTS < this->metrics_clients) {
+		CloseMetricsClient(client);
+		return;
+	}
+
+	// A scraper that never sends its request, or never reads the answer,
+	// would otherwise hold its connection open for good.
+	uv_timer_start(&client->deadline, UvMetricsDeadlineCallback,
+	               METRICS_TIMEOUT, 0);
+	uv_read_start(stream, UvAlloc, UvMetricsReadCallback);
+}
+
+void IoCore::MetricsClosed()
+{
+	assert(0 < this->metrics_clients);
+	this->metrics_clients--;
+}
+
 size_t IoCore::NextConnectionID()
 {
 	// We'll want to try and use an existing, empty ID in the connection
@@ -211,14 +454,130 @@ void IoCore::Remove(size_t slot)
 	// slot on the free list twice.
 	if (this->pool.at(slot - 1)) {
 		this->pool[slot - 1] = nullptr;
-		this->free_list.push_back(slot);
+		Metrics::Get().connections.fetch_sub(
+		        1, std::memory_order_relaxed);
+		this->clients--;
+		if (this->command_log != nullptr) {
+			this->command_log->Close(slot);
+		}
+
+		if (this->player_thread == nullptr) {
+			this->free_list.push_back(slot);
+		} else {
+			this->player_thread->SetListening(this->clients != 0);
+
+			// The player thread may still have replies for this
+			// slot queued up; we can't give the slot to anyone
+			// else until they're all out.
+			PlayerThread::Command release{
+			        PlayerThread::Command::Kind::RELEASE, {}, slot,
+			        {}};
+			this->Submit(release);
+		}
 	}
 
 	assert(!this->pool.at(slot - 1));
 }
 
+void IoCore::Dispatch(const std::vector<std::string> &cmd, size_t id,
+                      std::chrono::steady_clock::time_point read_at)
+{
+	if (this->player_thread == nullptr) {
+		CommandResult res = this->player.RunCommand(cmd, id);
+		if (res.IsSuccess()) Metrics::Get().audible.Arm(cmd, read_at);
+		res.Emit(*this, cmd, id);
+		return;
+	}
+
+	PlayerThread::Command run{PlayerThread::Command::Kind::RUN, cmd, id,
+	                          read_at};
+	if (this->Submit(run)) return;
+	CommandResult::Failure(MSG_PLAYER_BUSY).Emit(*this, cmd, id);
+}
+
+void IoCore::LogCommands(const std::vector<std::vector<std::string>> &cmds,
+                         size_t id)
+{
+	if (this->command_log == nullptr) return;
+
+	// Empty lines never run, so there's nothing to replay.
+	for (const auto &cmd : cmds) {
+		if (!cmd.empty()) this->command_log->Run(id, cmd);
+	}
+}
+
+bool IoCore::Submit(PlayerThread::Command &command)
+{
+	assert(this->player_thread != nullptr);
+
+	this->SubmitDeferred();
+	if (this->deferred.empty() && this->player_thread->Push(command)) {
+		return true;
+	}
+
+	if (command.kind == PlayerThread::Command::Kind::RUN) return false;
+	this->deferred.push_back(std::move(command));
+	return true;
+}
+
+void IoCore::SubmitDeferred()
+{
+	while (!this->deferred.empty() &&
+	       this->player_thread->Push(this->deferred.front())) {
+		this->deferred.pop_front();
+	}
+}
+
+void IoCore::DrainLater()
+{
+	// Idle handles run after timers, so a due player update happens
+	// first; while one is active, the loop also doesn't block on I/O.
+	uv_idle_start(&this->drainer, UvDrainCallback);
+}
+
+void IoCore::DrainBacklogs()
+{
+	TraceSpan span("IoCore::DrainBacklogs");
+
+	// Copy each connection by value, so that it stays alive throughout.
+	bool waiting = false;
+	for (const auto c : this->pool) {
+		if (c && c->RunBacklog()) waiting = true;
+	}
+
+	if (!waiting) uv_idle_stop(&this->drainer);
+}
+
+void IoCore::TakeReplies()
+{
+	assert(this->player_thread != nullptr);
+
+	PlayerThread::Reply reply;
+	while (this->player_thread->TakeReply(reply)) {
+		switch (reply.kind) {
+			case PlayerThread::Reply::Kind::RESPONSE:
+				this->Respond(reply.response, reply.id);
+				break;
+			case PlayerThread::Reply::Kind::RELEASED:
+				this->free_list.push_back(reply.id);
+				break;
+			case PlayerThread::Reply::Kind::QUIT:
+				// The thread has finished, or is about to; once
+				// it has, nothing else will touch the wakeup.
+				this->player_thread->Join();
+				this->Shutdown();
+				return;
+		}
+	}
+
+	// Making room in the reply queue will have been because the thread
+	// took some commands, so there may now be room for deferred ones.
+	this->SubmitDeferred();
+}
+
 void IoCore::UpdatePlayer()
 {
+	TraceSpan span("IoCore::UpdatePlayer");
 	bool running = this->player.Update();
 	if (!running) this->Shutdown();
 }
@@ -229,12 +588,24 @@ void IoCore::Shutdown()
 	// in order to disconnect clients and stop the updating.
 	// We do this by stopping everything using the loop.
 
-	// First, the update timer:
-	uv_timer_stop(&this->updater);
+	// First, the update timer, or the player thread's wakeup:
+	if (this->player_thread == nullptr) {
+		uv_timer_stop(&this->updater);
+	} else {
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->wakeup),
+		         nullptr);
+	}
+
+	// Then, the backlog drainer; nothing left in a backlog matters now:
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->drainer), nullptr);
 
 	// Then, the TCP server (as far as we can tell, this does *not* close
 	// down the connections):
 	uv_close(reinterpret_cast<uv_handle_t *>(&this->server), nullptr);
+	if (!this->metrics_port.empty()) {
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->metrics_server),
+		         nullptr);
+	}
 
 	// Finally, kill off all of the connections with 'fatal' responses.
 	for (const auto conn : this->pool) IoCore::TryShutdown(conn);
@@ -269,13 +640,26 @@ void IoCore::Respond(const Response &response, size_t id) const
 	}
 }
 
+bool IoCore::Listening() const
+{
+	return this->clients != 0;
+}
+
 void IoCore::Broadcast(const Response &response) const
 {
-	Debug() << "broadcast:" << response.Pack() << std::endl;
+	TraceSpan span("IoCore::Broadcast");
+	auto packed = response.Pack();
+	Debug() << "broadcast:" << packed << std::endl;
 
 	// Copy the connection by value, so that there's at least one
 	// active reference to it throughout.
-	for (const auto c : this->pool) IoCore::TryRespond(c, response);
+	std::uint64_t bytes = 0;
+	for (const auto c : this->pool) {
+		if (c) bytes += packed.Size() + 1; // +1 for the newline
+		IoCore::TryRespond(c, response);
+	}
+	Metrics::Get().broadcast_bytes.fetch_add(bytes,
+	                                         std::memory_order_relaxed);
 }
 
 void IoCore::Unicast(const Response &response, size_t id) const
@@ -296,19 +680,20 @@ void IoCore::DoUpdateTimer()
 	               PLAYER_UPDATE_PERIOD);
 }
 
-void IoCore::InitAcceptor(const std::string &address, const std::string &port)
+void IoCore::InitAcceptor(uv_tcp_t &server, const std::string &address,
+                          const std::string &port, uv_connection_cb cb)
 {
 	int uport = std::stoi(port);
 
-	uv_tcp_init(uv_default_loop(), &this->server);
-	this->server.data = static_cast<void *>(this);
-	assert(this->server.data != nullptr);
+	uv_tcp_init(uv_default_loop(), &server);
+	server.data = static_cast<void *>(this);
+	assert(server.data != nullptr);
 
 	struct sockaddr_in bind_addr;
 	uv_ip4_addr(address.c_str(), uport, &bind_addr);
-	uv_tcp_bind(&this->server, (const sockaddr *)&bind_addr, 0);
+	uv_tcp_bind(&server, (const sockaddr *)&bind_addr, 0);
 
-	int r = uv_listen((uv_stream_t *)&this->server, 128, UvListenCallback);
+	int r = uv_listen((uv_stream_t *)&server, 128, cb);
 	if (r) {
 		throw NetError("Could not listen on " + address + ":" + port +
 		               " (" + std::string(uv_err_name(r)) + ")");
@@ -321,8 +706,8 @@ void IoCore::InitAcceptor(const std::string &address, const std::string &port)
 // Connection
 //
 
-Connection::Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id)
-    : parent(parent), tcp(tcp), tokeniser(), player(player), id(id)
+Connection::Connection(IoCore &parent, uv_tcp_t *tcp, size_t id)
+    : parent(parent), tcp(tcp), tokeniser(), id(id), paused(false)
 {
 	Debug() << "Opening connection from" << Name() << std::endl;
 }
@@ -330,16 +715,19 @@ Connection::Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id)
 Connection::~Connection()
 {
 	Debug() << "Closing connection from" << Name() << std::endl;
+	Metrics::Get().command_backlog.fetch_sub(this->backlog.size(),
+	                                         std::memory_order_relaxed);
 	uv_close((uv_handle_t *)this->tcp, UvCloseCallback);
 }
 
 void Connection::Respond(const Response &response, bool fatal)
 {
-	auto string = response.Pack();
+	auto packed = response.Pack();
 
-	unsigned int l = string.length();
-	const char *s = string.c_str();
+	unsigned int l = packed.Size();
+	const char *s = packed.Data();
 	assert(s != nullptr);
+	PD_PROBE2(respond, this->id, l);
 
 	auto req = new WriteReq;
 	req->conn = this;
@@ -415,21 +803,63 @@ void Connection::Read(ssize_t nread, const uv_buf_t *buf)
 	if (chars == nullptr) return;
 
 	// Everything looks okay for reading.
+	auto read_at = std::chrono::steady_clock::now();
 	auto cmds = this->tokeniser.Feed(std::string(chars, nread));
-	for (auto cmd : cmds) RunCommand(cmd);
 	delete[] chars;
+	this->parent.LogCommands(cmds, this->id);
+
+	auto &metrics = Metrics::Get();
+	auto count = cmds.size();
+	metrics.command_backlog.fetch_add(count, std::memory_order_relaxed);
+	for (auto &cmd : cmds) {
+		this->backlog.push_back(Pending{std::move(cmd), read_at});
+	}
+
+	if (!this->RunBacklog()) return;
+
+	// Whatever of this read didn't get to run now has to wait.
+	auto deferred = std::min(this->backlog.size(), count);
+	metrics.commands_deferred.fetch_add(deferred,
+	                                    std::memory_order_relaxed);
+	this->parent.DrainLater();
+}
+
+bool Connection::RunBacklog()
+{
+	auto &waiting = Metrics::Get().command_backlog;
+	for (std::size_t run = 0;
+	     run < COMMAND_BUDGET && !this->backlog.empty(); run++) {
+		auto cmd = std::move(this->backlog.front());
+		this->backlog.pop_front();
+		waiting.fetch_sub(1, std::memory_order_relaxed);
+		this->RunCommand(cmd);
+	}
+
+	// Stop reading while there's a backlog, so that the client's own
+	// buffers fill up instead of ours.
+	auto stream = reinterpret_cast<uv_stream_t *>(this->tcp);
+	if (this->backlog.empty()) {
+		if (this->paused) uv_read_start(stream, UvAlloc, UvReadCallback);
+		this->paused = false;
+		return false;
+	}
+
+	if (!this->paused) uv_read_stop(stream);
+	this->paused = true;
+	return true;
 }
 
-void Connection::RunCommand(const std::vector<std::string> &cmd)
+void Connection::RunCommand(const Pending &cmd)
 {
-	if (cmd.empty()) return;
+	auto &words = cmd.words;
+	if (words.empty()) return;
 
 	Debug() << "Received command:";
-	for (const auto &word : cmd) std::cerr << ' ' << '"' << word << '"';
+	for (const auto &word : words) std::cerr << ' ' << '"' << word << '"';
 	std::cerr << std::endl;
 
-	CommandResult res = this->player.RunCommand(cmd, this->id);
-	res.Emit(this->parent, cmd, this->id);
+	PD_PROBE2(command, this->id, words[0].c_str());
+	this->parent.Dispatch(words, this->id, cmd.read_at);
 }
 
 void Connection::Depool()
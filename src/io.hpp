@@ -10,12 +10,16 @@
 #ifndef PLAYD_IO_CORE_HPP
 #define PLAYD_IO_CORE_HPP
 
+#include <chrono>
+#include <deque>
 #include <ostream>
 #include <set>
 
 #include <uv.h>
 
+#include "command_log.hpp"
 #include "player.hpp"
+#include "player_thread.hpp"
 #include "response.hpp"
 #include "tokeniser.hpp"
 
@@ -29,6 +33,10 @@ class Connection;
  * The IO core also maintains a pool of connections which can be sent responses
  * via their IDs inside the pool.  It ensures that each connection is given an
  * ID that is unique up until the removal of said connection.
+ *
+ * If given a PlayerThread, the IO core instead leaves the player to that
+ * thread: it passes commands over without waiting for them, and sends out
+ * the thread's replies whenever it is told there are some.
  */
 class IoCore : public ResponseSink
 {
@@ -46,13 +54,41 @@ public:
 	/// Deleted copy-assignment.
 	IoCore &operator=(const IoCore &) = delete;
 
+	/**
+	 * Hands the player over to a PlayerThread.
+	 * This must be called before Run, and the thread must not yet be
+	 * started; Run will start it.
+	 * @param thread The thread, which must be running this IoCore's
+	 *   player.
+	 */
+	void UsePlayerThread(PlayerThread &thread);
+
+	/**
+	 * Also serves Metrics, over HTTP, on the given address and port.
+	 * Every request gets the metrics in the Prometheus text format.
+	 * At most METRICS_CLIENTS scrapers may be connected at once, and
+	 * each is cut off after METRICS_TIMEOUT.
+	 * This must be called before Run.
+	 * @param host The IP host to which the metrics listener will bind;
+	 *   this should almost always be a loopback address.
+	 * @param port The TCP port to which the metrics listener will bind.
+	 */
+	void ServeMetrics(const std::string &host, const std::string &port);
+
+	/**
+	 * Logs every connection and command to a CommandLog.
+	 * This must be called before Run.
+	 * @param log The log, which must outlive the IoCore.
+	 */
+	void UseCommandLog(CommandLog &log);
+
 	/**
 	 * Runs the reactor.
 	 * It will block until it terminates.
 	 * @param host The IP host to which IoCore will bind.
 	 * @param port The TCP port to which IoCore will bind.
 	 * @exception NetError Thrown if IoCore cannot bind to @a host or @a
-	 *   port.
+	 *   port, or to the metrics host and port.
 	 */
 	void Run(const std::string &host, const std::string &port);
 
@@ -73,6 +109,18 @@ public:
 	 */
 	void Accept(uv_stream_t *server);
 
+	/**
+	 * Accepts a new connection to the metrics listener.
+	 * The connection isn't pooled: it is closed once it has been sent
+	 * the metrics, or once METRICS_TIMEOUT passes, whichever is first.
+	 * If METRICS_CLIENTS are already connected, it is closed at once.
+	 * @param server Pointer to the libuv server accepting connections.
+	 */
+	void AcceptMetrics(uv_stream_t *server);
+
+	/// Forgets a metrics connection that has finished closing.
+	void MetricsClosed();
+
 	/**
 	 * Removes a connection.
 	 * As the IoCore owns the Connection, it will be destroyed by this
@@ -81,6 +129,45 @@ public:
 	 */
 	void Remove(size_t id);
 
+	/**
+	 * Runs a command line from a connection.
+	 * With a PlayerThread, this only queues the command; if the queue is
+	 * full, the command fails straight away, and that failure may reach
+	 * the client before the ACKs of its earlier commands.
+	 * @param cmd The command words.
+	 * @param id The ID of the connection sending the command.
+	 * @param read_at When the command was read off the connection.
+	 */
+	void Dispatch(const std::vector<std::string> &cmd, size_t id,
+	              std::chrono::steady_clock::time_point read_at);
+
+	/**
+	 * Logs commands as they arrive from a connection, if there is a
+	 * CommandLog.
+	 * @param cmds The command lines, some of which may be empty.
+	 * @param id The ID of the connection sending the commands.
+	 */
+	void LogCommands(const std::vector<std::vector<std::string>> &cmds,
+	                 size_t id);
+
+	/**
+	 * Arranges for connections' command backlogs to be drained.
+	 * Each connection with a backlog gets to run some of it on each
+	 * loop iteration, until none have any left.
+	 * @see Connection::RunBacklog
+	 */
+	void DrainLater();
+
+	/// Lets each connection run part of its command backlog.
+	void DrainBacklogs();
+
+	/**
+	 * Sends out all of the PlayerThread's waiting replies.
+	 * If the player has stopped, this also shuts down the IoCore.
+	 * @exception Error Rethrown if the player thread died of one.
+	 */
+	void TakeReplies();
+
 	/**
 	 * Performs a player update cycle.
 	 * If the player is closing, IoCore will announce this fact to
@@ -90,14 +177,39 @@ public:
 
 	void Respond(const Response &response, size_t id = 0) const override;
 
+	/// @return Whether any clients are connected.
+	bool Listening() const override;
+
 private:
 	/// The period between player updates.
 	static const uint16_t PLAYER_UPDATE_PERIOD;
 
-	uv_tcp_t server;    ///< The libuv handle for the TCP server.
+	/// The longest, in milliseconds, a metrics connection may stay open.
+	static const std::uint64_t METRICS_TIMEOUT;
+
+	/// The most metrics connections that may be open at once.
+	static const std::size_t METRICS_CLIENTS;
+
+	uv_tcp_t server;         ///< The libuv handle for the TCP server.
+	uv_tcp_t metrics_server; ///< The libuv handle for the metrics server.
 	uv_timer_t updater; ///< The libuv handle for the update timer.
+	uv_async_t wakeup;  ///< The libuv handle woken by the player thread.
+	uv_idle_t drainer;  ///< The libuv handle draining command backlogs.
 	Player &player;     ///< The player.
 
+	std::string metrics_host; ///< The metrics listener's host, if any.
+	std::string metrics_port; ///< The metrics listener's port, if any.
+
+	/// The thread running the player, or nullptr if we run it.
+	PlayerThread *player_thread;
+
+	/// The log of connections and commands, or nullptr if there isn't one.
+	CommandLog *command_log;
+
+	/// Commands that must reach the player thread, but didn't fit in its
+	/// queue, oldest first.
+	std::deque<PlayerThread::Command> deferred;
+
 	/// The set of connections inside this IoCore.
 	std::vector<std::shared_ptr<Connection>> pool;
 
@@ -105,14 +217,24 @@ private:
 	/// These slots may be re-used instead of creating a new slot.
 	std::vector<size_t> free_list;
 
+	/// The number of connections inside pool.
+	std::size_t clients;
+
+	/// The number of metrics connections open, or still closing.
+	std::size_t metrics_clients;
+
 	/**
 	 * Initialises a TCP acceptor on the given address and port.
 	 *
+	 * @param server The handle to use for the TCP server.
 	 * @param address The IPv4 address on which the TCP server should
 	 *   listen.
 	 * @param port The TCP port on which the TCP server should listen.
+	 * @param cb The callback fired on each new connection.
+	 * @exception NetError Thrown if the server cannot listen.
 	 */
-	void InitAcceptor(const std::string &address, const std::string &port);
+	void InitAcceptor(uv_tcp_t &server, const std::string &address,
+	                  const std::string &port, uv_connection_cb cb);
 
 	/// Sets up a periodic timer to run the playd update loop.
 	void DoUpdateTimer();
@@ -120,6 +242,19 @@ private:
 	/// Shuts down the IoCore by terminating all IO loop tasks.
 	void Shutdown();
 
+	/**
+	 * Hands a command to the player thread, keeping its order with any
+	 * deferred commands.
+	 * Commands other than RUN are deferred, rather than dropped, if the
+	 * queue is full.
+	 * @param command The command, which is moved from if it was taken.
+	 * @return True if the command was queued or deferred; false if not.
+	 */
+	bool Submit(PlayerThread::Command &command);
+
+	/// Hands as many deferred commands to the player thread as will fit.
+	void SubmitDeferred();
+
 	//
 	// Connection pool handling
 	//
@@ -187,6 +322,12 @@ private:
  * This class wraps a libuv TCP stream representing a client connection,
  * allowing it to be sent responses (directly, or via a broadcast), removed
  * from its IoCore, and queried for its name.
+ *
+ * A Connection runs at most COMMAND_BUDGET commands at a time.  Any more
+ * wait in its backlog, which the IoCore drains on later loop iterations
+ * (after any player update due), and the Connection stops reading until
+ * its backlog is empty.  This stops one client flooding playd with
+ * commands from starving the player, and everyone else, of time.
  */
 class Connection
 {
@@ -195,10 +336,9 @@ public:
 	 * Constructs a Connection.
 	 * @param parent The connection pool to which this Connection belongs.
 	 * @param tcp The underlying libuv TCP stream.
-	 * @param player The player to which read commands should be sent.
 	 * @param id The ID of this Connection in the IoCore.
 	 */
-	Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id);
+	Connection(IoCore &parent, uv_tcp_t *tcp, size_t id);
 
 	/**
 	 * Destructs a Connection.
@@ -227,6 +367,12 @@ public:
 	 */
 	void Read(ssize_t nread, const uv_buf_t *buf);
 
+	/**
+	 * Runs up to COMMAND_BUDGET commands from this connection's backlog.
+	 * @return True if there are still commands waiting.
+	 */
+	bool RunBacklog();
+
 	/**
 	 * Removes this connection from its connection pool.
 	 * Since the pool may contain a shared reference to this connection,
@@ -251,17 +397,29 @@ private:
 	/// The Tokeniser to which data read on this connection should be sent.
 	Tokeniser tokeniser;
 
-	/// The Player to which finished commands should be sent.
-	Player &player;
-
 	/// The Connection's ID in the connection pool.
 	size_t id;
 
+	/// The most commands run from one connection in one go.
+	static const std::size_t COMMAND_BUDGET;
+
+	/// A command read, but not yet run.
+	struct Pending {
+		std::vector<std::string> words; ///< The command line.
+		std::chrono::steady_clock::time_point read_at; ///< When read.
+	};
+
+	/// Commands read, but not yet run, oldest first.
+	std::deque<Pending> backlog;
+
+	/// Whether reading has stopped until the backlog is drained.
+	bool paused;
+
 	/**
 	 * Handles a tokenised command line.
-	 * @param msg A vector of command words representing a command line.
+	 * @param cmd The command line, and when it was read.
 	 */
-	void RunCommand(const std::vector<std::string> &msg);
+	void RunCommand(const Pending &cmd);
 };
 
 #endif // PLAYD_IO_CORE_HPP
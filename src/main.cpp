@@ -8,14 +8,26 @@
  */
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include "audio/audio_system.hpp"
+#include "audio/null_sink.hpp"
+#include "audio/sample_formats.hpp"
+#include "command_log.hpp"
 #include "io.hpp"
 #include "response.hpp"
 #include "player.hpp"
+#include "player_thread.hpp"
+#include "realtime.hpp"
+#include "trace.hpp"
 #include "messages.h"
 
 #ifdef WITH_MP3
@@ -31,6 +43,15 @@ static const std::string DEFAULT_HOST = "0.0.0.0";
 /// The default TCP port on which playd will bind.
 static const std::string DEFAULT_PORT = "1350";
 
+/// The IP hostname on which playd serves metrics, if asked to.
+static const std::string METRICS_HOST = "127.0.0.1";
+
+/// The default silence threshold for cue point analysis, in dBFS.
+static const double DEFAULT_CUE_THRESHOLD_DB = -60.0;
+
+/// Type of the map from program option names to their values.
+using Options = std::map<std::string, std::string>;
+
 /**
  * Creates a vector of strings from a C-style argument vector.
  * @param argc Program argument count.
@@ -44,12 +65,47 @@ std::vector<std::string> MakeArgVector(int argc, char *argv[])
 	return args;
 }
 
+/**
+ * Removes program options from an argument vector.
+ *
+ * Options are arguments of the form `--name` or `--name=value`, and may
+ * appear anywhere in the argument vector.  Options without a value are
+ * mapped to the empty string.
+ *
+ * @param args The program argument vector, which will be left with only the
+ *   positional arguments.
+ * @return The map of options to their values.
+ */
+Options TakeOptions(std::vector<std::string> &args)
+{
+	Options options;
+
+	auto is_option = [](const std::string &arg) {
+		return arg.compare(0, 2, "--") == 0;
+	};
+
+	for (const auto &arg : args) {
+		if (!is_option(arg)) continue;
+
+		auto eq = arg.find('=');
+		auto name = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+		auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+		options[name] = value;
+	}
+
+	args.erase(std::remove_if(args.begin(), args.end(), is_option),
+	           args.end());
+	return options;
+}
+
 /**
  * Tries to get the output device ID from program arguments.
  * @param args The program argument vector.
+ * @param on_device Whether audio goes to the device; if not, any
+ *   non-negative ID is accepted, as it will be ignored.
  * @return The device ID, -1 if invalid selection (or none).
  */
-int GetDeviceID(const std::vector<std::string> &args)
+int GetDeviceID(const std::vector<std::string> &args, bool on_device)
 {
 	// Did the user provide an ID at all?
 	if (args.size() < 2) return -1;
@@ -64,18 +120,175 @@ int GetDeviceID(const std::vector<std::string> &args)
 	}
 
 	// Only allow valid, outputtable devices; reject input-only devices.
-	if (!SdlAudioSink::IsOutputDevice(id)) return -1;
+	if (on_device ? !SdlAudioSink::IsOutputDevice(id) : id < 0) return -1;
 
 	return id;
 }
 
+/**
+ * Configures cue point analysis, if requested by the program options.
+ *
+ * `--cue-threshold=DB` turns on analysis with a silence threshold of DB dBFS;
+ * `--cue-trim` additionally trims playback to the analysed cue points.
+ *
+ * @param audio The audio system to configure.
+ * @param options The program options.
+ */
+void SetupCueAnalysis(AudioSystem &audio, const Options &options)
+{
+	auto threshold = options.find("cue-threshold");
+	bool trim = options.count("cue-trim") != 0;
+	if (threshold == options.end() && !trim) return;
+
+	double db = DEFAULT_CUE_THRESHOLD_DB;
+	if (threshold != options.end()) {
+		try {
+			db = std::stod(threshold->second);
+		} catch (...) {
+			std::cerr << "invalid --cue-threshold; using default\n";
+		}
+	}
+
+	audio.SetCueAnalysis(std::pow(10.0, db / 20.0), trim);
+}
+
+/// Map from --float-pipeline option values to device sample formats.
+static const std::map<std::string, SampleFormat> DEVICE_FORMATS = {
+        {"u8", SampleFormat::PACKED_UNSIGNED_INT_8},
+        {"s8", SampleFormat::PACKED_SIGNED_INT_8},
+        {"s16", SampleFormat::PACKED_SIGNED_INT_16},
+        {"s32", SampleFormat::PACKED_SIGNED_INT_32},
+        {"f32", SampleFormat::PACKED_FLOAT_32}};
+
+/**
+ * Parses the value of a `--downmix` option.
+ *
+ * The value is `CENTRE,SURROUND` or `CENTRE,SURROUND,LFE`, each a gain in dB.
+ * Anything unparseable falls back to the ITU gains.
+ *
+ * @param value The option value.
+ * @return The downmix gains.
+ */
+DownmixGains ParseDownmix(const std::string &value)
+{
+	auto gains = DownmixGains::Itu();
+
+	std::vector<double> dbs;
+	std::string::size_type start = 0;
+	try {
+		while (start <= value.size()) {
+			auto comma = value.find(',', start);
+			if (comma == std::string::npos) comma = value.size();
+			dbs.push_back(std::stod(value.substr(start, comma - start)));
+			start = comma + 1;
+		}
+	} catch (...) {
+		dbs.clear();
+	}
+
+	if (dbs.size() < 2 || 3 < dbs.size()) {
+		std::cerr << "invalid --downmix; using ITU gains\n";
+		return gains;
+	}
+
+	auto linear = [](double db) { return std::pow(10.0, db / 20.0); };
+	gains.centre = linear(dbs[0]);
+	gains.surround = linear(dbs[1]);
+	if (dbs.size() == 3) gains.lfe = linear(dbs[2]);
+	return gains;
+}
+
+/**
+ * Parses the value of a `--sink` option.
+ *
+ * The value is `null`, for a NullAudioSink, or `file:PATH`, for a
+ * FileAudioSink appending to PATH; the file is emptied first.  Anything
+ * else falls back to the null sink, rather than the device, whose ID won't
+ * have been checked.
+ *
+ * @param value The option value.
+ * @return The function building the sinks.
+ */
+AudioSystem::SinkBuilder ParseSink(const std::string &value)
+{
+	static const std::string FILE_PREFIX = "file:";
+
+	bool to_file = value.compare(0, FILE_PREFIX.size(), FILE_PREFIX) == 0 &&
+	               FILE_PREFIX.size() < value.size();
+	if (!to_file) {
+		if (value != "null") {
+			std::cerr << "invalid --sink; using null\n";
+		}
+		return &NullAudioSink::Build;
+	}
+
+	auto path = value.substr(FILE_PREFIX.size());
+	std::ofstream emptied(path, std::ios::out | std::ios::trunc);
+	return [path](const AudioSource &source, int) {
+		return std::unique_ptr<AudioSink>(
+		        new FileAudioSink(source, path));
+	};
+}
+
+/**
+ * Configures the audio sink, and the float pipeline if requested.
+ *
+ * `--float-pipeline` decodes everything to floating point, converting it to
+ * the device's format only on output; `--float-pipeline=FORMAT` also picks
+ * that format.  `--downmix=GAINS` sets the gains used when the device has
+ * fewer channels than the file.  `--sink=SINK` plays to a null or file sink
+ * instead of the device, in the decoded format, for benchmarking.
+ *
+ * @param audio The audio system to configure.
+ * @param options The program options.
+ */
+void SetupSink(AudioSystem &audio, const Options &options)
+{
+	auto sink = options.find("sink");
+	if (sink != options.end()) {
+		if (options.count("float-pipeline")) audio.SetFloatPipeline();
+		audio.SetSink(ParseSink(sink->second));
+		return;
+	}
+
+	auto pipeline = options.find("float-pipeline");
+	auto downmix = options.find("downmix");
+	if (pipeline == options.end() && downmix == options.end()) {
+		audio.SetSink(&SdlAudioSink::Build);
+		return;
+	}
+
+	auto gains = DownmixGains::Itu();
+	if (downmix != options.end()) gains = ParseDownmix(downmix->second);
+
+	bool convert = pipeline != options.end();
+	auto format = SampleFormat::PACKED_FLOAT_32;
+	if (convert && !pipeline->second.empty()) {
+		auto it = DEVICE_FORMATS.find(pipeline->second);
+		if (it == DEVICE_FORMATS.end()) {
+			std::cerr << "invalid --float-pipeline; using f32\n";
+		} else {
+			format = it->second;
+		}
+	}
+
+	if (convert) audio.SetFloatPipeline();
+	audio.SetSink([convert, format, gains](const AudioSource &source,
+	                                       int device_id) {
+		auto fmt = convert ? format : source.OutputSampleFormat();
+		return std::unique_ptr<AudioSink>(
+		        new SdlAudioSink(source, device_id, fmt, gains));
+	});
+}
+
 /**
  * Sets up the audio system with the desired sources and sinks.
  * @param audio The audio system to configure.
+ * @param options The program options.
  */
-void SetupAudioSystem(AudioSystem &audio)
+void SetupAudioSystem(AudioSystem &audio, const Options &options)
 {
-	audio.SetSink(&SdlAudioSink::Build);
+	SetupSink(audio, options);
 
 // Now set up the available sources.
 #ifdef WITH_MP3
@@ -89,6 +302,105 @@ void SetupAudioSystem(AudioSystem &audio)
 	audio.AddSource("ogg", &SndfileAudioSource::Build);
 	audio.AddSource("wav", &SndfileAudioSource::Build);
 #endif // WITH_SNDFILE
+
+	SetupCueAnalysis(audio, options);
+}
+
+/**
+ * Parses a comma-separated list of CPU numbers.
+ * @param value The list.
+ * @param cpus Set to the CPU numbers, if the list parses.
+ * @return True if the list parses; false otherwise.
+ */
+bool ParseCpus(const std::string &value, std::vector<int> &cpus)
+{
+	std::vector<int> parsed;
+	std::string::size_type start = 0;
+	try {
+		while (start <= value.size()) {
+			auto comma = value.find(',', start);
+			if (comma == std::string::npos) comma = value.size();
+			parsed.push_back(
+			        std::stoi(value.substr(start, comma - start)));
+			start = comma + 1;
+		}
+	} catch (...) {
+		return false;
+	}
+
+	cpus = parsed;
+	return true;
+}
+
+/**
+ * Parses the value of a `--sched` option.
+ * The value is `fifo:PRIORITY`, `rr:PRIORITY` or `nice:VALUE`.
+ * @param value The option value.
+ * @param policy Has its scheduler and priority set, if the value parses.
+ * @return True if the value parses; false otherwise.
+ */
+bool ParseScheduler(const std::string &value, ThreadPolicy &policy)
+{
+	static const std::map<std::string, ThreadPolicy::Scheduler> NAMES = {
+	        {"fifo", ThreadPolicy::Scheduler::FIFO},
+	        {"rr", ThreadPolicy::Scheduler::RR},
+	        {"nice", ThreadPolicy::Scheduler::NICE}};
+
+	auto colon = value.find(':');
+	if (colon == std::string::npos) return false;
+
+	auto name = NAMES.find(value.substr(0, colon));
+	if (name == NAMES.end()) return false;
+
+	try {
+		policy.priority = std::stoi(value.substr(colon + 1));
+	} catch (...) {
+		return false;
+	}
+	policy.scheduler = name->second;
+	return true;
+}
+
+/**
+ * Configures thread scheduling and memory locking, if requested by the
+ * program options.
+ *
+ * `--sched=CLASS:PRIORITY` and `--decoder-cpus=LIST` set how the thread
+ * running the player is scheduled, and `--io-cpus=LIST` where the network
+ * I/O thread runs.  `--lock-memory` locks playd into RAM.  Any of these
+ * also turns on reports of page faults and context switches on the audio
+ * path.
+ *
+ * @param options The program options.
+ * @param io Set to the policy for the I/O thread.
+ * @param decoder Set to the policy for the player's thread.
+ */
+void SetupRealtime(const Options &options, ThreadPolicy &io,
+                   ThreadPolicy &decoder)
+{
+	auto sched = options.find("sched");
+	if (sched != options.end() && !ParseScheduler(sched->second, decoder)) {
+		std::cerr << "invalid --sched; ignoring\n";
+	}
+
+	auto decoder_cpus = options.find("decoder-cpus");
+	if (decoder_cpus != options.end() &&
+	    !ParseCpus(decoder_cpus->second, decoder.cpus)) {
+		std::cerr << "invalid --decoder-cpus; ignoring\n";
+	}
+
+	auto io_cpus = options.find("io-cpus");
+	if (io_cpus != options.end() && !ParseCpus(io_cpus->second, io.cpus)) {
+		std::cerr << "invalid --io-cpus; ignoring\n";
+	}
+
+	bool lock = options.count("lock-memory") != 0;
+	if (lock) LockMemory();
+
+	if (sched != options.end() || decoder_cpus != options.end() ||
+	    io_cpus != options.end() || lock) {
+		EnableFaultCounts();
+	}
 }
 
 /**
@@ -97,7 +409,7 @@ void SetupAudioSystem(AudioSystem &audio)
  */
 void ExitWithUsage(const std::string &progname)
 {
-	std::cerr << "usage: " << progname << " ID [HOST] [PORT]\n";
+	std::cerr << "usage: " << progname << " [OPTIONS] ID [HOST] [PORT]\n";
 	std::cerr << "where ID is one of the following numbers:\n";
 
 	// Show the user the valid device IDs they can use.
@@ -110,6 +422,27 @@ void ExitWithUsage(const std::string &progname)
 	std::cerr << "default HOST: " << DEFAULT_HOST << "\n";
 	std::cerr << "default PORT: " << DEFAULT_PORT << "\n";
 
+	std::cerr << "OPTIONS:\n";
+	std::cerr << "\t--cue-threshold=DB: find cue points at DB dBFS\n";
+	std::cerr << "\t--cue-trim: trim playback to cue points\n";
+	std::cerr << "\t--decoder-cpus=LIST: run the player on these CPUs\n";
+	std::cerr << "\t--downmix=CENTRE,SURROUND[,LFE]: downmix gains in dB"
+	             "\n\t\t(default -3,-3, LFE dropped)\n";
+	std::cerr << "\t--float-pipeline[=FORMAT]: decode to float, output as "
+	             "FORMAT\n\t\t(u8, s8, s16, s32 or f32; default f32)\n";
+	std::cerr << "\t--io-cpus=LIST: run the network I/O on these CPUs\n";
+	std::cerr << "\t--lock-memory: lock playd into RAM\n";
+	std::cerr << "\t--metrics-port=PORT: serve Prometheus metrics on "
+	             "127.0.0.1:PORT\n";
+	std::cerr << "\t--player-thread: run the player apart from the "
+	             "network I/O\n";
+	std::cerr << "\t--record=PATH: log connections and commands to PATH\n";
+	std::cerr << "\t--sched=CLASS:PRIORITY: schedule the player as fifo, "
+	             "rr or nice\n";
+	std::cerr << "\t--sink=null, --sink=file:PATH: play to no device, "
+	             "or to PATH\n\t\t(ID is then ignored)\n";
+	std::cerr << "\t--trace-dir=DIR: let clients dump traces into DIR\n";
+
 	exit(EXIT_FAILURE);
 }
 
@@ -173,18 +506,73 @@ int main(int argc, char *argv[])
 	atexit(SdlAudioSink::CleanupLibrary);
 
 	auto args = MakeArgVector(argc, argv);
+	auto options = TakeOptions(args);
 
-	auto device_id = GetDeviceID(args);
+	auto device_id = GetDeviceID(args, options.count("sink") == 0);
 	if (device_id < 0) ExitWithUsage(args.at(0));
 
+	// Lock memory before setting up audio, so its buffers are locked too.
+	ThreadPolicy io_policy;
+	ThreadPolicy decoder_policy;
+	SetupRealtime(options, io_policy, decoder_policy);
+
 	// Set up all of the components of playd in one fell swoop.
 	AudioSystem audio(device_id);
-	SetupAudioSystem(audio);
+	SetupAudioSystem(audio, options);
 	Player player(audio);
 	IoCore io(player);
 
-	// Make sure the player broadcasts its responses back to the IoCore.
-	player.SetSink(io);
+	// Dumps only ever go into this directory, never anywhere a client says.
+	auto trace_dir = options.find("trace-dir");
+	if (trace_dir != options.end()) {
+		if (trace_dir->second.empty()) ExitWithUsage(args.at(0));
+		player.SetTraceDir(trace_dir->second);
+	}
+
+	// Make sure the player broadcasts its responses back to the IoCore,
+	// either directly or through the player thread.
+	std::unique_ptr<PlayerThread> player_thread;
+	if (options.count("player-thread")) {
+		player_thread = std::unique_ptr<PlayerThread>(
+		        new PlayerThread(player));
+		io.UsePlayerThread(*player_thread);
+		player_thread->SetPolicy(decoder_policy);
+		io_policy.Apply();
+	} else {
+		player.SetSink(io);
+
+		// The player runs on the I/O thread, and its settings win.
+		if (decoder_policy.cpus.empty()) {
+			decoder_policy.cpus = io_policy.cpus;
+		}
+		decoder_policy.Apply();
+	}
+
+	// Metrics are only for local scrapers (or a local proxy), so they
+	// never listen on the same host as the control protocol.
+	auto metrics = options.find("metrics-port");
+	if (metrics != options.end()) {
+		if (metrics->second.empty()) ExitWithUsage(args.at(0));
+		io.ServeMetrics(METRICS_HOST, metrics->second);
+	}
+
+	// The log must outlive the IoCore's loop, so it lives out here.
+	std::ofstream log_file;
+	std::unique_ptr<CommandLog> command_log;
+	auto record = options.find("record");
+	if (record != options.end()) {
+		if (record->second.empty()) ExitWithUsage(args.at(0));
+		log_file.open(record->second, std::ios::out | std::ios::trunc);
+		if (!log_file) {
+			std::cerr << "can't open --record file\n";
+			exit(EXIT_FAILURE);
+		}
+		command_log = std::unique_ptr<CommandLog>(
+		        new CommandLog(log_file));
+		io.UseCommandLog(*command_log);
+	}
+
+	NameTraceThread("io");
 
 	// Now, actually run the IO loop.
 	std::string host;
@@ -70,6 +70,10 @@ const std::string MSG_DEV_BADID = "Incorrect device ID";
 /// Message shown when one tries to Load an empty path.
 const std::string MSG_LOAD_EMPTY_PATH = "Empty file path given";
 
+/// Message shown when the next file can't be mixed with the current one.
+const std::string MSG_LOAD_NEXT_MISMATCH =
+        "Next file has a different sample format, rate or channel count";
+
 //
 // Audio output failures
 //
@@ -103,6 +107,12 @@ const std::string MSG_INVALID_PAYLOAD = "cannot write this value";
 /// Message shown when we try to write/delete to something we can't.
 const std::string MSG_INVALID_ACTION = "cannot perform this action";
 
+/// Message shown when a dump command's file can't be written.
+const std::string MSG_DUMP_FAIL = "couldn't write dump file";
+
+/// Message shown when a dump is asked for, but playd has nowhere to put it.
+const std::string MSG_DUMP_OFF = "dumps are off (see --trace-dir)";
+
 //
 // IO failures
 //
@@ -110,4 +120,7 @@ const std::string MSG_INVALID_ACTION = "cannot perform this action";
 /// Message shown when too many simultaneous connections are launched.
 const std::string MSG_TOO_MANY_CONNS = "too many simultaneous connections";
 
+/// Message shown when the player thread has too many commands waiting.
+const std::string MSG_PLAYER_BUSY = "player busy; try again";
+
 #endif // PLAYD_MESSAGES_H
@@ -0,0 +1,304 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Metrics class and associated types.
+ * @see metrics.hpp
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cmd_result.hpp"
+#include "metrics.hpp"
+
+/// The upper bounds of all but the last LatencyHistogram bucket, in us.
+static const std::uint64_t BOUNDS_US[LatencyHistogram::BUCKETS - 1] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+	250000, 1000000};
+
+/// The command words counted separately, in Metrics::commands order.
+static const char *COMMAND_WORDS[Metrics::COMMAND_WORDS] = {
+	"read", "write", "delete", "dump", "batch", "other"};
+
+/// The commands whose latency is heard, in AudibleLatency::Kind order.
+static const char *AUDIBLE_KINDS[AudibleLatency::KINDS] = {"play", "seek"};
+
+/// The result codes, in CommandResult::Code order.
+static const char *RESULT_CODES[Metrics::RESULT_CODES] = {"OK", "WHAT",
+                                                          "FAIL"};
+
+/**
+ * Writes the HELP and TYPE lines of a metric.
+ * @param os The stream to write to.
+ * @param name The metric name.
+ * @param type The metric type.
+ * @param help The metric's description.
+ */
+static void WriteHeader(std::ostream &os, const char *name, const char *type,
+                        const char *help)
+{
+	os << "# HELP " << name << ' ' << help << '\n';
+	os << "# TYPE " << name << ' ' << type << '\n';
+}
+
+/**
+ * Writes a metric with a single value.
+ * @tparam T The type of the value.
+ * @param os The stream to write to.
+ * @param name The metric name.
+ * @param type The metric type.
+ * @param help The metric's description.
+ * @param value The metric's value.
+ */
+template <typename T>
+static void WriteSingle(std::ostream &os, const char *name, const char *type,
+                        const char *help, T value)
+{
+	WriteHeader(os, name, type, help);
+	os << name << ' ' << value << '\n';
+}
+
+/**
+ * Writes a number of microseconds as seconds, without losing precision.
+ * @param os The stream to write to.
+ * @param us The number of microseconds.
+ */
+static void WriteSeconds(std::ostream &os, std::uint64_t us)
+{
+	os << us / 1000000 << '.' << std::setw(6) << std::setfill('0')
+	   << us % 1000000;
+}
+
+//
+// LatencyHistogram
+//
+
+LatencyHistogram::LatencyHistogram() : sum_us(0)
+{
+	for (auto &bucket : this->buckets) bucket = 0;
+}
+
+void LatencyHistogram::Observe(std::chrono::steady_clock::duration duration)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration)
+	                  .count();
+	auto value = static_cast<std::uint64_t>(us < 0 ? 0 : us);
+
+	std::size_t b = 0;
+	while (b < BUCKETS - 1 && BOUNDS_US[b] < value) b++;
+
+	this->buckets[b].fetch_add(1, std::memory_order_relaxed);
+	this->sum_us.fetch_add(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Write(std::ostream &os, const char *name,
+                             const char *help) const
+{
+	WriteHeader(os, name, "histogram", help);
+	this->WriteSamples(os, name, "");
+}
+
+void LatencyHistogram::WriteSamples(std::ostream &os, const char *name,
+                                    const std::string &labels) const
+{
+	auto prefix = labels.empty() ? labels : labels + ",";
+	auto suffix = labels.empty() ? labels : "{" + labels + "}";
+
+	std::uint64_t count = 0;
+	for (std::size_t b = 0; b < BUCKETS; b++) {
+		count += this->buckets[b].load(std::memory_order_relaxed);
+
+		os << name << "_bucket{" << prefix << "le=\"";
+		if (b < BUCKETS - 1) {
+			WriteSeconds(os, BOUNDS_US[b]);
+		} else {
+			os << "+Inf";
+		}
+		os << "\"} " << count << '\n';
+	}
+
+	os << name << "_sum" << suffix << ' ';
+	WriteSeconds(os, this->sum_us.load(std::memory_order_relaxed));
+	os << '\n';
+	os << name << "_count" << suffix << ' ' << count << '\n';
+}
+
+//
+// LatencyTimer
+//
+
+LatencyTimer::LatencyTimer(LatencyHistogram &histogram)
+    : histogram(histogram), start(std::chrono::steady_clock::now())
+{
+}
+
+LatencyTimer::~LatencyTimer()
+{
+	this->histogram.Observe(std::chrono::steady_clock::now() - this->start);
+}
+
+//
+// AudibleLatency
+//
+
+/// The bits of AudibleLatency::armed holding the Kind.
+static const unsigned KIND_BITS = 2;
+
+AudibleLatency::AudibleLatency() : armed(0)
+{
+}
+
+void AudibleLatency::Arm(const std::vector<std::string> &cmd,
+                         std::chrono::steady_clock::time_point read_at)
+{
+	// Only writes change what is heard: write TAG PATH PAYLOAD.
+	if (cmd.size() != 4 || cmd[0] != "write") return;
+
+	Kind kind;
+	if (cmd[2] == "/control/state" && cmd[3] == "Playing") {
+		kind = Kind::PLAY;
+	} else if (cmd[2] == "/player/time/elapsed") {
+		kind = Kind::SEEK;
+	} else {
+		return;
+	}
+
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                  read_at.time_since_epoch())
+	                  .count();
+	auto at = static_cast<std::uint64_t>(ns < 0 ? 0 : ns);
+	auto k = static_cast<std::uint64_t>(kind) + 1;
+	this->armed.store(at << KIND_BITS | k, std::memory_order_relaxed);
+}
+
+bool AudibleLatency::Armed() const
+{
+	return this->armed.load(std::memory_order_relaxed) != 0;
+}
+
+void AudibleLatency::Heard(std::chrono::steady_clock::time_point heard_at)
+{
+	// Only one hearing may observe each arming.
+	auto armed = this->armed.exchange(0, std::memory_order_relaxed);
+	if (armed == 0) return;
+
+	auto kind = (armed & ((1 << KIND_BITS) - 1)) - 1;
+	std::chrono::nanoseconds since_epoch(armed >> KIND_BITS);
+	std::chrono::steady_clock::time_point read_at(
+	        std::chrono::duration_cast<
+	                std::chrono::steady_clock::duration>(since_epoch));
+	this->latency[kind].Observe(heard_at - read_at);
+}
+
+void AudibleLatency::Write(std::ostream &os) const
+{
+	auto name = "playd_audible_latency_seconds";
+	WriteHeader(os, name, "histogram",
+	            "Time from reading a command to the first audible sample "
+	            "after it, by command.");
+	for (std::size_t k = 0; k < KINDS; k++) {
+		auto kind = std::string(AUDIBLE_KINDS[k]);
+		this->latency[k].WriteSamples(os, name,
+		                              "command=\"" + kind + "\"");
+	}
+}
+
+//
+// Metrics
+//
+
+/* static */ Metrics &Metrics::Get()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Metrics()
+    : connections(0),
+      connections_total(0),
+      command_backlog(0),
+      commands_deferred(0),
+      broadcast_bytes(0),
+      replies_dropped(0),
+      ring_fill(0),
+      ring_size(0),
+      underruns(0)
+{
+	for (auto &word : this->commands) {
+		for (auto &code : word) code = 0;
+	}
+}
+
+void Metrics::CountCommand(const std::string &word, CommandResult::Code code)
+{
+	std::size_t w = 0;
+	while (w < COMMAND_WORDS - 1 && word != ::COMMAND_WORDS[w]) w++;
+
+	auto c = static_cast<std::size_t>(code);
+	this->commands[w][c].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::Write(std::ostream &os) const
+{
+	auto get = [](const std::atomic<std::uint64_t> &value) {
+		return value.load(std::memory_order_relaxed);
+	};
+
+	WriteSingle(os, "playd_connections", "gauge",
+	            "Clients currently connected.", get(this->connections));
+	WriteSingle(os, "playd_connections_total", "counter",
+	            "Clients accepted.", get(this->connections_total));
+
+	WriteHeader(os, "playd_commands_total", "counter",
+	            "Commands run, by command word and result code.");
+	for (std::size_t w = 0; w < COMMAND_WORDS; w++) {
+		for (std::size_t c = 0; c < RESULT_CODES; c++) {
+			os << "playd_commands_total{command=\""
+			   << ::COMMAND_WORDS[w] << "\",result=\""
+			   << ::RESULT_CODES[c] << "\"} "
+			   << get(this->commands[w][c]) << '\n';
+		}
+	}
+
+	WriteSingle(os, "playd_command_backlog", "gauge",
+	            "Commands read from clients, but not yet run.",
+	            get(this->command_backlog));
+	WriteSingle(os, "playd_commands_deferred_total", "counter",
+	            "Commands left for a later loop iteration, as their "
+	            "client sent too many at once.",
+	            get(this->commands_deferred));
+
+	WriteSingle(os, "playd_broadcast_bytes_total", "counter",
+	            "Bytes sent to clients in broadcasts.",
+	            get(this->broadcast_bytes));
+	WriteSingle(os, "playd_replies_dropped_total", "counter",
+	            "Replies dropped, as the I/O thread had fallen behind the "
+	            "player thread.",
+	            get(this->replies_dropped));
+
+	this->decode.Write(os, "playd_decode_seconds",
+	                   "Time taken by each call to a decoder.");
+	this->load.Write(os, "playd_load_seconds",
+	                 "Time taken to load each file.");
+	this->seek.Write(os, "playd_seek_seconds", "Time taken by each seek.");
+
+	auto size = static_cast<double>(get(this->ring_size));
+	auto used = static_cast<double>(get(this->ring_fill));
+	auto fill = size == 0 ? 0.0 : used / size;
+	WriteSingle(os, "playd_ring_fill_ratio", "gauge",
+	            "How full the ring buffer was when the device last asked.",
+	            fill);
+	WriteSingle(os, "playd_underruns_total", "counter",
+	            "Times the device asked for more audio than was buffered.",
+	            get(this->underruns));
+
+	this->audible.Write(os);
+}
@@ -0,0 +1,241 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Metrics class and associated types.
+ * @see metrics.cpp
+ */
+
+#ifndef PLAYD_METRICS_HPP
+#define PLAYD_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cmd_result.hpp"
+
+/**
+ * A histogram of durations, with fixed buckets from 50us to 1s.
+ * Observing a duration costs two relaxed atomic additions.
+ */
+class LatencyHistogram
+{
+public:
+	/// The number of buckets, including the one for anything over 1s.
+	static const std::size_t BUCKETS = 14;
+
+	/// Constructs an empty LatencyHistogram.
+	LatencyHistogram();
+
+	/**
+	 * Adds a duration to the histogram.
+	 * @param duration The duration.
+	 */
+	void Observe(std::chrono::steady_clock::duration duration);
+
+	/**
+	 * Writes the histogram in the Prometheus text format.
+	 * @param os The stream to write to.
+	 * @param name The metric name, in seconds.
+	 * @param help The metric's description.
+	 */
+	void Write(std::ostream &os, const char *name, const char *help) const;
+
+	/**
+	 * Writes the histogram's samples, but not its HELP and TYPE lines.
+	 * This is for metrics made of several histograms, told apart by
+	 * their labels.
+	 * @param os The stream to write to.
+	 * @param name The metric name, in seconds.
+	 * @param labels The labels, such as `command="play"`; may be empty.
+	 */
+	void WriteSamples(std::ostream &os, const char *name,
+	                  const std::string &labels) const;
+
+private:
+	/// The count of durations in each bucket (not cumulative).
+	std::atomic<std::uint64_t> buckets[BUCKETS];
+
+	/// The sum of all durations, in microseconds.
+	std::atomic<std::uint64_t> sum_us;
+};
+
+/**
+ * Times a region, adding its duration to a LatencyHistogram when destroyed.
+ */
+class LatencyTimer
+{
+public:
+	/**
+	 * Starts timing.
+	 * @param histogram The histogram to which the duration is added.
+	 */
+	explicit LatencyTimer(LatencyHistogram &histogram);
+
+	/// Stops timing, and records the duration.
+	~LatencyTimer();
+
+	/// Deleted copy constructor.
+	LatencyTimer(const LatencyTimer &) = delete;
+
+	/// Deleted copy-assignment.
+	LatencyTimer &operator=(const LatencyTimer &) = delete;
+
+private:
+	LatencyHistogram &histogram;                 ///< The histogram.
+	std::chrono::steady_clock::time_point start; ///< When timing began.
+};
+
+/**
+ * Measures how long commands take to be heard: from reading a command off
+ * its client's socket to the first audible sample leaving the sink after
+ * the command has run.
+ *
+ * Running a command that changes what is heard arms the probe, and the
+ * sink's next audible sample disarms it, observing the latency under the
+ * command's kind.  Arming over a command that was never heard replaces it.
+ * Checking whether the probe is armed is one relaxed load, so sinks can
+ * afford to on every callback, and only look at their samples when it is.
+ */
+class AudibleLatency
+{
+public:
+	/// The kinds of command measured.
+	enum class Kind : std::uint8_t {
+		PLAY, ///< Writing Playing to /control/state.
+		SEEK  ///< Writing to /player/time/elapsed.
+	};
+
+	/// The number of kinds of command measured.
+	static const std::size_t KINDS = 2;
+
+	/// Constructs an unarmed AudibleLatency.
+	AudibleLatency();
+
+	/**
+	 * Arms the probe, if a command is one that changes what is heard.
+	 * Call once the command has run, and succeeded.
+	 * @param cmd The command's words.
+	 * @param read_at When the command was read.
+	 */
+	void Arm(const std::vector<std::string> &cmd,
+	         std::chrono::steady_clock::time_point read_at);
+
+	/// @return Whether a command is waiting to be heard.
+	bool Armed() const;
+
+	/**
+	 * Observes the latency of the command waiting to be heard, if any,
+	 * and disarms the probe.
+	 * @param heard_at When the first audible sample left the sink.
+	 */
+	void Heard(std::chrono::steady_clock::time_point heard_at);
+
+	/**
+	 * Writes the latencies, by command, in the Prometheus text format.
+	 * @param os The stream to write to.
+	 */
+	void Write(std::ostream &os) const;
+
+private:
+	/**
+	 * The armed command: when it was read, in nanoseconds since the
+	 * clock's epoch, shifted left by two bits and ORed with its Kind plus
+	 * one; zero if nothing is armed.
+	 */
+	std::atomic<std::uint64_t> armed;
+
+	/// The latencies, by Kind.
+	LatencyHistogram latency[KINDS];
+};
+
+/**
+ * Counters and histograms describing what playd is doing.
+ *
+ * There is one set of Metrics per process, got from Metrics::Get, which
+ * anything can update from any thread.  Everything is a relaxed atomic, so
+ * updating a metric on the audio path costs a few nanoseconds; the only
+ * consistency offered is that each value, on its own, is right.
+ */
+class Metrics
+{
+public:
+	/// The command words counted separately; anything else is "other".
+	static const std::size_t COMMAND_WORDS = 6;
+
+	/// The number of command result codes.
+	static const std::size_t RESULT_CODES = 3;
+
+	/**
+	 * Gets the process's Metrics.
+	 * @return The Metrics.
+	 */
+	static Metrics &Get();
+
+	/// The number of clients connected.
+	std::atomic<std::uint64_t> connections;
+
+	/// The number of clients ever accepted.
+	std::atomic<std::uint64_t> connections_total;
+
+	/// The number of commands read, but not yet run.
+	std::atomic<std::uint64_t> command_backlog;
+
+	/// The number of commands that had to wait for a later loop iteration.
+	std::atomic<std::uint64_t> commands_deferred;
+
+	/// The number of bytes sent to clients in broadcasts.
+	std::atomic<std::uint64_t> broadcast_bytes;
+
+	/// The number of replies the player thread couldn't queue.
+	std::atomic<std::uint64_t> replies_dropped;
+
+	/// How long each call to a decoder took.
+	LatencyHistogram decode;
+
+	/// How long each file load took.
+	LatencyHistogram load;
+
+	/// How long each seek took.
+	LatencyHistogram seek;
+
+	/// The samples in the ring buffer, when the device last asked.
+	std::atomic<std::uint64_t> ring_fill;
+
+	/// The size of the ring buffer, in samples.
+	std::atomic<std::uint64_t> ring_size;
+
+	/// The number of times the device asked for more than was buffered.
+	std::atomic<std::uint64_t> underruns;
+
+	/// How long commands took to be heard.
+	AudibleLatency audible;
+
+	/**
+	 * Counts a finished command.
+	 * @param word The command word.
+	 * @param code The command's result code.
+	 */
+	void CountCommand(const std::string &word, CommandResult::Code code);
+
+	/**
+	 * Writes every metric in the Prometheus text exposition format.
+	 * @param os The stream to write to.
+	 */
+	void Write(std::ostream &os) const;
+
+private:
+	/// The count of commands, by word and result code.
+	std::atomic<std::uint64_t> commands[COMMAND_WORDS][RESULT_CODES];
+
+	/// Constructs a zeroed Metrics.
+	Metrics();
+};
+
+#endif // PLAYD_METRICS_HPP
@@ -7,7 +7,9 @@
  * @see player.hpp
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <sstream>
 #include <stdexcept>
@@ -20,13 +22,106 @@
 #include "errors.hpp"
 #include "response.hpp"
 #include "messages.h"
+#include "metrics.hpp"
 #include "player.hpp"
+#include "realtime.hpp"
+#include "trace.hpp"
 
 const std::vector<std::string> Player::FEATURES{"End", "FileLoad", "PlayStop",
                                                 "Seek", "TimeReport"};
 
+/**
+ * Parses a decimal number, such as a level in dB.
+ * @param str The string to parse.
+ * @param value Set to the parsed number, if parsing succeeded.
+ * @return True if @a str is a whole, finite number; false otherwise.
+ */
+static bool ParseNumber(const std::string &str, double &value)
+{
+	std::size_t end = 0;
+	try {
+		value = std::stod(str, &end);
+	} catch (std::invalid_argument &) {
+		return false;
+	} catch (std::out_of_range &) {
+		return false;
+	}
+
+	return end == str.size() && std::isfinite(value);
+}
+
+/**
+ * Formats a decimal number without trailing zeroes.
+ * @param value The number to format.
+ * @return The formatted number.
+ */
+static std::string FormatNumber(double value)
+{
+	std::ostringstream os;
+	os << value;
+	return os.str();
+}
+
+/**
+ * Decides whether reading one resource also reads another.
+ * @param dir The path of the resource being read.
+ * @param path The path of the other resource.
+ * @return True if @a path is @a dir, or inside it.
+ */
+static bool Includes(const std::string &dir, const std::string &path)
+{
+	if (dir == "/" || dir == path) return true;
+	return dir.size() < path.size() && path[dir.size()] == '/' &&
+	       path.compare(0, dir.size(), dir) == 0;
+}
+
+/**
+ * Matches a resource path against a glob pattern.
+ * In the pattern, `*` matches any run of characters and `?` any one
+ * character, neither matching `/`; anything else matches itself.
+ * @param pattern The pattern.
+ * @param path The resource path.
+ * @return True if the pattern matches the whole path.
+ */
+static bool GlobMatch(const std::string &pattern, const std::string &path)
+{
+	// Greedy matching, going back to the last star on a mismatch.
+	std::size_t p = 0;
+	std::size_t s = 0;
+	auto star = std::string::npos;
+	std::size_t mark = 0;
+
+	while (s < path.size()) {
+		if (p < pattern.size() && pattern[p] == '*') {
+			star = p++;
+			mark = s;
+		} else if (p < pattern.size() &&
+		           (pattern[p] == '?' ? path[s] != '/'
+		                              : pattern[p] == path[s])) {
+			p++;
+			s++;
+		} else if (star != std::string::npos && path[mark] != '/') {
+			p = star + 1;
+			s = ++mark;
+		} else {
+			return false;
+		}
+	}
+
+	while (p < pattern.size() && pattern[p] == '*') p++;
+	return p == pattern.size();
+}
+
 Player::Player(AudioSystem &audio)
-    : audio(audio), file(audio.Null()), is_running(true), sink(nullptr)
+    : audio(audio),
+      file(audio.Null()),
+      is_running(true),
+      sink(nullptr),
+      crossfade{0, CrossfadeCurve::EQUAL_POWER, false, 0},
+      dsp(),
+      rate(1.0),
+      trace_dir(),
+      batching(false)
 {
 }
 
@@ -35,21 +130,47 @@ void Player::SetSink(ResponseSink &sink)
 	this->sink = &sink;
 }
 
+void Player::SetTraceDir(const std::string &dir)
+{
+	this->trace_dir = dir;
+}
+
 bool Player::Update()
 {
 	assert(this->file != nullptr);
 	auto as = this->file->Update();
+	CountFaults(AudioPath::DECODER);
+	ReportFaults();
 
 	if (as == Audio::State::AT_END) this->End();
+
+	// A crossfade may have moved us on to the next file.
+	if (this->file->TakeFileChange()) this->Read("/player/file", 0);
+
+	// Background analysis may have just found the cue points.
+	if (this->file->TakeCuesReady()) {
+		this->Read("/player/cue/in", 0);
+		this->Read("/player/cue/out", 0);
+	}
+
 	if (as == Audio::State::PLAYING) {
 		// Since the audio is currently playing, the position may have
 		// advanced since last update.  So we need to update it.
-		this->Read("/player/time/elapsed", 0);
+		this->AnnounceTime();
 	}
 
 	return this->is_running;
 }
 
+void Player::AnnounceTime() const
+{
+	// Nobody would hear the announcement, so don't bother making it.
+	if (this->sink == nullptr || !this->sink->Listening()) return;
+
+	Response response(Response::Code::RES);
+	if (this->file->EmitTime(response)) this->sink->Announce(response);
+}
+
 void Player::WelcomeClient(size_t id) const
 {
 	this->sink->Respond(Response(Response::Code::OHAI).AddArg(MSG_OHAI), id);
@@ -82,6 +203,8 @@ void Player::End()
 
 CommandResult Player::RunCommand(const std::vector<std::string> &cmd, size_t id)
 {
+	TraceSpan span("Player::RunCommand");
+
 	if (!this->is_running) {
 		// Refuse any and all commands when not running.
 		// This is mainly to prevent the internal state from
@@ -99,13 +222,52 @@ CommandResult Player::RunCommand(const std::vector<std::string> &cmd, size_t id)
 	// This is because the first argument is a 'tag', emitted with the
 	// command result to allow it to be identified, but otherwise
 	// unused.
-	if (nargs == 2 && "read" == word) return this->Read(cmd[2], id);
+	if (2 <= nargs && "read" == word) return this->ReadMatching(cmd, id);
 	if (nargs == 2 && "delete" == word) return this->Delete(cmd[2]);
 	if (nargs == 3 && "write" == word) return this->Write(cmd[2], cmd[3]);
+	if (nargs == 3 && "dump" == word) return this->Dump(cmd[2], cmd[3]);
+	if (3 <= nargs && nargs % 2 == 1 && "batch" == word) {
+		return this->Batch(cmd);
+	}
 
 	return CommandResult::Invalid(MSG_CMD_INVALID);
 }
 
+CommandResult Player::Dump(const std::string &what, const std::string &name)
+{
+	if (what != "trace") return CommandResult::Invalid(MSG_NOT_FOUND);
+	if (name.empty() || name.find_first_of("/\\") != std::string::npos) {
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+	if (this->trace_dir.empty()) return CommandResult::Failure(MSG_DUMP_OFF);
+
+	auto path = this->trace_dir + "/trace-" + name + ".json";
+	if (!DumpTrace(path)) return CommandResult::Failure(MSG_DUMP_FAIL);
+	return CommandResult::Success();
+}
+
+CommandResult Player::Batch(const std::vector<std::string> &cmd)
+{
+	this->batching = true;
+
+	// The first two words are 'batch' and the tag; then come the pairs.
+	auto result = CommandResult::Success();
+	for (std::size_t i = 2; i + 1 < cmd.size(); i += 2) {
+		result = this->Write(cmd[i], cmd[i + 1]);
+		if (!result.IsSuccess() || !this->is_running) break;
+	}
+
+	this->batching = false;
+
+	// Broadcasts of the held resources now show the batch's end result,
+	// rather than every step along the way.
+	std::vector<std::string> held;
+	std::swap(held, this->held);
+	for (auto &path : held) this->Read(path, 0);
+
+	return result;
+}
+
 CommandResult Player::Eject()
 {
 	assert(this->file != nullptr);
@@ -119,6 +281,7 @@ CommandResult Player::Load(const std::string &path)
 {
 	if (path.empty()) return CommandResult::Invalid(MSG_LOAD_EMPTY_PATH);
 
+	LatencyTimer timer(Metrics::Get().load);
 	assert(this->file != nullptr);
 
 	// Bin the current file as soon as possible.
@@ -130,6 +293,9 @@ CommandResult Player::Load(const std::string &path)
 	try {
 		assert(this->file != nullptr);
 		this->file = this->audio.Load(path);
+		this->file->SetCrossfade(this->crossfade);
+		this->file->SetDsp(this->dsp);
+		this->file->SetRate(this->rate);
 		this->Read("/", 0);
 		assert(this->file != nullptr);
 	} catch (FileError &e) {
@@ -186,6 +352,7 @@ CommandResult Player::Seek(const std::string &time_str)
 	}
 
 	try {
+		LatencyTimer timer(Metrics::Get().seek);
 		this->SeekRaw(pos);
 	} catch (NoAudioError) {
 		return CommandResult::Invalid(MSG_CMD_NEEDS_LOADED);
@@ -227,6 +394,281 @@ CommandResult Player::Seek(const std::string &time_str)
 	return pos;
 }
 
+CommandResult Player::SetNext(const std::string &path)
+{
+	if (path.empty()) return CommandResult::Invalid(MSG_LOAD_EMPTY_PATH);
+
+	assert(this->file != nullptr);
+	try {
+		auto source = this->audio.LoadSource(path);
+		auto factory = this->audio.SourceFactoryFor(path);
+		this->file->SetNext(std::move(source), factory);
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	} catch (FileError &e) {
+		// As with Load, a bad next file isn't fatal.
+		return CommandResult::Failure(e.Message());
+	}
+
+	this->Read("/player/crossfade/file", 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::ClearNext()
+{
+	assert(this->file != nullptr);
+	try {
+		this->file->ClearNext();
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	return CommandResult::Success();
+}
+
+CommandResult Player::SetCrossfadeCurve(CrossfadeCurve curve)
+{
+	this->crossfade.curve = curve;
+	this->file->SetCrossfade(this->crossfade);
+
+	this->Read("/player/crossfade/curve", 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::SetCrossfadeTime(const std::string &path,
+                                       const std::string &time_str)
+{
+	bool start = "/player/crossfade/start" == path;
+
+	// An empty start means one crossfade length before the end.
+	bool clear = start && time_str.empty();
+	std::uint64_t pos = 0;
+	if (!clear) {
+		try {
+			pos = SeekParse(time_str);
+		} catch (SeekError &e) {
+			return CommandResult::Invalid(e.Message());
+		}
+	}
+
+	if (start) {
+		this->crossfade.has_start = !clear;
+		this->crossfade.start = pos;
+	} else {
+		this->crossfade.length = pos;
+	}
+	this->file->SetCrossfade(this->crossfade);
+
+	if (!clear) this->Read(path, 0);
+	return CommandResult::Success();
+}
+
+std::unique_ptr<Response> Player::Emit(const std::string &path) const
+{
+	std::string value;
+	std::size_t index;
+	if ("/player/crossfade/curve" == path) {
+		bool linear = this->crossfade.curve == CrossfadeCurve::LINEAR;
+		value = linear ? "Linear" : "EqualPower";
+	} else if ("/player/crossfade/length" == path) {
+		value = std::to_string(this->crossfade.length);
+	} else if ("/player/crossfade/start" == path) {
+		if (!this->crossfade.has_start) return nullptr;
+		value = std::to_string(this->crossfade.start);
+	} else if ("/player/dsp/gain" == path) {
+		if (!this->dsp.has_gain) return nullptr;
+		value = FormatNumber(this->dsp.gain);
+	} else if ("/player/dsp/limiter" == path) {
+		if (!this->dsp.has_limiter) return nullptr;
+		value = FormatNumber(this->dsp.ceiling);
+	} else if ("/player/rate" == path) {
+		value = FormatNumber(this->rate);
+	} else if (EqBandIndex(path, index)) {
+		auto &band = this->dsp.eq[index];
+		if (!band.enabled) return nullptr;
+		value = FormatNumber(band.frequency) + "," +
+		        FormatNumber(band.gain) + "," + FormatNumber(band.q);
+	} else {
+		// Everything else belongs to the Audio.
+		return nullptr;
+	}
+
+	return Response::Res("Entry", path, value);
+}
+
+CommandResult Player::SetHotCue(std::size_t index, const std::string &time_str)
+{
+	std::uint64_t pos = 0;
+	try {
+		pos = SeekParse(time_str);
+	} catch (SeekError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	assert(this->file != nullptr);
+	try {
+		this->file->SetHotCue(index, pos);
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	this->Read("/player/hotcue/" + std::to_string(index), 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::ClearHotCue(std::size_t index)
+{
+	assert(this->file != nullptr);
+	try {
+		this->file->ClearHotCue(index);
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	return CommandResult::Success();
+}
+
+/* static */ bool Player::HotCueIndex(const std::string &path,
+                                      std::size_t &index)
+{
+	// Only the slot entries themselves count, not /player/hotcue.
+	if (path.compare(0, 15, "/player/hotcue/") != 0) return false;
+	if (Player::RESOURCES.count(path) == 0) return false;
+
+	index = std::stoul(path.substr(15));
+	assert(index < Audio::HOT_CUE_COUNT);
+	return true;
+}
+
+CommandResult Player::SetDspLevel(const std::string &path,
+                                  const std::string &level)
+{
+	bool gain = "/player/dsp/gain" == path;
+
+	bool enable = !level.empty();
+	double db = 0.0;
+	if (enable && !ParseNumber(level, db)) {
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+
+	if (gain) {
+		this->dsp.has_gain = enable;
+		this->dsp.gain = db;
+	} else {
+		this->dsp.has_limiter = enable;
+		this->dsp.ceiling = db;
+	}
+	this->file->SetDsp(this->dsp);
+
+	if (enable) this->Read(path, 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::SetEqBand(std::size_t index, const std::string &band)
+{
+	assert(index < DspSettings::EQ_BANDS);
+	EqBand eq{false, 0, 0, 0};
+
+	if (!band.empty()) {
+		// Expecting 'frequency,gain,q'.
+		auto first = band.find(',');
+		auto second = band.find(',', first + 1);
+		if (first == std::string::npos || second == std::string::npos) {
+			return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+		}
+
+		bool ok = ParseNumber(band.substr(0, first), eq.frequency) &&
+		          ParseNumber(band.substr(first + 1, second - first - 1),
+		                      eq.gain) &&
+		          ParseNumber(band.substr(second + 1), eq.q);
+		if (!ok || eq.frequency <= 0 || eq.q <= 0) {
+			return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+		}
+		eq.enabled = true;
+	}
+
+	this->dsp.eq[index] = eq;
+	this->file->SetDsp(this->dsp);
+
+	if (eq.enabled) this->Read("/player/dsp/eq/" + std::to_string(index), 0);
+	return CommandResult::Success();
+}
+
+/* static */ bool Player::EqBandIndex(const std::string &path,
+                                      std::size_t &index)
+{
+	// Only the band entries themselves count, not /player/dsp/eq.
+	if (path.compare(0, 15, "/player/dsp/eq/") != 0) return false;
+	if (Player::RESOURCES.count(path) == 0) return false;
+
+	index = std::stoul(path.substr(15));
+	assert(index < DspSettings::EQ_BANDS);
+	return true;
+}
+
+CommandResult Player::SetRate(const std::string &rate)
+{
+	double value = 0.0;
+	if (!ParseNumber(rate, value)) {
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+	if (value < TimeStretch::MIN_RATE || TimeStretch::MAX_RATE < value) {
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+
+	this->rate = value;
+	this->file->SetRate(this->rate);
+
+	this->Read("/player/rate", 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::SetLooping(bool looping)
+{
+	assert(this->file != nullptr);
+	try {
+		this->file->SetLooping(looping);
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	this->Read("/player/loop/mode", 0);
+	return CommandResult::Success();
+}
+
+CommandResult Player::SetLoopPoint(const std::string &path,
+                                   const std::string &time_str)
+{
+	bool out = "/player/loop/out" == path;
+
+	// An empty loop-out point means the end of the file.
+	bool clear = out && time_str.empty();
+	std::uint64_t pos = 0;
+	if (!clear) {
+		try {
+			pos = SeekParse(time_str);
+		} catch (SeekError &e) {
+			return CommandResult::Invalid(e.Message());
+		}
+	}
+
+	assert(this->file != nullptr);
+	try {
+		if (clear) {
+			this->file->ClearLoopOut();
+		} else if (out) {
+			this->file->SetLoopOut(pos);
+		} else {
+			this->file->SetLoopIn(pos);
+		}
+	} catch (NoAudioError &e) {
+		return CommandResult::Invalid(e.Message());
+	}
+
+	if (!clear) this->Read(path, 0);
+	return CommandResult::Success();
+}
+
 void Player::SeekRaw(std::uint64_t pos)
 {
 	assert(this->file != nullptr);
@@ -242,9 +684,78 @@ const std::multimap<std::string, std::string> Player::RESOURCES = {
 	{"/", "/player"},
 	{"/control", "/control/state"},
 	{"/control/state", ""},
+	{"/player", "/player/crossfade"},
+	{"/player", "/player/cue"},
+	{"/player", "/player/dsp"},
 	{"/player", "/player/file"},
+	{"/player", "/player/hotcue"},
+	{"/player", "/player/loop"},
+	{"/player", "/player/rate"},
 	{"/player", "/player/time"},
+	{"/player/crossfade", "/player/crossfade/cost"},
+	{"/player/crossfade", "/player/crossfade/curve"},
+	{"/player/crossfade", "/player/crossfade/file"},
+	{"/player/crossfade", "/player/crossfade/length"},
+	{"/player/crossfade", "/player/crossfade/start"},
+	{"/player/crossfade/cost", ""},
+	{"/player/crossfade/curve", ""},
+	{"/player/crossfade/file", ""},
+	{"/player/crossfade/length", ""},
+	{"/player/crossfade/start", ""},
+	{"/player/cue", "/player/cue/in"},
+	{"/player/cue", "/player/cue/out"},
+	{"/player/cue/in", ""},
+	{"/player/cue/out", ""},
+	{"/player/dsp", "/player/dsp/cost"},
+	{"/player/dsp", "/player/dsp/eq"},
+	{"/player/dsp", "/player/dsp/gain"},
+	{"/player/dsp", "/player/dsp/limiter"},
+	{"/player/dsp/cost", "/player/dsp/cost/eq0"},
+	{"/player/dsp/cost", "/player/dsp/cost/eq1"},
+	{"/player/dsp/cost", "/player/dsp/cost/eq2"},
+	{"/player/dsp/cost", "/player/dsp/cost/eq3"},
+	{"/player/dsp/cost", "/player/dsp/cost/gain"},
+	{"/player/dsp/cost", "/player/dsp/cost/limiter"},
+	{"/player/dsp/cost/eq0", ""},
+	{"/player/dsp/cost/eq1", ""},
+	{"/player/dsp/cost/eq2", ""},
+	{"/player/dsp/cost/eq3", ""},
+	{"/player/dsp/cost/gain", ""},
+	{"/player/dsp/cost/limiter", ""},
+	{"/player/dsp/eq", "/player/dsp/eq/0"},
+	{"/player/dsp/eq", "/player/dsp/eq/1"},
+	{"/player/dsp/eq", "/player/dsp/eq/2"},
+	{"/player/dsp/eq", "/player/dsp/eq/3"},
+	{"/player/dsp/eq/0", ""},
+	{"/player/dsp/eq/1", ""},
+	{"/player/dsp/eq/2", ""},
+	{"/player/dsp/eq/3", ""},
+	{"/player/dsp/gain", ""},
+	{"/player/dsp/limiter", ""},
 	{"/player/file", ""},
+	{"/player/hotcue", "/player/hotcue/0"},
+	{"/player/hotcue", "/player/hotcue/1"},
+	{"/player/hotcue", "/player/hotcue/2"},
+	{"/player/hotcue", "/player/hotcue/3"},
+	{"/player/hotcue", "/player/hotcue/4"},
+	{"/player/hotcue", "/player/hotcue/5"},
+	{"/player/hotcue", "/player/hotcue/6"},
+	{"/player/hotcue", "/player/hotcue/7"},
+	{"/player/hotcue/0", ""},
+	{"/player/hotcue/1", ""},
+	{"/player/hotcue/2", ""},
+	{"/player/hotcue/3", ""},
+	{"/player/hotcue/4", ""},
+	{"/player/hotcue/5", ""},
+	{"/player/hotcue/6", ""},
+	{"/player/hotcue/7", ""},
+	{"/player/loop", "/player/loop/in"},
+	{"/player/loop", "/player/loop/mode"},
+	{"/player/loop", "/player/loop/out"},
+	{"/player/loop/in", ""},
+	{"/player/loop/mode", ""},
+	{"/player/loop/out", ""},
+	{"/player/rate", ""},
 	{"/player/time", "/player/time/elapsed"},
 	{"/player/time/elapsed", ""}
 };
@@ -253,6 +764,11 @@ CommandResult Player::Read(const std::string &path, size_t id) const
 {
 	assert(this->file != nullptr);
 
+	if (id == 0 && this->batching) {
+		this->Hold(path);
+		return CommandResult::Success();
+	}
+
 	// Maybe the requested item is a directory?
 	auto count = Player::RESOURCES.count(path);
 	if (0 < count) {
@@ -263,7 +779,8 @@ CommandResult Player::Read(const std::string &path, size_t id) const
 			// The entry might be currently empty, in which case
 			// Emit will return nullptr.  This is fine, but we'll just
 			// act as if it doesn't exist at all.
-			auto response = this->file->Emit(path, id == 0);
+			auto response = this->Emit(path);
+			if (!response) response = this->file->Emit(path, id == 0);
 			if (!response) return CommandResult::Failure(MSG_NOT_FOUND);
 
 			if (this->sink != nullptr) this->sink->Respond(*response, id);
@@ -287,6 +804,69 @@ CommandResult Player::Read(const std::string &path, size_t id) const
 	return CommandResult::Failure(MSG_NOT_FOUND);
 }
 
+CommandResult Player::ReadMatching(const std::vector<std::string> &cmd,
+                                   size_t id) const
+{
+	// A single plain path is read as it always was; in particular, reading
+	// an empty entry fails.
+	bool plain = cmd[2].find_first_of("*?") == std::string::npos;
+	if (cmd.size() == 3 && plain) return this->Read(cmd[2], id);
+
+	// The first two words are 'read' and the tag; then come the patterns.
+	std::vector<bool> matched(cmd.size() - 2, false);
+	std::vector<std::string> paths;
+
+	// Each distinct path in the tree is a resource; skipping from key to
+	// key visits each once.
+	for (auto it = RESOURCES.begin(); it != RESOURCES.end();
+	     it = RESOURCES.upper_bound(it->first)) {
+		auto &path = it->first;
+
+		bool match = false;
+		for (std::size_t i = 2; i < cmd.size(); i++) {
+			if (!GlobMatch(cmd[i], path)) continue;
+			matched[i - 2] = true;
+			match = true;
+		}
+		if (!match) continue;
+
+		// Reading a directory reads everything inside it, so don't
+		// read anything twice.
+		auto read = [&path](const std::string &dir) {
+			return Includes(dir, path);
+		};
+		if (std::any_of(paths.begin(), paths.end(), read)) continue;
+		paths.erase(std::remove_if(paths.begin(), paths.end(),
+		                           [&path](const std::string &inner) {
+			                           return Includes(path, inner);
+		                           }),
+		            paths.end());
+		paths.push_back(path);
+	}
+
+	bool all = std::all_of(matched.begin(), matched.end(),
+	                       [](bool m) { return m; });
+	if (!all) return CommandResult::Failure(MSG_NOT_FOUND);
+
+	// Empty entries are left out, as they are when reading a directory.
+	for (auto &path : paths) this->Read(path, id);
+	return CommandResult::Success();
+}
+
+void Player::Hold(const std::string &path) const
+{
+	for (auto &dir : this->held) {
+		if (Includes(dir, path)) return;
+	}
+
+	this->held.erase(std::remove_if(this->held.begin(), this->held.end(),
+	                                [&path](const std::string &held) {
+		                                return Includes(path, held);
+	                                }),
+	                 this->held.end());
+	this->held.push_back(path);
+}
+
 CommandResult Player::Write(const std::string &path, const std::string &payload)
 {
 	if ("/control/state" == path) {
@@ -300,6 +880,49 @@ CommandResult Player::Write(const std::string &path, const std::string &payload)
 	if ("/player/file" == path) return this->Load(payload);
 	if ("/player/time/elapsed" == path) return this->Seek(payload);
 
+	if ("/player/crossfade/file" == path) return this->SetNext(payload);
+	if ("/player/crossfade/curve" == path) {
+		if ("Linear" == payload) {
+			return this->SetCrossfadeCurve(CrossfadeCurve::LINEAR);
+		}
+		if ("EqualPower" == payload) {
+			return this->SetCrossfadeCurve(CrossfadeCurve::EQUAL_POWER);
+		}
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+	if ("/player/crossfade/length" == path ||
+	    "/player/crossfade/start" == path) {
+		return this->SetCrossfadeTime(path, payload);
+	}
+
+	if ("/player/dsp/gain" == path || "/player/dsp/limiter" == path) {
+		// An empty level would turn the processor off; that's what
+		// deleting is for.
+		if (payload.empty()) {
+			return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+		}
+		return this->SetDspLevel(path, payload);
+	}
+
+	if ("/player/loop/mode" == path) {
+		if ("On" == payload) return this->SetLooping(true);
+		if ("Off" == payload) return this->SetLooping(false);
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+	if ("/player/loop/in" == path) return this->SetLoopPoint(path, payload);
+	if ("/player/loop/out" == path) return this->SetLoopPoint(path, payload);
+
+	if ("/player/rate" == path) return this->SetRate(payload);
+
+	std::size_t index;
+	if (HotCueIndex(path, index)) return this->SetHotCue(index, payload);
+	if (EqBandIndex(path, index)) {
+		if (payload.empty()) {
+			return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+		}
+		return this->SetEqBand(index, payload);
+	}
+
 	return this->ResourceFailure(path);
 }
 
@@ -309,6 +932,31 @@ CommandResult Player::Delete(const std::string &path)
 	if ("/player/file" == path) return this->Eject();
 	if ("/player/time/elapsed" == path) return this->Seek("0");
 
+	if ("/player/crossfade/file" == path) return this->ClearNext();
+	if ("/player/crossfade/curve" == path) {
+		return this->SetCrossfadeCurve(CrossfadeCurve::EQUAL_POWER);
+	}
+	if ("/player/crossfade/length" == path) {
+		return this->SetCrossfadeTime(path, "0");
+	}
+	if ("/player/crossfade/start" == path) {
+		return this->SetCrossfadeTime(path, "");
+	}
+
+	if ("/player/dsp/gain" == path || "/player/dsp/limiter" == path) {
+		return this->SetDspLevel(path, "");
+	}
+
+	if ("/player/loop/mode" == path) return this->SetLooping(false);
+	if ("/player/loop/in" == path) return this->SetLoopPoint(path, "0");
+	if ("/player/loop/out" == path) return this->SetLoopPoint(path, "");
+
+	if ("/player/rate" == path) return this->SetRate("1");
+
+	std::size_t index;
+	if (HotCueIndex(path, index)) return this->ClearHotCue(index);
+	if (EqBandIndex(path, index)) return this->SetEqBand(index, "");
+
 	return this->ResourceFailure(path);
 }
 
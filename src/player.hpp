@@ -61,6 +61,13 @@ public:
 	 */
 	void SetSink(ResponseSink &sink);
 
+	/**
+	 * Sets the directory into which the Player dumps diagnostics.
+	 * Until this is set, dumps fail.
+	 * @param dir The directory, which should exist.
+	 */
+	void SetTraceDir(const std::string &dir);
+
 	/**
 	 * Instructs the Player to perform a cycle of work.
 	 * This includes decoding the next frame and responding to commands.
@@ -81,6 +88,24 @@ private:
 	bool is_running;             ///< Whether the Player is running.
 	const ResponseSink *sink;    ///< The sink for audio responses.
 
+	/// How files are crossfaded into the next file.
+	CrossfadeSettings crossfade;
+
+	/// The settings of the built-in DSP processors.
+	DspSettings dsp;
+
+	/// The speed of playback: 1 is normal speed.
+	double rate;
+
+	/// The directory into which dumps go, or empty if there is none.
+	std::string trace_dir;
+
+	/// Whether a batch is running, so broadcasts should be held back.
+	bool batching;
+
+	/// The resources whose broadcasts are held back until a batch ends.
+	mutable std::vector<std::string> held;
+
 	/// The set of features playd implements.
 	const static std::vector<std::string> FEATURES;
 
@@ -115,6 +140,12 @@ private:
 	/// Handles ending a file (stopping and rewinding).
 	void End();
 
+	/**
+	 * Broadcasts the playback position, if the Audio says it's time to.
+	 * Unlike a Read, this doesn't allocate.
+	 */
+	void AnnounceTime() const;
+
 	//
 	// Seeking
 	//
@@ -152,6 +183,142 @@ private:
 	 */
 	void SeekRaw(std::uint64_t pos);
 
+	//
+	// Crossfading
+	//
+
+	/**
+	 * Queues a file to be crossfaded into at the end of the current one.
+	 * @param path The absolute path to the next file.
+	 * @return Whether the queueing succeeded.
+	 */
+	CommandResult SetNext(const std::string &path);
+
+	/**
+	 * Unqueues the next file, if any.
+	 * @return Whether the unqueueing succeeded.
+	 */
+	CommandResult ClearNext();
+
+	/**
+	 * Sets the shape of crossfades.
+	 * @param curve The new crossfade curve.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetCrossfadeCurve(CrossfadeCurve curve);
+
+	/**
+	 * Sets the length or start of crossfades.
+	 * @param path The resource to set: `/player/crossfade/length` or
+	 *   `/player/crossfade/start`.
+	 * @param time_str A string containing the time, in microseconds.  An
+	 *   empty start means one crossfade length before the end of the file.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetCrossfadeTime(const std::string &path,
+	                               const std::string &time_str);
+
+	/**
+	 * Emits one of the resources the Player, rather than the Audio, holds.
+	 * @param path The path of the resource.
+	 * @return The resource, or nullptr if it isn't held by the Player.
+	 */
+	std::unique_ptr<Response> Emit(const std::string &path) const;
+
+	//
+	// DSP
+	//
+
+	/**
+	 * Sets the level of the gain stage or the limiter.
+	 * @param path The resource to set: `/player/dsp/gain` or
+	 *   `/player/dsp/limiter`.
+	 * @param level A string containing the gain or ceiling, in dB.  An
+	 *   empty level turns the processor off.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetDspLevel(const std::string &path,
+	                          const std::string &level);
+
+	/**
+	 * Sets up one band of the EQ.
+	 * @param index The index of the band.
+	 * @param band A string of the form `frequency,gain,q`, with the
+	 *   frequency in Hz and the gain in dB.  An empty string turns the
+	 *   band off.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetEqBand(std::size_t index, const std::string &band);
+
+	/**
+	 * Finds the EQ band named by a resource path.
+	 * @param path The resource path, for example `/player/dsp/eq/2`.
+	 * @param index Set to the index of the band, if @a path names one.
+	 * @return True if @a path names an EQ band; false otherwise.
+	 */
+	static bool EqBandIndex(const std::string &path, std::size_t &index);
+
+	/**
+	 * Sets the speed of playback.
+	 * @param rate A string containing the rate, between
+	 *   TimeStretch::MIN_RATE and TimeStretch::MAX_RATE.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetRate(const std::string &rate);
+
+	//
+	// Looping
+	//
+
+	/**
+	 * Sets whether the current track loops.
+	 * @param looping True to loop; false to play through.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetLooping(bool looping);
+
+	/**
+	 * Sets one of the current track's loop points.
+	 * @param path The resource of the loop point: `/player/loop/in` or
+	 *   `/player/loop/out`.
+	 * @param time_str A string containing the loop point, in
+	 *   microseconds.  An empty loop-out point loops at the end of the
+	 *   file.
+	 * @return Whether the change succeeded.
+	 */
+	CommandResult SetLoopPoint(const std::string &path,
+	                           const std::string &time_str);
+
+	//
+	// Hot cues
+	//
+
+	/**
+	 * Registers a hot cue in the current track.
+	 * Seeks to the cue's position will then start from a preroll of
+	 * decoded audio, rather than waiting on the decoder.
+	 * @param index The slot of the hot cue.
+	 * @param time_str A string containing the cue's position, in
+	 *   microseconds.
+	 * @return Whether the registration succeeded.
+	 */
+	CommandResult SetHotCue(std::size_t index, const std::string &time_str);
+
+	/**
+	 * Unregisters a hot cue in the current track.
+	 * @param index The slot of the hot cue.
+	 * @return Whether the unregistration succeeded.
+	 */
+	CommandResult ClearHotCue(std::size_t index);
+
+	/**
+	 * Finds the hot cue slot named by a resource path.
+	 * @param path The resource path, for example `/player/hotcue/3`.
+	 * @param index Set to the slot of the hot cue, if @a path names one.
+	 * @return True if @a path names a hot cue slot; false otherwise.
+	 */
+	static bool HotCueIndex(const std::string &path, std::size_t &index);
+
 	//
 	// Other
 	//
@@ -173,6 +340,24 @@ private:
 	 */
 	virtual CommandResult Read(const std::string &path, size_t id) const;
 
+	/**
+	 * Reads every resource matching any of several paths or patterns.
+	 *
+	 * The words after the tag are resource paths, in which `*` matches
+	 * any run of characters and `?` any one character, other than `/`.
+	 * The tree is searched once, and each matching resource is read once,
+	 * even if it matches several patterns or is inside a matching
+	 * directory.
+	 *
+	 * @param words The words of the read command.
+	 * @param id The ID of the connection to which the responses go.
+	 *   May be 0, for all (broadcast).
+	 * @return The result of reading, which is a failure if any pattern
+	 *   matches nothing.
+	 */
+	CommandResult ReadMatching(const std::vector<std::string> &words,
+	                           size_t id) const;
+
 	/**
 	 * Writes to the requested resource.
 	 *
@@ -193,6 +378,45 @@ private:
 	 */
 	virtual CommandResult Delete(const std::string &path);
 
+	/**
+	 * Dumps diagnostic information to a file.
+	 * The only thing that can be dumped is `trace`, the spans recorded by
+	 * the trace recorder, as Chrome trace JSON.  The file is written on
+	 * the calling thread, which holds up playback updates until done.
+	 *
+	 * Clients only name the dump: it goes to `trace-NAME.json` in the
+	 * trace directory, and names with path separators are refused, so
+	 * clients can't make playd write anywhere else.
+	 *
+	 * @param what The thing to dump.
+	 * @param name The name of the dump.
+	 * @return The result of dumping, which may be a failure if the thing
+	 *   doesn't exist, there is no trace directory, or the file can't be
+	 *   written.
+	 */
+	CommandResult Dump(const std::string &what, const std::string &name);
+
+	/**
+	 * Runs several writes in order, as one command.
+	 *
+	 * The words after the tag are pairs of resource paths and payloads.
+	 * The batch stops at the first write that fails; writes before it
+	 * stay done.  Broadcasts are held back until the batch ends, and then
+	 * each changed resource is broadcast once, with its final value.
+	 *
+	 * @param words The words of the batch command.
+	 * @return The result of the batch: success, or the failing write's.
+	 */
+	CommandResult Batch(const std::vector<std::string> &words);
+
+	/**
+	 * Holds back a broadcast of a resource until the current batch ends.
+	 * Resources inside a directory that is already held are dropped, as
+	 * the directory's broadcast will include them.
+	 * @param path The path of the resource.
+	 */
+	void Hold(const std::string &path) const;
+
 	/**
 	 * Resolves a failure to write or delete a resource.
 	 * This checks to see if the resource is supposed to exist.  If it
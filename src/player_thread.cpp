@@ -0,0 +1,241 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the PlayerThread class.
+ * @see player_thread.hpp
+ */
+
+#include <cassert>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "metrics.hpp"
+#include "player.hpp"
+#include "response.hpp"
+#include "trace.hpp"
+
+#include "player_thread.hpp"
+
+const std::size_t PlayerThread::QUEUE_CAPACITY = 1024;
+const std::chrono::milliseconds PlayerThread::UPDATE_PERIOD(5);
+const std::chrono::milliseconds PlayerThread::REPLY_WAIT(1000);
+
+PlayerThread::Reply::Reply() : Reply(Kind::QUIT, 0)
+{
+}
+
+PlayerThread::Reply::Reply(Kind kind, size_t id)
+    : kind(kind), response(Response::Code::ACK), id(id)
+{
+	assert(kind != Kind::RESPONSE);
+}
+
+PlayerThread::Reply::Reply(const Response &response, size_t id)
+    : kind(Kind::RESPONSE), response(response), id(id)
+{
+}
+
+PlayerThread::PlayerThread(Player &player)
+    : player(player),
+      commands(QUEUE_CAPACITY),
+      replies(QUEUE_CAPACITY),
+      unwoken(false),
+      listening(false),
+      stopping(false)
+{
+	this->player.SetSink(*this);
+}
+
+PlayerThread::~PlayerThread()
+{
+	this->Stop();
+	if (this->thread.joinable()) this->thread.join();
+}
+
+void PlayerThread::SetPolicy(const ThreadPolicy &policy)
+{
+	this->policy = policy;
+}
+
+void PlayerThread::Start(WakeFn wake)
+{
+	assert(!this->thread.joinable());
+
+	this->wake = wake;
+	this->thread = std::thread([this]() {
+		// Failing to get the policy is worth a log line, but not
+		// worth refusing to play.
+		this->policy.Apply();
+		NameTraceThread("player");
+
+		try {
+			this->Loop();
+		} catch (...) {
+			// Let the I/O thread shut down; Join passes the
+			// exception on.
+			this->error = std::current_exception();
+			Reply quit(Reply::Kind::QUIT, 0);
+			this->PushReply(quit);
+			this->Wake();
+		}
+	});
+}
+
+void PlayerThread::Stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->wakeup.notify_one();
+}
+
+void PlayerThread::Join()
+{
+	if (this->thread.joinable()) this->thread.join();
+	if (this->error) std::rethrow_exception(this->error);
+}
+
+bool PlayerThread::Push(Command &command)
+{
+	if (!this->commands.TryPush(command)) return false;
+
+	// Taking the lock means the thread is either not yet waiting, and
+	// will see the command when it checks, or waiting, and will get the
+	// notification.
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+	}
+	this->wakeup.notify_one();
+	return true;
+}
+
+bool PlayerThread::TakeReply(Reply &reply)
+{
+	return this->replies.TryPop(reply);
+}
+
+void PlayerThread::Respond(const Response &response, size_t id) const
+{
+	Reply reply(response, id);
+	this->PushReply(reply);
+}
+
+void PlayerThread::Announce(const Response &response) const
+{
+	Reply reply(response, 0);
+	if (this->replies.TryPush(reply)) {
+		this->unwoken = true;
+		return;
+	}
+
+	Metrics::Get().replies_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PlayerThread::SetListening(bool listening)
+{
+	this->listening.store(listening, std::memory_order_relaxed);
+}
+
+bool PlayerThread::Listening() const
+{
+	return this->listening.load(std::memory_order_relaxed);
+}
+
+void PlayerThread::Loop()
+{
+	using clock = std::chrono::steady_clock;
+	auto next_update = clock::now();
+
+	while (!this->stopping) {
+		Command command;
+		while (this->commands.TryPop(command)) this->Handle(command);
+
+		auto now = clock::now();
+		if (next_update <= now) {
+			bool running;
+			{
+				TraceSpan span("PlayerThread::Update");
+				running = this->player.Update();
+			}
+
+			if (!running) {
+				Reply quit(Reply::Kind::QUIT, 0);
+				this->PushReply(quit);
+				this->Wake();
+				return;
+			}
+
+			// If we've fallen behind, don't try to catch up with a
+			// burst of updates.
+			next_update += UPDATE_PERIOD;
+			if (next_update < now) next_update = now + UPDATE_PERIOD;
+		}
+
+		this->Wake();
+
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->wakeup.wait_until(guard, next_update, [this]() {
+			return this->stopping || !this->commands.Empty();
+		});
+	}
+}
+
+void PlayerThread::Handle(Command &command)
+{
+	switch (command.kind) {
+		case Command::Kind::RUN: {
+			auto res = this->player.RunCommand(command.words,
+			                                   command.id);
+			if (res.IsSuccess()) {
+				Metrics::Get().audible.Arm(command.words,
+				                           command.read_at);
+			}
+			// The ACK goes through Respond, so it lands in the reply
+			// queue after everything the command itself sent.
+			res.Emit(*this, command.words, command.id);
+			break;
+		}
+		case Command::Kind::WELCOME:
+			this->player.WelcomeClient(command.id);
+			break;
+		case Command::Kind::RELEASE: {
+			Reply released(Reply::Kind::RELEASED, command.id);
+			this->PushReply(released);
+			break;
+		}
+	}
+}
+
+void PlayerThread::PushReply(Reply &reply) const
+{
+	// Dropping a reply could lose an ACK, so, if the I/O thread has
+	// fallen behind, nudge it and give it a while to catch up.  Sleeping
+	// between tries leaves the CPU to the I/O thread, which is the one
+	// with work to do; if it is stuck for good, we stop waiting on it.
+	using clock = std::chrono::steady_clock;
+	auto give_up = clock::now() + REPLY_WAIT;
+	while (!this->replies.TryPush(reply)) {
+		this->unwoken = true;
+		this->Wake();
+		if (this->stopping || give_up <= clock::now()) {
+			auto &dropped = Metrics::Get().replies_dropped;
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	this->unwoken = true;
+}
+
+void PlayerThread::Wake() const
+{
+	if (!this->unwoken) return;
+	this->unwoken = false;
+	if (this->wake) this->wake();
+}
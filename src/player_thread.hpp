@@ -0,0 +1,238 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the PlayerThread class.
+ * @see player_thread.cpp
+ */
+
+#ifndef PLAYD_PLAYER_THREAD_HPP
+#define PLAYD_PLAYER_THREAD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "realtime.hpp"
+#include "response.hpp"
+#include "spsc_queue.hpp"
+
+class Player;
+
+/**
+ * A thread running a Player, apart from the thread doing the I/O.
+ *
+ * The I/O thread hands the PlayerThread commands through one SpscQueue, and
+ * takes responses back through another.  While it runs, the PlayerThread is
+ * the only thing touching the Player, and is its ResponseSink.
+ *
+ * Every reply caused by a command is queued before any reply caused by a
+ * later command, and a command's ACK is queued after all of the responses
+ * it caused.  So, as long as the I/O thread sends replies in the order it
+ * takes them, each client sees its commands' ACKs in the order it sent the
+ * commands, each after whatever the command broadcast.
+ */
+class PlayerThread : public ResponseSink
+{
+public:
+	/// A request from the I/O thread.
+	struct Command {
+		/// The kinds of Command.
+		enum class Kind : std::uint8_t {
+			RUN,     ///< Run a command line.
+			WELCOME, ///< Send a new client the state dump.
+			RELEASE  ///< Reply RELEASED once earlier replies are out.
+		};
+
+		Kind kind;                      ///< The kind of Command.
+		std::vector<std::string> words; ///< For RUN, the command line.
+		size_t id;                      ///< The client's ID.
+
+		/// For RUN, when the command line was read.
+		std::chrono::steady_clock::time_point read_at;
+	};
+
+	/**
+	 * A reply to the I/O thread.
+	 * The response is held by value, so that queueing a reply copies it
+	 * into a slot of the reply queue rather than allocating.
+	 */
+	struct Reply {
+		/// The kinds of Reply.
+		enum class Kind : std::uint8_t {
+			RESPONSE, ///< Send a response.
+			RELEASED, ///< A client ID can now be re-used.
+			QUIT      ///< The player has stopped running.
+		};
+
+		/// Constructs an empty Reply, for the reply queue's slots.
+		Reply();
+
+		/**
+		 * Constructs a Reply without a response.
+		 * @param kind The kind of Reply; not RESPONSE.
+		 * @param id The client's ID, or 0.
+		 */
+		Reply(Kind kind, size_t id);
+
+		/**
+		 * Constructs a RESPONSE Reply.
+		 * @param response The response, which is copied.
+		 * @param id The client's ID, or 0.
+		 */
+		Reply(const Response &response, size_t id);
+
+		Kind kind;         ///< The kind of Reply.
+		Response response; ///< For RESPONSE, the response.
+		size_t id;         ///< The client's ID, or 0.
+	};
+
+	/// Type of functions telling the I/O thread there are replies.
+	using WakeFn = std::function<void()>;
+
+	/// The number of commands, and of replies, that can be waiting.
+	static const std::size_t QUEUE_CAPACITY;
+
+	/// The period between player updates.
+	static const std::chrono::milliseconds UPDATE_PERIOD;
+
+	/// The longest the thread waits for room in the reply queue.
+	static const std::chrono::milliseconds REPLY_WAIT;
+
+	/**
+	 * Constructs a PlayerThread, and makes it the Player's ResponseSink.
+	 * The thread doesn't start until Start is called.
+	 * @param player The player to run.
+	 */
+	explicit PlayerThread(Player &player);
+
+	/// Stops and joins the thread, if it is running.
+	~PlayerThread();
+
+	/// Deleted copy constructor.
+	PlayerThread(const PlayerThread &) = delete;
+
+	/// Deleted copy-assignment.
+	PlayerThread &operator=(const PlayerThread &) = delete;
+
+	/**
+	 * Sets how the thread is to be scheduled.
+	 * This takes effect when the thread starts.
+	 * @param policy The thread's scheduling policy.
+	 */
+	void SetPolicy(const ThreadPolicy &policy);
+
+	/**
+	 * Starts the thread.
+	 * @param wake Called, from the player thread, whenever there are new
+	 *   replies to take; this must be safe to call from any thread.
+	 */
+	void Start(WakeFn wake);
+
+	/**
+	 * Asks the thread to stop, without waiting for it.
+	 * Any commands still waiting are dropped.
+	 */
+	void Stop();
+
+	/**
+	 * Waits for the thread to finish.
+	 * @exception Error Rethrown if the thread died of an exception.
+	 */
+	void Join();
+
+	/**
+	 * Hands the thread a command.
+	 * Call only from the I/O thread.
+	 * @param command The command, which is moved from only if it was
+	 *   queued.
+	 * @return True if the command was queued; false if the queue is full.
+	 */
+	bool Push(Command &command);
+
+	/**
+	 * Takes the next reply, if any.
+	 * Call only from the I/O thread.
+	 * @param reply Set to the reply, if there was one.
+	 * @return True if there was a reply; false otherwise.
+	 */
+	bool TakeReply(Reply &reply);
+
+	/**
+	 * Queues a response for the I/O thread.
+	 * Call only from the player thread.  If the reply queue is full, this
+	 * waits for the I/O thread to make room, for up to REPLY_WAIT.
+	 */
+	void Respond(const Response &response, size_t id = 0) const override;
+
+	/**
+	 * Queues an announcement for the I/O thread, if there is room.
+	 * Call only from the player thread.  If the reply queue is full, the
+	 * announcement is dropped rather than waited on, as the next one will
+	 * supersede it anyway.
+	 */
+	void Announce(const Response &response) const override;
+
+	/**
+	 * Tells the thread whether any clients are connected.
+	 * Call only from the I/O thread, whenever that changes.
+	 * @param listening Whether any clients are connected.
+	 */
+	void SetListening(bool listening);
+
+	/// @return Whether any clients were connected, as the I/O thread
+	///   last said.
+	bool Listening() const override;
+
+private:
+	Player &player; ///< The player being run.
+	WakeFn wake;    ///< Tells the I/O thread there are replies.
+
+	ThreadPolicy policy; ///< How the thread is to be scheduled.
+
+	SpscQueue<Command> commands; ///< From the I/O thread.
+
+	/// To the I/O thread; mutable, as Respond is const.
+	mutable SpscQueue<Reply> replies;
+
+	/// Whether replies have been queued since wake was last called.
+	mutable bool unwoken;
+
+	std::atomic<bool> listening; ///< Set while clients are connected.
+	std::atomic<bool> stopping; ///< Set to stop the thread.
+	std::mutex lock;            ///< Guards sleeping on wakeup.
+	std::condition_variable wakeup; ///< Signalled on new commands.
+
+	std::thread thread;       ///< The player thread, if started.
+	std::exception_ptr error; ///< What killed the thread, if anything.
+
+	/// The body of the player thread.
+	void Loop();
+
+	/**
+	 * Carries out one command.
+	 * @param command The command.
+	 */
+	void Handle(Command &command);
+
+	/**
+	 * Queues a reply for the I/O thread, waiting for room if need be.
+	 * If there is still no room after REPLY_WAIT, or the thread is
+	 * stopping, the reply is dropped and counted in Metrics.
+	 * @param reply The reply.
+	 */
+	void PushReply(Reply &reply) const;
+
+	/// Calls wake, if replies have been queued since it was last called.
+	void Wake() const;
+};
+
+#endif // PLAYD_PLAYER_THREAD_HPP
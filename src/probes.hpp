@@ -0,0 +1,64 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Static tracepoints for perf, bpftrace and SystemTap.
+ *
+ * Where <sys/sdt.h> (from SystemTap) is available, each PD_PROBE becomes a
+ * USDT probe in the `playd` provider: a single no-op instruction, plus an
+ * ELF note telling tracers where it is and where its arguments live.  They
+ * cost nothing until a tracer attaches, for example with
+ *
+ *     bpftrace -e 'usdt:/usr/local/bin/playd:playd:callback
+ *                  { @avail = hist(arg0); }'
+ *
+ * Without <sys/sdt.h>, or with PLAYD_NO_SDT defined, the probes compile to
+ * nothing, and their arguments aren't evaluated.
+ *
+ * The probes are:
+ *
+ * - `decode_start()`, as a decoder is asked for a frame;
+ * - `decode_end(bytes)`, with the size of the frame it gave back;
+ * - `transfer(samples)`, as samples go into a sink's ring buffer;
+ * - `callback(avail, req)`, as the device asks for req samples and the
+ *   ring buffer has avail;
+ * - `command(id, word)`, as a client's command is received;
+ * - `respond(id, bytes)`, as a response is written to a client.
+ */
+
+#ifndef PLAYD_PROBES_HPP
+#define PLAYD_PROBES_HPP
+
+#if !defined(PLAYD_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PLAYD_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef PLAYD_HAVE_SDT
+
+/// Fires the probe @a name, with no arguments.
+#define PD_PROBE(name) DTRACE_PROBE(playd, name)
+
+/// Fires the probe @a name, with one argument.
+#define PD_PROBE1(name, a) DTRACE_PROBE1(playd, name, a)
+
+/// Fires the probe @a name, with two arguments.
+#define PD_PROBE2(name, a, b) DTRACE_PROBE2(playd, name, a, b)
+
+#else
+
+/// Fires the probe @a name, with no arguments.
+#define PD_PROBE(name) ((void)0)
+
+/// Fires the probe @a name, with one argument.
+#define PD_PROBE1(name, a) ((void)0)
+
+/// Fires the probe @a name, with two arguments.
+#define PD_PROBE2(name, a, b) ((void)0)
+
+#endif // PLAYD_HAVE_SDT
+
+#endif // PLAYD_PROBES_HPP
@@ -0,0 +1,245 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of thread scheduling, memory locking and fault counting.
+ * @see realtime.hpp
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+#include "errors.hpp"
+#include "realtime.hpp"
+
+/// Whether LockMemory has locked the process's memory.
+static std::atomic<bool> memory_locked(false);
+
+/// Whether CountFaults and ReportFaults are on.
+static std::atomic<bool> counting(false);
+
+/// A ThreadFaults that can be added to from one thread and read from others.
+struct AtomicFaults {
+	std::atomic<std::uint64_t> minor_faults; ///< Minor page faults.
+	std::atomic<std::uint64_t> major_faults; ///< Major page faults.
+	std::atomic<std::uint64_t> switches;     ///< Involuntary switches.
+};
+
+/// The totals for each AudioPath, indexed by the path.
+static AtomicFaults totals[2];
+
+/**
+ * Logs the failure of a system call.
+ * @param what What we were trying to do.
+ * @param err The error number.
+ */
+static void LogFailure(const char *what, int err)
+{
+	Debug() << "couldn't" << what << "-" << std::strerror(err)
+	        << std::endl;
+}
+
+bool ThreadPolicy::Apply() const
+{
+#ifdef __linux__
+	bool ok = true;
+
+	if (!this->cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : this->cpus) {
+			if (0 <= cpu && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+		}
+
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set),
+		                                 &set);
+		if (err != 0) {
+			LogFailure("pin thread to CPUs", err);
+			ok = false;
+		}
+	}
+
+	switch (this->scheduler) {
+		case Scheduler::DEFAULT:
+			break;
+		case Scheduler::NICE: {
+			// On Linux, each thread has its own nice value, which
+			// setpriority sets when given a thread ID.
+			auto tid = static_cast<id_t>(syscall(SYS_gettid));
+			if (setpriority(PRIO_PROCESS, tid, this->priority) != 0) {
+				LogFailure("set nice value", errno);
+				ok = false;
+			}
+			break;
+		}
+		case Scheduler::FIFO:
+		case Scheduler::RR: {
+			sched_param param;
+			std::memset(&param, 0, sizeof(param));
+			param.sched_priority = this->priority;
+
+			auto policy = this->scheduler == Scheduler::FIFO
+			                      ? SCHED_FIFO
+			                      : SCHED_RR;
+			int err = pthread_setschedparam(pthread_self(), policy,
+			                                &param);
+			if (err != 0) {
+				LogFailure("set realtime priority", err);
+				ok = false;
+			}
+			break;
+		}
+	}
+
+	return ok;
+#else
+	if (this->scheduler == Scheduler::DEFAULT && this->cpus.empty()) {
+		return true;
+	}
+	Debug() << "thread policies need Linux; ignoring" << std::endl;
+	return false;
+#endif // __linux__
+}
+
+bool LockMemory()
+{
+#ifdef __linux__
+	// Locking future mappings makes every later mmap fail once the lock
+	// limit is reached, including for thread stacks, so only do it if
+	// there is no limit.
+	rlimit limit;
+	int flags = MCL_CURRENT;
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+	    limit.rlim_cur == RLIM_INFINITY) {
+		flags |= MCL_FUTURE;
+	}
+
+	if (mlockall(flags) != 0) {
+		LogFailure("lock memory", errno);
+		return false;
+	}
+
+	// Stop the allocator giving memory back to the system, or serving
+	// big blocks from fresh (unlocked, unfaulted) mappings.
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	memory_locked = true;
+	return true;
+#else
+	Debug() << "memory locking needs Linux; ignoring" << std::endl;
+	return false;
+#endif // __linux__
+}
+
+void Prefault(void *start, std::size_t bytes)
+{
+	if (!memory_locked || start == nullptr) return;
+
+#ifdef __linux__
+	// This may already be covered by mlockall; if not, it may fail on
+	// the lock limit, in which case touching the pages is the best we
+	// can do.
+	if (mlock(start, bytes) != 0) LogFailure("lock buffer", errno);
+#endif // __linux__
+
+	std::memset(start, 0, bytes);
+}
+
+/* static */ bool ThreadFaults::Read(ThreadFaults &faults)
+{
+#if defined(__linux__) && defined(RUSAGE_THREAD)
+	rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) != 0) return false;
+
+	faults.minor_faults = static_cast<std::uint64_t>(usage.ru_minflt);
+	faults.major_faults = static_cast<std::uint64_t>(usage.ru_majflt);
+	faults.switches = static_cast<std::uint64_t>(usage.ru_nivcsw);
+	return true;
+#else
+	(void)faults;
+	return false;
+#endif
+}
+
+void EnableFaultCounts()
+{
+	counting = true;
+}
+
+void CountFaults(AudioPath path)
+{
+	if (!counting) return;
+
+	// Each thread measures from its own first call, so a new device
+	// thread (one per file) starts afresh rather than from the old one's
+	// counts.
+	static thread_local bool started = false;
+	static thread_local ThreadFaults last;
+
+	ThreadFaults now;
+	if (!ThreadFaults::Read(now)) return;
+
+	if (started) {
+		auto &total = totals[static_cast<int>(path)];
+		total.minor_faults += now.minor_faults - last.minor_faults;
+		total.major_faults += now.major_faults - last.major_faults;
+		total.switches += now.switches - last.switches;
+	}
+
+	last = now;
+	started = true;
+}
+
+ThreadFaults FaultTotals(AudioPath path)
+{
+	auto &total = totals[static_cast<int>(path)];
+	return ThreadFaults{total.minor_faults, total.major_faults,
+	                    total.switches};
+}
+
+void ReportFaults()
+{
+	if (!counting) return;
+
+	using clock = std::chrono::steady_clock;
+	static clock::time_point next_report = clock::now();
+	static ThreadFaults reported[2] = {};
+
+	auto now = clock::now();
+	if (now < next_report) return;
+	next_report = now + std::chrono::seconds(1);
+
+	static const char *NAMES[2] = {"decoder", "device"};
+	for (int p = 0; p < 2; p++) {
+		auto total = FaultTotals(static_cast<AudioPath>(p));
+		auto &last = reported[p];
+		if (total.minor_faults == last.minor_faults &&
+		    total.major_faults == last.major_faults &&
+		    total.switches == last.switches) {
+			continue;
+		}
+
+		Debug() << NAMES[p] << "thread: page faults"
+		        << (total.minor_faults - last.minor_faults) << "minor,"
+		        << (total.major_faults - last.major_faults) << "major;"
+		        << (total.switches - last.switches)
+		        << "involuntary context switches" << std::endl;
+		last = total;
+	}
+}
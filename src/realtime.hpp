@@ -0,0 +1,114 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of thread scheduling, memory locking and fault counting.
+ * @see realtime.cpp
+ */
+
+#ifndef PLAYD_REALTIME_HPP
+#define PLAYD_REALTIME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * How a thread should be scheduled, and where.
+ * These are only supported on Linux; elsewhere, Apply always fails.
+ */
+struct ThreadPolicy {
+	/// The scheduling classes a thread can be put in.
+	enum class Scheduler : std::uint8_t {
+		DEFAULT, ///< Leave the scheduling alone.
+		NICE,    ///< Normal scheduling, at a given nice value.
+		FIFO,    ///< SCHED_FIFO, at a given realtime priority.
+		RR       ///< SCHED_RR, at a given realtime priority.
+	};
+
+	/// The scheduling class.
+	Scheduler scheduler = Scheduler::DEFAULT;
+
+	/// For NICE, the nice value; for FIFO and RR, the priority.
+	int priority = 0;
+
+	/// The CPUs the thread may run on; empty for any.
+	std::vector<int> cpus;
+
+	/**
+	 * Applies this policy to the calling thread.
+	 * Failures (usually from lacking privileges) are logged, and leave
+	 * the thread as it was.
+	 * @return True if everything applied; false otherwise.
+	 */
+	bool Apply() const;
+};
+
+/**
+ * Locks the process's memory into RAM.
+ *
+ * Everything mapped now is locked.  If the process may lock unlimited
+ * memory, everything mapped later is locked (and faulted in) too; otherwise,
+ * only buffers passed to Prefault are.  The allocator is also told to keep
+ * freed memory, so that buffers re-allocated on the audio path come back
+ * already locked.
+ *
+ * @return True if the memory was locked; false otherwise.
+ */
+bool LockMemory();
+
+/**
+ * Locks a buffer into RAM and touches each of its pages, if LockMemory has
+ * been called; otherwise, does nothing.
+ * The buffer's contents are zeroed.
+ * @param start The start of the buffer.
+ * @param bytes The size of the buffer, in bytes.
+ */
+void Prefault(void *start, std::size_t bytes);
+
+/// Counts of the things that stall a thread on the audio path.
+struct ThreadFaults {
+	std::uint64_t minor_faults; ///< Page faults served without I/O.
+	std::uint64_t major_faults; ///< Page faults needing I/O.
+	std::uint64_t switches;     ///< Involuntary context switches.
+
+	/**
+	 * Reads the calling thread's counts so far.
+	 * @param faults Set to the counts, if they can be read.
+	 * @return True if the counts were read; false if unsupported.
+	 */
+	static bool Read(ThreadFaults &faults);
+};
+
+/// The threads on the audio path.
+enum class AudioPath : std::uint8_t {
+	DECODER, ///< The thread running Player::Update.
+	DEVICE   ///< The audio device's callback thread.
+};
+
+/// Turns on CountFaults and ReportFaults, which otherwise do nothing.
+void EnableFaultCounts();
+
+/**
+ * Adds any faults on the calling thread, since it last called this, to the
+ * totals for its path.
+ * This is one system call, and safe to make from the audio callback.
+ * @param path The path the calling thread is on.
+ */
+void CountFaults(AudioPath path);
+
+/**
+ * Gets the totals counted for a path.
+ * @param path The path.
+ * @return The faults counted on the path so far.
+ */
+ThreadFaults FaultTotals(AudioPath path);
+
+/**
+ * Logs any faults counted since the last report, at most once a second.
+ * Call from the decoder thread.
+ */
+void ReportFaults();
+
+#endif // PLAYD_REALTIME_HPP
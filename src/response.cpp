@@ -7,11 +7,16 @@
  * @see response.hpp
  */
 
-#include <cctype>
-#include <initializer_list>
-#include <sstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
 
 #include "errors.hpp"
+#include "simd.hpp"
 
 #include "response.hpp"
 
@@ -26,6 +31,51 @@ const std::string Response::STRINGS[] = {
         "RES"       // Code::RES
 };
 
+//
+// Response::View
+//
+
+Response::View::View(const char *data, std::size_t size)
+    : data(data), size(size)
+{
+}
+
+const char *Response::View::Data() const
+{
+	return this->data;
+}
+
+std::size_t Response::View::Size() const
+{
+	return this->size;
+}
+
+Response::View::operator std::string() const
+{
+	return std::string(this->data, this->size);
+}
+
+bool operator==(const Response::View &view, const std::string &string)
+{
+	return view.Size() == string.size() &&
+	       std::memcmp(view.Data(), string.data(), view.Size()) == 0;
+}
+
+bool operator==(const Response::View &view, const char *string)
+{
+	return view.Size() == std::strlen(string) &&
+	       std::memcmp(view.Data(), string, view.Size()) == 0;
+}
+
+std::ostream &operator<<(std::ostream &os, const Response::View &view)
+{
+	return os.write(view.Data(), view.Size());
+}
+
+//
+// Response
+//
+
 // Pre-made responses.
 std::unique_ptr<Response> Response::Res(const std::string &type,
                                         const std::string &path,
@@ -38,47 +88,168 @@ std::unique_ptr<Response> Response::Res(const std::string &type,
 	return res;
 }
 
-Response::Response(Response::Code code)
+Response::Response(Response::Code code) : size(0)
 {
-	this->string = Response::STRINGS[static_cast<int>(code)];
+	auto &name = Response::STRINGS[static_cast<int>(code)];
+	this->Append(name.data(), name.size());
 }
 
 Response &Response::AddArg(const std::string &arg)
 {
-	this->string += " " + Response::EscapeArg(arg);
+	return this->AddEscaped(arg.data(), arg.size());
+}
+
+Response &Response::AddArg(const char *arg)
+{
+	return this->AddEscaped(arg, std::strlen(arg));
+}
+
+Response &Response::AddArg(std::uint64_t arg)
+{
+	// Numbers never need escaping, so we can write the digits (backwards,
+	// from the end of a buffer that fits any 64-bit number) straight in.
+	char digits[20];
+	auto end = digits + sizeof(digits);
+	auto begin = end;
+	do {
+		*--begin = static_cast<char>('0' + arg % 10);
+		arg /= 10;
+	} while (arg != 0);
+
+	this->Append(" ", 1);
+	this->Append(begin, static_cast<std::size_t>(end - begin));
 	return *this;
 }
 
-std::string Response::Pack() const
+Response::View Response::Pack() const
 {
-	return this->string;
+	if (this->spill.empty()) return View(this->inline_chars, this->size);
+	return View(this->spill.data(), this->spill.size());
 }
 
-/* static */ std::string Response::EscapeArg(const std::string &arg)
+/**
+ * Checks whether a character means its argument must be single-quoted.
+ * These are the quotes, backslash, and the characters isspace() accepts in
+ * the C locale (which playd never leaves).
+ * @param c The character.
+ * @return True if the character needs quoting.
+ */
+static bool IsQuotable(char c)
 {
-	bool escaping = false;
-	std::string escaped;
+	bool is_space = c == ' ' || ('\t' <= c && c <= '\r');
+	bool is_escaper = c == '"' || c == '\'' || c == '\\';
+	return is_space || is_escaper;
+}
 
-	for (char c : arg) {
-		// These are the characters (including all whitespace, via
-		// isspace())  whose presence means we need to single-quote
-		// escape the argument.
-		bool is_escaper = c == '"' || c == '\'' || c == '\\';
-		if (isspace(c) || is_escaper) escaping = true;
-
-		// Since we use single-quote escaping, the only thing we need
-		// to escape by itself is single quotes, which are replaced by
-		// the sequence '\'' (break out of single quotes, escape a
-		// single quote, then re-enter single quotes).
-		escaped += (c == '\'') ? R"('\'')" : std::string(1, c);
+/* static */ bool Response::NeedsQuoting(const char *arg, std::size_t size)
+{
+	std::size_t i = 0;
+
+#ifdef PLAYD_HAVE_SSE2
+	// Most arguments need no quoting, and file paths are long, so we look
+	// at sixteen characters at a time.  '\t' to '\r' is one range, which
+	// becomes an unsigned 'at most 4' once '\t' is subtracted.
+	const auto tab = _mm_set1_epi8('\t');
+	const auto four = _mm_set1_epi8(4);
+	const auto space = _mm_set1_epi8(' ');
+	const auto dquote = _mm_set1_epi8('"');
+	const auto squote = _mm_set1_epi8('\'');
+	const auto backslash = _mm_set1_epi8('\\');
+
+	for (; i + 16 <= size; i += 16) {
+		auto chunk = _mm_loadu_si128(
+		        reinterpret_cast<const __m128i *>(arg + i));
+
+		auto from_tab = _mm_sub_epi8(chunk, tab);
+		auto hits = _mm_cmpeq_epi8(_mm_min_epu8(from_tab, four), from_tab);
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, space));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, dquote));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, squote));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, backslash));
+		if (_mm_movemask_epi8(hits) != 0) return true;
+	}
+#endif // PLAYD_HAVE_SSE2
+
+	for (; i < size; i++) {
+		if (IsQuotable(arg[i])) return true;
 	}
+	return false;
+}
+
+/**
+ * Single-quotes an argument, escaping any single quotes inside it.
+ * @param arg The first character of the argument.
+ * @param size The length of the argument.
+ * @param append Called with each run of quoted characters, as a pointer to
+ *   the first character and a length.
+ */
+template <typename Append>
+static void Quote(const char *arg, std::size_t size, Append append)
+{
+	// Since we use single-quote escaping, the only thing we need to
+	// escape by itself is single quotes, which are replaced by the
+	// sequence '\'' (break out of single quotes, escape a single quote,
+	// then re-enter single quotes).
+	append("'", 1);
+	auto end = arg + size;
+	for (auto run = arg; run < end;) {
+		auto quote = std::find(run, end, '\'');
+		append(run, static_cast<std::size_t>(quote - run));
+		if (quote == end) break;
+
+		append(R"('\'')", 4);
+		run = quote + 1;
+	}
+	append("'", 1);
+}
+
+Response &Response::AddEscaped(const char *arg, std::size_t size)
+{
+	this->Append(" ", 1);
 
 	// Only single-quote escape if necessary.
 	// Otherwise, it wastes two characters!
-	if (escaping) return "'" + escaped + "'";
+	if (!Response::NeedsQuoting(arg, size)) {
+		this->Append(arg, size);
+		return *this;
+	}
+
+	Quote(arg, size, [this](const char *chars, std::size_t count) {
+		this->Append(chars, count);
+	});
+	return *this;
+}
+
+/* static */ std::string Response::Escape(const std::string &word)
+{
+	if (!word.empty() && !NeedsQuoting(word.data(), word.size())) {
+		return word;
+	}
+
+	std::string escaped;
+	Quote(word.data(), word.size(),
+	      [&escaped](const char *chars, std::size_t count) {
+		      escaped.append(chars, count);
+	      });
 	return escaped;
 }
 
+void Response::Append(const char *chars, std::size_t size)
+{
+	if (this->spill.empty() && this->size + size <= INLINE_CAPACITY) {
+		std::memcpy(this->inline_chars + this->size, chars, size);
+		this->size += size;
+		return;
+	}
+
+	// Once spilled, the packed form stays spilled.
+	if (this->spill.empty()) {
+		this->spill.assign(this->inline_chars, this->size);
+	}
+	this->spill.append(chars, size);
+	this->size = this->spill.size();
+}
+
 //
 // ResponseSink
 //
@@ -87,3 +258,13 @@ void ResponseSink::Respond(const Response &, size_t) const
 {
 	// By default, do nothing.
 }
+
+void ResponseSink::Announce(const Response &response) const
+{
+	this->Respond(response);
+}
+
+bool ResponseSink::Listening() const
+{
+	return true;
+}
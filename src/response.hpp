@@ -10,6 +10,7 @@
 #ifndef PLAYD_IO_RESPONSE_HPP
 #define PLAYD_IO_RESPONSE_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -19,7 +20,13 @@
 
 #include "errors.hpp"
 
-/// A response.
+/**
+ * A response.
+ *
+ * A Response packs itself as arguments are added.  Short responses, which
+ * are almost all of them, live entirely inside the Response; only one that
+ * outgrows INLINE_CAPACITY spills onto the heap.
+ */
 class Response
 {
 public:
@@ -40,6 +47,37 @@ public:
 		RES       ///< Resource.
 	};
 
+	/**
+	 * A read-only view of a packed Response.
+	 * It is only valid while its Response exists and isn't added to.
+	 */
+	class View
+	{
+	public:
+		/**
+		 * Constructs a View.
+		 * @param data The first character of the packed Response.
+		 * @param size The length of the packed Response.
+		 */
+		View(const char *data, std::size_t size);
+
+		/// @return The first character; this is not null-terminated.
+		const char *Data() const;
+
+		/// @return The number of characters.
+		std::size_t Size() const;
+
+		/// @return A copy of the packed Response.
+		operator std::string() const;
+
+	private:
+		const char *data; ///< The first character.
+		std::size_t size; ///< The number of characters.
+	};
+
+	/// The length of packed Response that fits without allocating.
+	static const std::size_t INLINE_CAPACITY = 128;
+
 	/**
 	 * Constructs a Response with no arguments.
 	 * @param code The Response::Code representing the response command.
@@ -63,12 +101,39 @@ public:
 	 */
 	Response &AddArg(const std::string &arg);
 
+	/**
+	 * Adds an argument to this Response.
+	 * @param arg The null-terminated argument to add.  The argument must
+	 *   not be escaped.
+	 * @return A reference to this Response, for chaining.
+	 */
+	Response &AddArg(const char *arg);
+
+	/**
+	 * Adds a number as an argument to this Response.
+	 * The number is formatted in place, without allocating.
+	 * @param arg The number to add.
+	 * @return A reference to this Response, for chaining.
+	 */
+	Response &AddArg(std::uint64_t arg);
+
+	/**
+	 * Escapes a word as Response escapes its arguments, so that the
+	 * Tokeniser reads it back unchanged.
+	 * Unlike an argument, an empty word is quoted, so that it isn't lost.
+	 * This is for writing commands, such as in command logs; Responses
+	 * escape their own arguments.
+	 * @param word The word.
+	 * @return The word, single-quoted if it needs to be.
+	 */
+	static std::string Escape(const std::string &word);
+
 	/**
 	 * Packs the Response, converting it to a BAPS3 protocol message.
 	 * Pack()ing does not alter the Response, which may be Pack()ed again.
-	 * @return The BAPS3 message, sans newline, ready to send.
+	 * @return A view of the BAPS3 message, sans newline, ready to send.
 	 */
-	std::string Pack() const;
+	View Pack() const;
 
 private:
 	/**
@@ -78,17 +143,63 @@ private:
 	static const std::string STRINGS[];
 
 	/**
-	 * Escapes a single response argument.
-	 * @param arg The argument to escape.
-	 * @return The escaped argument.
+	 * Checks whether an argument must be single-quoted.
+	 * @param arg The first character of the argument.
+	 * @param size The length of the argument.
+	 * @return True if the argument has whitespace, quotes or backslashes.
+	 */
+	static bool NeedsQuoting(const char *arg, std::size_t size);
+
+	/**
+	 * Adds a space and an escaped argument to the packed Response.
+	 * @param arg The first character of the argument.
+	 * @param size The length of the argument.
+	 * @return A reference to this Response, for chaining.
+	 */
+	Response &AddEscaped(const char *arg, std::size_t size);
+
+	/**
+	 * Adds raw characters to the packed Response.
+	 * @param chars The first character to add.
+	 * @param size The number of characters to add.
 	 */
-	static std::string EscapeArg(const std::string &arg);
+	void Append(const char *chars, std::size_t size);
 
-	/// The current packed form of the response.
+	/// The packed form of the response, while it fits.
 	/// @see Pack
-	std::string string;
+	char inline_chars[INLINE_CAPACITY];
+
+	/// The length of the packed form of the response.
+	std::size_t size;
+
+	/// The packed form of the response, once it no longer fits inline.
+	std::string spill;
 };
 
+/**
+ * Compares a packed Response with a string.
+ * @param view The packed Response.
+ * @param string The string.
+ * @return Whether the two have the same characters.
+ */
+bool operator==(const Response::View &view, const std::string &string);
+
+/**
+ * Compares a packed Response with a null-terminated string.
+ * @param view The packed Response.
+ * @param string The string.
+ * @return Whether the two have the same characters.
+ */
+bool operator==(const Response::View &view, const char *string);
+
+/**
+ * Writes a packed Response to a stream.
+ * @param os The stream.
+ * @param view The packed Response.
+ * @return The stream.
+ */
+std::ostream &operator<<(std::ostream &os, const Response::View &view);
+
 /**
  * Abstract class for anything that can be sent a response.
  */
@@ -106,6 +217,23 @@ public:
 	 *   entire sub-component should receive the Response.  Defaults to 0.
 	 */
 	virtual void Respond(const Response &response, size_t id = 0) const;
+
+	/**
+	 * Outputs a broadcast Response that the next one of its kind
+	 * supersedes, such as a regular time announcement.
+	 * A ResponseSink that has fallen behind may drop it; by default, it is
+	 * broadcast as any other Response.
+	 * @param response The Response to output.
+	 */
+	virtual void Announce(const Response &response) const;
+
+	/**
+	 * Checks whether anyone would receive a broadcast Response.
+	 * Responses that are only ever broadcast, such as the regular time
+	 * announcements, needn't be made when this is false.
+	 * @return True, unless the ResponseSink knows otherwise.
+	 */
+	virtual bool Listening() const;
 };
 
 #endif // PLAYD_IO_RESPONSE_HPP
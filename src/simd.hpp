@@ -0,0 +1,23 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Detection of the SIMD instruction sets playd has hand-written kernels for.
+ *
+ * playd is built without optimisation flags by default, so loops aren't
+ * left to the compiler to vectorise.  Where a loop is hot enough to matter,
+ * it has an SSE2 version under PLAYD_HAVE_SSE2, which covers every x86-64
+ * compiler, followed by a plain loop that finishes off whatever is left over
+ * and does all of the work elsewhere.
+ */
+
+#ifndef PLAYD_SIMD_HPP
+#define PLAYD_SIMD_HPP
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PLAYD_HAVE_SSE2 1
+#endif
+
+#endif // PLAYD_SIMD_HPP
@@ -0,0 +1,120 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration and implementation of the SpscQueue class template.
+ */
+
+#ifndef PLAYD_SPSC_QUEUE_HPP
+#define PLAYD_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * A bounded, lock-free queue with a single producer and a single consumer.
+ *
+ * Exactly one thread may push, and exactly one (other) thread may pop; the
+ * queue never blocks, and never allocates after construction.  The head and
+ * tail counters are kept on separate cache lines, so that the two threads
+ * don't fight over one line on every push and pop.
+ *
+ * @tparam T The type of item, which must be default-constructible and
+ *   move-assignable.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	/**
+	 * Constructs an SpscQueue.
+	 * @param capacity The most items the queue can hold; this is rounded
+	 *   up to a power of two.
+	 */
+	explicit SpscQueue(std::size_t capacity) : head(0), tail(0)
+	{
+		assert(0 < capacity);
+
+		std::size_t size = 1;
+		while (size < capacity) size <<= 1;
+		this->slots.resize(size);
+		this->mask = size - 1;
+	}
+
+	/// Deleted copy constructor.
+	SpscQueue(const SpscQueue &) = delete;
+
+	/// Deleted copy-assignment.
+	SpscQueue &operator=(const SpscQueue &) = delete;
+
+	/**
+	 * Pushes an item onto the back of the queue.
+	 * Call only from the producer thread.
+	 * @param item The item, which is moved from only if it was pushed.
+	 * @return True if the item was pushed; false if the queue is full.
+	 */
+	bool TryPush(T &item)
+	{
+		auto t = this->tail.load(std::memory_order_relaxed);
+		auto h = this->head.load(std::memory_order_acquire);
+		if (t - h == this->slots.size()) return false;
+
+		this->slots[t & this->mask] = std::move(item);
+		this->tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Pops an item from the front of the queue.
+	 * Call only from the consumer thread.
+	 * @param item Set to the item, if there was one.
+	 * @return True if an item was popped; false if the queue is empty.
+	 */
+	bool TryPop(T &item)
+	{
+		auto h = this->head.load(std::memory_order_relaxed);
+		auto t = this->tail.load(std::memory_order_acquire);
+		if (h == t) return false;
+
+		item = std::move(this->slots[h & this->mask]);
+		this->head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Checks whether the queue is empty.
+	 * From the producer, a false answer may be stale; from the consumer,
+	 * a true one may be.
+	 * @return True if there are no items waiting.
+	 */
+	bool Empty() const
+	{
+		return this->head.load(std::memory_order_acquire) ==
+		       this->tail.load(std::memory_order_acquire);
+	}
+
+private:
+	/// A guess at the size of a cache line, in bytes.
+	static const std::size_t LINE = 64;
+
+	std::vector<T> slots; ///< The items; a power of two of them.
+	std::size_t mask;     ///< One less than the number of slots.
+
+	char pad0[LINE]; ///< Keeps head off the line holding slots and mask.
+
+	/// The count of items ever popped; written only by the consumer.
+	std::atomic<std::size_t> head;
+
+	char pad1[LINE]; ///< Keeps head and tail on separate lines.
+
+	/// The count of items ever pushed; written only by the producer.
+	std::atomic<std::size_t> tail;
+
+	char pad2[LINE]; ///< Keeps tail off whatever follows the queue.
+};
+
+#endif // PLAYD_SPSC_QUEUE_HPP
@@ -0,0 +1,197 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests that steady playback doesn't touch the heap.
+ * @see tests/counting_allocator.cpp
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio_system.hpp"
+#include "../cmd_result.hpp"
+#include "../player.hpp"
+#include "../player_thread.hpp"
+#include "../response.hpp"
+#include "counting_allocator.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+/// A DummyAudioSink that plays everything it's given straight away.
+class PlayingAudioSink : public DummyAudioSink
+{
+public:
+	/**
+	 * Constructs a PlayingAudioSink.
+	 * @param bytes_per_sample The size of one sample, across all channels.
+	 */
+	explicit PlayingAudioSink(std::size_t bytes_per_sample)
+	    : bytes_per_sample(bytes_per_sample)
+	{
+	}
+
+	void Transfer(AudioSink::TransferIterator &start,
+	              const AudioSink::TransferIterator &end) override
+	{
+		auto bytes = static_cast<std::size_t>(end - start);
+		this->position += bytes / this->bytes_per_sample;
+		start = end;
+	}
+
+private:
+	std::size_t bytes_per_sample; ///< The size of one sample.
+};
+
+/// A ResponseSink that counts, and otherwise ignores, its responses.
+class CountingResponseSink : public ResponseSink
+{
+public:
+	void Respond(const Response &, size_t) const override
+	{
+		this->responses++;
+	}
+
+	bool Listening() const override
+	{
+		return this->listening;
+	}
+
+	/// Whether this sink claims to have anyone listening.
+	bool listening = true;
+
+	/// The number of responses sent to this sink.
+	mutable std::size_t responses = 0;
+};
+
+/// The number of samples in each frame the source decodes.
+static const std::size_t FRAME_SAMPLES = 1152;
+
+/// The length of playback to simulate, in seconds of audio.
+static const std::size_t PLAYBACK_SECONDS = 180;
+
+/// The number of updates that play PLAYBACK_SECONDS of audio.
+static const std::size_t TICKS = PLAYBACK_SECONDS * 44100 / FRAME_SAMPLES;
+
+/// The number of updates to run before counting, to let buffers grow.
+static const std::size_t WARM_UP_TICKS = 16;
+
+SCENARIO("Steady playback makes no heap allocations", "[allocation]") {
+	GIVEN("a Player playing a DummyAudioSource into a DummyAudioSink") {
+		AudioSystem audio(0);
+		audio.SetSink([](const AudioSource &source, int) {
+			return std::unique_ptr<AudioSink>(
+			        new PlayingAudioSink(source.BytesPerSample()));
+		});
+		audio.AddSource("mp3", [](const std::string &path) {
+			auto source = new DummyAudioSource(path);
+			source->frame_samples = FRAME_SAMPLES;
+			return std::unique_ptr<AudioSource>(source);
+		});
+
+		Player player(audio);
+		CountingResponseSink sink;
+		player.SetSink(sink);
+
+		std::vector<std::string> load{"write", "tag", "/player/file",
+		                              "blah.mp3"};
+		std::vector<std::string> play{"write", "tag", "/control/state",
+		                              "Playing"};
+		REQUIRE(player.RunCommand(load).IsSuccess());
+		REQUIRE(player.RunCommand(play).IsSuccess());
+		for (std::size_t i = 0; i < WARM_UP_TICKS; i++) player.Update();
+
+		WHEN("minutes of audio play with no clients connected") {
+			sink.listening = false;
+
+			StartCountingAllocations();
+			for (std::size_t i = 0; i < TICKS; i++) player.Update();
+			auto allocations = StopCountingAllocations();
+
+			THEN("nothing is allocated") {
+				REQUIRE(allocations == 0);
+			}
+		}
+
+		WHEN("minutes of audio play with a client connected") {
+			auto before = sink.responses;
+
+			StartCountingAllocations();
+			for (std::size_t i = 0; i < TICKS; i++) player.Update();
+			auto allocations = StopCountingAllocations();
+
+			THEN("the time is announced about once a second") {
+				auto announced = sink.responses - before;
+				REQUIRE(PLAYBACK_SECONDS <= announced);
+				REQUIRE(announced <= PLAYBACK_SECONDS + 2);
+			}
+
+			THEN("nothing is allocated, even to announce the time") {
+				REQUIRE(allocations == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Command results are acknowledged without allocating", "[allocation]") {
+	GIVEN("a command, and a ResponseSink") {
+		std::vector<std::string> cmd{"write", "tag", "/control/state",
+		                             "Playing"};
+		CountingResponseSink sink;
+
+		WHEN("its result is emitted") {
+			auto result = CommandResult::Success();
+
+			StartCountingAllocations();
+			result.Emit(sink, cmd, 1);
+			auto allocations = StopCountingAllocations();
+
+			THEN("the ACK is sent") {
+				REQUIRE(sink.responses == 1);
+			}
+
+			THEN("nothing is allocated") {
+				REQUIRE(allocations == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Replies cross to the I/O thread without allocating", "[allocation]") {
+	GIVEN("a PlayerThread, and a response") {
+		AudioSystem audio(0);
+		Player player(audio);
+		PlayerThread pt(player);
+
+		Response response(Response::Code::RES);
+		response.AddArg("Entry").AddArg("/control/state").AddArg("Playing");
+
+		WHEN("the response is queued, and taken back off the queue") {
+			PlayerThread::Reply reply;
+
+			StartCountingAllocations();
+			pt.Respond(response, 1);
+			auto taken = pt.TakeReply(reply);
+			auto allocations = StopCountingAllocations();
+
+			THEN("the reply carries the response") {
+				REQUIRE(taken);
+				REQUIRE(reply.kind ==
+				        PlayerThread::Reply::Kind::RESPONSE);
+				REQUIRE(reply.id == 1);
+				REQUIRE(reply.response.Pack() ==
+				        "RES Entry /control/state Playing");
+			}
+
+			THEN("nothing is allocated") {
+				REQUIRE(allocations == 0);
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the CommandLog class.
+ */
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../command_log.hpp"
+#include "../tokeniser.hpp"
+
+SCENARIO("Command logs can be read back by the Tokeniser", "[command-log]") {
+	GIVEN("a log of one connection's commands") {
+		std::vector<std::string> load{"write", "a", "/player/file",
+		                              "/music/it's a song.mp3"};
+		std::vector<std::string> odd{"write", "b", "", "\"\\"};
+
+		std::ostringstream os;
+		{
+			CommandLog log(os);
+			log.Open(3);
+			log.Run(3, load);
+			log.Run(3, odd);
+			log.Close(3);
+		}
+
+		WHEN("it is tokenised") {
+			Tokeniser t;
+			auto lines = t.Feed(os.str());
+
+			THEN("there is one line per event") {
+				REQUIRE(lines.size() == 4);
+			}
+
+			THEN("each line has a time, the connection and the event") {
+				std::vector<std::string> events{"open", "run", "run",
+				                                "close"};
+				for (std::size_t i = 0; i < lines.size(); i++) {
+					REQUIRE(3 <= lines[i].size());
+					REQUIRE(std::stoull(lines[i][0]) <= std::stoull(lines.back()[0]));
+					REQUIRE(lines[i][1] == "3");
+					REQUIRE(lines[i][2] == events[i]);
+				}
+			}
+
+			THEN("the commands come back word for word") {
+				std::vector<std::string> read_load(lines[1].begin() + 3,
+				                                   lines[1].end());
+				std::vector<std::string> read_odd(lines[2].begin() + 3,
+				                                  lines[2].end());
+				REQUIRE(read_load == load);
+				REQUIRE(read_odd == odd);
+			}
+		}
+	}
+}
@@ -0,0 +1,91 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Replacements for the global operator new and delete, counting allocations.
+ *
+ * These replace the operators for the whole test binary.  They live apart
+ * from the tests using them, so that the compiler can't inline them into
+ * new-expressions and then take their malloc and free for a mismatched
+ * pair.
+ *
+ * @see tests/counting_allocator.hpp
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "counting_allocator.hpp"
+
+/// Whether allocations on this thread are being counted.
+static thread_local bool counting = false;
+
+/// The number of allocations counted on this thread.
+static thread_local std::size_t allocations = 0;
+
+void StartCountingAllocations()
+{
+	allocations = 0;
+	counting = true;
+}
+
+std::size_t StopCountingAllocations()
+{
+	counting = false;
+	return allocations;
+}
+
+/**
+ * Allocates memory, counting the allocation if need be.
+ * @param size The number of bytes to allocate.
+ * @return The memory, or nullptr if there is none.
+ */
+static void *Allocate(std::size_t size)
+{
+	if (counting) allocations++;
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(std::size_t size)
+{
+	auto ptr = Allocate(size);
+	if (ptr == nullptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return Allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return Allocate(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
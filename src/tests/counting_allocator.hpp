@@ -0,0 +1,24 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the allocation counter.
+ * @see tests/counting_allocator.cpp
+ */
+
+#ifndef PLAYD_COUNTING_ALLOCATOR_HPP
+#define PLAYD_COUNTING_ALLOCATOR_HPP
+
+#include <cstddef>
+
+/// Starts counting the heap allocations made on the calling thread.
+void StartCountingAllocations();
+
+/**
+ * Stops counting the heap allocations made on the calling thread.
+ * @return The number of allocations made since counting started.
+ */
+std::size_t StopCountingAllocations();
+
+#endif // PLAYD_COUNTING_ALLOCATOR_HPP
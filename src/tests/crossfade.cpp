@@ -0,0 +1,398 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for crossfading.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/crossfade.hpp"
+#include "../audio/sample_convert.hpp"
+#include "../audio/sample_formats.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("Samples survive conversion to and from floating point", "[crossfade]") {
+	GIVEN("some 16-bit samples") {
+		std::vector<std::int16_t> samples{0, 16384, -32767, 32767};
+		auto bytes = reinterpret_cast<std::uint8_t *>(samples.data());
+
+		WHEN("they are converted to floating point") {
+			std::vector<float> floats(samples.size());
+			SamplesToFloat(bytes, SampleFormat::PACKED_SIGNED_INT_16, samples.size(), floats.data());
+
+			THEN("they are scaled into [-1, 1]") {
+				REQUIRE(floats[0] == 0.0f);
+				REQUIRE(floats[1] == 0.5f);
+				REQUIRE(-1.0f <= floats[2]);
+				REQUIRE(floats[3] <= 1.0f);
+			}
+
+			AND_WHEN("they are converted back") {
+				std::vector<std::int16_t> back(samples.size());
+				SamplesFromFloat(floats.data(), floats.size(), SampleFormat::PACKED_SIGNED_INT_16, reinterpret_cast<std::uint8_t *>(back.data()));
+
+				THEN("they are (nearly) unchanged") {
+					for (std::size_t i = 0; i < samples.size(); i++) {
+						int diff = back[i] - samples[i];
+						REQUIRE(-1 <= diff);
+						REQUIRE(diff <= 1);
+					}
+				}
+			}
+		}
+	}
+
+	GIVEN("some floating point samples outside [-1, 1]") {
+		std::vector<float> floats{2.0f, -2.0f};
+
+		WHEN("they are converted to unsigned 8-bit samples") {
+			std::vector<std::uint8_t> bytes(floats.size());
+			SamplesFromFloat(floats.data(), floats.size(), SampleFormat::PACKED_UNSIGNED_INT_8, bytes.data());
+
+			THEN("they are clipped") {
+				REQUIRE(bytes[0] == 255);
+				REQUIRE(bytes[1] == 1);
+			}
+		}
+	}
+}
+
+SCENARIO("Sample conversions agree however the samples fall", "[crossfade]") {
+	// The SIMD kernels take several samples at a time, and leave the odd
+	// ones over to a plain loop; 13 samples leaves some over either way.
+	GIVEN("an awkward number of floating point samples, some out of range") {
+		std::vector<float> floats(13);
+		for (std::size_t i = 0; i < floats.size(); i++) {
+			floats[i] = -1.5f + 0.25f * static_cast<float>(i);
+		}
+		floats[6] = 0.3337f;
+
+		WHEN("they are converted to 16-bit samples and back") {
+			std::vector<std::int16_t> ints(floats.size());
+			std::vector<float> back(floats.size());
+			SamplesFromFloat(floats.data(), floats.size(), SampleFormat::PACKED_SIGNED_INT_16, reinterpret_cast<std::uint8_t *>(ints.data()));
+			SamplesToFloat(reinterpret_cast<std::uint8_t *>(ints.data()), SampleFormat::PACKED_SIGNED_INT_16, ints.size(), back.data());
+
+			THEN("every sample is clipped, scaled and truncated alike") {
+				std::size_t misses = 0;
+				for (std::size_t i = 0; i < floats.size(); i++) {
+					float x = std::min(1.0f, std::max(-1.0f, floats[i]));
+					auto want = static_cast<std::int16_t>(x * 32767.0f);
+					if (ints[i] != want) misses++;
+					if (back[i] != want / 32768.0f) misses++;
+				}
+				REQUIRE(misses == 0);
+			}
+		}
+
+		WHEN("they are converted to 32-bit samples and back") {
+			std::vector<std::int32_t> ints(floats.size());
+			std::vector<float> back(floats.size());
+			SamplesFromFloat(floats.data(), floats.size(), SampleFormat::PACKED_SIGNED_INT_32, reinterpret_cast<std::uint8_t *>(ints.data()));
+			SamplesToFloat(reinterpret_cast<std::uint8_t *>(ints.data()), SampleFormat::PACKED_SIGNED_INT_32, ints.size(), back.data());
+
+			THEN("every sample is clipped, scaled and truncated alike") {
+				std::size_t misses = 0;
+				for (std::size_t i = 0; i < floats.size(); i++) {
+					float x = std::min(1.0f, std::max(-1.0f, floats[i]));
+					auto want = static_cast<std::int32_t>(static_cast<double>(x) * 2147483647.0);
+					if (ints[i] != want) misses++;
+					if (back[i] != static_cast<float>(want) * (1.0f / 2147483648LL)) misses++;
+				}
+				REQUIRE(misses == 0);
+			}
+		}
+
+		WHEN("they are clipped as floating point samples") {
+			std::vector<float> clipped(floats.size());
+			SamplesFromFloat(floats.data(), floats.size(), SampleFormat::PACKED_FLOAT_32, reinterpret_cast<std::uint8_t *>(clipped.data()));
+
+			THEN("every sample is clipped alike") {
+				std::size_t misses = 0;
+				for (std::size_t i = 0; i < floats.size(); i++) {
+					float x = std::min(1.0f, std::max(-1.0f, floats[i]));
+					if (clipped[i] != x) misses++;
+				}
+				REQUIRE(misses == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Every sample format has conversion kernels", "[crossfade]") {
+	GIVEN("some floating point samples") {
+		std::vector<float> floats{0.0f, 0.5f, -0.5f, 1.0f, -1.0f};
+
+		for (int f = 0; f <= static_cast<int>(SampleFormat::PACKED_FLOAT_32); f++) {
+			auto fmt = static_cast<SampleFormat>(f);
+
+			WHEN("they go to format " + std::to_string(f) + " and back") {
+				std::vector<std::uint8_t> bytes(floats.size() * SAMPLE_FORMAT_BPS[f]);
+				std::vector<float> back(floats.size());
+				FromFloatKernel(fmt)(floats.data(), floats.size(), bytes.data());
+				ToFloatKernel(fmt)(bytes.data(), floats.size(), back.data());
+
+				THEN("they are (nearly) unchanged") {
+					for (std::size_t i = 0; i < floats.size(); i++) {
+						REQUIRE(std::fabs(back[i] - floats[i]) < 0.02f);
+					}
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Crossfade fades the outgoing file into the incoming one", "[crossfade]") {
+	GIVEN("a Crossfade into a silent file") {
+		auto next = new DummyAudioSource("next");
+		next->frame_samples = 100;
+		Crossfade xf(std::unique_ptr<AudioSource>(next), nullptr, 100);
+
+		// Full-scale stereo 32-bit samples.
+		const std::size_t frames = 200;
+		std::vector<std::int32_t> loud(2 * frames, 1 << 30);
+		auto bytes = reinterpret_cast<std::uint8_t *>(loud.data());
+
+		WHEN("a frame before the fade is mixed") {
+			AudioSource::DecodeVector frame(bytes, bytes + loud.size() * 4);
+			xf.Mix(frame, 0, 1000, 100, CrossfadeCurve::LINEAR, false);
+
+			THEN("nothing changes") {
+				REQUIRE_FALSE(xf.Started());
+				REQUIRE_FALSE(xf.Done());
+				REQUIRE(frame.size() == loud.size() * 4);
+				REQUIRE(0 == std::memcmp(frame.data(), bytes, frame.size()));
+			}
+		}
+
+		WHEN("a frame spanning the whole fade is mixed") {
+			AudioSource::DecodeVector frame(bytes, bytes + loud.size() * 4);
+			xf.Mix(frame, 0, 50, 100, CrossfadeCurve::LINEAR, false);
+
+			THEN("the frame is cut at the end of the fade") {
+				REQUIRE(frame.size() == 150 * 2 * 4);
+				REQUIRE(xf.Started());
+				REQUIRE(xf.Done());
+				REQUIRE(xf.Position() == 100);
+			}
+
+			THEN("the outgoing audio fades out") {
+				std::vector<std::int32_t> mixed(frame.size() / 4);
+				std::memcpy(mixed.data(), frame.data(), frame.size());
+
+				REQUIRE(mixed[2 * 49] == 1 << 30);
+				REQUIRE(mixed[2 * 100] < mixed[2 * 50]);
+				REQUIRE(mixed[2 * 149] < mixed[2 * 100]);
+
+				// Halfway through a linear fade, the gain is a half.
+				int diff = mixed[2 * 100] - (1 << 29);
+				REQUIRE(-64 <= diff);
+				REQUIRE(diff <= 64);
+			}
+		}
+
+		WHEN("a fade ending partway through a block of gains is mixed") {
+			// 101 samples is a 64-sample block, then 37 more, whose
+			// 74 mono samples don't divide into fours.
+			AudioSource::DecodeVector frame(bytes, bytes + loud.size() * 4);
+			xf.Mix(frame, 0, 50, 101, CrossfadeCurve::LINEAR, false);
+
+			THEN("the last sample is faded on every channel") {
+				REQUIRE(frame.size() == 151 * 2 * 4);
+				std::vector<std::int32_t> mixed(frame.size() / 4);
+				std::memcpy(mixed.data(), frame.data(), frame.size());
+
+				int expected = (1 << 30) / 101;
+				for (int c = 0; c < 2; c++) {
+					int diff = mixed[2 * 150 + c] - expected;
+					REQUIRE(-64 <= diff);
+					REQUIRE(diff <= 64);
+				}
+			}
+		}
+
+		WHEN("the outgoing file ends before the fade") {
+			AudioSource::DecodeVector frame(bytes, bytes + loud.size() * 4);
+			xf.Mix(frame, 0, 1000, 100, CrossfadeCurve::LINEAR, true);
+
+			THEN("the fade is done, without having started") {
+				REQUIRE(xf.Done());
+				REQUIRE_FALSE(xf.Started());
+				REQUIRE(xf.Position() == 0);
+			}
+		}
+	}
+}
+
+/// A DummyAudioSource that counts how often it is decoded and sought.
+class CountingAudioSource : public DummyAudioSource
+{
+public:
+	/**
+	 * Constructs a CountingAudioSource.
+	 * @param path The path to the file from which this AudioSource is
+	 *   decoding.
+	 */
+	explicit CountingAudioSource(const std::string &path)
+	    : DummyAudioSource(path), decodes(0), seeks(0)
+	{
+	}
+
+	AudioSource::DecodeState DecodeInto(
+	        AudioSource::DecodeVector &frame) override
+	{
+		this->decodes++;
+		return DummyAudioSource::DecodeInto(frame);
+	}
+
+	std::uint64_t Seek(std::uint64_t position) override
+	{
+		this->seeks++;
+		return DummyAudioSource::Seek(position);
+	}
+
+	std::atomic<int> decodes; ///< The number of frames decoded.
+	int seeks;                ///< The number of seeks.
+};
+
+SCENARIO("Crossfade prerolls the incoming file", "[crossfade]") {
+	GIVEN("a Crossfade prerolling 150 samples of 100-sample frames") {
+		auto next = new CountingAudioSource("next");
+		next->frame_samples = 100;
+		Crossfade xf(std::unique_ptr<AudioSource>(next), nullptr, 150);
+
+		const std::size_t frames = 300;
+		std::vector<std::int32_t> loud(2 * frames, 1 << 30);
+		auto bytes = reinterpret_cast<std::uint8_t *>(loud.data());
+		AudioSource::DecodeVector frame(bytes, bytes + loud.size() * 4);
+
+		WHEN("a fade as long as the preroll is mixed") {
+			xf.Mix(frame, 0, 0, 150, CrossfadeCurve::LINEAR, false);
+
+			THEN("only the preroll was decoded") {
+				REQUIRE(xf.Done());
+				REQUIRE(next->decodes == 2);
+				REQUIRE(next->seeks == 0);
+			}
+
+			THEN("the rest of the preroll is left over") {
+				REQUIRE(xf.TakeLeftover().size() == 50 * 2 * 4);
+				REQUIRE(next->seeks == 0);
+			}
+		}
+
+		WHEN("a fade longer than the preroll is mixed") {
+			xf.Mix(frame, 0, 0, 250, CrossfadeCurve::LINEAR, false);
+
+			THEN("the rest is decoded as the fade goes") {
+				REQUIRE(xf.Done());
+				REQUIRE(xf.Position() == 250);
+				REQUIRE(next->decodes == 3);
+				REQUIRE(next->seeks == 0);
+			}
+		}
+
+		WHEN("the outgoing file seeks after the fade passes the preroll") {
+			frame.resize(250 * 2 * 4);
+			xf.Mix(frame, 0, 0, 280, CrossfadeCurve::LINEAR, false);
+			xf.Restart();
+
+			THEN("the incoming file isn't sought yet") {
+				REQUIRE_FALSE(xf.Started());
+				REQUIRE(xf.Position() == 0);
+				REQUIRE(next->seeks == 0);
+			}
+
+			AND_WHEN("the fade runs past the preroll again") {
+				next->decodes = 0;
+				frame.assign(bytes, bytes + loud.size() * 4);
+				xf.Mix(frame, 0, 0, 280, CrossfadeCurve::LINEAR, false);
+
+				THEN("the incoming file is sought only then") {
+					REQUIRE(xf.Done());
+					REQUIRE(xf.Position() == 280);
+					REQUIRE(next->seeks == 1);
+					REQUIRE(next->decodes == 1);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio switches to the next file after a crossfade", "[crossfade][pipe-audio]") {
+	GIVEN("a PipeAudio with a next file queued") {
+		auto src = new DummyAudioSource("current");
+		src->frame_samples = 100;
+		std::unique_ptr<AudioSource> src_ptr(src);
+		std::unique_ptr<AudioSink> sink_ptr(new DummyAudioSink());
+		PipeAudio pa(std::move(src_ptr), std::move(sink_ptr));
+
+		auto next = new DummyAudioSource("next");
+		next->frame_samples = 100;
+		pa.SetNext(std::unique_ptr<AudioSource>(next), nullptr);
+
+		WHEN("the next file is requested") {
+			auto response = pa.Emit("/player/crossfade/file", false);
+
+			THEN("it is emitted") {
+				REQUIRE(response);
+				REQUIRE(response->Pack() == "RES /player/crossfade/file Entry next");
+			}
+		}
+
+		WHEN("the PipeAudio plays into an explicit crossfade start") {
+			// 44100 samples per second, so 10000 micros is 441 samples.
+			pa.SetCrossfade(CrossfadeSettings{10000, CrossfadeCurve::EQUAL_POWER, true, 0});
+			for (int i = 0; i < 20; i++) pa.Update();
+
+			THEN("the PipeAudio announces the file change once") {
+				REQUIRE(pa.TakeFileChange());
+				REQUIRE_FALSE(pa.TakeFileChange());
+
+				auto file = pa.Emit("/player/file", false);
+				REQUIRE(file);
+				REQUIRE(file->Pack() == "RES /player/file Entry next");
+			}
+
+			THEN("the next file is no longer queued") {
+				REQUIRE_FALSE(pa.Emit("/player/crossfade/file", false));
+			}
+
+			THEN("the cost of the crossfade is emitted") {
+				REQUIRE(pa.Emit("/player/crossfade/cost", false));
+			}
+		}
+
+		WHEN("the next file is unqueued") {
+			pa.ClearNext();
+
+			THEN("it is no longer emitted") {
+				REQUIRE_FALSE(pa.Emit("/player/crossfade/file", false));
+			}
+		}
+	}
+
+	GIVEN("a PipeAudio") {
+		PipeAudio pa(std::unique_ptr<AudioSource>(new DummyAudioSource("current")),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+
+		WHEN("nothing has been crossfaded") {
+			THEN("no file change is announced") {
+				REQUIRE_FALSE(pa.TakeFileChange());
+			}
+		}
+	}
+}
@@ -0,0 +1,251 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for cue point analysis.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/cue_points.hpp"
+#include "../audio/sample_formats.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("FindAudible finds the audible region of a block of samples", "[cue-points]") {
+	GIVEN("a block of stereo 16-bit samples with quiet edges") {
+		std::vector<std::int16_t> block(2 * 1000, 0);
+		block[2 * 300 + 1] = 20000;
+		block[2 * 700] = -20000;
+		block[2 * 900] = 5; // Below the threshold.
+
+		auto begin = reinterpret_cast<const std::uint8_t *>(block.data());
+		auto end = begin + block.size() * sizeof(std::int16_t);
+
+		WHEN("FindAudible is called") {
+			std::size_t first = 0;
+			std::size_t last = 0;
+			bool found = FindAudible(begin, end, SampleFormat::PACKED_SIGNED_INT_16, 2, 0.001, first, last);
+
+			THEN("the first and last loud samples are found") {
+				REQUIRE(found);
+				REQUIRE(first == 300);
+				REQUIRE(last == 700);
+			}
+		}
+	}
+
+	GIVEN("a block of mono floating-point samples that is entirely silent") {
+		std::vector<float> block(1000, 0.0001f);
+
+		auto begin = reinterpret_cast<const std::uint8_t *>(block.data());
+		auto end = begin + block.size() * sizeof(float);
+
+		WHEN("FindAudible is called") {
+			std::size_t first = 0;
+			std::size_t last = 0;
+			bool found = FindAudible(begin, end, SampleFormat::PACKED_FLOAT_32, 1, 0.001, first, last);
+
+			THEN("nothing is found") {
+				REQUIRE_FALSE(found);
+			}
+		}
+	}
+
+	GIVEN("a block of unsigned 8-bit samples, which are silent at 128") {
+		std::vector<std::uint8_t> block(200, 128);
+		block[5] = 0;
+
+		WHEN("FindAudible is called") {
+			std::size_t first = 0;
+			std::size_t last = 0;
+			bool found = FindAudible(block.data(), block.data() + block.size(), SampleFormat::PACKED_UNSIGNED_INT_8, 1, 0.01, first, last);
+
+			THEN("only the loud sample is found") {
+				REQUIRE(found);
+				REQUIRE(first == 5);
+				REQUIRE(last == 5);
+			}
+		}
+	}
+	// The SIMD scans take several samples at a time, and leave the odd
+	// ones over to a plain loop, so we try every position.
+	GIVEN("mono blocks of an awkward length with one loud sample") {
+		const std::size_t n = 71;
+
+		WHEN("the loud sample is put at each position in turn") {
+			std::size_t misses = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				std::vector<std::int16_t> s16(n, 3);
+				std::vector<std::int32_t> s32(n, -3);
+				std::vector<float> f32(n, 0.0001f);
+				s16[i] = -20000;
+				s32[i] = 1 << 30;
+				f32[i] = -0.5f;
+
+				auto b16 = reinterpret_cast<const std::uint8_t *>(s16.data());
+				auto b32 = reinterpret_cast<const std::uint8_t *>(s32.data());
+				auto bf = reinterpret_cast<const std::uint8_t *>(f32.data());
+
+				std::size_t first = 0;
+				std::size_t last = 0;
+				bool found = FindAudible(b16, b16 + n * 2, SampleFormat::PACKED_SIGNED_INT_16, 1, 0.001, first, last);
+				if (!found || first != i || last != i) misses++;
+				found = FindAudible(b32, b32 + n * 4, SampleFormat::PACKED_SIGNED_INT_32, 1, 0.001, first, last);
+				if (!found || first != i || last != i) misses++;
+				found = FindAudible(bf, bf + n * 4, SampleFormat::PACKED_FLOAT_32, 1, 0.001, first, last);
+				if (!found || first != i || last != i) misses++;
+			}
+
+			THEN("it is found exactly every time") {
+				REQUIRE(misses == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("CueCache remembers cue points by path", "[cue-points]") {
+	GIVEN("an empty CueCache") {
+		CueCache cache;
+		CuePoints points{0, 0};
+
+		WHEN("a path is looked up") {
+			THEN("nothing is found") {
+				REQUIRE_FALSE(cache.Find("foo.mp3", points));
+			}
+		}
+
+		WHEN("cue points are added for a path") {
+			cache.Add("foo.mp3", CuePoints{10, 20});
+
+			THEN("they can be found again") {
+				REQUIRE(cache.Find("foo.mp3", points));
+				REQUIRE(points.in == 10);
+				REQUIRE(points.out == 20);
+			}
+		}
+	}
+}
+
+/// A DummyAudioSource that ends after a few frames of silence.
+class EndingAudioSource : public DummyAudioSource
+{
+public:
+	/// Constructs an EndingAudioSource.
+	EndingAudioSource() : DummyAudioSource("test"), frames(0)
+	{
+		this->frame_samples = 1152;
+	}
+
+	AudioSource::DecodeState DecodeInto(
+	        AudioSource::DecodeVector &frame) override
+	{
+		DummyAudioSource::DecodeInto(frame);
+		if (++this->frames < 10) return DecodeState::DECODING;
+		return DecodeState::END_OF_FILE;
+	}
+
+private:
+	int frames; ///< The number of frames decoded so far.
+};
+
+SCENARIO("PipeAudio emits cue points once they are analysed", "[cue-points][pipe-audio]") {
+	GIVEN("a PipeAudio with no cue analysis") {
+		PipeAudio pa(std::unique_ptr<AudioSource>(new DummyAudioSource("test")),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+
+		WHEN("the cue points are requested") {
+			THEN("nothing is emitted") {
+				REQUIRE_FALSE(pa.Emit("/player/cue/in", false));
+				REQUIRE_FALSE(pa.Emit("/player/cue/out", false));
+			}
+		}
+
+		GIVEN("a finished cue analysis") {
+			// The DummyAudioSource runs at 44100Hz.
+			pa.SetCueAnalysis(std::unique_ptr<CueAnalysis>(new CueAnalysis(CuePoints{44100, 441000})), false);
+
+			WHEN("the cue points are requested") {
+				THEN("they are emitted in microseconds") {
+					auto in = pa.Emit("/player/cue/in", false);
+					REQUIRE(in);
+					REQUIRE(in->Pack() == "RES /player/cue/in Entry 1000000");
+
+					auto out = pa.Emit("/player/cue/out", false);
+					REQUIRE(out);
+					REQUIRE(out->Pack() == "RES /player/cue/out Entry 10000000");
+				}
+			}
+		}
+
+		GIVEN("a finished cue analysis with trimming") {
+			pa.SetCueAnalysis(std::unique_ptr<CueAnalysis>(new CueAnalysis(CuePoints{44100, 441000})), true);
+
+			WHEN("the PipeAudio is updated before playing") {
+				pa.Update();
+
+				THEN("the position moves to the in point") {
+					REQUIRE(pa.Position() == 1000000);
+				}
+			}
+
+			WHEN("the PipeAudio is sought into the lead-in") {
+				pa.Seek(0);
+
+				THEN("the position is clamped to the in point") {
+					REQUIRE(pa.Position() == 1000000);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio reports a background cue analysis finishing once", "[cue-points][pipe-audio]") {
+	GIVEN("a PipeAudio") {
+		PipeAudio pa(std::unique_ptr<AudioSource>(new DummyAudioSource("test")),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+
+		WHEN("it is given cue points that are already known") {
+			pa.SetCueAnalysis(std::unique_ptr<CueAnalysis>(new CueAnalysis(CuePoints{44100, 441000})), false);
+
+			THEN("they aren't reported, as the load announces them") {
+				REQUIRE_FALSE(pa.TakeCuesReady());
+			}
+		}
+
+		WHEN("it is given an analysis that runs in the background") {
+			auto cache = std::make_shared<CueCache>();
+			auto factory = []() {
+				return std::unique_ptr<AudioSource>(
+				        new EndingAudioSource());
+			};
+			pa.SetCueAnalysis(std::unique_ptr<CueAnalysis>(new CueAnalysis(factory, 0.001, cache, "test")), false);
+
+			auto give_up = std::chrono::steady_clock::now() +
+			               std::chrono::seconds(10);
+			bool ready = false;
+			while (!ready && std::chrono::steady_clock::now() < give_up) {
+				ready = pa.TakeCuesReady();
+				if (!ready) std::this_thread::yield();
+			}
+
+			THEN("its finishing is reported exactly once") {
+				REQUIRE(ready);
+				REQUIRE_FALSE(pa.TakeCuesReady());
+			}
+
+			THEN("the cue points are then there to emit") {
+				REQUIRE(pa.Emit("/player/cue/in", false));
+				REQUIRE(pa.Emit("/player/cue/out", false));
+			}
+		}
+	}
+}
@@ -0,0 +1,145 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Downmix class.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/downmix.hpp"
+
+SCENARIO("Downmix folds 5.1 into stereo with the ITU gains", "[downmix]") {
+	GIVEN("a 5.1 to stereo downmix") {
+		Downmix d(6, 2, DownmixGains::Itu());
+
+		THEN("the fronts go straight through") {
+			REQUIRE(d.Coefficient(0, 0) == 1.0f);
+			REQUIRE(d.Coefficient(0, 1) == 0.0f);
+			REQUIRE(d.Coefficient(1, 1) == 1.0f);
+			REQUIRE(d.Coefficient(1, 0) == 0.0f);
+		}
+
+		THEN("the centre goes into both sides at -3dB") {
+			REQUIRE(d.Coefficient(0, 2) == Approx(0.7071));
+			REQUIRE(d.Coefficient(1, 2) == Approx(0.7071));
+		}
+
+		THEN("the LFE is dropped") {
+			REQUIRE(d.Coefficient(0, 3) == 0.0f);
+			REQUIRE(d.Coefficient(1, 3) == 0.0f);
+		}
+
+		THEN("each surround goes into its own side at -3dB") {
+			REQUIRE(d.Coefficient(0, 4) == Approx(0.7071));
+			REQUIRE(d.Coefficient(1, 4) == 0.0f);
+			REQUIRE(d.Coefficient(1, 5) == Approx(0.7071));
+			REQUIRE(d.Coefficient(0, 5) == 0.0f);
+		}
+
+		WHEN("a sample is mixed") {
+			std::vector<float> in{0.1f, 0.2f, 0.4f, 1.0f, 0.3f, 0.0f};
+			std::vector<float> out(2);
+			d.Run(in.data(), 1, out.data());
+
+			THEN("each side is the weighted sum of its inputs") {
+				REQUIRE(out[0] == Approx(0.1 + 0.7071 * 0.7));
+				REQUIRE(out[1] == Approx(0.2 + 0.7071 * 0.4));
+			}
+		}
+	}
+}
+
+SCENARIO("Downmix takes custom gains", "[downmix]") {
+	GIVEN("a 5.1 to stereo downmix keeping the LFE") {
+		DownmixGains gains{1.0, 0.5, 0.25};
+		Downmix d(6, 2, gains);
+
+		THEN("the centre, surrounds and LFE use those gains") {
+			REQUIRE(d.Coefficient(0, 2) == 1.0f);
+			REQUIRE(d.Coefficient(0, 3) == 0.25f);
+			REQUIRE(d.Coefficient(0, 4) == 0.5f);
+		}
+	}
+}
+
+SCENARIO("Downmix maps between other layouts", "[downmix]") {
+	GIVEN("a stereo to mono downmix") {
+		Downmix d(2, 1, DownmixGains::Itu());
+
+		THEN("both sides go in at -3dB") {
+			REQUIRE(d.Coefficient(0, 0) == Approx(0.7071));
+			REQUIRE(d.Coefficient(0, 1) == Approx(0.7071));
+		}
+	}
+
+	GIVEN("a 7.1 to 5.1 downmix") {
+		Downmix d(8, 6, DownmixGains::Itu());
+
+		THEN("the sides fold into the backs unchanged") {
+			REQUIRE(d.Coefficient(4, 6) == 1.0f);
+			REQUIRE(d.Coefficient(5, 7) == 1.0f);
+			REQUIRE(d.Coefficient(4, 4) == 1.0f);
+		}
+
+		WHEN("several samples are mixed") {
+			std::vector<float> in(8 * 3, 0.125f);
+			std::vector<float> out(6 * 3);
+			d.Run(in.data(), 3, out.data());
+
+			THEN("every sample is mixed") {
+				REQUIRE(out[6 * 2 + 0] == Approx(0.125));
+				REQUIRE(out[6 * 2 + 4] == Approx(0.25));
+			}
+		}
+	}
+
+	// The SIMD kernels mix several frames at a time, and leave the odd
+	// ones over to a plain loop, so we mix an awkward number of frames.
+	GIVEN("5.1 to stereo and 5.1 to mono downmixes") {
+		Downmix stereo(6, 2, DownmixGains::Itu());
+		Downmix mono(6, 1, DownmixGains::Itu());
+
+		std::vector<float> in(6 * 7);
+		for (std::size_t i = 0; i < in.size(); i++) {
+			in[i] = std::sin(static_cast<float>(i));
+		}
+
+		WHEN("seven samples are mixed") {
+			std::vector<float> to_stereo(2 * 7);
+			std::vector<float> to_mono(7);
+			stereo.Run(in.data(), 7, to_stereo.data());
+			mono.Run(in.data(), 7, to_mono.data());
+
+			THEN("every sample is the weighted sum of its channels") {
+				std::size_t misses = 0;
+				for (std::size_t f = 0; f < 7; f++) {
+					for (std::uint8_t o = 0; o < 2; o++) {
+						float sum = 0.0f;
+						float msum = 0.0f;
+						for (std::uint8_t i = 0; i < 6; i++) {
+							sum += stereo.Coefficient(o, i) * in[f * 6 + i];
+							msum += mono.Coefficient(0, i) * in[f * 6 + i];
+						}
+						if (to_stereo[f * 2 + o] != sum) misses++;
+						if (o == 0 && to_mono[f] != msum) misses++;
+					}
+				}
+				REQUIRE(misses == 0);
+			}
+		}
+	}
+
+	GIVEN("channel counts outside the known layouts") {
+		THEN("they can't be mapped") {
+			REQUIRE_FALSE(Downmix::CanMap(9, 2));
+			REQUIRE_FALSE(Downmix::CanMap(2, 0));
+			REQUIRE(Downmix::CanMap(8, 1));
+		}
+	}
+}
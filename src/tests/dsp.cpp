@@ -0,0 +1,297 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the DSP insert chain.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/dsp.hpp"
+#include "../audio/sample_formats.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+/**
+ * Makes a block of mono sine wave.
+ * @param frames The number of samples.
+ * @param period The period of the wave, in samples.
+ * @param amplitude The peak of the wave.
+ * @return The samples.
+ */
+static std::vector<float> Sine(std::size_t frames, double period,
+                               float amplitude)
+{
+	std::vector<float> samples(frames);
+	for (std::size_t i = 0; i < frames; i++) {
+		auto phase = 2 * 3.14159265358979323846 * i / period;
+		samples[i] = amplitude * static_cast<float>(std::sin(phase));
+	}
+	return samples;
+}
+
+/**
+ * Finds the peak of a run of samples.
+ * @param begin The first sample.
+ * @param end Just past the last sample.
+ * @return The largest magnitude in the run.
+ */
+static float Peak(std::vector<float>::const_iterator begin,
+                  std::vector<float>::const_iterator end)
+{
+	float peak = 0.0f;
+	for (auto i = begin; i != end; i++) peak = std::max(peak, std::fabs(*i));
+	return peak;
+}
+
+SCENARIO("The built-in processors shape audio", "[dsp]") {
+	DspSettings settings = DspSettings();
+
+	GIVEN("a GainProcessor set to -6dB") {
+		GainProcessor gain(44100, 1);
+		settings.has_gain = true;
+		settings.gain = -6.0206;
+		gain.Configure(settings);
+
+		WHEN("two blocks of full-scale audio are processed") {
+			std::vector<float> first(64, 1.0f);
+			std::vector<float> second(64, 1.0f);
+			float *p = first.data();
+			gain.Process(&p, first.size());
+			p = second.data();
+			gain.Process(&p, second.size());
+
+			THEN("the gain ramps in over the first block") {
+				REQUIRE(first[0] == 1.0f);
+				REQUIRE(first[63] < first[0]);
+			}
+
+			THEN("the second block is halved") {
+				REQUIRE(std::fabs(second[0] - 0.5f) < 0.001f);
+				REQUIRE(std::fabs(second[63] - 0.5f) < 0.001f);
+			}
+		}
+
+		WHEN("a block of an awkward length is processed") {
+			// 67 samples leave three over after the SIMD loop.
+			std::vector<float> block(67, 1.0f);
+			float *p = block.data();
+			gain.Process(&p, block.size());
+
+			THEN("every sample is on the same straight ramp") {
+				float step = block[1] - block[0];
+				float worst = 0.0f;
+				for (std::size_t i = 0; i < block.size(); i++) {
+					float want = 1.0f + step * static_cast<float>(i);
+					worst = std::max(worst, std::fabs(block[i] - want));
+				}
+				REQUIRE(step < 0.0f);
+				REQUIRE(worst < 0.0001f);
+			}
+		}
+
+		WHEN("the gain is used, then turned off again") {
+			std::vector<float> block(64, 1.0f);
+			float *p = block.data();
+			gain.Process(&p, block.size());
+
+			settings.has_gain = false;
+			gain.Configure(settings);
+
+			THEN("it stays enabled until it has ramped back") {
+				REQUIRE(gain.Enabled());
+				gain.Process(&p, block.size());
+				REQUIRE_FALSE(gain.Enabled());
+			}
+		}
+	}
+
+	GIVEN("a BiquadProcessor boosting 1kHz by 12dB") {
+		BiquadProcessor eq(48000, 1, 0);
+		settings.eq[0] = EqBand{true, 1000, 12, 1};
+		eq.Configure(settings);
+
+		WHEN("a 1kHz sine wave is processed") {
+			auto samples = Sine(4800, 48, 0.1f);
+			float *p = samples.data();
+			eq.Process(&p, samples.size());
+
+			THEN("it is boosted by about four times") {
+				// Skip the filter's settling time.
+				auto peak = Peak(samples.begin() + 2400, samples.end());
+				REQUIRE(0.38f < peak);
+				REQUIRE(peak < 0.42f);
+			}
+		}
+
+		WHEN("a 10Hz sine wave is processed") {
+			auto samples = Sine(19200, 4800, 0.1f);
+			float *p = samples.data();
+			eq.Process(&p, samples.size());
+
+			THEN("it is barely changed") {
+				auto peak = Peak(samples.begin() + 9600, samples.end());
+				REQUIRE(0.095f < peak);
+				REQUIRE(peak < 0.105f);
+			}
+		}
+	}
+
+	GIVEN("a LimiterProcessor with a -6dB ceiling") {
+		LimiterProcessor limiter(44100, 2);
+		settings.has_limiter = true;
+		settings.ceiling = -6.0206;
+		limiter.Configure(settings);
+
+		WHEN("a loud block is processed") {
+			auto left = Sine(256, 32, 1.0f);
+			auto right = Sine(256, 20, 0.2f);
+			float *planes[] = {left.data(), right.data()};
+			limiter.Process(planes, left.size());
+
+			THEN("nothing exceeds the ceiling") {
+				REQUIRE(Peak(left.begin(), left.end()) <= 0.5f);
+				REQUIRE(Peak(right.begin(), right.end()) <= 0.5f);
+			}
+
+			THEN("the loudest peak reaches the ceiling") {
+				REQUIRE(0.49f < Peak(left.begin(), left.end()));
+			}
+		}
+
+		WHEN("a block of an awkward length peaks in its last few samples") {
+			// 67 samples leave three over after the SIMD loops.
+			std::vector<float> left(67, 0.1f);
+			std::vector<float> right(67, -0.1f);
+			left[65] = -1.0f;
+			float *planes[] = {left.data(), right.data()};
+			limiter.Process(planes, left.size());
+
+			THEN("the peak is found and brought down to the ceiling") {
+				REQUIRE(Peak(left.begin(), left.end()) <= 0.5f);
+				REQUIRE(left[65] < -0.49f);
+			}
+		}
+
+		WHEN("a quiet block is followed by one with a late, loud peak") {
+			// Steady level, so the gain is each output over 0.3.
+			std::vector<float> left(512, 0.3f);
+			std::vector<float> right(512, 0.3f);
+			left[256 + 200] = 2.0f;
+			for (std::size_t at = 0; at < 512; at += 256) {
+				float *planes[] = {left.data() + at, right.data() + at};
+				limiter.Process(planes, 256);
+			}
+
+			THEN("the gain doesn't jump at the block edge") {
+				auto before = right[255] / 0.3f;
+				auto after = right[256] / 0.3f;
+				REQUIRE(std::fabs(after - before) < 0.01f);
+			}
+
+			THEN("the gain comes down smoothly, and is down by the peak") {
+				float largest_step = 0.0f;
+				for (std::size_t i = 1; i < 512; i++) {
+					auto step = std::fabs(right[i] - right[i - 1]) / 0.3f;
+					largest_step = std::max(largest_step, step);
+				}
+				REQUIRE(largest_step < 0.01f);
+				REQUIRE(left[256 + 200] <= 0.5f);
+				REQUIRE(0.49f < left[256 + 200]);
+			}
+		}
+
+		WHEN("a quiet block is processed") {
+			auto left = Sine(256, 32, 0.25f);
+			auto right = Sine(256, 32, 0.25f);
+			float *planes[] = {left.data(), right.data()};
+			limiter.Process(planes, left.size());
+
+			THEN("it is unchanged") {
+				REQUIRE(Peak(left.begin(), left.end()) == Peak(right.begin(), right.end()));
+				REQUIRE(std::fabs(Peak(left.begin(), left.end()) - 0.25f) < 0.001f);
+			}
+		}
+	}
+}
+
+SCENARIO("ProcessorChain runs processors over packed audio", "[dsp]") {
+	GIVEN("a stereo ProcessorChain with the built-in processors") {
+		ProcessorChain chain(44100, 2);
+		chain.AddBuiltins();
+
+		// Two seconds of full-scale stereo 16-bit samples.
+		const std::size_t frames = 88200;
+		std::vector<std::int16_t> samples(2 * frames, 32767);
+		auto bytes = reinterpret_cast<std::uint8_t *>(samples.data());
+		AudioSource::DecodeVector frame(bytes, bytes + samples.size() * 2);
+
+		WHEN("nothing is enabled") {
+			THEN("the chain is disabled") {
+				REQUIRE(chain.Size() == 2 + DspSettings::EQ_BANDS);
+				REQUIRE_FALSE(chain.Enabled());
+			}
+
+			THEN("processing leaves the audio alone") {
+				chain.Process(frame, SampleFormat::PACKED_SIGNED_INT_16);
+				REQUIRE(0 == std::memcmp(frame.data(), bytes, frame.size()));
+			}
+		}
+
+		WHEN("only the limiter is enabled, and the audio is processed") {
+			DspSettings settings = DspSettings();
+			settings.has_limiter = true;
+			settings.ceiling = -6.0206;
+			chain.Configure(settings);
+			chain.Process(frame, SampleFormat::PACKED_SIGNED_INT_16);
+
+			THEN("the audio is limited") {
+				std::vector<std::int16_t> out(samples.size());
+				std::memcpy(out.data(), frame.data(), frame.size());
+				REQUIRE(out.front() <= 16384);
+				REQUIRE(out.back() <= 16384);
+			}
+
+			THEN("only the limiter's time is accounted") {
+				std::chrono::nanoseconds cost;
+				REQUIRE(chain.Cost("limiter", cost));
+				REQUIRE(0 < cost.count());
+				REQUIRE(chain.Cost("gain", cost));
+				REQUIRE(0 == cost.count());
+				REQUIRE_FALSE(chain.Cost("reverb", cost));
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio emits the cost of its DSP processors", "[dsp][pipe-audio]") {
+	GIVEN("a PipeAudio") {
+		PipeAudio pa(std::unique_ptr<AudioSource>(new DummyAudioSource("test")),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+
+		WHEN("the cost of a built-in processor is requested") {
+			auto cost = pa.Emit("/player/dsp/cost/eq2", false);
+
+			THEN("it is emitted in microseconds") {
+				REQUIRE(cost);
+				REQUIRE(cost->Pack() == "RES /player/dsp/cost/eq2 Entry 0");
+			}
+		}
+
+		WHEN("the cost of a nonexistent processor is requested") {
+			THEN("nothing is emitted") {
+				REQUIRE_FALSE(pa.Emit("/player/dsp/cost/reverb", false));
+			}
+		}
+	}
+}
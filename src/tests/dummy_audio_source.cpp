@@ -19,9 +19,10 @@
 	return std::unique_ptr<AudioSource>(new DummyAudioSource(path));
 }
 
-AudioSource::DecodeResult DummyAudioSource::Decode()
+AudioSource::DecodeState DummyAudioSource::DecodeInto(AudioSource::DecodeVector &frame)
 {
-	return std::make_pair(AudioSource::DecodeState::DECODING, AudioSource::DecodeVector());
+	frame.assign(this->frame_samples * this->BytesPerSample(), 0);
+	return AudioSource::DecodeState::DECODING;
 }
 
 std::uint8_t DummyAudioSource::ChannelCount() const
@@ -30,7 +30,7 @@ public:
 	 * @param path The path of the file this DummyAudioSource 'represents'.
 	 */
 	DummyAudioSource(const std::string &path) : AudioSource(path) {};
-	AudioSource::DecodeResult Decode() override;
+	AudioSource::DecodeState DecodeInto(AudioSource::DecodeVector &frame) override;
 	std::uint8_t ChannelCount() const override;
 	std::uint32_t SampleRate() const override;
 	SampleFormat OutputSampleFormat() const override;
@@ -41,4 +41,7 @@ public:
 
 	/// The position of the AudioSource, in samples.
 	std::uint64_t position;
+
+	/// The number of (silent) samples each DecodeInto() emits.
+	std::size_t frame_samples = 0;
 };
@@ -0,0 +1,81 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for FloatAudioSource.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "catch.hpp"
+
+#include "../audio/audio_sink.hpp"
+#include "../audio/float_source.hpp"
+#include "../audio/sample_convert.hpp"
+#include "../audio/sample_formats.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("FloatAudioSource converts another source to floating point", "[float-source]") {
+	GIVEN("a FloatAudioSource wrapping a 32-bit integer source") {
+		auto inner = new DummyAudioSource("test");
+		inner->frame_samples = 10;
+		std::unique_ptr<AudioSource> inner_ptr(inner);
+		FloatAudioSource source(std::move(inner_ptr));
+
+		WHEN("its format is requested") {
+			THEN("it is 32-bit floating point") {
+				REQUIRE(source.OutputSampleFormat() == SampleFormat::PACKED_FLOAT_32);
+				REQUIRE(source.BytesPerSample() == 2 * sizeof(float));
+			}
+		}
+
+		WHEN("a frame is decoded") {
+			auto result = source.Decode();
+
+			THEN("it holds the same number of samples, as floats") {
+				REQUIRE(result.first == AudioSource::DecodeState::DECODING);
+				REQUIRE(result.second.size() == 10 * 2 * sizeof(float));
+			}
+		}
+
+		WHEN("the source is sought") {
+			auto pos = source.Seek(441);
+
+			THEN("the wrapped source is sought too") {
+				REQUIRE(pos == 441);
+				REQUIRE(inner->position == 441);
+			}
+		}
+	}
+}
+
+SCENARIO("SDL devices are filled with silence in their own format", "[float-source]") {
+	GIVEN("an unsigned 8-bit device") {
+		auto fmt = SampleFormat::PACKED_UNSIGNED_INT_8;
+
+		THEN("silence is the midpoint, not zero") {
+			REQUIRE(SdlAudioSink::SilenceByte(fmt) == 0x80);
+		}
+	}
+
+	for (int f = 0; f <= static_cast<int>(SampleFormat::PACKED_FLOAT_32); f++) {
+		auto fmt = static_cast<SampleFormat>(f);
+
+		GIVEN("a device in format " + std::to_string(f)) {
+			WHEN("a sample is filled with its silence byte") {
+				std::uint8_t sample[4];
+				std::memset(sample, SdlAudioSink::SilenceByte(fmt), sizeof(sample));
+				float value = 1.0f;
+				ToFloatKernel(fmt)(sample, 1, &value);
+
+				THEN("it reads back as silence") {
+					REQUIRE(value == 0.0f);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,112 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for hot cues.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/hot_cue.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+/// Makes a HotCue::SourceFactory for DummyAudioSources that emit audio.
+static HotCue::SourceFactory DummyFactory()
+{
+	return []() {
+		auto src = new DummyAudioSource("test");
+		src->frame_samples = 4410;
+		return std::unique_ptr<AudioSource>(src);
+	};
+}
+
+SCENARIO("HotCue prerolls audio in the background", "[hot-cue]") {
+	GIVEN("a HotCue at 1 second with a 1000-sample preroll") {
+		HotCue cue(DummyFactory(), 44100, 1000);
+
+		WHEN("the preroll finishes") {
+			for (int i = 0; i < 500 && !cue.Ready(); i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+
+			THEN("the preroll is exactly the requested length") {
+				REQUIRE(cue.Ready());
+				REQUIRE(cue.Position() == 44100);
+				REQUIRE(cue.Start() == 44100);
+				REQUIRE(cue.Preroll().size() == 1000 * 8);
+				REQUIRE_FALSE(cue.AtEnd());
+			}
+		}
+	}
+
+	GIVEN("a HotCue with no source factory") {
+		HotCue cue(HotCue::SourceFactory(), 44100, 1000);
+
+		THEN("it is registered, but never ready") {
+			REQUIRE(cue.Position() == 44100);
+			REQUIRE_FALSE(cue.Ready());
+		}
+	}
+}
+
+SCENARIO("PipeAudio seeks to hot cues from their preroll", "[hot-cue][pipe-audio]") {
+	GIVEN("a PipeAudio with a hot cue at 1 second") {
+		auto src = new DummyAudioSource("test");
+		src->frame_samples = 4410;
+
+		PipeAudio pa(std::unique_ptr<AudioSource>(src),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+		pa.SetPrerollSource(DummyFactory());
+		pa.SetHotCue(3, 1000000);
+
+		THEN("the hot cue is emitted") {
+			auto rs = pa.Emit("/player/hotcue/3", false);
+			REQUIRE(rs);
+			REQUIRE(rs->Pack() == "RES /player/hotcue/3 Entry 1000000");
+			REQUIRE_FALSE(pa.Emit("/player/hotcue/2", false));
+		}
+
+		WHEN("the hot cue is sought to once its preroll is ready") {
+			// Until the preroll is ready, seeks go to the decoder, so
+			// keep trying until one doesn't.
+			const std::uint64_t untouched = 12345;
+			for (int i = 0; i < 500; i++) {
+				pa.Seek(0);
+				src->position = untouched;
+				pa.Seek(1000000);
+				if (src->position == untouched) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+
+			THEN("the decoder is not asked to seek") {
+				REQUIRE(src->position == untouched);
+				REQUIRE(pa.Position() == 1000000);
+			}
+
+			AND_WHEN("the preroll has been transferred") {
+				pa.Update();
+				pa.Update();
+
+				THEN("the decoder catches up to the end of the preroll") {
+					REQUIRE(src->position == 44100 + 2 * 44100);
+				}
+			}
+		}
+
+		WHEN("the hot cue is cleared") {
+			pa.ClearHotCue(3);
+
+			THEN("it is no longer emitted") {
+				REQUIRE_FALSE(pa.Emit("/player/hotcue/3", false));
+			}
+		}
+	}
+}
@@ -6,9 +6,16 @@
  * Tests for response classes.
  */
 
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
 #include <ostream>
+#include <random>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "catch.hpp"
 #include "../response.hpp"
@@ -86,3 +93,214 @@ SCENARIO("Responses correctly escape arguments with single quotes", "[response]"
 		}
 	}
 }
+
+SCENARIO("Words are escaped as Response arguments are", "[response]") {
+	WHEN("a word needs no quoting") {
+		THEN("it is left as it is") {
+			REQUIRE(Response::Escape("ulyoath") == "ulyoath");
+		}
+	}
+
+	WHEN("a word has whitespace or quotes") {
+		THEN("it is quoted as a Response argument would be") {
+			REQUIRE(Response::Escape("pargon pargon") == "'pargon pargon'");
+			REQUIRE(Response::Escape("chattur'gha") == R"('chattur'\''gha')");
+			REQUIRE(Response::Escape("new\nline") == "'new\nline'");
+		}
+	}
+
+	WHEN("a word is empty") {
+		THEN("it is quoted, so that it isn't lost") {
+			REQUIRE(Response::Escape("") == "''");
+		}
+	}
+}
+
+SCENARIO("Responses format numbers in place", "[response]") {
+	WHEN("the Response is fed numbers") {
+		auto r = Response(Response::Code::RES)
+		                 .AddArg("/player/time/elapsed")
+		                 .AddArg("Entry")
+		                 .AddArg(std::uint64_t(0))
+		                 .AddArg(std::uint64_t(1234567))
+		                 .AddArg(UINT64_MAX);
+
+		THEN("they come out in decimal, unquoted") {
+			REQUIRE(r.Pack() == "RES /player/time/elapsed Entry 0 1234567 "
+			                    "18446744073709551615");
+		}
+	}
+}
+
+SCENARIO("Responses outgrowing their inline storage pack correctly", "[response]") {
+	GIVEN("an argument longer than the inline storage") {
+		std::string path(Response::INLINE_CAPACITY, 'a');
+		path += " b'c";
+
+		WHEN("the Response is fed it, and more arguments after it") {
+			auto r = Response(Response::Code::FILE).AddArg("x").AddArg(path).AddArg("y");
+
+			THEN("the whole response is packed, escaped as usual") {
+				auto expected = "FILE x '" + path.substr(0, path.size() - 2) +
+				                R"('\''c' y)";
+				REQUIRE(r.Pack() == expected);
+			}
+
+			THEN("copies of it pack the same way") {
+				auto copy = r;
+				std::string packed = r.Pack();
+				REQUIRE(copy.Pack() == packed);
+			}
+		}
+	}
+}
+
+/**
+ * Times building and packing many copies of a response.
+ * @param name The name to report the timing under.
+ * @param build Builds one response, returning its packed length.
+ * @return The time taken per response, in nanoseconds.
+ */
+template <typename Build>
+static double TimeResponses(const char *name, Build build)
+{
+	const std::size_t count = 1000000;
+
+	std::size_t total = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < count; i++) total += build(i);
+	auto end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::nano> taken = end - begin;
+	double each = taken.count() / count;
+	std::cout << name << ": " << each << "ns per response (" << total
+	          << " bytes)" << std::endl;
+	return each;
+}
+
+SCENARIO("Responses are quick to build", "[response][benchmark][.]") {
+	WHEN("a million TIME broadcasts are built and packed") {
+		auto each = TimeResponses("response TIME", [](std::size_t i) {
+			Response r(Response::Code::RES);
+			r.AddArg("/player/time/elapsed")
+			        .AddArg("Entry")
+			        .AddArg(static_cast<std::uint64_t>(i) * 1000);
+			return r.Pack().Size();
+		});
+
+		THEN("each takes well under a microsecond") {
+			REQUIRE(each < 1000.0);
+		}
+	}
+
+	WHEN("a million ACKs are built and packed") {
+		std::vector<std::string> cmd{"write", "tag", "/control/state",
+		                             "Playing"};
+		auto each = TimeResponses("response ACK", [&cmd](std::size_t) {
+			Response r(Response::Code::ACK);
+			r.AddArg("OK").AddArg("success");
+			for (auto &word : cmd) r.AddArg(word);
+			return r.Pack().Size();
+		});
+
+		THEN("each takes well under a microsecond") {
+			REQUIRE(each < 1000.0);
+		}
+	}
+}
+
+/**
+ * Escapes an argument the way Response always has, a character at a time.
+ * @param arg The argument to escape.
+ * @return The escaped argument.
+ */
+static std::string ReferenceEscape(const std::string &arg)
+{
+	bool escaping = false;
+	std::string escaped;
+
+	for (char c : arg) {
+		bool is_escaper = c == '"' || c == '\'' || c == '\\';
+		if (isspace(c) || is_escaper) escaping = true;
+		escaped += (c == '\'') ? R"('\'')" : std::string(1, c);
+	}
+
+	if (escaping) return "'" + escaped + "'";
+	return escaped;
+}
+
+/**
+ * Checks that Response escapes an argument as ReferenceEscape does.
+ * @param arg The argument.
+ * @return Whether the escaping matches.
+ */
+static bool EscapesLikeReference(const std::string &arg)
+{
+	auto r = Response(Response::Code::END).AddArg(arg);
+	return r.Pack() == "END " + ReferenceEscape(arg);
+}
+
+SCENARIO("Response escapes exactly as the per-character escaper did", "[response]") {
+	WHEN("each escaped character is placed at every position of every "
+	     "length around the chunk sizes") {
+		const std::string specials = " \t\n\v\f\r\"'\\";
+		bool all_match = true;
+		for (std::size_t length = 1; length <= 48; length++) {
+			for (std::size_t at = 0; at < length; at++) {
+				for (char c : specials) {
+					std::string arg(length, 'x');
+					arg[at] = c;
+					if (!EscapesLikeReference(arg)) all_match = false;
+				}
+			}
+		}
+
+		THEN("the escaping always matches") {
+			REQUIRE(all_match);
+		}
+	}
+
+	WHEN("it is fed random arguments, biased towards awkward characters") {
+		std::mt19937 random(68);
+		std::uniform_int_distribution<int> length(0, 100);
+		std::uniform_int_distribution<int> kind(0, 3);
+		std::uniform_int_distribution<int> byte(0, 255);
+		std::uniform_int_distribution<int> letter('a', 'z');
+		const std::string specials = " \t\n\v\f\r\"'\\";
+		std::uniform_int_distribution<std::size_t> special(
+		        0, specials.size() - 1);
+
+		std::size_t mismatches = 0;
+		for (int i = 0; i < 20000; i++) {
+			std::string arg(length(random), '\0');
+			for (auto &c : arg) {
+				switch (kind(random)) {
+					case 0:
+						c = static_cast<char>(byte(random));
+						break;
+					case 1:
+						c = specials[special(random)];
+						break;
+					default:
+						c = static_cast<char>(letter(random));
+						break;
+				}
+			}
+
+			// Most real arguments have nothing to escape at all.
+			if (i % 2 == 0) {
+				for (auto &c : arg) {
+					if (specials.find(c) != std::string::npos) {
+						c = '_';
+					}
+				}
+			}
+
+			if (!EscapesLikeReference(arg)) mismatches++;
+		}
+
+		THEN("the escaping always matches") {
+			REQUIRE(mismatches == 0);
+		}
+	}
+}
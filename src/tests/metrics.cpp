@@ -0,0 +1,222 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the metrics.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "catch.hpp"
+
+#include "../cmd_result.hpp"
+#include "../metrics.hpp"
+#include "dummy_response_sink.hpp"
+
+/**
+ * Finds the value of a metric in the exposition text.
+ * @param text The text written by Metrics::Write.
+ * @param series The metric name, including any labels.
+ * @return The value, as written, or the empty string if it is missing.
+ */
+static std::string Value(const std::string &text, const std::string &series)
+{
+	auto at = text.find("\n" + series + " ");
+	if (at == std::string::npos) return "";
+
+	at += series.size() + 2;
+	return text.substr(at, text.find('\n', at) - at);
+}
+
+/**
+ * Gets the value of a counter from the process's Metrics.
+ * @param series The metric name, including any labels.
+ * @return The value.
+ */
+static std::uint64_t Counter(const std::string &series)
+{
+	std::ostringstream os;
+	Metrics::Get().Write(os);
+	return std::stoull(Value(os.str(), series));
+}
+
+SCENARIO("LatencyHistograms write cumulative Prometheus buckets",
+         "[metrics]") {
+	GIVEN("a histogram with three observations") {
+		using std::chrono::microseconds;
+
+		LatencyHistogram histogram;
+		histogram.Observe(microseconds(30));
+		histogram.Observe(microseconds(700));
+		histogram.Observe(microseconds(2000000));
+
+		WHEN("it is written") {
+			std::ostringstream os;
+			histogram.Write(os, "test_seconds", "A test.");
+			auto text = os.str();
+
+			THEN("it has a histogram header") {
+				REQUIRE(text.find("# HELP test_seconds A test.\n") !=
+				        std::string::npos);
+				REQUIRE(text.find("# TYPE test_seconds histogram\n") !=
+				        std::string::npos);
+			}
+
+			THEN("the buckets count everything at or below them") {
+				REQUIRE(Value(text, "test_seconds_bucket{le=\"0.000050\"}") ==
+				        "1");
+				REQUIRE(Value(text, "test_seconds_bucket{le=\"0.000500\"}") ==
+				        "1");
+				REQUIRE(Value(text, "test_seconds_bucket{le=\"0.001000\"}") ==
+				        "2");
+				REQUIRE(Value(text, "test_seconds_bucket{le=\"1.000000\"}") ==
+				        "2");
+				REQUIRE(Value(text, "test_seconds_bucket{le=\"+Inf\"}") ==
+				        "3");
+			}
+
+			THEN("the sum and count are exact") {
+				REQUIRE(Value(text, "test_seconds_sum") == "2.000730");
+				REQUIRE(Value(text, "test_seconds_count") == "3");
+			}
+		}
+	}
+}
+
+SCENARIO("Emitting a command result counts it", "[metrics]") {
+	GIVEN("the current counts, and a response sink") {
+		const std::string read_ok =
+		        "playd_commands_total{command=\"read\",result=\"OK\"}";
+		const std::string other_what =
+		        "playd_commands_total{command=\"other\",result=\"WHAT\"}";
+		auto reads = Counter(read_ok);
+		auto others = Counter(other_what);
+
+		std::ostringstream os;
+		DummyResponseSink sink(os);
+
+		WHEN("a successful read is emitted") {
+			CommandResult::Success().Emit(sink, {"read", "tag", "/"}, 0);
+
+			THEN("it is counted as a read that succeeded") {
+				auto now = Counter(read_ok);
+				REQUIRE(now == reads + 1);
+			}
+		}
+
+		WHEN("an unknown command is rejected") {
+			CommandResult::Invalid("nope").Emit(sink, {"frob", "tag"}, 0);
+
+			THEN("it is counted as an other that was invalid") {
+				auto now = Counter(other_what);
+				REQUIRE(now == others + 1);
+			}
+		}
+	}
+}
+
+SCENARIO("AudibleLatency times commands until they are heard", "[metrics]") {
+	GIVEN("an unarmed probe") {
+		using std::chrono::microseconds;
+
+		AudibleLatency probe;
+		auto read_at = std::chrono::steady_clock::now();
+		const std::string play_count =
+		        "playd_audible_latency_seconds_count{command=\"play\"}";
+		const std::string seek_count =
+		        "playd_audible_latency_seconds_count{command=\"seek\"}";
+		const std::string seek_sum =
+		        "playd_audible_latency_seconds_sum{command=\"seek\"}";
+
+		WHEN("a command that changes nothing heard is run") {
+			probe.Arm({"write", "t", "/player/rate", "1.5"},
+			          read_at);
+
+			THEN("the probe stays unarmed") {
+				REQUIRE_FALSE(probe.Armed());
+			}
+		}
+
+		WHEN("a seek is run, and then heard twice") {
+			probe.Arm({"write", "t", "/player/time/elapsed", "0"},
+			          read_at);
+			REQUIRE(probe.Armed());
+			probe.Heard(read_at + microseconds(2000));
+			probe.Heard(read_at + microseconds(9000));
+
+			std::ostringstream os;
+			probe.Write(os);
+			auto text = os.str();
+
+			THEN("the first hearing is observed, as a seek") {
+				REQUIRE_FALSE(probe.Armed());
+				REQUIRE(Value(text, seek_count) == "1");
+				REQUIRE(Value(text, seek_sum) == "0.002000");
+				REQUIRE(Value(text, play_count) == "0");
+			}
+		}
+
+		WHEN("a play is run over a seek not yet heard") {
+			probe.Arm({"write", "t", "/player/time/elapsed", "0"},
+			          read_at);
+			probe.Arm({"write", "t", "/control/state", "Playing"},
+			          read_at + microseconds(1000));
+			probe.Heard(read_at + microseconds(5000));
+
+			std::ostringstream os;
+			probe.Write(os);
+			auto text = os.str();
+
+			THEN("only the play is observed, from when it was read") {
+				REQUIRE(Value(text, seek_count) == "0");
+				REQUIRE(Value(text, play_count) == "1");
+				REQUIRE(Value(text,
+				              "playd_audible_latency_seconds_sum"
+				              "{command=\"play\"}") == "0.004000");
+			}
+		}
+	}
+}
+
+SCENARIO("Metrics are written in the Prometheus text format", "[metrics]") {
+	GIVEN("the process's Metrics, with a known ring buffer state") {
+		auto &metrics = Metrics::Get();
+		metrics.ring_size = 1000;
+		metrics.ring_fill = 250;
+
+		WHEN("they are written") {
+			std::ostringstream os;
+			metrics.Write(os);
+			auto text = os.str();
+
+			THEN("every metric is there, with its type") {
+				for (auto type : {"playd_connections gauge",
+				                  "playd_connections_total counter",
+				                  "playd_commands_total counter",
+				                  "playd_command_backlog gauge",
+				                  "playd_commands_deferred_total counter",
+				                  "playd_broadcast_bytes_total counter",
+				                  "playd_replies_dropped_total counter",
+				                  "playd_decode_seconds histogram",
+				                  "playd_load_seconds histogram",
+				                  "playd_seek_seconds histogram",
+				                  "playd_ring_fill_ratio gauge",
+				                  "playd_underruns_total counter",
+				                  "playd_audible_latency_seconds "
+				                  "histogram"}) {
+					INFO(type);
+					auto line = "# TYPE " + std::string(type) + "\n";
+					REQUIRE(text.find(line) != std::string::npos);
+				}
+			}
+
+			THEN("the ring fill is a ratio") {
+				REQUIRE(Value(text, "playd_ring_fill_ratio") == "0.25");
+			}
+		}
+	}
+}
@@ -0,0 +1,208 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the NullAudioSink class.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_source.hpp"
+#include "../audio/null_sink.hpp"
+#include "../metrics.hpp"
+#include "dummy_audio_source.hpp"
+
+/**
+ * Gets the total latency of plays heard so far, from the process's Metrics.
+ * @return The latency, in seconds.
+ */
+static double PlaysHeard()
+{
+	std::ostringstream os;
+	Metrics::Get().audible.Write(os);
+	auto text = os.str();
+
+	auto at = text.find(
+	        "playd_audible_latency_seconds_sum{command=\"play\"} ");
+	return std::stod(text.substr(text.find(' ', at) + 1));
+}
+
+/// A DummyAudioSource whose samples are unsigned, so silent at 0x80.
+class UnsignedAudioSource : public DummyAudioSource
+{
+public:
+	/**
+	 * Constructs an UnsignedAudioSource.
+	 * @param path The path to the file from which this AudioSource is
+	 *   decoding.
+	 */
+	explicit UnsignedAudioSource(const std::string &path)
+	    : DummyAudioSource(path)
+	{
+	}
+
+	SampleFormat OutputSampleFormat() const override
+	{
+		return SampleFormat::PACKED_UNSIGNED_INT_8;
+	}
+};
+
+SCENARIO("Null sinks keep time by the clock", "[null-sink]") {
+	GIVEN("a null sink for a 44.1kHz source") {
+		DummyAudioSource src("test");
+		NullAudioSink sink(src);
+		auto bps = src.BytesPerSample();
+
+		WHEN("it is given more samples than it can hold") {
+			AudioSource::DecodeVector samples(100000 * bps);
+			auto start = samples.begin();
+			sink.Transfer(start, samples.end());
+
+			THEN("it takes as many as a device ring buffer would") {
+				auto taken = std::distance(samples.begin(), start);
+				REQUIRE(taken == static_cast<std::ptrdiff_t>(65536 * bps));
+			}
+
+			THEN("it plays nothing while stopped") {
+				std::this_thread::sleep_for(
+				        std::chrono::milliseconds(20));
+				REQUIRE(sink.Position() == 0);
+				REQUIRE(sink.State() == Audio::State::STOPPED);
+			}
+
+			AND_WHEN("it plays for a while") {
+				auto before = std::chrono::steady_clock::now();
+				sink.Start();
+				std::this_thread::sleep_for(
+				        std::chrono::milliseconds(50));
+				auto position = sink.Position();
+				auto elapsed = std::chrono::steady_clock::now() - before;
+
+				THEN("its position moves at the sample rate") {
+					auto micros = std::chrono::duration_cast<
+					        std::chrono::microseconds>(elapsed).count();
+					REQUIRE(2205 <= position);
+					REQUIRE(position <= static_cast<std::uint64_t>(
+					        micros) * 44100 / 1000000);
+				}
+			}
+		}
+
+		WHEN("it plays out a short, finished source") {
+			AudioSource::DecodeVector samples(441 * bps);
+			auto start = samples.begin();
+			sink.Transfer(start, samples.end());
+			sink.SourceOut();
+
+			auto underruns = Metrics::Get().underruns.load();
+			sink.Start();
+			std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+			THEN("it ends at the last sample, without underrunning") {
+				REQUIRE(sink.State() == Audio::State::AT_END);
+				REQUIRE(sink.Position() == 441);
+				REQUIRE(Metrics::Get().underruns.load() == underruns);
+			}
+		}
+
+		WHEN("it runs dry before the source runs out") {
+			AudioSource::DecodeVector samples(441 * bps);
+			auto start = samples.begin();
+			sink.Transfer(start, samples.end());
+
+			auto underruns = Metrics::Get().underruns.load();
+			sink.Start();
+			std::this_thread::sleep_for(std::chrono::milliseconds(30));
+			sink.Position();
+			sink.Position();
+
+			THEN("it counts one underrun, and keeps playing") {
+				REQUIRE(Metrics::Get().underruns.load() ==
+				        underruns + 1);
+				REQUIRE(sink.State() == Audio::State::PLAYING);
+				REQUIRE(sink.Position() == 441);
+			}
+		}
+
+		WHEN("a play is run, with silence held before the sound") {
+			// 100ms of silence, then 10ms of sound.
+			AudioSource::DecodeVector samples(4851 * bps);
+			auto sound = samples.begin() + 4410 * bps;
+			std::fill(sound, samples.end(), 1);
+			auto start = samples.begin();
+			sink.Transfer(start, samples.end());
+
+			auto before = PlaysHeard();
+			auto read_at = std::chrono::steady_clock::now();
+			auto &audible = Metrics::Get().audible;
+			audible.Arm({"write", "t", "/control/state", "Playing"},
+			            read_at);
+			sink.Start();
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			sink.Position();
+			bool armed_in_silence = audible.Armed();
+			std::this_thread::sleep_for(std::chrono::milliseconds(80));
+			sink.Position();
+			auto latency = PlaysHeard() - before;
+
+			THEN("the probe waits for the sound, and is then disarmed") {
+				REQUIRE(armed_in_silence);
+				REQUIRE_FALSE(audible.Armed());
+			}
+
+			THEN("the latency runs to when the sound played") {
+				REQUIRE(0.1 <= latency);
+				REQUIRE(latency < 0.12);
+			}
+		}
+	}
+
+	GIVEN("a null sink for an unsigned 8-bit source") {
+		UnsignedAudioSource src("test");
+		NullAudioSink sink(src);
+		auto bps = src.BytesPerSample();
+
+		WHEN("a play is run, with unsigned silence held before the sound") {
+			// 100ms of silence, at the midpoint, then 10ms of sound.
+			AudioSource::DecodeVector samples(4851 * bps, 0x80);
+			auto sound = samples.begin() + 4410 * bps;
+			std::fill(sound, samples.end(), 0x90);
+			auto start = samples.begin();
+			sink.Transfer(start, samples.end());
+
+			auto before = PlaysHeard();
+			auto read_at = std::chrono::steady_clock::now();
+			auto &audible = Metrics::Get().audible;
+			audible.Arm({"write", "t", "/control/state", "Playing"},
+			            read_at);
+			sink.Start();
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			sink.Position();
+			bool armed_in_silence = audible.Armed();
+			std::this_thread::sleep_for(std::chrono::milliseconds(80));
+			sink.Position();
+			auto latency = PlaysHeard() - before;
+
+			THEN("the silence isn't taken for sound") {
+				REQUIRE(armed_in_silence);
+				REQUIRE_FALSE(audible.Armed());
+			}
+
+			THEN("the latency runs to when the sound played") {
+				REQUIRE(0.1 <= latency);
+				REQUIRE(latency < 0.12);
+			}
+		}
+	}
+}
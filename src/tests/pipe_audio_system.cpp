@@ -78,3 +78,30 @@ SCENARIO("AudioSystems fail to load audio with an unknown format", "[pipe-audio-
 		}
 	}
 }
+
+SCENARIO("AudioSystems in the float pipeline emit floating point", "[pipe-audio-system]") {
+	GIVEN("an AudioSystem with a dummy source and the float pipeline") {
+		AudioSystem sys(0);
+		sys.AddSource("bar", &DummyAudioSource::Build);
+		sys.SetFloatPipeline();
+
+		WHEN("a source is loaded") {
+			auto source = sys.LoadSource("foo.bar");
+
+			THEN("it emits 32-bit floats, at the same rate and channels") {
+				REQUIRE(source->OutputSampleFormat() == SampleFormat::PACKED_FLOAT_32);
+				REQUIRE(source->ChannelCount() == 2);
+				REQUIRE(source->SampleRate() == 44100);
+				REQUIRE(source->Path() == "foo.bar");
+			}
+		}
+
+		WHEN("a source is opened through a source factory") {
+			auto source = sys.SourceFactoryFor("foo.bar")();
+
+			THEN("it also emits 32-bit floats") {
+				REQUIRE(source->OutputSampleFormat() == SampleFormat::PACKED_FLOAT_32);
+			}
+		}
+	}
+}
@@ -62,6 +62,15 @@ SCENARIO("Player interacts correctly with a AudioSystem", "[player][dummy-audio-
 			THEN("setting time to 0 returns failure") {
 				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/time/elapsed", "0"}).IsSuccess());
 			}
+			THEN("setting a hot cue returns failure") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/hotcue/0", "0"}).IsSuccess());
+			}
+			THEN("queueing a next file returns failure") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/file", "blah.mp3"}).IsSuccess());
+			}
+			THEN("setting the crossfade length returns success") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/length", "5000000"}).IsSuccess());
+			}
 			THEN("setting state to 'Ejected' returns success") {
 				// Telling an ejected player to eject is a
 				// no-op.
@@ -90,6 +99,53 @@ SCENARIO("Player interacts correctly with a AudioSystem", "[player][dummy-audio-
 				THEN("seeking to 0 returns success") {
 					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/time/elapsed", "0"}).IsSuccess());
 				}
+				THEN("setting and clearing a hot cue returns success") {
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/hotcue/7", "1000000"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/hotcue/7"}).IsSuccess());
+				}
+				THEN("setting up a loop returns success") {
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/loop/in", "500000"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/loop/out", "1000000"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/loop/mode", "On"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/loop/out"}).IsSuccess());
+				}
+				THEN("setting and resetting the rate returns success") {
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/rate", "1.05"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/rate"}).IsSuccess());
+				}
+				THEN("setting an invalid rate returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/rate", "0"}).IsSuccess());
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/rate", "fast"}).IsSuccess());
+				}
+				THEN("setting an invalid loop mode returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/loop/mode", "Sometimes"}).IsSuccess());
+				}
+				THEN("setting up a crossfade returns success") {
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/file", "next.mp3"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/curve", "Linear"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/start", "1000000"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/crossfade/file"}).IsSuccess());
+				}
+				THEN("setting up the DSP chain returns success") {
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/gain", "-3.5"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/eq/3", "1000,6,0.7"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/limiter", "-1"}).IsSuccess());
+					REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/dsp/eq/3"}).IsSuccess());
+				}
+				THEN("setting an invalid EQ band returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/eq/0", "1000,6"}).IsSuccess());
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/eq/0", "-5,6,1"}).IsSuccess());
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/dsp/gain", "loud"}).IsSuccess());
+				}
+				THEN("setting an invalid crossfade curve returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/curve", "Wobbly"}).IsSuccess());
+				}
+				THEN("queueing a next file of an unknown type returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/crossfade/file", "next.wav"}).IsSuccess());
+				}
+				THEN("setting a nonexistent hot cue returns failure") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/hotcue/8", "1000000"}).IsSuccess());
+				}
 				THEN("setting state to Ejected returns success") {
 					REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Ejected"}).IsSuccess());
 				}
@@ -129,3 +185,154 @@ SCENARIO("Player interacts correctly with a AudioSystem", "[player][dummy-audio-
 
 	}
 }
+
+/**
+ * Counts the occurrences of a line in some output.
+ * @param out The output.
+ * @param line The line, without its newline.
+ * @return The number of times the line appears.
+ */
+static std::size_t CountLines(const std::string &out, const std::string &line)
+{
+	std::istringstream lines(out);
+	std::size_t count = 0;
+	for (std::string l; std::getline(lines, l);) {
+		if (l == line) count++;
+	}
+	return count;
+}
+
+SCENARIO("Player runs batches of writes as one command", "[player][batch]") {
+	GIVEN("a fresh Player with a DummyResponseSink") {
+		AudioSystem ds(0);
+		Player p(ds);
+		std::ostringstream os;
+		DummyResponseSink sink(os);
+		p.SetSink(sink);
+
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+
+		WHEN("a batch loads, seeks and plays a file") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "batch", "tag", "/player/file", "blah.mp3",
+			        "/player/time/elapsed", "0", "/control/state",
+			        "Playing"});
+			auto out = os.str();
+
+			THEN("the batch succeeds") {
+				REQUIRE(res.IsSuccess());
+			}
+			THEN("the whole state is broadcast once, at the end") {
+				auto roots = CountLines(out, "RES / Directory 2");
+				REQUIRE(roots == 1);
+				auto playing = CountLines(
+				        out, "RES /control/state Entry Playing");
+				REQUIRE(playing == 1);
+				auto stopped = CountLines(
+				        out, "RES /control/state Entry Stopped");
+				REQUIRE(stopped == 0);
+			}
+		}
+
+		WHEN("a batch has a failing write in the middle") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "batch", "tag", "/player/crossfade/length", "5",
+			        "/control/state", "Bogus",
+			        "/player/crossfade/length", "7"});
+			auto out = os.str();
+
+			THEN("the batch fails") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+			THEN("only the writes before the failure happen") {
+				auto five = CountLines(
+				        out, "RES /player/crossfade/length Entry 5");
+				REQUIRE(five == 1);
+				auto seven = CountLines(
+				        out, "RES /player/crossfade/length Entry 7");
+				REQUIRE(seven == 0);
+			}
+		}
+
+		WHEN("a batch has a path without a payload") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "batch", "tag", "/player/crossfade/length", "5",
+			        "/player/crossfade/length"});
+
+			THEN("the batch is invalid, and nothing is written") {
+				REQUIRE_FALSE(res.IsSuccess());
+				REQUIRE(os.str().empty());
+			}
+		}
+	}
+}
+
+SCENARIO("Player reads several paths and patterns at once", "[player][read]") {
+	GIVEN("a fresh Player with a DummyResponseSink") {
+		AudioSystem ds(0);
+		Player p(ds);
+		std::ostringstream os;
+		DummyResponseSink sink(os);
+		p.SetSink(sink);
+
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+
+		WHEN("two paths are read") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "read", "tag", "/control/state", "/player/rate"});
+			auto out = os.str();
+
+			THEN("both are read, in one command") {
+				REQUIRE(res.IsSuccess());
+				REQUIRE(out == "RES /control/state Entry Ejected\n"
+				               "RES /player/rate Entry 1\n");
+			}
+		}
+
+		WHEN("a pattern is read") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "read", "tag", "/*/rate"});
+			auto out = os.str();
+
+			THEN("only what matches, within one level, is read") {
+				REQUIRE(res.IsSuccess());
+				REQUIRE(out == "RES /player/rate Entry 1\n");
+			}
+		}
+
+		WHEN("a directory and something inside it are both read") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "read", "tag", "/player/rate", "/player"});
+			auto out = os.str();
+
+			THEN("the thing inside is read only once") {
+				REQUIRE(res.IsSuccess());
+				auto rates = CountLines(out, "RES /player/rate Entry 1");
+				REQUIRE(rates == 1);
+				auto dirs = CountLines(out, "RES /player Directory 8");
+				REQUIRE(dirs == 1);
+			}
+		}
+
+		WHEN("one of the patterns matches nothing") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "read", "tag", "/player/rate", "/player/nothing*"});
+
+			THEN("the read fails, and nothing is read") {
+				REQUIRE_FALSE(res.IsSuccess());
+				REQUIRE(os.str().empty());
+			}
+		}
+
+		WHEN("a single empty entry is read") {
+			auto res = p.RunCommand(std::vector<std::string>{
+			        "read", "tag", "/player/file"});
+
+			THEN("the read fails, as it always has") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+		}
+	}
+}
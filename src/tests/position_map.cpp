@@ -0,0 +1,118 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the PositionMap class, and looping in PipeAudio.
+ */
+
+#include <cstdint>
+#include <memory>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/position_map.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("PositionMap maps stream positions to file positions", "[position-map]") {
+	GIVEN("an empty PositionMap") {
+		PositionMap map;
+
+		THEN("stream and file positions are the same") {
+			REQUIRE(map.Empty());
+			REQUIRE(map.ToFile(1234) == 1234);
+		}
+
+		WHEN("two jumps are added") {
+			map.Add(1000, 500);
+			map.Add(1500, 500);
+
+			THEN("positions before the first jump are unchanged") {
+				REQUIRE(map.ToFile(999) == 999);
+			}
+
+			THEN("positions after each jump are offset by it") {
+				REQUIRE(map.ToFile(1000) == 500);
+				REQUIRE(map.ToFile(1499) == 999);
+				REQUIRE(map.ToFile(1600) == 600);
+			}
+
+			AND_WHEN("the map is pruned past the first jump") {
+				map.Prune(1200);
+
+				THEN("positions still map the same way") {
+					REQUIRE(map.ToFile(1200) == 700);
+					REQUIRE(map.ToFile(1600) == 600);
+				}
+			}
+
+			AND_WHEN("a jump with a different rate is added") {
+				map.Add(2000, 1000, 1.5);
+
+				THEN("positions after it go by at that rate") {
+					REQUIRE(map.ToFile(2000) == 1000);
+					REQUIRE(map.ToFile(2100) == 1150);
+				}
+
+				THEN("positions before it are unchanged") {
+					REQUIRE(map.ToFile(1600) == 600);
+				}
+			}
+
+			AND_WHEN("the map is cleared") {
+				map.Clear();
+
+				THEN("stream and file positions are the same again") {
+					REQUIRE(map.Empty());
+					REQUIRE(map.ToFile(1600) == 1600);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio loops without ending", "[position-map][pipe-audio]") {
+	GIVEN("a looping PipeAudio with loop points at 0.5 and 1 seconds") {
+		auto src = new DummyAudioSource("test");
+		src->frame_samples = 4410;
+		src->position = 0;
+		auto sink = new DummyAudioSink();
+
+		std::unique_ptr<AudioSource> src_ptr(src);
+		std::unique_ptr<AudioSink> sink_ptr(sink);
+		PipeAudio pa(std::move(src_ptr), std::move(sink_ptr));
+		pa.SetLoopIn(500000);
+		pa.SetLoopOut(1000000);
+		pa.SetLooping(true);
+
+		THEN("the loop is emitted") {
+			REQUIRE(pa.Emit("/player/loop/mode", false)->Pack() == "RES /player/loop/mode Entry On");
+			REQUIRE(pa.Emit("/player/loop/in", false)->Pack() == "RES /player/loop/in Entry 500000");
+			REQUIRE(pa.Emit("/player/loop/out", false)->Pack() == "RES /player/loop/out Entry 1000000");
+		}
+
+		WHEN("the decoder reaches the loop-out point") {
+			// Ten frames of 4410 samples take us to 1 second; the
+			// eleventh decode loops back.
+			for (int i = 0; i < 11; i++) {
+				REQUIRE(pa.Update() != Audio::State::AT_END);
+			}
+
+			THEN("the decoder is sent back to the loop-in point") {
+				REQUIRE(src->position == 22050);
+			}
+
+			THEN("positions before the wrap are unchanged") {
+				sink->position = 44000;
+				REQUIRE(pa.Position() == src->MicrosFromSamples(44000));
+			}
+
+			THEN("positions after the wrap follow on from the loop-in point") {
+				sink->position = 44100 + 100;
+				REQUIRE(pa.Position() == src->MicrosFromSamples(22150));
+			}
+		}
+	}
+}
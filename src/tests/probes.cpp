@@ -0,0 +1,117 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the USDT probes.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../probes.hpp"
+
+#if defined(__linux__) && defined(__LP64__)
+#include <elf.h>
+
+/// The note type of SystemTap probes.
+static const std::uint32_t NT_STAPSDT = 3;
+
+/**
+ * Rounds a note field size up to the 4-byte alignment of ELF notes.
+ * @param size The size.
+ * @return The aligned size.
+ */
+static std::size_t NoteAlign(std::size_t size)
+{
+	return (size + 3) & ~static_cast<std::size_t>(3);
+}
+
+/**
+ * Lists the SystemTap probes in the running executable.
+ * @param probes Filled with "provider:name" for each probe.
+ * @return True if the executable could be read as 64-bit ELF.
+ */
+static bool ReadProbes(std::set<std::string> &probes)
+{
+	std::ifstream file("/proc/self/exe", std::ios::binary);
+	if (!file) return false;
+	std::vector<char> elf((std::istreambuf_iterator<char>(file)),
+	                      std::istreambuf_iterator<char>());
+
+	if (elf.size() < sizeof(Elf64_Ehdr)) return false;
+	Elf64_Ehdr header;
+	std::memcpy(&header, elf.data(), sizeof(header));
+	if (std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) return false;
+	if (header.e_ident[EI_CLASS] != ELFCLASS64) return false;
+
+	auto section = [&elf, &header](std::size_t i) {
+		Elf64_Shdr shdr;
+		std::memcpy(&shdr,
+		            elf.data() + header.e_shoff + i * header.e_shentsize,
+		            sizeof(shdr));
+		return shdr;
+	};
+	auto names = section(header.e_shstrndx);
+
+	for (std::size_t i = 0; i < header.e_shnum; i++) {
+		auto shdr = section(i);
+		const char *name = elf.data() + names.sh_offset + shdr.sh_name;
+		if (std::strcmp(name, ".note.stapsdt") != 0) continue;
+
+		// Each note is a header, the owner ("stapsdt"), then three
+		// addresses, the provider, the probe name, and its arguments.
+		auto at = shdr.sh_offset;
+		auto end = shdr.sh_offset + shdr.sh_size;
+		while (at + sizeof(Elf64_Nhdr) <= end) {
+			Elf64_Nhdr note;
+			std::memcpy(&note, elf.data() + at, sizeof(note));
+			auto desc = at + sizeof(note) + NoteAlign(note.n_namesz);
+
+			if (note.n_type == NT_STAPSDT) {
+				const char *provider =
+				        elf.data() + desc + 3 * sizeof(Elf64_Addr);
+				const char *probe = provider + std::strlen(provider) + 1;
+				probes.insert(std::string(provider) + ":" + probe);
+			}
+
+			at = desc + NoteAlign(note.n_descsz);
+		}
+	}
+
+	return true;
+}
+
+SCENARIO("The USDT probes are in the executable", "[probes]") {
+	GIVEN("the probes listed in the running executable's ELF notes") {
+		std::set<std::string> probes;
+		REQUIRE(ReadProbes(probes));
+
+#ifdef PLAYD_HAVE_SDT
+		THEN("every playd probe is there") {
+			for (auto name : {"decode_start", "decode_end", "transfer",
+			                  "callback", "command", "respond"}) {
+				INFO(name);
+				REQUIRE(probes.count(std::string("playd:") + name) == 1);
+			}
+		}
+#else
+		THEN("there are no playd probes, as <sys/sdt.h> is missing") {
+			bool any = false;
+			for (auto &probe : probes) {
+				if (probe.compare(0, 6, "playd:") == 0) any = true;
+			}
+			REQUIRE_FALSE(any);
+		}
+#endif // PLAYD_HAVE_SDT
+	}
+}
+#endif // __linux__ && __LP64__
@@ -0,0 +1,62 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for thread scheduling, memory locking and fault counting.
+ */
+
+#include <cstddef>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../realtime.hpp"
+
+SCENARIO("The default ThreadPolicy changes nothing", "[realtime]") {
+	GIVEN("a default ThreadPolicy") {
+		ThreadPolicy policy;
+
+		WHEN("it is applied") {
+			THEN("it succeeds") {
+				REQUIRE(policy.Apply());
+			}
+		}
+	}
+}
+
+SCENARIO("Prefault does nothing while memory is unlocked", "[realtime]") {
+	GIVEN("a buffer and unlocked memory") {
+		std::vector<char> buffer(4096, 'x');
+
+		WHEN("the buffer is prefaulted") {
+			Prefault(buffer.data(), buffer.size());
+
+			THEN("its contents are untouched") {
+				REQUIRE(buffer.front() == 'x');
+				REQUIRE(buffer.back() == 'x');
+			}
+		}
+	}
+}
+
+#ifdef __linux__
+SCENARIO("ThreadFaults sees page faults on the calling thread", "[realtime]") {
+	GIVEN("the calling thread's counts") {
+		ThreadFaults before;
+		REQUIRE(ThreadFaults::Read(before));
+
+		WHEN("the thread touches a lot of fresh memory") {
+			const std::size_t bytes = 16 * 1024 * 1024;
+			std::vector<char> buffer(bytes);
+			for (std::size_t i = 0; i < bytes; i += 4096) buffer[i] = 1;
+
+			THEN("its minor fault count goes up") {
+				ThreadFaults after;
+				REQUIRE(ThreadFaults::Read(after));
+				REQUIRE(before.minor_faults < after.minor_faults);
+			}
+		}
+	}
+}
+#endif // __linux__
@@ -0,0 +1,109 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the RewindBuffer class, and rewinding in PipeAudio.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/rewind_buffer.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("RewindBuffer remembers a bounded history of samples", "[rewind-buffer]") {
+	GIVEN("a RewindBuffer of 4 one-byte samples, starting at position 10") {
+		RewindBuffer rb(4, 1);
+		rb.Reset(10);
+
+		WHEN("nothing has been appended") {
+			THEN("only the current position is contained") {
+				REQUIRE(rb.Contains(10));
+				REQUIRE_FALSE(rb.Contains(9));
+				REQUIRE_FALSE(rb.Contains(11));
+			}
+		}
+
+		WHEN("three samples are appended") {
+			std::vector<std::uint8_t> in{1, 2, 3};
+			rb.Append(in.data(), in.data() + in.size());
+
+			THEN("the history spans all three") {
+				REQUIRE(rb.Start() == 10);
+				REQUIRE(rb.End() == 13);
+			}
+
+			AND_WHEN("the buffer is rewound to position 11") {
+				AudioSource::DecodeVector out;
+				rb.Rewind(11, out);
+
+				THEN("the rewound samples are returned") {
+					REQUIRE(out == AudioSource::DecodeVector({2, 3}));
+				}
+
+				THEN("the history now ends at the rewind point") {
+					REQUIRE(rb.End() == 11);
+					REQUIRE_FALSE(rb.Contains(12));
+				}
+			}
+		}
+
+		WHEN("six samples are appended in two runs") {
+			std::vector<std::uint8_t> in{1, 2, 3, 4, 5, 6};
+			rb.Append(in.data(), in.data() + 3);
+			rb.Append(in.data() + 3, in.data() + 6);
+
+			THEN("only the last four are remembered") {
+				REQUIRE(rb.Start() == 12);
+				REQUIRE(rb.End() == 16);
+				REQUIRE_FALSE(rb.Contains(11));
+			}
+
+			AND_WHEN("the buffer is rewound to its start") {
+				AudioSource::DecodeVector out;
+				rb.Rewind(12, out);
+
+				THEN("the samples come back in order across the wrap") {
+					REQUIRE(out == AudioSource::DecodeVector({3, 4, 5, 6}));
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio serves short backward seeks from memory", "[rewind-buffer][pipe-audio]") {
+	GIVEN("a PipeAudio that has transferred two seconds of audio") {
+		auto src = new DummyAudioSource("test");
+		src->frame_samples = 4410;
+		src->position = 0;
+
+		PipeAudio pa(std::unique_ptr<AudioSource>(src),
+		             std::unique_ptr<AudioSink>(new DummyAudioSink()));
+		for (int i = 0; i < 20; i++) pa.Update();
+
+		WHEN("the PipeAudio is sought back to one second") {
+			pa.Seek(1000000);
+
+			THEN("the position changes") {
+				REQUIRE(pa.Position() == 1000000);
+			}
+
+			THEN("the source was not asked to seek") {
+				REQUIRE(src->position == 0);
+			}
+		}
+
+		WHEN("the PipeAudio is sought past what has been transferred") {
+			pa.Seek(5000000);
+
+			THEN("the source is asked to seek") {
+				REQUIRE(src->position == 220500);
+			}
+		}
+	}
+}
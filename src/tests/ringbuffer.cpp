@@ -0,0 +1,42 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the RingBuffer class.
+ */
+
+#include "catch.hpp"
+
+#include "../audio/ringbuffer.hpp"
+
+SCENARIO("RingBuffer can skip samples without reading them", "[ringbuffer]") {
+	GIVEN("a RingBuffer of 8 one-byte samples containing 5 samples") {
+		RingBuffer rb(3, 1);
+		char in[] = {1, 2, 3, 4, 5};
+		rb.Write(in, 5);
+
+		WHEN("3 samples are skipped") {
+			rb.Skip(3);
+
+			THEN("only 2 samples remain") {
+				REQUIRE(rb.ReadCapacity() == 2);
+				REQUIRE(rb.WriteCapacity() == 6);
+			}
+
+			THEN("the next sample read is the one after the skip") {
+				char out = 0;
+				rb.Read(&out, 1);
+				REQUIRE(out == 4);
+			}
+		}
+
+		WHEN("every sample is skipped") {
+			rb.Skip(5);
+
+			THEN("the RingBuffer is empty") {
+				REQUIRE(rb.ReadCapacity() == 0);
+			}
+		}
+	}
+}
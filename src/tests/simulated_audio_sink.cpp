@@ -0,0 +1,188 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Definition of the SimulatedAudioSink class.
+ * @see audio/audio_sink.hpp
+ * @see tests/simulated_audio_sink.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <random>
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_sink.hpp"
+#include "../audio/audio_source.hpp"
+#include "../audio/ringbuffer.hpp"
+#include "simulated_audio_sink.hpp"
+#include "simulated_clock.hpp"
+
+SimulatedAudioSink::SimulatedAudioSink(const AudioSource &source,
+                                       const DeviceSettings &settings,
+                                       SimulatedClock &clock)
+    : settings(settings),
+      bytes_per_sample(source.BytesPerSample()),
+      ring_buf(settings.ring_power, source.BytesPerSample()),
+      block(settings.block_samples * source.BytesPerSample()),
+      random(settings.seed),
+      state(Audio::State::STOPPED),
+      position_sample_count(0),
+      source_out(false),
+      underruns(0),
+      silence(0),
+      callbacks(0),
+      clock(clock),
+      listener(0)
+{
+	assert(0 < this->settings.block_samples);
+
+	if (this->settings.period.count() == 0) {
+		this->settings.period = std::chrono::microseconds(
+		        this->settings.block_samples * 1000000 /
+		        source.SampleRate());
+	}
+
+	// Callbacks are due at a steady period, however late or early each
+	// one actually comes, as with a device clock.
+	this->due = this->clock.Now() + this->settings.period;
+	this->next = this->due + this->Stray();
+	this->listener = this->clock.Listen(
+	        [this](SimulatedClock::time_point now) { this->CatchUp(now); });
+}
+
+SimulatedAudioSink::~SimulatedAudioSink()
+{
+	this->clock.Forget(this->listener);
+}
+
+void SimulatedAudioSink::Start()
+{
+	if (this->state != Audio::State::STOPPED) return;
+	this->state = Audio::State::PLAYING;
+}
+
+void SimulatedAudioSink::Stop()
+{
+	this->state = Audio::State::STOPPED;
+}
+
+Audio::State SimulatedAudioSink::State()
+{
+	return this->state;
+}
+
+std::uint64_t SimulatedAudioSink::Position()
+{
+	return this->position_sample_count;
+}
+
+void SimulatedAudioSink::SetPosition(std::uint64_t samples)
+{
+	this->position_sample_count = samples;
+	this->source_out = false;
+	if (this->state == Audio::State::AT_END) {
+		this->state = Audio::State::STOPPED;
+	}
+	this->ring_buf.Flush();
+}
+
+void SimulatedAudioSink::SourceOut()
+{
+	this->source_out = true;
+}
+
+void SimulatedAudioSink::Transfer(AudioSink::TransferIterator &start,
+                                  const AudioSink::TransferIterator &end)
+{
+	assert(start <= end);
+	if (start == end) return;
+
+	auto bytes = static_cast<unsigned long>(std::distance(start, end));
+	assert(bytes % this->bytes_per_sample == 0);
+
+	auto samples = bytes / this->bytes_per_sample;
+	auto count = std::min(samples, this->ring_buf.WriteCapacity());
+	if (count == 0) return;
+
+	auto written = this->ring_buf.Write(reinterpret_cast<char *>(&*start),
+	                                    count);
+	start += written * this->bytes_per_sample;
+}
+
+std::uint64_t SimulatedAudioSink::Underruns() const
+{
+	return this->underruns;
+}
+
+std::uint64_t SimulatedAudioSink::SilentSamples() const
+{
+	return this->silence;
+}
+
+std::uint64_t SimulatedAudioSink::Callbacks() const
+{
+	return this->callbacks;
+}
+
+void SimulatedAudioSink::CatchUp(SimulatedClock::time_point now)
+{
+	while (this->next <= now) {
+		this->Pull();
+		this->due += this->settings.period;
+		this->next = this->due + this->Stray();
+	}
+}
+
+void SimulatedAudioSink::Pull()
+{
+	this->callbacks++;
+
+	if (this->state != Audio::State::PLAYING) return;
+
+	auto avail = this->ring_buf.ReadCapacity();
+	auto wanted = static_cast<unsigned long>(this->settings.block_samples);
+	if (avail < wanted && !this->source_out) {
+		this->underruns++;
+		this->silence += wanted - avail;
+	}
+
+	if (avail == 0) {
+		if (this->source_out) this->state = Audio::State::AT_END;
+		return;
+	}
+
+	auto read = this->ring_buf.Read(this->block.data(),
+	                                std::min(wanted, avail));
+	this->position_sample_count += read;
+}
+
+std::chrono::microseconds SimulatedAudioSink::Stray()
+{
+	auto jitter = this->settings.jitter.count();
+	if (jitter == 0) return std::chrono::microseconds(0);
+
+	double stray = 0.0;
+	switch (this->settings.distribution) {
+		case DeviceSettings::Jitter::UNIFORM: {
+			std::uniform_real_distribution<double> d(-jitter, jitter);
+			stray = d(this->random);
+			break;
+		}
+		case DeviceSettings::Jitter::NORMAL: {
+			std::normal_distribution<double> d(0.0, jitter);
+			stray = d(this->random);
+			break;
+		}
+		case DeviceSettings::Jitter::EXPONENTIAL: {
+			std::exponential_distribution<double> d(1.0 / jitter);
+			stray = d(this->random);
+			break;
+		}
+	}
+	return std::chrono::microseconds(static_cast<std::int64_t>(stray));
+}
@@ -0,0 +1,135 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the SimulatedAudioSink class.
+ * @see audio/audio_sink.hpp
+ * @see tests/simulated_audio_sink.cpp
+ */
+
+#ifndef PLAYD_SIMULATED_AUDIO_SINK_HPP
+#define PLAYD_SIMULATED_AUDIO_SINK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_sink.hpp"
+#include "../audio/audio_source.hpp"
+#include "../audio/ringbuffer.hpp"
+#include "simulated_clock.hpp"
+
+/// How a simulated device pulls samples.
+struct DeviceSettings
+{
+	/// Ways in which the device's callbacks can be late or early.
+	enum class Jitter : std::uint8_t {
+		UNIFORM,    ///< Anywhere within `jitter` either side.
+		NORMAL,     ///< Normally, with `jitter` as standard deviation.
+		EXPONENTIAL ///< Only late, by `jitter` on average; long-tailed.
+	};
+
+	/// Samples pulled per callback.
+	std::size_t block_samples = 1024;
+
+	/// Time between callbacks; zero means one block's worth of audio.
+	std::chrono::microseconds period{0};
+
+	/// How far each callback strays from its period.
+	std::chrono::microseconds jitter{0};
+
+	/// How the straying is distributed.
+	Jitter distribution = Jitter::UNIFORM;
+
+	/// n, where 2^n is the capacity of the ring buffer, in samples.
+	int ring_power = 16;
+
+	/// The seed for the jitter, so that runs can be repeated.
+	unsigned seed = 1;
+};
+
+/**
+ * An AudioSink that behaves like an SdlAudioSink on a real device, without
+ * one.
+ *
+ * It has a ring buffer like an SdlAudioSink's, which it pulls from in
+ * blocks, as a device callback would: at a steady period of a
+ * SimulatedClock, with each pull late or early by some jitter.  The pulls
+ * happen as the clock passes them, so the simulation is repeatable, and
+ * takes no wall time.  It counts underruns as the callback does, as well
+ * as how many samples of silence it played in their place, so that
+ * buffering changes can be tested for glitches without hardware.
+ */
+class SimulatedAudioSink : public AudioSink
+{
+public:
+	/**
+	 * Constructs a SimulatedAudioSink, and starts its device clock.
+	 * @param source The source from which this sink will receive audio.
+	 * @param settings How the device pulls samples.
+	 * @param clock The clock driving the device, which must outlive the
+	 *   sink.
+	 */
+	SimulatedAudioSink(const AudioSource &source,
+	                   const DeviceSettings &settings,
+	                   SimulatedClock &clock);
+
+	/// Stops listening to the clock, and destructs the SimulatedAudioSink.
+	~SimulatedAudioSink() override;
+
+	void Start() override;
+	void Stop() override;
+	Audio::State State() override;
+	std::uint64_t Position() override;
+	void SetPosition(std::uint64_t samples) override;
+	void SourceOut() override;
+	void Transfer(TransferIterator &start,
+	              const TransferIterator &end) override;
+
+	/// @return The number of callbacks that wanted more than they got.
+	std::uint64_t Underruns() const;
+
+	/// @return The samples of silence played in place of audio.
+	std::uint64_t SilentSamples() const;
+
+	/// @return The number of callbacks so far.
+	std::uint64_t Callbacks() const;
+
+private:
+	/**
+	 * Makes every pull due by a given time.
+	 * @param now The time on the clock.
+	 */
+	void CatchUp(SimulatedClock::time_point now);
+
+	/// Pulls one block, as SdlAudioSink::Callback does.
+	void Pull();
+
+	/**
+	 * Picks how far the next callback strays from its period.
+	 * @return The amount, which may be negative.
+	 */
+	std::chrono::microseconds Stray();
+
+	DeviceSettings settings;           ///< How the device pulls samples.
+	std::size_t bytes_per_sample;      ///< Bytes in one sample.
+	RingBuffer ring_buf;               ///< The samples not yet pulled.
+	std::vector<char> block;           ///< Where pulled samples go.
+	std::mt19937 random;               ///< Randomness for the jitter.
+	Audio::State state;                ///< The sink's state.
+	std::uint64_t position_sample_count; ///< Samples played.
+	bool source_out;                   ///< Whether the source is out.
+	std::uint64_t underruns;           ///< @see Underruns
+	std::uint64_t silence;             ///< @see SilentSamples
+	std::uint64_t callbacks;           ///< @see Callbacks
+	SimulatedClock &clock;             ///< The clock driving the device.
+	std::size_t listener;              ///< The sink's ID on the clock.
+	SimulatedClock::time_point due;    ///< When the next pull is due.
+	SimulatedClock::time_point next;   ///< When it happens, with jitter.
+};
+
+#endif // PLAYD_SIMULATED_AUDIO_SINK_HPP
@@ -0,0 +1,45 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Definition of the SimulatedClock class.
+ * @see tests/simulated_clock.hpp
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+
+#include "simulated_clock.hpp"
+
+SimulatedClock::SimulatedClock() : now()
+{
+}
+
+SimulatedClock::time_point SimulatedClock::Now() const
+{
+	return this->now;
+}
+
+void SimulatedClock::Advance(std::chrono::steady_clock::duration by)
+{
+	assert(0 <= by.count());
+
+	this->now += by;
+	for (auto &listener : this->listeners) {
+		if (listener) listener(this->now);
+	}
+}
+
+std::size_t SimulatedClock::Listen(Listener listener)
+{
+	this->listeners.push_back(listener);
+	return this->listeners.size() - 1;
+}
+
+void SimulatedClock::Forget(std::size_t id)
+{
+	assert(id < this->listeners.size());
+	this->listeners[id] = nullptr;
+}
@@ -0,0 +1,73 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the SimulatedClock class.
+ * @see tests/simulated_clock.cpp
+ */
+
+#ifndef PLAYD_SIMULATED_CLOCK_HPP
+#define PLAYD_SIMULATED_CLOCK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * A clock that only moves when it is told to, for simulated devices.
+ *
+ * Whatever is listening to the clock, such as a simulated device's
+ * callbacks, runs as the clock passes it, on whichever thread moved the
+ * clock.  So a simulation on a SimulatedClock takes no wall time, and plays
+ * out the same way every time.
+ */
+class SimulatedClock
+{
+public:
+	/// A time on the clock; the clock starts at the epoch.
+	using time_point = std::chrono::steady_clock::time_point;
+
+	/// Type of functions called, with the new time, as the clock moves.
+	using Listener = std::function<void(time_point)>;
+
+	/// Constructs a SimulatedClock at the epoch.
+	SimulatedClock();
+
+	/// Deleted copy constructor.
+	SimulatedClock(const SimulatedClock &) = delete;
+
+	/// Deleted copy-assignment.
+	SimulatedClock &operator=(const SimulatedClock &) = delete;
+
+	/// @return The time on the clock.
+	time_point Now() const;
+
+	/**
+	 * Moves the clock on, then tells each listener the new time.
+	 * @param by How far to move the clock.
+	 */
+	void Advance(std::chrono::steady_clock::duration by);
+
+	/**
+	 * Starts telling a listener whenever the clock moves.
+	 * @param listener The listener.
+	 * @return An ID with which to Forget the listener.
+	 */
+	std::size_t Listen(Listener listener);
+
+	/**
+	 * Stops telling a listener that the clock moves.
+	 * @param id The ID Listen gave for the listener.
+	 */
+	void Forget(std::size_t id);
+
+private:
+	time_point now; ///< The time on the clock.
+
+	/// The listeners, by ID; forgotten ones are empty.
+	std::vector<Listener> listeners;
+};
+
+#endif // PLAYD_SIMULATED_CLOCK_HPP
@@ -0,0 +1,275 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the SpscQueue class and the PlayerThread built on it.
+ */
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio_system.hpp"
+#include "../metrics.hpp"
+#include "../player.hpp"
+#include "../player_thread.hpp"
+#include "../spsc_queue.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+SCENARIO("SpscQueue is a bounded FIFO", "[spsc-queue]") {
+	GIVEN("an SpscQueue asked for a capacity of 3") {
+		SpscQueue<int> q(3);
+
+		THEN("it starts empty") {
+			int out = 0;
+			REQUIRE(q.Empty());
+			REQUIRE_FALSE(q.TryPop(out));
+		}
+
+		WHEN("it is filled") {
+			int pushed = 0;
+			for (int i = 0; i < 10; i++) {
+				int item = i;
+				if (q.TryPush(item)) pushed++;
+			}
+
+			THEN("it holds a power of two of items") {
+				REQUIRE(pushed == 4);
+			}
+
+			THEN("items come out in the order they went in") {
+				for (int i = 0; i < 4; i++) {
+					int out = -1;
+					REQUIRE(q.TryPop(out));
+					REQUIRE(out == i);
+				}
+				REQUIRE(q.Empty());
+			}
+		}
+
+		WHEN("an item is refused") {
+			std::string item = "kept";
+			SpscQueue<std::string> s(1);
+			std::string first = "first";
+			s.TryPush(first);
+
+			THEN("it is not moved from") {
+				REQUIRE_FALSE(s.TryPush(item));
+				REQUIRE(item == "kept");
+			}
+		}
+	}
+}
+
+SCENARIO("SpscQueue passes items between two threads", "[spsc-queue]") {
+	GIVEN("an SpscQueue much smaller than the number of items") {
+		const int count = 100000;
+		SpscQueue<int> q(16);
+
+		WHEN("one thread pushes while another pops") {
+			std::thread producer([&q, count]() {
+				for (int i = 0; i < count; i++) {
+					int item = i;
+					while (!q.TryPush(item)) {
+						std::this_thread::yield();
+					}
+				}
+			});
+
+			std::vector<int> got;
+			while (got.size() < static_cast<size_t>(count)) {
+				int out;
+				if (q.TryPop(out)) {
+					got.push_back(out);
+				} else {
+					std::this_thread::yield();
+				}
+			}
+			producer.join();
+
+			THEN("every item arrives once, in order") {
+				bool ordered = true;
+				for (int i = 0; i < count; i++) {
+					if (got[i] != i) ordered = false;
+				}
+				REQUIRE(ordered);
+			}
+		}
+	}
+}
+
+/**
+ * Takes replies from a PlayerThread until one of a given kind arrives.
+ * @param pt The PlayerThread.
+ * @param kind The kind of reply to wait for.
+ * @param packed Appended with each RESPONSE reply, packed, in order.
+ * @return True if the reply arrived; false if we gave up waiting.
+ */
+static bool TakeUntil(PlayerThread &pt, PlayerThread::Reply::Kind kind,
+                      std::vector<std::string> &packed)
+{
+	auto give_up = std::chrono::steady_clock::now() +
+	               std::chrono::seconds(10);
+
+	while (std::chrono::steady_clock::now() < give_up) {
+		PlayerThread::Reply reply;
+		if (!pt.TakeReply(reply)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (reply.kind == PlayerThread::Reply::Kind::RESPONSE) {
+			packed.push_back(reply.response.Pack());
+		}
+		if (reply.kind == kind) return true;
+	}
+	return false;
+}
+
+SCENARIO("PlayerThread keeps replies in command order", "[player-thread]") {
+	GIVEN("a running PlayerThread with a dummy audio system") {
+		AudioSystem ds(0);
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+		Player p(ds);
+
+		PlayerThread pt(p);
+		pt.Start([]() {});
+
+		WHEN("a client sends several tagged commands, then leaves") {
+			const int count = 50;
+			for (int i = 0; i < count; i++) {
+				PlayerThread::Command cmd{
+				        PlayerThread::Command::Kind::RUN,
+				        {"read", "t" + std::to_string(i),
+				         "/control/state"},
+				        1,
+				        {}};
+				REQUIRE(pt.Push(cmd));
+			}
+			PlayerThread::Command release{
+			        PlayerThread::Command::Kind::RELEASE, {}, 1,
+			        {}};
+			REQUIRE(pt.Push(release));
+
+			std::vector<std::string> packed;
+			auto released = TakeUntil(
+			        pt, PlayerThread::Reply::Kind::RELEASED, packed);
+
+			THEN("its ID is released after all of its replies") {
+				REQUIRE(released);
+				auto size = packed.size();
+				REQUIRE(size == 2 * count);
+			}
+
+			THEN("each ACK follows its own command's response") {
+				bool ordered = true;
+				for (int i = 0; i < count; i++) {
+					auto tag = "t" + std::to_string(i);
+					auto &res = packed[2 * i];
+					auto &ack = packed[2 * i + 1];
+					if (res.compare(0, 4, "RES ") != 0 ||
+					    ack.compare(0, 4, "ACK ") != 0 ||
+					    ack.find(tag) == std::string::npos) {
+						ordered = false;
+					}
+				}
+				REQUIRE(ordered);
+			}
+		}
+
+		WHEN("the player is told to quit") {
+			PlayerThread::Command quit{
+			        PlayerThread::Command::Kind::RUN,
+			        {"write", "q", "/control/state", "Quitting"},
+			        1,
+			        {}};
+			REQUIRE(pt.Push(quit));
+
+			std::vector<std::string> packed;
+			auto quitted = TakeUntil(
+			        pt, PlayerThread::Reply::Kind::QUIT, packed);
+
+			THEN("the thread says so, and finishes") {
+				REQUIRE(quitted);
+				pt.Join();
+			}
+		}
+	}
+}
+
+SCENARIO("PlayerThread listens only while the I/O thread has clients", "[player-thread]") {
+	GIVEN("a PlayerThread") {
+		AudioSystem ds(0);
+		Player p(ds);
+		PlayerThread pt(p);
+
+		THEN("nobody is listening at first") {
+			REQUIRE_FALSE(pt.Listening());
+		}
+
+		WHEN("the I/O thread gains, then loses, its clients") {
+			pt.SetListening(true);
+			bool gained = pt.Listening();
+			pt.SetListening(false);
+
+			THEN("the player's sink follows suit") {
+				REQUIRE(gained);
+				REQUIRE_FALSE(pt.Listening());
+			}
+		}
+	}
+}
+
+SCENARIO("PlayerThread drops replies the I/O thread has no room for", "[player-thread]") {
+	GIVEN("a PlayerThread whose reply queue is full") {
+		AudioSystem ds(0);
+		Player p(ds);
+		PlayerThread pt(p);
+
+		Response ack(Response::Code::ACK);
+		for (std::size_t i = 0; i < PlayerThread::QUEUE_CAPACITY; i++) {
+			pt.Respond(ack, 1);
+		}
+
+		auto &dropped = Metrics::Get().replies_dropped;
+		auto before = dropped.load();
+
+		WHEN("the time is announced") {
+			auto start = std::chrono::steady_clock::now();
+			pt.Announce(Response(Response::Code::RES));
+			auto waited = std::chrono::steady_clock::now() - start;
+
+			THEN("the announcement is dropped straight away") {
+				REQUIRE(dropped.load() == before + 1);
+				REQUIRE(waited < PlayerThread::REPLY_WAIT);
+			}
+		}
+
+		WHEN("a response is sent, and the I/O thread never takes any") {
+			auto start = std::chrono::steady_clock::now();
+			pt.Respond(ack, 1);
+			auto waited = std::chrono::steady_clock::now() - start;
+
+			THEN("the response is dropped after a bounded wait") {
+				REQUIRE(dropped.load() == before + 1);
+				REQUIRE(PlayerThread::REPLY_WAIT <= waited);
+			}
+		}
+
+		WHEN("the replies are taken") {
+			std::size_t taken = 0;
+			PlayerThread::Reply reply;
+			while (pt.TakeReply(reply)) taken++;
+
+			THEN("every one that fitted is there") {
+				REQUIRE(taken == PlayerThread::QUEUE_CAPACITY);
+			}
+		}
+	}
+}
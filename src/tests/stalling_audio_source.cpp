@@ -0,0 +1,48 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Definition of the StallingAudioSource class.
+ * @see tests/stalling_audio_source.hpp
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "../audio/audio_source.hpp"
+#include "simulated_clock.hpp"
+#include "stalling_audio_source.hpp"
+
+StallingAudioSource::StallingAudioSource(const std::string &path,
+                                         std::size_t frame_samples,
+                                         std::chrono::milliseconds interval,
+                                         std::chrono::milliseconds stall,
+                                         SimulatedClock &clock)
+    : DummyAudioSource(path),
+      interval(interval),
+      stall(stall),
+      clock(clock),
+      next_stall(clock.Now() + interval),
+      stalls(0)
+{
+	this->frame_samples = frame_samples;
+}
+
+AudioSource::DecodeState StallingAudioSource::DecodeInto(
+        AudioSource::DecodeVector &frame)
+{
+	if (0 < this->stall.count() && this->next_stall <= this->clock.Now()) {
+		this->stalls++;
+		this->clock.Advance(this->stall);
+		this->next_stall = this->clock.Now() + this->interval;
+	}
+
+	return DummyAudioSource::DecodeInto(frame);
+}
+
+std::uint64_t StallingAudioSource::Stalls() const
+{
+	return this->stalls;
+}
@@ -0,0 +1,71 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the StallingAudioSource class.
+ * @see tests/stalling_audio_source.cpp
+ */
+
+#ifndef PLAYD_STALLING_AUDIO_SOURCE_HPP
+#define PLAYD_STALLING_AUDIO_SOURCE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "../audio/audio_source.hpp"
+#include "dummy_audio_source.hpp"
+#include "simulated_clock.hpp"
+
+/**
+ * A DummyAudioSource whose decoding now and then takes far too long, as
+ * when a disk or network share is slow to give up the next block of a
+ * file.
+ *
+ * Time passes on a SimulatedClock: a stall moves the clock on, as if the
+ * decoder had blocked for that long.  Stalls come at most once per interval
+ * of that time, starting one interval after construction, so filling a
+ * sink straight away is quick.
+ */
+class StallingAudioSource : public DummyAudioSource
+{
+public:
+	/**
+	 * Constructs a StallingAudioSource.
+	 * @param path The path of the file.
+	 * @param frame_samples The number of samples in each frame.
+	 * @param interval The time from the end of one stall to the next.
+	 * @param stall How long each stall lasts; zero means never stall.
+	 * @param clock The clock on which stalls take time, which must
+	 *   outlive the source.
+	 */
+	StallingAudioSource(const std::string &path, std::size_t frame_samples,
+	                    std::chrono::milliseconds interval,
+	                    std::chrono::milliseconds stall,
+	                    SimulatedClock &clock);
+
+	AudioSource::DecodeState DecodeInto(
+	        AudioSource::DecodeVector &frame) override;
+
+	/// @return The number of stalls so far.
+	std::uint64_t Stalls() const;
+
+private:
+	/// The time from the end of one stall to the next.
+	std::chrono::milliseconds interval;
+
+	/// How long each stall lasts.
+	std::chrono::milliseconds stall;
+
+	/// The clock on which stalls take time.
+	SimulatedClock &clock;
+
+	/// When the next stall is due.
+	SimulatedClock::time_point next_stall;
+
+	/// Stalls so far.
+	std::uint64_t stalls;
+};
+
+#endif // PLAYD_STALLING_AUDIO_SOURCE_HPP
@@ -0,0 +1,186 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for time-stretching.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/time_stretch.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+/// Ratio of pi to 1.
+static const double PI = 3.14159265358979323846;
+
+/**
+ * Makes a stereo sine wave.
+ * @param rate The sample rate, in Hz.
+ * @param frequency The frequency of the wave, in Hz.
+ * @param frames The number of (stereo) samples to make.
+ * @return The packed samples.
+ */
+static std::vector<float> Sine(std::uint32_t rate, double frequency,
+                               std::size_t frames)
+{
+	std::vector<float> samples(frames * 2);
+	for (std::size_t f = 0; f < frames; f++) {
+		auto value = 0.5 * std::sin(2.0 * PI * frequency * f / rate);
+		samples[f * 2] = samples[f * 2 + 1] = static_cast<float>(value);
+	}
+	return samples;
+}
+
+/**
+ * Counts the upward zero crossings in one channel of some stereo samples.
+ * @param samples The packed samples.
+ * @return The number of crossings in the left channel.
+ */
+static int Crossings(const std::vector<float> &samples)
+{
+	int count = 0;
+	for (std::size_t i = 2; i < samples.size(); i += 2) {
+		if (samples[i - 2] < 0.0f && 0.0f <= samples[i]) count++;
+	}
+	return count;
+}
+
+SCENARIO("TimeStretch passes audio through at normal speed", "[time-stretch]") {
+	GIVEN("a TimeStretch at normal speed and a second of audio") {
+		TimeStretch ts(48000, 2);
+		auto in = Sine(48000, 440.0, 48000);
+
+		WHEN("the audio is stretched and drained") {
+			std::vector<float> out;
+			ts.Process(in.data(), 48000, out);
+			ts.Drain(out);
+
+			THEN("the same audio comes out") {
+				REQUIRE(out.size() == in.size());
+				for (std::size_t i = 0; i < in.size(); i += 997) {
+					REQUIRE(out[i] == Approx(in[i]).epsilon(0.001));
+				}
+			}
+
+			THEN("nothing is left held back") {
+				REQUIRE(ts.Pending() == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("TimeStretch changes speed but not pitch", "[time-stretch]") {
+	GIVEN("a TimeStretch at 1.25 times speed and a second of 1kHz") {
+		TimeStretch ts(48000, 2);
+		ts.SetRate(1.25);
+		auto in = Sine(48000, 1000.0, 48000);
+
+		WHEN("the audio is stretched and drained") {
+			std::vector<float> out;
+			ts.Process(in.data(), 48000, out);
+			ts.Drain(out);
+
+			THEN("it lasts 0.8 seconds") {
+				auto frames = out.size() / 2;
+				REQUIRE(frames == Approx(38400).epsilon(0.01));
+			}
+
+			THEN("it is still at 1kHz") {
+				REQUIRE(Crossings(out) == Approx(800).epsilon(0.01));
+			}
+		}
+
+		WHEN("some audio is held back") {
+			std::vector<float> out;
+			ts.Process(in.data(), 4800, out);
+
+			THEN("its length at the new speed is pending") {
+				auto total = out.size() / 2 + ts.Pending();
+				REQUIRE(total == Approx(3840).epsilon(0.01));
+			}
+		}
+	}
+}
+
+SCENARIO("PipeAudio reports time-stretched positions in file time", "[time-stretch][pipe-audio]") {
+	GIVEN("a PipeAudio with a dummy source and sink") {
+		auto src = new DummyAudioSource("test");
+		src->frame_samples = 4410;
+		src->position = 0;
+		auto sink = new DummyAudioSink();
+
+		std::unique_ptr<AudioSource> src_ptr(src);
+		std::unique_ptr<AudioSink> sink_ptr(sink);
+		PipeAudio pa(std::move(src_ptr), std::move(sink_ptr));
+
+		WHEN("it plays at double speed from the start") {
+			pa.SetRate(2.0);
+			for (int i = 0; i < 10; i++) pa.Update();
+
+			THEN("each played sample covers two file samples") {
+				sink->position = 10000;
+				REQUIRE(pa.Position() == src->MicrosFromSamples(20000));
+			}
+		}
+
+		WHEN("it changes to half speed part way through") {
+			for (int i = 0; i < 5; i++) pa.Update();
+			pa.SetRate(0.5);
+			for (int i = 0; i < 5; i++) pa.Update();
+
+			THEN("positions before the change are unchanged") {
+				sink->position = 20000;
+				REQUIRE(pa.Position() == src->MicrosFromSamples(20000));
+			}
+
+			THEN("positions after the change go by at half speed") {
+				sink->position = 22050 + 1000;
+				REQUIRE(pa.Position() == src->MicrosFromSamples(22550));
+			}
+		}
+	}
+}
+
+SCENARIO("TimeStretch runs well within realtime", "[time-stretch][benchmark][.]") {
+	GIVEN("a TimeStretch at 48kHz stereo, slightly fast") {
+		const std::uint32_t rate = 48000;
+		const std::size_t seconds = 20;
+		const std::size_t block = 1152;
+
+		TimeStretch ts(rate, 2);
+		ts.SetRate(1.04);
+		auto in = Sine(rate, 440.0, rate * seconds);
+
+		WHEN("it stretches twenty seconds of audio a frame at a time") {
+			std::vector<float> out;
+			out.reserve(in.size());
+
+			auto begin = std::chrono::steady_clock::now();
+			for (std::size_t f = 0; f + block <= rate * seconds; f += block) {
+				ts.Process(in.data() + f * 2, block, out);
+			}
+			auto end = std::chrono::steady_clock::now();
+
+			std::chrono::duration<double> taken = end - begin;
+			double load = taken.count() / seconds;
+			std::cout << "time-stretch: " << taken.count() << "s for "
+			          << seconds << "s of audio (" << load * 100.0
+			          << "% of one core)" << std::endl;
+
+			THEN("it takes under a tenth of a core") {
+				REQUIRE(load < 0.1);
+			}
+		}
+	}
+}
@@ -0,0 +1,151 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the trace recorder.
+ */
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio_system.hpp"
+#include "../player.hpp"
+#include "../trace.hpp"
+
+/**
+ * Counts the occurrences of a string in another.
+ * @param haystack The string to search.
+ * @param needle The string to count.
+ * @return The number of occurrences.
+ */
+static int Count(const std::string &haystack, const std::string &needle)
+{
+	int count = 0;
+	for (auto at = haystack.find(needle); at != std::string::npos;
+	     at = haystack.find(needle, at + 1)) {
+		count++;
+	}
+	return count;
+}
+
+SCENARIO("Trace spans come out as Chrome trace events", "[trace]") {
+	GIVEN("spans recorded on a named thread") {
+		std::thread worker([]() {
+			NameTraceThread("trace-test-worker");
+			TraceSpan outer("TraceTest::Outer");
+			TraceSpan inner("TraceTest::Inner");
+		});
+		worker.join();
+
+		WHEN("the trace is written") {
+			std::ostringstream os;
+			WriteTrace(os);
+			auto json = os.str();
+
+			THEN("it is a trace event object") {
+				REQUIRE(json.compare(0, 16, "{\"traceEvents\":[") == 0);
+			}
+
+			THEN("each span is a complete event") {
+				REQUIRE(0 < Count(json, "\"TraceTest::Outer\",\"ph\":\"X\""));
+				REQUIRE(0 < Count(json, "\"TraceTest::Inner\",\"ph\":\"X\""));
+			}
+
+			THEN("the thread is named") {
+				REQUIRE(0 < Count(json, "\"name\":\"trace-test-worker\""));
+			}
+		}
+	}
+
+	GIVEN("more spans than a ring holds, recorded on one thread") {
+		std::thread worker([]() {
+			for (int i = 0; i < 10000; i++) TraceSpan span("TraceTest::Wrap");
+		});
+		worker.join();
+
+		WHEN("the trace is written") {
+			std::ostringstream os;
+			WriteTrace(os);
+
+			THEN("only the ring's worth of the newest spans are kept") {
+				auto spans = Count(os.str(), "TraceTest::Wrap");
+				REQUIRE(spans == 4096);
+			}
+		}
+	}
+}
+
+SCENARIO("Reserved trace rings are adopted by the threads given them", "[trace]") {
+	GIVEN("a ring reserved before its thread starts") {
+		TraceReservation reservation;
+
+		WHEN("the thread adopts it, and records spans") {
+			std::thread worker([&reservation]() {
+				reservation.Adopt();
+				NameTraceThread("trace-test-adopter");
+				TraceSpan span("TraceTest::Adopted");
+			});
+			worker.join();
+
+			std::ostringstream os;
+			WriteTrace(os);
+
+			THEN("the spans are written, under the thread's name") {
+				auto json = os.str();
+				REQUIRE(0 < Count(json, "TraceTest::Adopted"));
+				REQUIRE(0 < Count(json, "\"name\":\"trace-test-adopter\""));
+			}
+		}
+	}
+}
+
+SCENARIO("Player dumps traces on request", "[trace][player]") {
+	GIVEN("a Player with no trace directory") {
+		AudioSystem ds(0);
+		Player p(ds);
+
+		WHEN("it is asked to dump something other than a trace") {
+			auto res = p.RunCommand(std::vector<std::string>{"dump", "tag", "heap", "x"});
+
+			THEN("the command is invalid") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+		}
+
+		WHEN("it is asked to dump a trace") {
+			auto res = p.RunCommand(std::vector<std::string>{"dump", "tag", "trace", "x"});
+
+			THEN("the command fails") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+		}
+	}
+
+	GIVEN("a Player with a trace directory that doesn't exist") {
+		AudioSystem ds(0);
+		Player p(ds);
+		p.SetTraceDir("/nonexistent/dir");
+
+		WHEN("it is asked to dump a trace with a path for a name") {
+			THEN("the command is refused") {
+				for (auto name : {"../x", "/tmp/x", "a/b", "a\\b", ""}) {
+					auto res = p.RunCommand(std::vector<std::string>{"dump", "tag", "trace", name});
+					REQUIRE_FALSE(res.IsSuccess());
+				}
+			}
+		}
+
+		WHEN("it is asked to dump a trace") {
+			auto res = p.RunCommand(std::vector<std::string>{"dump", "tag", "trace", "x"});
+
+			THEN("the command fails") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+		}
+	}
+}
@@ -0,0 +1,200 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for how well PipeAudio rides out device jitter and decoder stalls,
+ * using simulated devices on a simulated clock.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "simulated_audio_sink.hpp"
+#include "simulated_clock.hpp"
+#include "stalling_audio_source.hpp"
+
+/// The samples in each decoded frame; this is an MP3 frame.
+static const std::size_t FRAME_SAMPLES = 1152;
+
+/// How often the player updates its audio, as in IoCore.
+static const std::chrono::milliseconds UPDATE_PERIOD(5);
+
+/// What a run of a simulated device measured.
+struct UnderrunRun
+{
+	std::uint64_t underruns; ///< Callbacks that ran short.
+	std::uint64_t silence;   ///< Samples of silence played.
+	std::uint64_t callbacks; ///< Callbacks in all.
+	std::uint64_t stalls;    ///< Decoder stalls.
+	std::uint64_t position;  ///< Samples played.
+};
+
+/**
+ * Plays a stalling source through a simulated device for a while, updating
+ * the audio as the player would.
+ * The sink is filled before playing starts, as it would be while loading.
+ * All of this happens on a SimulatedClock, so the run takes next to no
+ * wall time, and always measures the same.
+ * @param device How the device pulls samples.
+ * @param interval The time between decoder stalls.
+ * @param stall How long each decoder stall lasts.
+ * @param duration How long to play for.
+ * @return What the run measured.
+ */
+static UnderrunRun Play(const DeviceSettings &device,
+                        std::chrono::milliseconds interval,
+                        std::chrono::milliseconds stall,
+                        std::chrono::milliseconds duration)
+{
+	SimulatedClock clock;
+
+	// PipeAudio owns these, but we still need to look at them afterwards.
+	auto src = new StallingAudioSource("test", FRAME_SAMPLES, interval,
+	                                   stall, clock);
+	auto sink = new SimulatedAudioSink(*src, device, clock);
+	std::unique_ptr<AudioSource> src_ptr(src);
+	std::unique_ptr<AudioSink> sink_ptr(sink);
+	PipeAudio pa(std::move(src_ptr), std::move(sink_ptr));
+
+	auto ring_frames = (std::size_t(1) << device.ring_power) /
+	                   FRAME_SAMPLES;
+	for (std::size_t i = 0; i <= ring_frames + 1; i++) pa.Update();
+
+	pa.SetPlaying(true);
+	auto end = clock.Now() + duration;
+	while (clock.Now() < end) {
+		pa.Update();
+		clock.Advance(UPDATE_PERIOD);
+	}
+	pa.SetPlaying(false);
+
+	return UnderrunRun{sink->Underruns(), sink->SilentSamples(),
+	                   sink->Callbacks(), src->Stalls(), sink->Position()};
+}
+
+/**
+ * Converts a length of time to a number of samples at 44100Hz.
+ * @param time The length of time.
+ * @return The number of samples.
+ */
+static std::uint64_t Samples(std::chrono::milliseconds time)
+{
+	return static_cast<std::uint64_t>(time.count()) * 44100 / 1000;
+}
+
+SCENARIO("Simulated devices underrun only when the decoder falls behind", "[underruns]") {
+	GIVEN("a device pulling 1024-sample blocks, with 3ms of jitter") {
+		DeviceSettings device;
+		device.block_samples = 1024;
+		device.jitter = std::chrono::milliseconds(3);
+
+		// The jitter moves callbacks by up to a few milliseconds, so
+		// counts that depend on when they land are allowed a block's
+		// worth of slack.
+		std::uint64_t slack = device.block_samples;
+
+		WHEN("the decoder keeps up") {
+			device.ring_power = 14;
+			auto duration = std::chrono::milliseconds(300);
+			auto run = Play(device, std::chrono::milliseconds(0),
+			                std::chrono::milliseconds(0), duration);
+
+			THEN("the device plays a full block on every callback") {
+				auto blocks = Samples(duration) / 1024;
+				auto fewest = blocks - 1;
+				auto most = blocks + 1;
+				REQUIRE(fewest <= run.callbacks);
+				REQUIRE(run.callbacks <= most);
+				REQUIRE(run.position == run.callbacks * 1024);
+			}
+
+			THEN("the device never runs dry") {
+				REQUIRE(run.underruns == 0);
+				REQUIRE(run.silence == 0);
+			}
+		}
+
+		WHEN("the decoder stalls for longer than a small ring holds") {
+			device.ring_power = 12;
+			auto stall = std::chrono::milliseconds(200);
+			auto run = Play(device, std::chrono::milliseconds(150),
+			                stall, std::chrono::milliseconds(500));
+
+			THEN("the decoder stalls once") {
+				REQUIRE(run.stalls == 1);
+			}
+
+			THEN("the device plays silence for what the ring lacked") {
+				auto lacked = Samples(stall) - (1 << 12);
+				auto least = lacked - slack;
+				auto most = lacked + slack;
+				REQUIRE(0 < run.underruns);
+				REQUIRE(least <= run.silence);
+				REQUIRE(run.silence <= most);
+			}
+		}
+
+		WHEN("the decoder stalls as long, but the ring is bigger") {
+			device.ring_power = 16;
+			auto run = Play(device, std::chrono::milliseconds(150),
+			                std::chrono::milliseconds(200),
+			                std::chrono::milliseconds(500));
+
+			THEN("the ring rides the stall out") {
+				REQUIRE(run.stalls == 1);
+				REQUIRE(run.underruns == 0);
+				REQUIRE(run.silence == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Ring buffers ride out decoder stalls and device jitter", "[underruns][benchmark][.]") {
+	GIVEN("devices with long-tailed jitter, and decoders that stall") {
+		DeviceSettings device;
+		device.block_samples = 512;
+		device.jitter = std::chrono::milliseconds(2);
+		device.distribution = DeviceSettings::Jitter::EXPONENTIAL;
+
+		WHEN("each ring size plays through each length of stall") {
+			std::cout << "underruns: ring (ms), stall (ms), underruns, "
+			          << "silence (ms), over 2s" << std::endl;
+
+			std::uint64_t worst = 0;
+			for (int power : {12, 13, 14, 16}) {
+				for (int stall : {0, 25, 50, 100, 200}) {
+					device.ring_power = power;
+					auto run = Play(
+					        device,
+					        std::chrono::milliseconds(400),
+					        std::chrono::milliseconds(stall),
+					        std::chrono::milliseconds(2000));
+
+					auto ring_ms = (1 << power) * 1000 / 44100;
+					std::cout << std::setw(8) << ring_ms
+					          << std::setw(8) << stall
+					          << std::setw(8) << run.underruns
+					          << std::setw(8)
+					          << run.silence * 1000 / 44100
+					          << std::endl;
+					if (power == 16) {
+						worst = std::max(worst,
+						                 run.underruns);
+					}
+				}
+			}
+
+			THEN("the default ring never underruns") {
+				REQUIRE(worst == 0);
+			}
+		}
+	}
+}
@@ -0,0 +1,256 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the measuring and reporting shared by playd's tools.
+ * @see tools/bench.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif // __linux__
+
+#include "bench.hpp"
+
+Options TakeOptions(std::vector<std::string> &args)
+{
+	Options options;
+	std::vector<std::string> positional;
+	for (const auto &arg : args) {
+		if (arg.compare(0, 2, "--") != 0) {
+			positional.push_back(arg);
+			continue;
+		}
+
+		auto eq = arg.find('=');
+		bool bare = eq == std::string::npos;
+		auto name = arg.substr(2, bare ? eq : eq - 2);
+		options[name] = bare ? "" : arg.substr(eq + 1);
+	}
+	args = positional;
+	return options;
+}
+
+//
+// Samples
+//
+
+void Samples::Add(Clock::duration duration)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+	        duration);
+	this->us.push_back(us.count());
+}
+
+/* static */ void Samples::WriteHeading(std::ostream &os)
+{
+	os << std::left << std::setw(18) << "latency (ms)" << std::right
+	   << std::setw(8) << "count" << std::setw(9) << "p50" << std::setw(9)
+	   << "p90" << std::setw(9) << "p99" << std::setw(9) << "p99.9"
+	   << std::setw(9) << "max" << "\n";
+}
+
+void Samples::Write(std::ostream &os, const std::string &name)
+{
+	std::sort(this->us.begin(), this->us.end());
+
+	os << std::left << std::setw(18) << name << std::right << std::setw(8)
+	   << this->us.size();
+	for (double p : {0.5, 0.9, 0.99, 0.999, 1.0}) {
+		os << std::setw(9);
+		if (this->us.empty()) {
+			os << "-";
+			continue;
+		}
+
+		auto last = this->us.size() - 1;
+		auto i = static_cast<std::size_t>(p * last);
+		os << std::fixed << std::setprecision(2)
+		   << this->us[i] / 1000.0;
+	}
+	os << '\n';
+}
+
+//
+// libuv callbacks
+//
+
+void UvAlloc(uv_handle_t *, size_t suggested_size, uv_buf_t *buf)
+{
+	*buf = uv_buf_init(new char[suggested_size](), suggested_size);
+}
+
+void UvWriteCallback(uv_write_t *req, int)
+{
+	delete reinterpret_cast<WriteReq *>(req);
+}
+
+/// A scrape of playd's metrics.
+struct Scrape
+{
+	uv_tcp_t tcp;             ///< The connection to the metrics port.
+	uv_connect_t connect_req; ///< The connection request.
+	WriteReq request;         ///< The HTTP request.
+	std::string body;         ///< Everything read back.
+	bool ok;                  ///< Whether anything came back.
+};
+
+/// The callback fired when a metrics scrape has read something.
+void UvScrapeReadCallback(uv_stream_t *stream, ssize_t nread,
+                          const uv_buf_t *buf)
+{
+	auto *scrape = static_cast<Scrape *>(stream->data);
+	if (0 < nread) {
+		scrape->body.append(buf->base, nread);
+		scrape->ok = true;
+	}
+	delete[] buf->base;
+
+	auto *handle = reinterpret_cast<uv_handle_t *>(stream);
+	if (nread < 0) uv_close(handle, nullptr);
+}
+
+/// The callback fired when a metrics scrape connects, or fails to.
+void UvScrapeConnectCallback(uv_connect_t *req, int status)
+{
+	auto *scrape = static_cast<Scrape *>(req->data);
+	auto *stream = reinterpret_cast<uv_stream_t *>(&scrape->tcp);
+	if (status < 0) {
+		uv_close(reinterpret_cast<uv_handle_t *>(stream), nullptr);
+		return;
+	}
+
+	auto &data = scrape->request.data;
+	data = "GET /metrics HTTP/1.0\r\n\r\n";
+	uv_buf_t buf = uv_buf_init(&data[0], data.size());
+	uv_write(&scrape->request.req, stream, &buf, 1, nullptr);
+	uv_read_start(stream, UvAlloc, UvScrapeReadCallback);
+}
+
+//
+// Helpers
+//
+
+bool ScrapeMetrics(uv_loop_t *loop, const std::string &host, int port,
+                   std::map<std::string, double> &values)
+{
+	sockaddr_in addr;
+	if (uv_ip4_addr(host.c_str(), port, &addr) < 0) return false;
+
+	Scrape scrape;
+	scrape.ok = false;
+	uv_tcp_init(loop, &scrape.tcp);
+	scrape.tcp.data = &scrape;
+	scrape.connect_req.data = &scrape;
+	uv_tcp_connect(&scrape.connect_req, &scrape.tcp,
+	               reinterpret_cast<const sockaddr *>(&addr),
+	               UvScrapeConnectCallback);
+	uv_run(loop, UV_RUN_DEFAULT);
+	if (!scrape.ok) return false;
+
+	std::istringstream lines(scrape.body);
+	std::string line;
+	while (std::getline(lines, line)) {
+		if (line.empty() || line[0] == '#') continue;
+
+		auto space = line.rfind(' ');
+		if (space == std::string::npos) continue;
+		auto value = std::atof(line.c_str() + space + 1);
+		values[line.substr(0, space)] = value;
+	}
+	return true;
+}
+
+/**
+ * Gets the CPU time, user and system, that a process has used.
+ * @param pid The process ID.
+ * @param seconds Set to the CPU time, in seconds.
+ * @return Whether the CPU time could be found.
+ */
+static bool ProcessCpuTime(int pid, double &seconds)
+{
+#ifdef __linux__
+	std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+	std::string line;
+	if (!std::getline(stat, line)) return false;
+
+	// The process name is in parentheses, and may contain spaces; the
+	// user and system times are the 12th and 13th fields after it.
+	auto close = line.rfind(')');
+	if (close == std::string::npos) return false;
+	std::istringstream fields(line.substr(close + 1));
+	std::string field;
+	for (int i = 0; i < 11; i++) fields >> field;
+
+	unsigned long long user = 0, system = 0;
+	if (!(fields >> user >> system)) return false;
+	seconds = static_cast<double>(user + system) / sysconf(_SC_CLK_TCK);
+	return true;
+#else
+	(void)pid;
+	(void)seconds;
+	return false;
+#endif // __linux__
+}
+
+//
+// PlaydWatch
+//
+
+PlaydWatch::PlaydWatch(uv_loop_t *loop, const std::string &host, int pid,
+                       int metrics_port)
+    : loop(loop),
+      host(host),
+      pid(pid),
+      metrics_port(metrics_port),
+      timed(false),
+      scraped(false),
+      cpu_before(0.0)
+{
+}
+
+void PlaydWatch::Start()
+{
+	this->scraped = 0 < this->metrics_port &&
+	                ScrapeMetrics(this->loop, this->host,
+	                              this->metrics_port, this->before);
+	this->timed = 0 < this->pid &&
+	              ProcessCpuTime(this->pid, this->cpu_before);
+}
+
+void PlaydWatch::Report(std::ostream &os, Clock::duration elapsed)
+{
+	auto seconds = std::chrono::duration<double>(elapsed).count();
+	double cpu_after = 0.0;
+	if (this->timed && ProcessCpuTime(this->pid, cpu_after)) {
+		os << "playd cpu: " << std::fixed << std::setprecision(1)
+		   << 100.0 * (cpu_after - this->cpu_before) / seconds
+		   << "% of one core\n";
+	}
+
+	std::map<std::string, double> after;
+	if (this->scraped && ScrapeMetrics(this->loop, this->host,
+	                                   this->metrics_port, after)) {
+		for (auto name : {"playd_underruns_total",
+		                  "playd_commands_deferred_total",
+		                  "playd_replies_dropped_total"}) {
+			os << name << ": +" << std::fixed
+			   << std::setprecision(0)
+			   << after[name] - this->before[name] << "\n";
+		}
+	}
+}
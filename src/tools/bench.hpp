@@ -0,0 +1,141 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the measuring and reporting shared by playd's tools.
+ * @see tools/bench.cpp
+ */
+
+#ifndef PLAYD_TOOLS_BENCH_HPP
+#define PLAYD_TOOLS_BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
+// We don't want this.
+#undef UNICODE
+#include <uv.h>
+
+/// The clock used for all measurements.
+using Clock = std::chrono::steady_clock;
+
+/// Type of the map from program option names to their values.
+using Options = std::map<std::string, std::string>;
+
+/**
+ * Removes `--name=value` options from an argument vector.
+ * @param args The program argument vector, left with only the positional
+ *   arguments.
+ * @return The map of options to their values.
+ */
+Options TakeOptions(std::vector<std::string> &args);
+
+/**
+ * A collection of durations, from which percentiles can be taken.
+ */
+class Samples
+{
+public:
+	/**
+	 * Adds a duration.
+	 * @param duration The duration.
+	 */
+	void Add(Clock::duration duration);
+
+	/**
+	 * Writes the heading of a report's table of Samples.
+	 * @param os The stream to write to.
+	 */
+	static void WriteHeading(std::ostream &os);
+
+	/**
+	 * Writes a row of the report: the count, percentiles and maximum.
+	 * @param os The stream to write to.
+	 * @param name The name of the row.
+	 */
+	void Write(std::ostream &os, const std::string &name);
+
+private:
+	std::vector<std::int64_t> us; ///< The durations, in microseconds.
+};
+
+/// A write request, and the data it is writing.
+struct WriteReq
+{
+	uv_write_t req;   ///< The main libuv write handle.
+	std::string data; ///< The data being written.
+};
+
+/// The function used to allocate buffers for reading from playd.
+void UvAlloc(uv_handle_t *, size_t suggested_size, uv_buf_t *buf);
+
+/// The callback fired when a WriteReq has been written; it deletes it.
+void UvWriteCallback(uv_write_t *req, int);
+
+/**
+ * Scrapes playd's metrics.
+ * This runs the loop until the scrape is done, so nothing else may be
+ * running on it.
+ * @param loop The loop to use.
+ * @param host The host playd is on.
+ * @param port The metrics port.
+ * @param values Filled with each sample's value, by name and labels.
+ * @return Whether the scrape worked.
+ */
+bool ScrapeMetrics(uv_loop_t *loop, const std::string &host, int port,
+                   std::map<std::string, double> &values);
+
+/**
+ * Watches how much CPU a playd uses, and its metrics, over a run.
+ *
+ * Given a process ID, it reports the CPU time playd used (on Linux only);
+ * given a metrics port, how many underruns and deferred commands playd
+ * counted.
+ */
+class PlaydWatch
+{
+public:
+	/**
+	 * Constructs a PlaydWatch.
+	 * @param loop The loop on which to scrape metrics.
+	 * @param host The host playd is on.
+	 * @param pid playd's process ID, or 0 to not watch its CPU.
+	 * @param metrics_port playd's metrics port, or 0 to not watch them.
+	 */
+	PlaydWatch(uv_loop_t *loop, const std::string &host, int pid,
+	           int metrics_port);
+
+	/**
+	 * Takes the readings at the start of a run.
+	 * This runs the loop, so nothing else may be running on it.
+	 */
+	void Start();
+
+	/**
+	 * Takes the readings at the end of a run, and reports the change.
+	 * This runs the loop, so nothing else may be running on it.
+	 * @param os The stream to write to.
+	 * @param elapsed How long the run took.
+	 */
+	void Report(std::ostream &os, Clock::duration elapsed);
+
+private:
+	uv_loop_t *loop;   ///< The loop on which to scrape metrics.
+	std::string host;  ///< The host playd is on.
+	int pid;           ///< playd's process ID, or 0.
+	int metrics_port;  ///< playd's metrics port, or 0.
+	bool timed;        ///< Whether the CPU time was found at the start.
+	bool scraped;      ///< Whether the metrics were found at the start.
+	double cpu_before; ///< The CPU time at the start, in seconds.
+
+	/// The metrics at the start, by name and labels.
+	std::map<std::string, double> before;
+};
+
+#endif // PLAYD_TOOLS_BENCH_HPP
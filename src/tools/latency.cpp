@@ -0,0 +1,466 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * A benchmark of how long playd takes to make commands heard.
+ *
+ * It loads a file, plays it, seeks within it and stops it, over and over,
+ * one command at a time.  For each command it measures the round trip, from
+ * sending the command to its ACK coming back; for plays and seeks it also
+ * measures, from playd's own playd_audible_latency_seconds metric, the time
+ * from playd reading the command to the first audible sample after it
+ * leaving the sink.  Then it reports percentiles of each.
+ *
+ * The seek happens while playing, as a seek while stopped isn't heard until
+ * the next play.  Running playd with `--sink=null` lets the benchmark run on
+ * machines without a sound device, and leaves the device's own buffering
+ * out of the measurements.  The file must be at the same path on the
+ * machine running playd, and mustn't start with more silence than the
+ * timeout.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
+// We don't want this.
+#undef UNICODE
+#include <uv.h>
+
+#include "../response.hpp"
+#include "../tokeniser.hpp"
+#include "bench.hpp"
+
+/// The settings of a latency benchmark.
+struct LatencyOptions
+{
+	std::string file;         ///< The file to load, on playd's machine.
+	std::string host;         ///< The host playd is on.
+	int port;                 ///< The port playd is on.
+	int metrics_port;         ///< playd's metrics port.
+	int iterations;           ///< The number of times round the loop.
+	std::string seek;         ///< Where to seek, in microseconds.
+	Clock::duration timeout;  ///< How long to wait to hear a command.
+	int pid;                  ///< playd's process ID, or 0 if not given.
+};
+
+/// A command sent on each time round the loop.
+struct Step
+{
+	std::string name;    ///< The name under which it is reported.
+	std::string path;    ///< The resource written to.
+	std::string payload; ///< The payload written.
+	bool heard;          ///< Whether playd times it until it is heard.
+};
+
+/**
+ * A latency benchmark, and the measurements it takes.
+ */
+class LatencyBench
+{
+public:
+	/**
+	 * Constructs a LatencyBench.
+	 * @param options The benchmark's settings.
+	 */
+	explicit LatencyBench(const LatencyOptions &options);
+
+	/// Destructs a LatencyBench.
+	~LatencyBench();
+
+	/// Deleted copy constructor.
+	LatencyBench(const LatencyBench &) = delete;
+
+	/// Deleted copy-assignment.
+	LatencyBench &operator=(const LatencyBench &) = delete;
+
+	/**
+	 * Runs the benchmark, then reports what it measured.
+	 * @return Whether the benchmark managed to run.
+	 */
+	bool Run();
+
+	/**
+	 * Handles the result of connecting.
+	 * @param status The libuv status of the connection.
+	 */
+	void Connected(int status);
+
+	/**
+	 * Handles data read from playd.
+	 * @param nread The number of bytes read, or a libuv error.
+	 * @param buf The buffer read into.
+	 */
+	void Read(ssize_t nread, const uv_buf_t *buf);
+
+	/// Checks whether the command waiting to be heard has been.
+	void Poll();
+
+private:
+	/// Sends the current step's command.
+	void Send();
+
+	/**
+	 * Handles the current step's ACK.
+	 * @param ok Whether the command succeeded.
+	 */
+	void Acked(bool ok);
+
+	/// Moves on to the next step, or finishes.
+	void Next();
+
+	/**
+	 * Scrapes playd's count and sum of audible latencies for a step.
+	 * @param step The step.
+	 * @param count Set to the number of latencies observed.
+	 * @param sum Set to their sum, in seconds.
+	 * @return Whether the scrape worked.
+	 */
+	bool ScrapeHeard(const Step &step, double &count, double &sum);
+
+	/// Stops the benchmark early, closing everything.
+	void Abort();
+
+	/**
+	 * Writes the report.
+	 * @param os The stream to write to.
+	 * @param elapsed How long the benchmark ran.
+	 */
+	void Report(std::ostream &os, Clock::duration elapsed);
+
+	const LatencyOptions &opts;   ///< The benchmark's settings.
+	uv_loop_t *loop;              ///< The loop running the benchmark.
+	uv_loop_t scrape_loop;        ///< The loop on which to scrape metrics.
+	uv_tcp_t tcp;                 ///< The connection to playd.
+	uv_connect_t connect_req;     ///< The connection request.
+	uv_timer_t poller;            ///< Fires while waiting to be heard.
+	Tokeniser tokeniser;          ///< The response tokeniser.
+	std::vector<Step> steps;      ///< The steps of each iteration.
+	int iteration;                ///< The current iteration.
+	std::size_t step;             ///< The current step.
+	bool ok;                      ///< Whether nothing has gone wrong.
+	Clock::time_point sent_at;    ///< When the current command was sent.
+	double heard_count;           ///< Audible latencies before sending.
+	double heard_sum;             ///< Their sum before sending, in s.
+	std::uint64_t failures;       ///< Commands that didn't ACK OK.
+	std::uint64_t unheard;        ///< Commands never heard in time.
+	std::map<std::string, Samples> acks;  ///< Round trips, by step.
+	std::map<std::string, Samples> heard; ///< Audible latencies, by step.
+};
+
+//
+// libuv callbacks
+//
+
+/// The callback fired when the benchmark connects, or fails to.
+void UvConnectCallback(uv_connect_t *req, int status)
+{
+	assert(req != nullptr);
+	static_cast<LatencyBench *>(req->data)->Connected(status);
+}
+
+/// The callback fired when the benchmark reads from playd.
+void UvReadCallback(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+	assert(stream != nullptr);
+	static_cast<LatencyBench *>(stream->data)->Read(nread, buf);
+}
+
+/// The callback fired while waiting for a command to be heard.
+void UvPollCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+	static_cast<LatencyBench *>(handle->data)->Poll();
+}
+
+//
+// LatencyBench
+//
+
+LatencyBench::LatencyBench(const LatencyOptions &options)
+    : opts(options),
+      loop(uv_default_loop()),
+      steps{{"load", "/player/file", options.file, false},
+            {"play", "/control/state", "Playing", true},
+            {"seek", "/player/time/elapsed", options.seek, true},
+            {"stop", "/control/state", "Stopped", false}},
+      iteration(0),
+      step(0),
+      ok(true),
+      heard_count(0.0),
+      heard_sum(0.0),
+      failures(0),
+      unheard(0)
+{
+	uv_loop_init(&this->scrape_loop);
+}
+
+LatencyBench::~LatencyBench()
+{
+	uv_loop_close(&this->scrape_loop);
+}
+
+bool LatencyBench::Run()
+{
+	sockaddr_in addr;
+	if (uv_ip4_addr(this->opts.host.c_str(), this->opts.port, &addr) < 0) {
+		std::cerr << "invalid address: " << this->opts.host << "\n";
+		return false;
+	}
+
+	PlaydWatch watch(&this->scrape_loop, this->opts.host, this->opts.pid,
+	                 this->opts.metrics_port);
+	watch.Start();
+
+	uv_timer_init(this->loop, &this->poller);
+	this->poller.data = this;
+
+	uv_tcp_init(this->loop, &this->tcp);
+	this->tcp.data = this;
+	this->connect_req.data = this;
+	uv_tcp_connect(&this->connect_req, &this->tcp,
+	               reinterpret_cast<const sockaddr *>(&addr),
+	               UvConnectCallback);
+
+	auto start = Clock::now();
+	uv_run(this->loop, UV_RUN_DEFAULT);
+	auto elapsed = Clock::now() - start;
+	if (!this->ok) return false;
+
+	this->Report(std::cout, elapsed);
+	watch.Report(std::cout, elapsed);
+	return true;
+}
+
+void LatencyBench::Connected(int status)
+{
+	if (status < 0) {
+		std::cerr << "can't connect: " << uv_strerror(status) << "\n";
+		this->Abort();
+		return;
+	}
+
+	// As in swarm, Nagle's algorithm shouldn't hold commands back.
+	uv_tcp_nodelay(&this->tcp, 1);
+	uv_read_start(reinterpret_cast<uv_stream_t *>(&this->tcp), UvAlloc,
+	              UvReadCallback);
+	this->Send();
+}
+
+void LatencyBench::Read(ssize_t nread, const uv_buf_t *buf)
+{
+	if (nread < 0) {
+		delete[] buf->base;
+		std::cerr << "playd hung up\n";
+		this->Abort();
+		return;
+	}
+
+	std::string raw(buf->base, nread);
+	delete[] buf->base;
+
+	// Only one command is ever waiting, so any ACK is its ACK; anything
+	// else is a broadcast.
+	for (auto &words : this->tokeniser.Feed(raw)) {
+		if (words.empty() || words[0] != "ACK") continue;
+		this->Acked(2 <= words.size() && words[1] == "OK");
+	}
+}
+
+void LatencyBench::Poll()
+{
+	const auto &step = this->steps[this->step];
+
+	double count, sum;
+	if (!this->ScrapeHeard(step, count, sum)) {
+		std::cerr << "can't scrape metrics\n";
+		this->Abort();
+		return;
+	}
+
+	if (this->heard_count < count) {
+		// The sum is written to the microsecond, and only this
+		// benchmark is making playd heard, so the change in the sum is
+		// exactly this command's latency.
+		auto us = std::llround((sum - this->heard_sum) * 1000000.0);
+		this->heard[step.name].Add(std::chrono::microseconds(us));
+	} else if (Clock::now() - this->sent_at < this->opts.timeout) {
+		return;
+	} else {
+		this->unheard++;
+	}
+
+	uv_timer_stop(&this->poller);
+	this->Next();
+}
+
+void LatencyBench::Send()
+{
+	const auto &step = this->steps[this->step];
+
+	// Anything heard from now on was heard after this command.
+	if (step.heard &&
+	    !this->ScrapeHeard(step, this->heard_count, this->heard_sum)) {
+		std::cerr << "can't scrape metrics\n";
+		this->Abort();
+		return;
+	}
+
+	auto *req = new WriteReq;
+	req->data = "write " + step.name + " " + step.path + " " +
+	            Response::Escape(step.payload) + "\n";
+	uv_buf_t buf = uv_buf_init(&req->data[0], req->data.size());
+
+	this->sent_at = Clock::now();
+	uv_write(&req->req, reinterpret_cast<uv_stream_t *>(&this->tcp), &buf,
+	         1, UvWriteCallback);
+}
+
+void LatencyBench::Acked(bool ok)
+{
+	const auto &step = this->steps[this->step];
+	this->acks[step.name].Add(Clock::now() - this->sent_at);
+
+	if (!ok) this->failures++;
+	if (ok && step.heard) {
+		uv_timer_start(&this->poller, UvPollCallback, 0, 1);
+		return;
+	}
+	this->Next();
+}
+
+void LatencyBench::Next()
+{
+	this->step++;
+	if (this->step == this->steps.size()) {
+		this->step = 0;
+		this->iteration++;
+	}
+
+	if (this->iteration < this->opts.iterations) {
+		this->Send();
+		return;
+	}
+
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->poller), nullptr);
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->tcp), nullptr);
+}
+
+bool LatencyBench::ScrapeHeard(const Step &step, double &count,
+                               double &sum)
+{
+	std::map<std::string, double> values;
+	if (!ScrapeMetrics(&this->scrape_loop, this->opts.host,
+	                   this->opts.metrics_port, values)) {
+		return false;
+	}
+
+	auto labels = "{command=\"" + step.name + "\"}";
+	count = values["playd_audible_latency_seconds_count" + labels];
+	sum = values["playd_audible_latency_seconds_sum" + labels];
+	return true;
+}
+
+void LatencyBench::Abort()
+{
+	this->ok = false;
+
+	auto *poller = reinterpret_cast<uv_handle_t *>(&this->poller);
+	auto *tcp = reinterpret_cast<uv_handle_t *>(&this->tcp);
+	if (!uv_is_closing(poller)) uv_close(poller, nullptr);
+	if (!uv_is_closing(tcp)) uv_close(tcp, nullptr);
+}
+
+void LatencyBench::Report(std::ostream &os, Clock::duration elapsed)
+{
+	auto seconds = std::chrono::duration<double>(elapsed).count();
+
+	os << this->opts.iterations << " iterations in " << std::fixed
+	   << std::setprecision(1) << seconds << " s, " << this->failures
+	   << " failed, " << this->unheard << " never heard\n\n";
+
+	Samples::WriteHeading(os);
+	for (const auto &step : this->steps) {
+		this->acks[step.name].Write(os, step.name + " ack");
+		if (step.heard) {
+			this->heard[step.name].Write(os, step.name + " heard");
+		}
+	}
+	os << "\n";
+}
+
+//
+// Entry point
+//
+
+/**
+ * Exits with a usage message.
+ * @param progname The program name.
+ */
+[[noreturn]] static void ExitWithUsage(const std::string &progname)
+{
+	std::cerr << "usage: " << progname
+	          << " [OPTIONS] FILE HOST PORT METRICS_PORT\n";
+	std::cerr << "where playd is serving metrics on METRICS_PORT\n";
+	std::cerr << "OPTIONS:\n";
+	std::cerr << "\t--iterations=N: go round the loop N times (default "
+	             "100)\n";
+	std::cerr << "\t--seek=MICROS: where in FILE to seek (default "
+	             "1000000)\n";
+	std::cerr << "\t--timeout=MILLIS: how long to wait for a command to "
+	             "be heard (default 2000)\n";
+	std::cerr << "\t--pid=PID: report playd's CPU use (Linux only)\n";
+
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * The main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+// As in playd itself, a connection dropping mid-write shouldn't kill us.
+#ifndef _MSC_VER
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	std::vector<std::string> args(argv, argv + argc);
+	auto options = TakeOptions(args);
+	if (args.size() != 5) ExitWithUsage(args.at(0));
+
+	auto option = [&options](const std::string &name, int fallback) {
+		auto it = options.find(name);
+		return it == options.end() ? fallback
+		                           : std::atoi(it->second.c_str());
+	};
+
+	LatencyOptions opts;
+	opts.file = args.at(1);
+	opts.host = args.at(2);
+	opts.port = std::atoi(args.at(3).c_str());
+	opts.metrics_port = std::atoi(args.at(4).c_str());
+	opts.iterations = option("iterations", 100);
+	opts.seek = options.count("seek") ? options["seek"] : "1000000";
+	opts.timeout = std::chrono::milliseconds(option("timeout", 2000));
+	opts.pid = option("pid", 0);
+	if (opts.port <= 0 || opts.metrics_port <= 0 || opts.iterations <= 0) {
+		ExitWithUsage(args.at(0));
+	}
+
+	LatencyBench bench(opts);
+	return bench.Run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
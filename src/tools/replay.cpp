@@ -0,0 +1,608 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * A benchmark replaying a command log, as written by `playd --record`,
+ * against a playd.
+ *
+ * Each connection in the log gets a connection of its own, opened, sent
+ * its commands and closed in the same order as in the log, either:
+ *
+ * - at the recorded times, so that playd sees the same load it did when
+ *   the log was recorded; or
+ * - with `--fast`, as fast as possible: each command is sent as soon as the
+ *   one before it, on any connection, has been answered.  This keeps the
+ *   order of commands across connections, so each run does the same thing.
+ *
+ * Either way, the replay measures each command's round trip, from when it
+ * was due to when its ACK came back, by command word; given `--pid` and
+ * `--metrics-port`, it also reports the CPU playd used and whether it
+ * underran.  Running playd with `--sink=null` or `--sink=file:PATH` lets
+ * the replay run on machines without a sound device, and compare runs
+ * without one getting in the way.
+ *
+ * The files the log loads must be at the same paths on the machine running
+ * playd.  A `quit` in the log will quit playd, so it is best removed.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
+// We don't want this.
+#undef UNICODE
+#include <uv.h>
+
+#include "../tokeniser.hpp"
+#include "bench.hpp"
+
+/// An event in a command log.
+struct Event
+{
+	/// The kinds of event.
+	enum class Kind : std::uint8_t {
+		OPEN,  ///< A connection opened.
+		RUN,   ///< A connection sent a command.
+		CLOSE, ///< A connection closed.
+	};
+
+	Clock::duration at; ///< When the event happened, from the log's start.
+	std::size_t id;     ///< The connection's ID in the log.
+	Kind kind;          ///< The kind of event.
+	std::string word;   ///< The command word, for RUN events.
+	std::string line;   ///< The command, as sent, for RUN events.
+};
+
+/// The settings of a replay.
+struct ReplayOptions
+{
+	std::string host; ///< The host playd is on.
+	int port;         ///< The port playd is on.
+	bool fast;        ///< Whether to replay as fast as possible.
+	int pid;          ///< playd's process ID, or 0 if not given.
+	int metrics_port; ///< playd's metrics port, or 0 if not given.
+};
+
+class Replay;
+
+/**
+ * One of the log's connections, replayed.
+ */
+class Session
+{
+public:
+	/**
+	 * Constructs a Session, and connects it.
+	 * @param replay The replay to which the session belongs.
+	 */
+	explicit Session(Replay &replay);
+
+	/// Deleted copy constructor.
+	Session(const Session &) = delete;
+
+	/// Deleted copy-assignment.
+	Session &operator=(const Session &) = delete;
+
+	/**
+	 * Handles the result of connecting.
+	 * @param status The libuv status of the connection.
+	 */
+	void Connected(int status);
+
+	/**
+	 * Sends a command, or queues it until the session is connected.
+	 * @param event The RUN event.
+	 */
+	void Send(const Event &event);
+
+	/**
+	 * Handles data read from playd.
+	 * @param nread The number of bytes read, or a libuv error.
+	 * @param buf The buffer read into.
+	 */
+	void Read(ssize_t nread, const uv_buf_t *buf);
+
+	/// Closes the session once all of its commands have been answered.
+	void Finish();
+
+private:
+	/// A command sent, or to be sent, and when it was due.
+	struct Command
+	{
+		std::string word;        ///< The command word.
+		std::string line;        ///< The command line.
+		Clock::time_point since; ///< When the command was due.
+	};
+
+	/// Writes a command to playd.
+	void Write(const Command &command);
+
+	/// Closes the connection, losing any unanswered commands.
+	void Close();
+
+	Replay &replay;             ///< The replay.
+	bool connected;             ///< Whether the session is connected.
+	bool closed;                ///< Whether the session has closed.
+	bool finishing;             ///< Whether to close once answered.
+	uv_tcp_t tcp;               ///< The session's connection.
+	uv_connect_t connect_req;   ///< The connection request.
+	Tokeniser tokeniser;        ///< The response tokeniser.
+	std::deque<Command> unsent; ///< Commands due before connecting.
+	std::deque<Command> sent;   ///< Commands awaiting an ACK, in order.
+};
+
+/**
+ * A replay of a command log, and the measurements it takes.
+ */
+class Replay
+{
+public:
+	/**
+	 * Constructs a Replay.
+	 * @param options The replay's settings.
+	 * @param events The events of the log, in order.
+	 */
+	Replay(const ReplayOptions &options, std::vector<Event> events);
+
+	/**
+	 * Runs the replay to the end of the log, then reports what it
+	 * measured.
+	 * @return Whether the replay managed to run.
+	 */
+	bool Run();
+
+	/// Plays every event that is due, then waits for the next.
+	void Next();
+
+	/**
+	 * Notes that a command was answered.
+	 * @param word The command word.
+	 * @param since When the command was due.
+	 * @param ok Whether the command succeeded.
+	 */
+	void Answered(const std::string &word, Clock::time_point since,
+	              bool ok);
+
+	/**
+	 * Notes that commands went unanswered, because their connection
+	 * closed or never opened.
+	 * @param count The number of commands.
+	 */
+	void Lost(std::size_t count);
+
+	uv_loop_t *loop;           ///< The loop running the replay.
+	sockaddr_in addr;          ///< playd's address.
+
+private:
+	/**
+	 * Plays an event.
+	 * @param event The event.
+	 */
+	void Play(const Event &event);
+
+	/// In fast mode, moves on to the next event once the loop is free.
+	void Continue();
+
+	/**
+	 * Writes the report.
+	 * @param os The stream to write to.
+	 * @param elapsed How long the replay ran.
+	 */
+	void Report(std::ostream &os, Clock::duration elapsed);
+
+	const ReplayOptions &opts;   ///< The replay's settings.
+	std::vector<Event> events;   ///< The log's events.
+	std::size_t next;            ///< The index of the next event.
+	bool done;                   ///< Whether every event has been played.
+	Clock::time_point start;     ///< When the replay started.
+	uv_timer_t timer;            ///< Fires when the next event is due.
+	std::uint64_t commands;      ///< Commands answered or lost.
+	std::uint64_t failures;      ///< Commands that didn't ACK OK.
+	std::uint64_t lost;          ///< Commands never answered.
+	std::map<std::string, Samples> latencies; ///< Round trips, by word.
+
+	/// Every session, including closed ones.
+	std::vector<std::unique_ptr<Session>> sessions;
+
+	/// The open session for each of the log's connection IDs.
+	std::map<std::size_t, Session *> by_id;
+};
+
+//
+// libuv callbacks
+//
+
+/// The callback fired when a session connects, or fails to.
+void UvConnectCallback(uv_connect_t *req, int status)
+{
+	assert(req != nullptr);
+	static_cast<Session *>(req->data)->Connected(status);
+}
+
+/// The callback fired when a session reads from playd.
+void UvReadCallback(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+	assert(stream != nullptr);
+	static_cast<Session *>(stream->data)->Read(nread, buf);
+}
+
+/// The callback fired when the next event is due.
+void UvNextCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+	static_cast<Replay *>(handle->data)->Next();
+}
+
+//
+// Helpers
+//
+
+/**
+ * Reads a command log.
+ * @param is The stream from which to read the log.
+ * @param events Filled with the log's events, in order.
+ * @return The number of the first line that couldn't be read, or 0 if
+ *   every line could.
+ */
+static std::size_t ReadLog(std::istream &is, std::vector<Event> &events)
+{
+	static const std::map<std::string, Event::Kind> KINDS = {
+	        {"open", Event::Kind::OPEN},
+	        {"run", Event::Kind::RUN},
+	        {"close", Event::Kind::CLOSE}};
+
+	std::string line;
+	for (std::size_t number = 1; std::getline(is, line); number++) {
+		if (line.empty()) continue;
+
+		// The command is sent on as it was logged, so only the fields
+		// before it are split off here.
+		std::istringstream fields(line);
+		std::uint64_t micros;
+		Event event;
+		std::string kind;
+		if (!(fields >> micros >> event.id >> kind)) return number;
+
+		auto it = KINDS.find(kind);
+		if (it == KINDS.end()) return number;
+		event.at = std::chrono::microseconds(micros);
+		event.kind = it->second;
+
+		if (event.kind == Event::Kind::RUN) {
+			std::getline(fields >> std::ws, event.line);
+			auto words = Tokeniser().Feed(event.line + "\n");
+			if (words.size() != 1 || words[0].empty()) return number;
+			event.word = words[0][0];
+			event.line += "\n";
+		}
+
+		events.push_back(std::move(event));
+	}
+	return 0;
+}
+
+//
+// Session
+//
+
+Session::Session(Replay &replay)
+    : replay(replay), connected(false), closed(false), finishing(false)
+{
+	uv_tcp_init(replay.loop, &this->tcp);
+	this->tcp.data = this;
+	this->connect_req.data = this;
+	uv_tcp_connect(&this->connect_req, &this->tcp,
+	               reinterpret_cast<const sockaddr *>(&replay.addr),
+	               UvConnectCallback);
+}
+
+void Session::Connected(int status)
+{
+	if (status < 0) {
+		this->Close();
+		return;
+	}
+
+	this->connected = true;
+
+	// As in swarm, Nagle's algorithm shouldn't hold commands back.
+	uv_tcp_nodelay(&this->tcp, 1);
+	uv_read_start(reinterpret_cast<uv_stream_t *>(&this->tcp), UvAlloc,
+	              UvReadCallback);
+
+	for (const auto &command : this->unsent) this->Write(command);
+	this->unsent.clear();
+	if (this->finishing) this->Finish();
+}
+
+void Session::Send(const Event &event)
+{
+	Command command{event.word, event.line, Clock::now()};
+	if (this->closed) {
+		this->replay.Lost(1);
+	} else if (this->connected) {
+		this->Write(command);
+	} else {
+		this->unsent.push_back(std::move(command));
+	}
+}
+
+void Session::Read(ssize_t nread, const uv_buf_t *buf)
+{
+	if (nread < 0) {
+		delete[] buf->base;
+		this->Close();
+		return;
+	}
+
+	std::string raw(buf->base, nread);
+	delete[] buf->base;
+
+	// Command results: ACK CODE MESSAGE WORD TAG ARGS...  Each connection
+	// gets its ACKs in the order it sent its commands.
+	for (auto &words : this->tokeniser.Feed(raw)) {
+		if (words.empty() || words[0] != "ACK") continue;
+		if (this->sent.empty()) continue;
+
+		auto command = std::move(this->sent.front());
+		this->sent.pop_front();
+		bool ok = 2 <= words.size() && words[1] == "OK";
+		this->replay.Answered(command.word, command.since, ok);
+	}
+
+	if (this->finishing) this->Finish();
+}
+
+void Session::Finish()
+{
+	this->finishing = true;
+	if (this->connected && this->sent.empty()) this->Close();
+}
+
+void Session::Write(const Command &command)
+{
+	auto *req = new WriteReq;
+	req->data = command.line;
+	uv_buf_t buf = uv_buf_init(&req->data[0], req->data.size());
+	uv_write(&req->req, reinterpret_cast<uv_stream_t *>(&this->tcp), &buf,
+	         1, UvWriteCallback);
+	this->sent.push_back(command);
+}
+
+void Session::Close()
+{
+	if (this->closed) return;
+	this->closed = true;
+	this->connected = false;
+
+	auto lost = this->unsent.size() + this->sent.size();
+	this->unsent.clear();
+	this->sent.clear();
+
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->tcp), nullptr);
+	if (0 < lost) this->replay.Lost(lost);
+}
+
+//
+// Replay
+//
+
+Replay::Replay(const ReplayOptions &options, std::vector<Event> events)
+    : loop(uv_default_loop()),
+      opts(options),
+      events(std::move(events)),
+      next(0),
+      done(false),
+      commands(0),
+      failures(0),
+      lost(0)
+{
+}
+
+bool Replay::Run()
+{
+	if (uv_ip4_addr(this->opts.host.c_str(), this->opts.port, &this->addr) <
+	    0) {
+		std::cerr << "invalid address: " << this->opts.host << "\n";
+		return false;
+	}
+
+	PlaydWatch watch(this->loop, this->opts.host, this->opts.pid,
+	                 this->opts.metrics_port);
+	watch.Start();
+
+	uv_timer_init(this->loop, &this->timer);
+	this->timer.data = this;
+
+	this->start = Clock::now();
+	this->Next();
+	uv_run(this->loop, UV_RUN_DEFAULT);
+	auto elapsed = Clock::now() - this->start;
+
+	this->Report(std::cout, elapsed);
+	watch.Report(std::cout, elapsed);
+	return true;
+}
+
+void Replay::Next()
+{
+	if (this->done) return;
+
+	while (this->next < this->events.size()) {
+		const auto &event = this->events[this->next];
+
+		if (!this->opts.fast) {
+			auto due = this->start + event.at;
+			auto now = Clock::now();
+			if (now < due) {
+				auto wait = std::chrono::duration_cast<
+				        std::chrono::milliseconds>(due - now);
+				uv_timer_start(&this->timer, UvNextCallback,
+				               wait.count() + 1, 0);
+				return;
+			}
+		}
+
+		this->next++;
+		this->Play(event);
+
+		// In fast mode, this command's answer (or loss) moves us on.
+		if (this->opts.fast && event.kind == Event::Kind::RUN) return;
+	}
+
+	// Whatever the log left open, close once it's been answered.
+	this->done = true;
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->timer), nullptr);
+	for (const auto &session : this->by_id) session.second->Finish();
+	this->by_id.clear();
+}
+
+void Replay::Play(const Event &event)
+{
+	auto it = this->by_id.find(event.id);
+	switch (event.kind) {
+		case Event::Kind::OPEN:
+			if (it != this->by_id.end()) it->second->Finish();
+			this->sessions.emplace_back(new Session(*this));
+			this->by_id[event.id] = this->sessions.back().get();
+			break;
+
+		case Event::Kind::RUN:
+			// A log begun while clients were connected has commands
+			// from connections it never saw open.
+			if (it == this->by_id.end()) {
+				this->sessions.emplace_back(new Session(*this));
+				it = this->by_id
+				             .emplace(event.id,
+				                      this->sessions.back().get())
+				             .first;
+			}
+			it->second->Send(event);
+			break;
+
+		case Event::Kind::CLOSE:
+			if (it == this->by_id.end()) break;
+			it->second->Finish();
+			this->by_id.erase(it);
+			break;
+	}
+}
+
+void Replay::Answered(const std::string &word, Clock::time_point since,
+                      bool ok)
+{
+	this->latencies[word].Add(Clock::now() - since);
+	this->commands++;
+	if (!ok) this->failures++;
+	this->Continue();
+}
+
+void Replay::Lost(std::size_t count)
+{
+	this->commands += count;
+	this->lost += count;
+	this->Continue();
+}
+
+void Replay::Continue()
+{
+	// This may be called from inside Next, by a command lost straight
+	// away, so the next event waits for the loop to come round.
+	if (!this->opts.fast || this->done) return;
+	uv_timer_start(&this->timer, UvNextCallback, 0, 0);
+}
+
+void Replay::Report(std::ostream &os, Clock::duration elapsed)
+{
+	auto seconds = std::chrono::duration<double>(elapsed).count();
+
+	os << this->commands << " commands on " << this->sessions.size()
+	   << " connections in " << std::fixed << std::setprecision(1)
+	   << seconds << " s (" << this->commands / seconds << "/s), "
+	   << this->failures << " failed, " << this->lost << " lost\n\n";
+
+	Samples::WriteHeading(os);
+	for (auto &latency : this->latencies) {
+		latency.second.Write(os, latency.first);
+	}
+	os << "\n";
+}
+
+//
+// Entry point
+//
+
+/**
+ * Exits with a usage message.
+ * @param progname The program name.
+ */
+[[noreturn]] static void ExitWithUsage(const std::string &progname)
+{
+	std::cerr << "usage: " << progname << " [OPTIONS] LOG HOST PORT\n";
+	std::cerr << "where LOG was written by playd --record\n";
+	std::cerr << "OPTIONS:\n";
+	std::cerr << "\t--fast: send each command once the last is answered, "
+	             "not on time\n";
+	std::cerr << "\t--metrics-port=PORT: report playd's underruns and "
+	             "deferred commands\n";
+	std::cerr << "\t--pid=PID: report playd's CPU use (Linux only)\n";
+
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * The main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+// As in playd itself, a connection dropping mid-write shouldn't kill us.
+#ifndef _MSC_VER
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	std::vector<std::string> args(argv, argv + argc);
+	auto options = TakeOptions(args);
+	if (args.size() != 4) ExitWithUsage(args.at(0));
+
+	ReplayOptions opts;
+	opts.host = args.at(2);
+	opts.port = std::atoi(args.at(3).c_str());
+	opts.fast = options.count("fast") != 0;
+	opts.pid = std::atoi(options["pid"].c_str());
+	opts.metrics_port = std::atoi(options["metrics-port"].c_str());
+	if (opts.port <= 0) ExitWithUsage(args.at(0));
+
+	std::ifstream log(args.at(1));
+	if (!log) {
+		std::cerr << "can't open " << args.at(1) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Event> events;
+	auto bad = ReadLog(log, events);
+	if (bad != 0) {
+		std::cerr << args.at(1) << ":" << bad << ": not a log line\n";
+		return EXIT_FAILURE;
+	}
+
+	Replay replay(opts, std::move(events));
+	return replay.Run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,659 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * A load tester, connecting a swarm of simulated clients to a playd.
+ *
+ * Each client behaves like a monitoring client: it mostly reads resources,
+ * sometimes hangs up and reconnects (so playd has to welcome it again), and,
+ * for the first few clients, sometimes writes.  While they run, the swarm
+ * measures:
+ *
+ * - the round trip of each read and write, from sending the command to
+ *   receiving its ACK;
+ * - how long a welcome takes, from connecting to the ACK of a read sent
+ *   straight after connecting;
+ * - the broadcast lag, from a write being sent to each client receiving the
+ *   resulting broadcast;
+ * - given `--pid`, the CPU time playd used (on Linux only);
+ * - given `--metrics-port`, how many underruns and deferred commands playd
+ *   counted while the swarm ran.
+ *
+ * Commands that don't ACK OK are counted as failures, but still timed; with
+ * nothing loaded, reads of resources such as `/player/file` will fail.
+ *
+ * The writes change `/player/crossfade/length`, which is harmless when
+ * nothing is queued to crossfade into, but does mean the swarm shouldn't be
+ * pointed at a playd that is on air.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
+// We don't want this.
+#undef UNICODE
+#include <uv.h>
+
+#include "../tokeniser.hpp"
+#include "bench.hpp"
+
+/// The resource the writing clients write, and everyone hears broadcast.
+static const std::string WRITE_PATH = "/player/crossfade/length";
+
+/// The resources clients read, weighted by repetition.
+static const std::vector<std::string> READ_PATHS = {
+        "/control/state", "/control/state", "/player/time/elapsed",
+        "/player/time/elapsed", "/player/file", "/player/time",
+        "/player/loop", "/player/dsp"};
+
+/// Of every this many commands a writing client sends, one is a write.
+static const unsigned WRITE_EVERY = 10;
+
+/// The settings of a swarm.
+struct SwarmOptions
+{
+	std::string host;    ///< The host playd is on.
+	int port;            ///< The port playd is on.
+	std::size_t clients; ///< The number of clients to connect.
+	std::size_t writers; ///< How many of the clients also write.
+	double duration;     ///< How long to run, in seconds.
+	double rate;         ///< Commands per second, per client.
+	double churn;        ///< The chance of reconnecting, per tick.
+	int pid;             ///< playd's process ID, or 0 if not given.
+	int metrics_port;    ///< playd's metrics port, or 0 if not given.
+};
+
+class Swarm;
+
+/**
+ * A simulated client.
+ */
+class Client
+{
+public:
+	/**
+	 * Constructs a Client.
+	 * @param swarm The swarm to which the client belongs.
+	 * @param index The client's index in the swarm.
+	 * @param writer Whether the client sometimes writes.
+	 */
+	Client(Swarm &swarm, std::size_t index, bool writer);
+
+	/// Deleted copy constructor.
+	Client(const Client &) = delete;
+
+	/// Deleted copy-assignment.
+	Client &operator=(const Client &) = delete;
+
+	/// Waits a random, exponentially distributed time before ticking.
+	void Wait();
+
+	/// Connects the client.
+	void Connect();
+
+	/**
+	 * Handles the result of connecting.
+	 * @param status The libuv status of the connection.
+	 */
+	void Connected(int status);
+
+	/// Sends the client's next command, or reconnects, then waits again.
+	void Tick();
+
+	/**
+	 * Handles data read from playd.
+	 * @param nread The number of bytes read, or a libuv error.
+	 * @param buf The buffer read into.
+	 */
+	void Read(ssize_t nread, const uv_buf_t *buf);
+
+	/// Handles the client's connection having closed.
+	void Closed();
+
+	/// Disconnects the client for good.
+	void Stop();
+
+private:
+	/// The kinds of command the client sends.
+	enum class Kind : std::uint8_t {
+		READ,    ///< A read.
+		WRITE,   ///< A write.
+		WELCOME, ///< The read sent just after connecting.
+	};
+
+	/**
+	 * Sends a command, expecting an ACK.
+	 * @param kind The kind of command.
+	 * @param since The time from which to measure the round trip.
+	 * @param word The command word.
+	 * @param args The command's arguments, already escaped.
+	 */
+	void Send(Kind kind, Clock::time_point since, const std::string &word,
+	          const std::string &args);
+
+	/**
+	 * Handles one response.
+	 * @param words The words of the response.
+	 */
+	void Handle(const std::vector<std::string> &words);
+
+	/**
+	 * Closes the client's connection, forgetting unanswered commands.
+	 * @param rejoin Whether to reconnect straight away, rather than on the
+	 *   next tick.
+	 */
+	void Close(bool rejoin);
+
+	Swarm &swarm;                   ///< The swarm.
+	std::size_t index;              ///< The client's index.
+	bool writer;                    ///< Whether the client writes.
+	bool open;                      ///< Whether the TCP handle is open.
+	bool connected;                 ///< Whether the client is connected.
+	bool stopping;                  ///< Whether the client is stopping.
+	bool rejoin;                    ///< Whether to reconnect once closed.
+	unsigned commands;              ///< Commands sent, for pacing writes.
+	std::uint64_t next_tag;         ///< The next command tag number.
+	Clock::time_point connected_at; ///< When the client last connected.
+	uv_tcp_t tcp;                   ///< The client's connection.
+	uv_connect_t connect_req;       ///< The connection request.
+	uv_timer_t timer;               ///< The timer between commands.
+	Tokeniser tokeniser;            ///< The response tokeniser.
+
+	/// Commands awaiting an ACK, by tag, with when to measure from.
+	std::map<std::string, std::pair<Kind, Clock::time_point>> pending;
+};
+
+/**
+ * A swarm of Clients, and the measurements they take.
+ */
+class Swarm
+{
+public:
+	/**
+	 * Constructs a Swarm.
+	 * @param options The swarm's settings.
+	 */
+	explicit Swarm(const SwarmOptions &options);
+
+	/**
+	 * Runs the swarm for its duration, then reports what it measured.
+	 * @return Whether the swarm managed to run.
+	 */
+	bool Run();
+
+	/// Stops every client, letting the loop finish.
+	void Stop();
+
+	/**
+	 * Picks a random command gap.
+	 * @return The gap, in milliseconds.
+	 */
+	std::uint64_t Gap();
+
+	/**
+	 * Decides, at random, whether a client should reconnect.
+	 * @return True if it should.
+	 */
+	bool Churn();
+
+	/**
+	 * Picks a random resource to read.
+	 * @return The resource path.
+	 */
+	const std::string &ReadPath();
+
+	/**
+	 * Notes that a write is being sent, so its broadcast can be timed.
+	 * @param now When the write is sent.
+	 * @return The (unique) value to write.
+	 */
+	std::string Written(Clock::time_point now);
+
+	/**
+	 * Notes that a client heard a broadcast of WRITE_PATH.
+	 * @param value The broadcast value.
+	 * @param connected_at When the client last connected.
+	 */
+	void Heard(const std::string &value, Clock::time_point connected_at);
+
+	uv_loop_t *loop;           ///< The loop running the swarm.
+	sockaddr_in addr;          ///< playd's address.
+	const SwarmOptions &opts;  ///< The swarm's settings.
+	Samples reads;             ///< Read round trips.
+	Samples writes;            ///< Write round trips.
+	Samples welcomes;          ///< Welcome times.
+	Samples broadcasts;        ///< Broadcast lags.
+	std::uint64_t sent;        ///< Commands sent.
+	std::uint64_t failures;    ///< Commands that didn't ACK OK.
+	std::uint64_t reconnects;  ///< Deliberate reconnections.
+	std::uint64_t drops;       ///< Connections playd closed or refused.
+
+private:
+	/**
+	 * Writes the report.
+	 * @param os The stream to write to.
+	 * @param elapsed How long the swarm ran.
+	 */
+	void Report(std::ostream &os, Clock::duration elapsed);
+
+	std::vector<std::unique_ptr<Client>> clients; ///< The clients.
+	std::map<std::string, Clock::time_point> written; ///< Write times.
+	std::uint64_t next_value;    ///< The next value to write.
+	std::mt19937 random;         ///< Randomness for gaps and choices.
+	uv_timer_t stopper;          ///< Fires at the end of the run.
+};
+
+//
+// libuv callbacks
+//
+
+/// The callback fired when a client connects, or fails to.
+void UvConnectCallback(uv_connect_t *req, int status)
+{
+	assert(req != nullptr);
+	static_cast<Client *>(req->data)->Connected(status);
+}
+
+/// The callback fired when a client reads from playd.
+void UvReadCallback(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+	assert(stream != nullptr);
+	static_cast<Client *>(stream->data)->Read(nread, buf);
+}
+
+/// The callback fired when a client's connection closes.
+void UvClosedCallback(uv_handle_t *handle)
+{
+	assert(handle != nullptr);
+	static_cast<Client *>(handle->data)->Closed();
+}
+
+/// The callback fired when a client's command timer fires.
+void UvTickCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+	static_cast<Client *>(handle->data)->Tick();
+}
+
+/// The callback fired when the swarm has run for long enough.
+void UvStopCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+	static_cast<Swarm *>(handle->data)->Stop();
+}
+
+//
+// Client
+//
+
+Client::Client(Swarm &swarm, std::size_t index, bool writer)
+    : swarm(swarm),
+      index(index),
+      writer(writer),
+      open(false),
+      connected(false),
+      stopping(false),
+      rejoin(false),
+      commands(0),
+      next_tag(0)
+{
+	uv_timer_init(swarm.loop, &this->timer);
+	this->timer.data = this;
+}
+
+void Client::Connect()
+{
+	uv_tcp_init(this->swarm.loop, &this->tcp);
+	this->tcp.data = this;
+	this->connect_req.data = this;
+	this->open = true;
+
+	this->connected_at = Clock::now();
+	uv_tcp_connect(&this->connect_req, &this->tcp,
+	               reinterpret_cast<const sockaddr *>(&this->swarm.addr),
+	               UvConnectCallback);
+}
+
+void Client::Connected(int status)
+{
+	if (this->stopping) return;
+	if (status < 0) {
+		this->swarm.drops++;
+		this->Close(false);
+		return;
+	}
+
+	this->connected = true;
+
+	// Don't let Nagle's algorithm hold commands back; the swarm should
+	// measure playd, not the client's TCP stack.
+	uv_tcp_nodelay(&this->tcp, 1);
+	uv_read_start(reinterpret_cast<uv_stream_t *>(&this->tcp), UvAlloc,
+	              UvReadCallback);
+
+	// playd answers this only after it has sent the welcome.
+	this->Send(Kind::WELCOME, this->connected_at, "read", "/control/state");
+}
+
+void Client::Tick()
+{
+	if (this->stopping) return;
+	this->Wait();
+
+	// A client connects on its first tick, so that the swarm doesn't
+	// overflow playd's listen backlog by connecting all at once.  One that
+	// was dropped tries again once per tick, and one that is still
+	// connecting gets its turn next time.
+	if (!this->open) {
+		this->Connect();
+		return;
+	}
+	if (!this->connected) return;
+
+	if (this->swarm.Churn()) {
+		this->swarm.reconnects++;
+		this->Close(true);
+		return;
+	}
+
+	auto now = Clock::now();
+	if (this->writer && this->commands++ % WRITE_EVERY == 0) {
+		auto value = this->swarm.Written(now);
+		this->Send(Kind::WRITE, now, "write", WRITE_PATH + " " + value);
+		return;
+	}
+	this->Send(Kind::READ, now, "read", this->swarm.ReadPath());
+}
+
+void Client::Read(ssize_t nread, const uv_buf_t *buf)
+{
+	if (nread < 0) {
+		delete[] buf->base;
+		if (!this->stopping) this->swarm.drops++;
+		this->Close(false);
+		return;
+	}
+
+	std::string raw(buf->base, nread);
+	delete[] buf->base;
+
+	for (auto &line : this->tokeniser.Feed(raw)) this->Handle(line);
+}
+
+void Client::Closed()
+{
+	this->open = false;
+	if (this->rejoin && !this->stopping) this->Connect();
+}
+
+void Client::Stop()
+{
+	this->stopping = true;
+	uv_timer_stop(&this->timer);
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->timer), nullptr);
+	this->Close(false);
+}
+
+void Client::Send(Kind kind, Clock::time_point since, const std::string &word,
+                  const std::string &args)
+{
+	auto tag = std::to_string(this->index) + "." +
+	           std::to_string(this->next_tag++);
+	this->pending.emplace(tag, std::make_pair(kind, since));
+	this->swarm.sent++;
+
+	auto *req = new WriteReq;
+	req->data = word + " " + tag + " " + args + "\n";
+	uv_buf_t buf = uv_buf_init(&req->data[0], req->data.size());
+	uv_write(&req->req, reinterpret_cast<uv_stream_t *>(&this->tcp), &buf,
+	         1, UvWriteCallback);
+}
+
+void Client::Handle(const std::vector<std::string> &words)
+{
+	// Broadcasts of the written resource: RES PATH Entry VALUE.
+	if (words.size() == 4 && words[0] == "RES" && words[1] == WRITE_PATH) {
+		this->swarm.Heard(words[3], this->connected_at);
+		return;
+	}
+
+	// Command results: ACK CODE MESSAGE WORD TAG ARGS...
+	if (words.size() < 5 || words[0] != "ACK") return;
+
+	auto it = this->pending.find(words[4]);
+	if (it == this->pending.end()) return;
+	auto kind = it->second.first;
+	auto taken = Clock::now() - it->second.second;
+	this->pending.erase(it);
+
+	if (words[1] != "OK") this->swarm.failures++;
+	switch (kind) {
+		case Kind::READ:
+			this->swarm.reads.Add(taken);
+			break;
+		case Kind::WRITE:
+			this->swarm.writes.Add(taken);
+			break;
+		case Kind::WELCOME:
+			this->swarm.welcomes.Add(taken);
+			break;
+	}
+}
+
+void Client::Close(bool rejoin)
+{
+	this->rejoin = rejoin;
+	this->connected = false;
+	this->pending.clear();
+	this->tokeniser = Tokeniser();
+
+	auto *handle = reinterpret_cast<uv_handle_t *>(&this->tcp);
+	if (this->open && !uv_is_closing(handle)) {
+		uv_close(handle, UvClosedCallback);
+	}
+}
+
+void Client::Wait()
+{
+	uv_timer_start(&this->timer, UvTickCallback, this->swarm.Gap(), 0);
+}
+
+//
+// Swarm
+//
+
+Swarm::Swarm(const SwarmOptions &options)
+    : loop(uv_default_loop()),
+      opts(options),
+      sent(0),
+      failures(0),
+      reconnects(0),
+      drops(0),
+      next_value(1),
+      random(std::random_device()())
+{
+}
+
+bool Swarm::Run()
+{
+	if (uv_ip4_addr(this->opts.host.c_str(), this->opts.port, &this->addr) <
+	    0) {
+		std::cerr << "invalid address: " << this->opts.host << "\n";
+		return false;
+	}
+
+	PlaydWatch watch(this->loop, this->opts.host, this->opts.pid,
+	                 this->opts.metrics_port);
+	watch.Start();
+
+	for (std::size_t i = 0; i < this->opts.clients; i++) {
+		bool writer = i < this->opts.writers;
+		this->clients.emplace_back(new Client(*this, i, writer));
+		this->clients.back()->Wait();
+	}
+
+	uv_timer_init(this->loop, &this->stopper);
+	this->stopper.data = this;
+	auto ms = static_cast<std::uint64_t>(this->opts.duration * 1000.0);
+	uv_timer_start(&this->stopper, UvStopCallback, ms, 0);
+
+	auto start = Clock::now();
+	uv_run(this->loop, UV_RUN_DEFAULT);
+	auto elapsed = Clock::now() - start;
+
+	this->Report(std::cout, elapsed);
+	watch.Report(std::cout, elapsed);
+	return true;
+}
+
+void Swarm::Stop()
+{
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->stopper), nullptr);
+	for (auto &client : this->clients) client->Stop();
+}
+
+std::uint64_t Swarm::Gap()
+{
+	std::exponential_distribution<double> gap(this->opts.rate);
+	return static_cast<std::uint64_t>(gap(this->random) * 1000.0);
+}
+
+bool Swarm::Churn()
+{
+	std::bernoulli_distribution churn(this->opts.churn);
+	return churn(this->random);
+}
+
+const std::string &Swarm::ReadPath()
+{
+	auto last = READ_PATHS.size() - 1;
+	std::uniform_int_distribution<std::size_t> pick(0, last);
+	return READ_PATHS[pick(this->random)];
+}
+
+std::string Swarm::Written(Clock::time_point now)
+{
+	// Each write is a different length, so its broadcast can be told
+	// apart from the others.
+	auto value = std::to_string(this->next_value++);
+	this->written.emplace(value, now);
+	return value;
+}
+
+void Swarm::Heard(const std::string &value, Clock::time_point connected_at)
+{
+	auto it = this->written.find(value);
+	if (it == this->written.end()) return;
+
+	// A client that connected after the write heard it in its welcome,
+	// not as a broadcast.
+	if (it->second < connected_at) return;
+
+	this->broadcasts.Add(Clock::now() - it->second);
+}
+
+void Swarm::Report(std::ostream &os, Clock::duration elapsed)
+{
+	auto seconds = std::chrono::duration<double>(elapsed).count();
+
+	os << this->opts.clients << " clients for " << std::fixed
+	   << std::setprecision(1) << seconds << " s: " << this->sent
+	   << " commands (" << this->sent / seconds << "/s), "
+	   << this->failures << " failed, " << this->reconnects
+	   << " reconnects, " << this->drops << " dropped\n\n";
+
+	Samples::WriteHeading(os);
+	this->reads.Write(os, "read round trip");
+	this->writes.Write(os, "write round trip");
+	this->welcomes.Write(os, "welcome");
+	this->broadcasts.Write(os, "broadcast lag");
+	os << "\n";
+}
+
+//
+// Entry point
+//
+
+/**
+ * Exits with a usage message.
+ * @param progname The program name.
+ */
+[[noreturn]] static void ExitWithUsage(const std::string &progname)
+{
+	std::cerr << "usage: " << progname << " [OPTIONS] HOST PORT\n";
+	std::cerr << "OPTIONS:\n";
+	std::cerr << "\t--churn=PERCENT: chance of reconnecting instead of "
+	             "a command (default 1)\n";
+	std::cerr << "\t--clients=N: clients to connect (default 10)\n";
+	std::cerr << "\t--duration=SECONDS: how long to run (default 10)\n";
+	std::cerr << "\t--metrics-port=PORT: report playd's underruns and "
+	             "deferred commands\n";
+	std::cerr << "\t--pid=PID: report playd's CPU use (Linux only)\n";
+	std::cerr << "\t--rate=N: commands per second, per client "
+	             "(default 10)\n";
+	std::cerr << "\t--writers=N: clients that also write (default 1)\n";
+
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * The main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+// As in playd itself, a connection dropping mid-write shouldn't kill us.
+#ifndef _MSC_VER
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	std::vector<std::string> args(argv, argv + argc);
+	auto options = TakeOptions(args);
+	if (args.size() != 3) ExitWithUsage(args.at(0));
+
+	// Gets an option, or its default, exiting on anything unparseable.
+	auto number = [&options, &args](const std::string &name,
+	                                double def) -> double {
+		auto it = options.find(name);
+		if (it == options.end()) return def;
+		try {
+			auto value = std::stod(it->second);
+			if (0 <= value) return value;
+		} catch (...) {
+			// Fall through to the usage message.
+		}
+		std::cerr << "invalid --" << name << "\n";
+		ExitWithUsage(args.at(0));
+	};
+
+	SwarmOptions opts;
+	opts.host = args.at(1);
+	opts.port = std::atoi(args.at(2).c_str());
+	opts.clients = static_cast<std::size_t>(number("clients", 10));
+	opts.writers = static_cast<std::size_t>(number("writers", 1));
+	opts.duration = number("duration", 10);
+	opts.rate = number("rate", 10);
+	opts.churn = std::min(number("churn", 1) / 100.0, 1.0);
+	opts.pid = static_cast<int>(number("pid", 0));
+	opts.metrics_port = static_cast<int>(number("metrics-port", 0));
+	if (opts.port <= 0 || opts.rate <= 0) ExitWithUsage(args.at(0));
+
+	Swarm swarm(opts);
+	return swarm.Run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,274 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the trace recorder.
+ * @see trace.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+/// The number of spans each thread's ring holds; a power of two.
+static const std::size_t RING_SIZE = 4096;
+
+/**
+ * One recorded span.
+ * The fields are atomic only so that dumping while recording is defined;
+ * they are written and read relaxed.
+ */
+struct TraceEvent {
+	std::atomic<const char *> name;     ///< The span's name.
+	std::atomic<std::uint64_t> start;    ///< When it started, in ns.
+	std::atomic<std::uint64_t> duration; ///< How long it took, in ns.
+};
+
+/// One thread's ring of spans.
+struct TraceRing {
+	TraceEvent events[RING_SIZE];      ///< The spans, oldest overwritten.
+	std::atomic<std::uint64_t> count;  ///< The number ever recorded.
+	std::atomic<const char *> thread;  ///< The thread's name, if any.
+	bool in_use;                       ///< Guarded by the registry lock.
+};
+
+/// The rings of all threads, live and finished.
+struct TraceRegistry {
+	std::mutex lock;                              ///< Guards rings.
+	std::vector<std::unique_ptr<TraceRing>> rings; ///< The rings.
+};
+
+/**
+ * Gets the registry of rings.
+ * @return The registry.
+ */
+static TraceRegistry &Registry()
+{
+	static TraceRegistry registry;
+	return registry;
+}
+
+/**
+ * Gets the current time, relative to when tracing started.
+ * @return The time, in ns.
+ */
+static std::uint64_t Now()
+{
+	using clock = std::chrono::steady_clock;
+	static const clock::time_point epoch = clock::now();
+
+	auto since = clock::now() - epoch;
+	return static_cast<std::uint64_t>(
+	        std::chrono::duration_cast<std::chrono::nanoseconds>(since)
+	                .count());
+}
+
+/**
+ * Takes a ring that no thread is using, allocating one if needed.
+ * @return The ring.
+ */
+static TraceRing *TakeRing()
+{
+	auto &registry = Registry();
+	std::lock_guard<std::mutex> guard(registry.lock);
+
+	TraceRing *taken = nullptr;
+	for (auto &ring : registry.rings) {
+		if (ring->in_use) continue;
+		taken = ring.get();
+		break;
+	}
+
+	if (taken == nullptr) {
+		registry.rings.emplace_back(new TraceRing());
+		taken = registry.rings.back().get();
+	}
+
+	taken->in_use = true;
+	taken->thread.store(nullptr, std::memory_order_relaxed);
+	return taken;
+}
+
+/**
+ * Gives a ring back for another thread to use.
+ * @param ring The ring.
+ */
+static void GiveRing(TraceRing *ring)
+{
+	auto &registry = Registry();
+	std::lock_guard<std::mutex> guard(registry.lock);
+	ring->in_use = false;
+}
+
+/// A thread's hold on a ring, given back when the thread finishes.
+struct TraceLease {
+	TraceRing *ring = nullptr; ///< The ring, once the thread has one.
+
+	/// Gives the ring back for another thread to use.
+	~TraceLease()
+	{
+		if (this->ring != nullptr) GiveRing(this->ring);
+	}
+};
+
+/// The calling thread's hold on its ring.
+static thread_local TraceLease lease;
+
+/**
+ * Gets the calling thread's ring, taking one if it has none.
+ * @return The ring.
+ */
+static TraceRing &ThisThreadRing()
+{
+	if (lease.ring == nullptr) lease.ring = TakeRing();
+	return *lease.ring;
+}
+
+TraceReservation::TraceReservation() : ring(TakeRing())
+{
+}
+
+TraceReservation::~TraceReservation()
+{
+	auto ring = this->ring.exchange(nullptr, std::memory_order_acquire);
+	if (ring != nullptr) GiveRing(ring);
+}
+
+void TraceReservation::Adopt()
+{
+	if (this->ring.load(std::memory_order_relaxed) == nullptr) return;
+
+	auto ring = this->ring.exchange(nullptr, std::memory_order_acquire);
+	if (ring == nullptr) return;
+
+	if (lease.ring == nullptr) {
+		lease.ring = ring;
+	} else {
+		GiveRing(ring);
+	}
+}
+
+TraceSpan::TraceSpan(const char *name) : name(name), start(Now())
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+	auto end = Now();
+	auto &ring = ThisThreadRing();
+
+	auto n = ring.count.load(std::memory_order_relaxed);
+	auto &event = ring.events[n & (RING_SIZE - 1)];
+	event.name.store(this->name, std::memory_order_relaxed);
+	event.start.store(this->start, std::memory_order_relaxed);
+	event.duration.store(end - this->start, std::memory_order_relaxed);
+	ring.count.store(n + 1, std::memory_order_release);
+}
+
+void NameTraceThread(const char *name)
+{
+	ThisThreadRing().thread.store(name, std::memory_order_relaxed);
+}
+
+/**
+ * Writes a string as a JSON string literal.
+ * @param os The stream to write to.
+ * @param str The string.
+ */
+static void WriteJsonString(std::ostream &os, const char *str)
+{
+	os << '"';
+	for (auto c = str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') os << '\\';
+		if (static_cast<unsigned char>(*c) < 0x20) continue;
+		os << *c;
+	}
+	os << '"';
+}
+
+/**
+ * Writes a time in microseconds, the unit of Chrome traces.
+ * @param os The stream to write to.
+ * @param ns The time, in ns.
+ */
+static void WriteMicros(std::ostream &os, std::uint64_t ns)
+{
+	os << ns / 1000 << '.' << std::setw(3) << std::setfill('0')
+	   << ns % 1000;
+}
+
+void WriteTrace(std::ostream &os)
+{
+	// Rings are never freed, so the stream can be written without holding
+	// the lock, which would hold up threads taking rings.
+	std::vector<TraceRing *> rings;
+	{
+		auto &registry = Registry();
+		std::lock_guard<std::mutex> guard(registry.lock);
+		for (auto &ring : registry.rings) rings.push_back(ring.get());
+	}
+
+	os << "{\"traceEvents\":[";
+	bool first = true;
+	auto separate = [&os, &first]() {
+		if (!first) os << ",\n";
+		first = false;
+	};
+
+	for (std::size_t tid = 0; tid < rings.size(); tid++) {
+		auto &ring = *rings[tid];
+
+		auto thread = ring.thread.load(std::memory_order_relaxed);
+		if (thread != nullptr) {
+			separate();
+			os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			   << "\"tid\":" << tid << ",\"args\":{\"name\":";
+			WriteJsonString(os, thread);
+			os << "}}";
+		}
+
+		auto count = ring.count.load(std::memory_order_acquire);
+		auto oldest = count < RING_SIZE ? 0 : count - RING_SIZE;
+		for (auto n = oldest; n < count; n++) {
+			auto &event = ring.events[n & (RING_SIZE - 1)];
+			auto name = event.name.load(std::memory_order_relaxed);
+			if (name == nullptr) continue;
+
+			separate();
+			os << "{\"name\":";
+			WriteJsonString(os, name);
+			os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+			   << ",\"ts\":";
+			WriteMicros(os, event.start.load(
+			                        std::memory_order_relaxed));
+			os << ",\"dur\":";
+			WriteMicros(os, event.duration.load(
+			                        std::memory_order_relaxed));
+			os << "}";
+		}
+	}
+
+	os << "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+bool DumpTrace(const std::string &path)
+{
+	std::ofstream file(path);
+	if (!file) return false;
+
+	WriteTrace(file);
+	file.close();
+	return !file.fail();
+}
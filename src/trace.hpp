@@ -0,0 +1,113 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the trace recorder.
+ * @see trace.cpp
+ */
+
+#ifndef PLAYD_TRACE_HPP
+#define PLAYD_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+struct TraceRing;
+
+/**
+ * A span of time spent in one place on one thread.
+ *
+ * Construct a TraceSpan at the start of a region of interest; when it is
+ * destroyed, the span is recorded in the calling thread's trace ring.  Each
+ * thread has its own ring of the last few thousand spans, so recording
+ * takes no locks: it costs two clock reads and a few stores.  A thread's
+ * first span allocates its ring, unless a ring left by a finished thread
+ * can be re-used, or the thread adopts one from a TraceReservation.
+ */
+class TraceSpan
+{
+public:
+	/**
+	 * Starts a span.
+	 * @param name The name of the span, which must outlive the program
+	 *   (in practice, a string literal).
+	 */
+	explicit TraceSpan(const char *name);
+
+	/// Ends the span, recording it.
+	~TraceSpan();
+
+	/// Deleted copy constructor.
+	TraceSpan(const TraceSpan &) = delete;
+
+	/// Deleted copy-assignment.
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+	const char *name;    ///< The name of the span.
+	std::uint64_t start; ///< When the span started, in ns.
+};
+
+/**
+ * A trace ring taken ahead of time, for a thread that can't wait for one.
+ *
+ * Taking a ring locks the registry of rings, and may allocate.  Threads
+ * that mustn't block, such as audio device callbacks, reserve one before
+ * they start, and adopt it on their first run without either.
+ */
+class TraceReservation
+{
+public:
+	/// Takes a ring, allocating one if none are free.
+	TraceReservation();
+
+	/// Gives the ring back, if no thread adopted it.
+	~TraceReservation();
+
+	/// Deleted copy constructor.
+	TraceReservation(const TraceReservation &) = delete;
+
+	/// Deleted copy-assignment.
+	TraceReservation &operator=(const TraceReservation &) = delete;
+
+	/**
+	 * Makes the ring the calling thread's, if no thread has adopted it.
+	 * This takes no locks unless the calling thread already has a ring.
+	 */
+	void Adopt();
+
+private:
+	std::atomic<TraceRing *> ring; ///< The ring, until adopted.
+};
+
+/**
+ * Names the calling thread in trace dumps.
+ * @param name The name, which must outlive the program.
+ */
+void NameTraceThread(const char *name);
+
+/**
+ * Writes every thread's recorded spans in the Chrome trace event format.
+ *
+ * This can run while other threads are recording; a span recorded during
+ * the write may be missed, or, if it overwrites one being written, come out
+ * garbled.  Rings re-used by a new thread keep the old thread's spans, which
+ * appear under the new thread's name.
+ *
+ * @param os The stream to which the JSON is written.
+ */
+void WriteTrace(std::ostream &os);
+
+/**
+ * Writes every thread's recorded spans to a Chrome trace file.
+ * The file can be opened in chrome://tracing, or Perfetto.  The path isn't
+ * checked here: callers must not take it from clients as it is.
+ * @param path The path of the file, which is overwritten.
+ * @return True if the file was written; false otherwise.
+ */
+bool DumpTrace(const std::string &path);
+
+#endif // PLAYD_TRACE_HPP